@@ -255,6 +255,7 @@ public slots:
 
 	void run_test_initialize() { mesh_viewer_core_.test_initialize(); }
 	void run_test_optimize() { mesh_viewer_core_.test_optimize(); }
+	void run_test_quadratic_solver_benchmark() { mesh_viewer_core_.test_quadratic_solver_benchmark(); }
 
 
 protected: // inherited
@@ -262,6 +262,10 @@ void create_menu(QMainWindow &w)
 	//QObject::connect(runAct, SIGNAL(triggered()), w.centralWidget(), SLOT(run_test_optimize()));
 	//w.menuBar()->addAction(runAct);
 
+	//runAct = new QAction(w.tr("[Test] Quadratic Solver Benchmark"), &w);
+	//QObject::connect(runAct, SIGNAL(triggered()), w.centralWidget(), SLOT(run_test_quadratic_solver_benchmark()));
+	//w.menuBar()->addAction(runAct);
+
 	runAct = new QAction(w.tr("Test"), &w);
 	QObject::connect(runAct, SIGNAL(triggered()), w.centralWidget(), SLOT(run_test()));
 	w.menuBar()->addAction(runAct);
@@ -9,6 +9,7 @@
 #define MIN_ICP_ANGLE_DIFFERENCE	1.0E-2
 #define MIN_ICP_TRANSLATION			1.0E-8
 
+#include <vector>
 #include <ANN/ANN.h>
 #include <Eigen/Core>
 
@@ -38,6 +39,117 @@ namespace ICP {
 		const Eigen::MatrixXd &_query_points,
 		Eigen::VectorXd &_distances);
 
+	// KD-tree cached with a copy of its points.
+	// The tree is rebuilt only when the given points are different from the cached points.
+	// NOTE:
+	// The returned tree and ANN points are owned by the cache.
+	// Copying a cache does not copy the tree. A cache is not thread-safe.
+	class KdTreeCache
+	{
+	public:
+		KdTreeCache();
+		KdTreeCache(const KdTreeCache &_other);
+		~KdTreeCache();
+
+		KdTreeCache& operator=(const KdTreeCache &_other);
+
+		// Returns NULL if no point is given.
+		ANNkd_tree *get_kd_tree(
+			const Eigen::MatrixXd &_points,
+			ANNpointArray *_ann_points = NULL);
+		void clear();
+
+		// The version is increased whenever the tree is rebuilt.
+		unsigned int get_version() const { return version_; }
+		unsigned long get_num_hits() const { return num_hits_; }
+		unsigned long get_num_misses() const { return num_misses_; }
+
+		// Statistics of all caches.
+		static unsigned long get_total_num_hits();
+		static unsigned long get_total_num_misses();
+		static void print_statistics();
+
+	private:
+		Eigen::MatrixXd points_;
+		ANNpointArray ann_points_;
+		ANNkd_tree *ann_kd_tree_;
+
+		unsigned int version_;
+		unsigned long num_hits_;
+		unsigned long num_misses_;
+	};
+
+	// Reentrant 3D KD-tree.
+	// Unlike 'ANNkd_tree', which keeps search states in global variables, all search
+	// functions of this tree are const and use only stack memory, so they can be
+	// called from several threads at the same time.
+	// NOTE:
+	// In all matrices, "column" is an instance.
+	// Batch queries are partitioned over threads, and results are written directly
+	// into the given matrices. The matrices are resized only when their sizes differ.
+	class KdTree
+	{
+	public:
+		KdTree();
+		KdTree(const Eigen::MatrixXd &_points);
+
+		void build(const Eigen::MatrixXd &_points);
+		void clear();
+
+		int num_points() const { return static_cast<int>(point_indices_.size()); }
+		bool empty() const { return point_indices_.empty(); }
+
+		// Single query.
+		// Neighbors are sorted by distance, and the number of found neighbors
+		// (at most '_k') is returned.
+		int knn_search(const double _query_point[3], const int _k,
+			int *_indices, double *_squared_distances) const;
+
+		// Only neighbors within '_squared_radius' are returned.
+		int radius_search(const double _query_point[3], const double _squared_radius,
+			const int _k, int *_indices, double *_squared_distances) const;
+
+		// Batch queries.
+		// '_indices' and '_squared_distances' are (_k x num_queries) matrices.
+		// Index -1 and infinite distance are filled when less than '_k' neighbors are found.
+		void knn_search(const Eigen::MatrixXd &_query_points, const int _k,
+			Eigen::MatrixXi &_indices, Eigen::MatrixXd &_squared_distances) const;
+
+		// '_num_neighbors(i)' is the number of found neighbors of the i-th query point.
+		void radius_search(const Eigen::MatrixXd &_query_points, const double _squared_radius,
+			const int _k, Eigen::MatrixXi &_indices, Eigen::MatrixXd &_squared_distances,
+			Eigen::VectorXi &_num_neighbors) const;
+
+	private:
+		struct Node
+		{
+			// Leaf if 'axis_' is -1.
+			int axis_;
+			double split_;
+			int begin_;
+			int end_;
+			int left_;
+			int right_;
+		};
+
+		int build_node(const Eigen::MatrixXd &_points, const int _begin, const int _end);
+		int search(const double _query_point[3], const double _squared_radius,
+			const int _k, int *_indices, double *_squared_distances) const;
+
+		static const int k_max_leaf_size = 8;
+		static const int k_max_depth = 64;
+
+		std::vector<Node> nodes_;
+		// Points sorted by leaves.
+		std::vector<double> x_, y_, z_;
+		std::vector<int> point_indices_;
+	};
+
+	void get_closest_points(
+		const KdTree &_data_kd_tree,
+		const Eigen::MatrixXd &_query_points,
+		Eigen::VectorXd &_distances);
+
 	// Return: error (Minus error means that the computation is failed.)
 	double compute_rigid_transformation(const Eigen::MatrixXd &_X, const Eigen::MatrixXd &_Y,
 		Eigen::Matrix3d &_rotation_mat, Eigen::Vector3d &_translation_vec,
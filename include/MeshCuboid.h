@@ -10,6 +10,7 @@
 
 #include <array>
 #include <map>
+#include <memory>
 #include <ANN/ANN.h>
 #include <Eigen/Core>
 
@@ -58,37 +59,50 @@ public:
 	Real error_;
 };
 
+// NOTE:
+// Cuboid surface points are computed from the cuboid corners and the corner weights
+// in 'MeshCuboidSurfacePointTemplate'. Changing values does not affect the cuboid.
 class MeshCuboidSurfacePoint
 {
 public:
 	MeshCuboidSurfacePoint(
 		const MyMesh::Point _point,
 		const MyMesh::Normal _normal,
-		unsigned int _cuboid_face_index,
-		const std::array<Real, 8>& _corner_weights)
+		unsigned int _cuboid_face_index)
 		: point_(_point)
 		, normal_(_normal)
 		, cuboid_face_index_(_cuboid_face_index)
-		, corner_weights_(_corner_weights)
-		, visibility_(1.0) 
-	{}
-
-	MeshCuboidSurfacePoint(
-		const MeshCuboidSurfacePoint& _other)
-		: point_(_other.point_)
-		, normal_(_other.normal_)
-		, cuboid_face_index_(_other.cuboid_face_index_)
-		, corner_weights_(_other.corner_weights_)
-		, visibility_(_other.visibility_)
 	{}
 
 	MyMesh::Point point_;
 	MyMesh::Normal normal_;
 	unsigned int cuboid_face_index_;
-	std::array<Real, 8> corner_weights_;
-	Real visibility_;
 };
 
+// Immutable parameterization of cuboid surface points.
+// It is shared by copied cuboids.
+class MeshCuboidSurfacePointTemplate
+{
+public:
+	MeshCuboidSurfacePointTemplate() : is_face_grid_(false) {}
+
+	unsigned int size() const { return static_cast<unsigned int>(face_indices_.size()); }
+
+	std::vector<unsigned int> face_indices_;
+	std::vector< std::array<Real, 8> > corner_weights_;
+
+	// True if the points of each face are a regular grid of the bilinear weights
+	// (see 'MeshCuboid::create_grid_points_on_cuboid_surface()').
+	// Then, the points of face 'f' start at 'face_grid_offsets_[f]', and the weights of
+	// the '(i * n_2 + j)'-th point are '(i / (n_1 - 1), j / (n_2 - 1))',
+	// where '(n_1, n_2) = face_grid_sizes_[f]'.
+	bool is_face_grid_;
+	std::array<unsigned int, 6> face_grid_offsets_;
+	std::array< std::array<unsigned int, 2>, 6 > face_grid_sizes_;
+};
+
+class MeshCuboidVisibilityEngine;
+
 class MeshCuboid
 {
 public:
@@ -166,8 +180,22 @@ public:
 	void get_sample_points(Eigen::MatrixXd &_sample_points)const;
 	MeshSamplePoint *get_sample_point(const unsigned int _point_index)const;
 
-	const std::vector<MeshCuboidSurfacePoint *> &get_cuboid_surface_points()const;
-	MeshCuboidSurfacePoint *get_cuboid_surface_point(const unsigned int _point_index)const;
+	// NOTE:
+	// Cuboid surface points are updated when they are requested after the cuboid is changed.
+	// The returned pointers are valid until the cuboid is changed.
+	const std::vector<const MeshCuboidSurfacePoint *> &get_cuboid_surface_points()const;
+	void get_cuboid_surface_points(Eigen::MatrixXd &_cuboid_surface_points)const;
+	const MeshCuboidSurfacePoint *get_cuboid_surface_point(const unsigned int _point_index)const;
+	const std::array<Real, 8> &get_cuboid_surface_point_corner_weights(
+		const unsigned int _point_index)const;
+	Real get_cuboid_surface_point_visibility(const unsigned int _point_index)const;
+
+	// KD-trees of sample points and cuboid surface points.
+	// NOTE:
+	// The trees are cached in the cuboid, and rebuilt only when the points are changed.
+	// Do not delete the returned trees and ANN points.
+	ANNkd_tree *get_sample_point_kd_tree(ANNpointArray *_ann_points = NULL)const;
+	ANNkd_tree *get_cuboid_surface_point_kd_tree(ANNpointArray *_ann_points = NULL)const;
 
 	MyMesh::Point get_bbox_min()const;
 	MyMesh::Point get_bbox_max()const;
@@ -235,14 +263,29 @@ public:
 		const std::vector<MeshSamplePoint *>& _given_sample_points,
 		bool _use_cuboid_normal = true);
 
+	void compute_cuboid_surface_point_visibility(
+		const MeshCuboidVisibilityEngine &_visibility_engine,
+		bool _use_cuboid_normal = true);
+
 	bool is_point_inside_cuboid(const MyMesh::Point& _point)const;
 	void points_to_cuboid_distances(const Eigen::MatrixXd& _points,
-		Eigen::VectorXd &_distances);
+		Eigen::VectorXd &_distances)const;
+	// Unsigned distances from the cuboid surface.
+	void points_to_cuboid_surface_distances(const Eigen::MatrixXd& _points,
+		Eigen::VectorXd &_distances)const;
 
-	// NOTE: Assume that cuboid surface points exist.
+	// NOTE: Assume that cuboid surface points exist
+	// unless 'FLAGS_use_exact_cuboid_distance' is true.
 	static Real distance_between_cuboids(
 		const MeshCuboid *_cuboid_1, const MeshCuboid *_cuboid_2);
 
+	// Exact Hausdorff distance between cuboid surfaces.
+	static Real hausdorff_distance_between_cuboids(
+		const MeshCuboid *_cuboid_1, const MeshCuboid *_cuboid_2);
+	// Maximum distance from the surface of '_cuboid_1' to the surface of '_cuboid_2'.
+	static Real directed_hausdorff_distance_between_cuboids(
+		const MeshCuboid *_cuboid_1, const MeshCuboid *_cuboid_2);
+
 	void print_cuboid()const;
 	void draw_cuboid()const;
 
@@ -252,7 +295,13 @@ protected:
 
 	LabelIndex label_index_;
 	std::vector<MeshSamplePoint *> sample_points_;
-	std::vector<MeshCuboidSurfacePoint *> cuboid_surface_points_;
+
+	std::shared_ptr<const MeshCuboidSurfacePointTemplate> cuboid_surface_point_template_;
+	std::vector<float> cuboid_surface_point_visibilities_;
+
+	// Cuboid surface points computed with the current corners and axes.
+	std::vector<MeshCuboidSurfacePoint> cuboid_surface_point_values_;
+	std::vector<const MeshCuboidSurfacePoint *> cuboid_surface_points_;
 
 	std::vector<int> sample_to_cuboid_surface_correspondence_;
 	std::vector<int> cuboid_surface_to_sample_corresopndence_;
@@ -262,10 +311,29 @@ protected:
 	MyMesh::Normal bbox_size_;
 	std::array<MyMesh::Point, k_num_corners> bbox_corners_;
 
+	mutable ICP::KdTreeCache sample_point_kd_tree_cache_;
+	mutable ICP::KdTreeCache cuboid_surface_point_kd_tree_cache_;
+
 	void compute_axis_aligned_bbox();
 
 	void compute_oriented_bbox();
 
+	bool has_orthonormal_bbox_axes()const;
+
+	void set_cuboid_surface_point_template(
+		const std::shared_ptr<const MeshCuboidSurfacePointTemplate> &_template);
+	// NOTE:
+	// Called whenever the template, corners, or axes are changed,
+	// so that the const accessors only read and are safe to call from parallel regions.
+	void update_cuboid_surface_point_values();
+
+	// Sample to cuboid surface point correspondences are found in the cuboid local coordinates.
+	// If the cuboid surface points are grids on the faces, the closest point on each face is
+	// found in closed form. Otherwise, the cuboid faces are searched in the order of distance,
+	// and the previous correspondences are used as initial upper bounds of the search.
+	void update_point_correspondences_incrementally(
+		const std::vector<int> &_prev_sample_to_cuboid_surface_correspondence);
+
 	void create_sub_cuboids(const Real _object_diameter, ANNkd_tree* _kd_tree, std::vector<MeshCuboid *> &_sub_cuboids);
 
 	void remove_small_sub_cuboids(std::vector<MeshCuboid *> &_sub_cuboids);
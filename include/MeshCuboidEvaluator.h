@@ -14,8 +14,11 @@ class MeshCuboidEvaluator {
 public:
 	MeshCuboidEvaluator(MeshCuboidStructure *_ground_truth_cuboid_structure);
 
+	// NOTE:
+	// Errors are recorded in the sample points of both structures,
+	// so the sample points are no longer shared with their copies.
 	void evaluate_point_to_point_distances(
-		const MeshCuboidStructure *_test_cuboid_structure,
+		MeshCuboidStructure *_test_cuboid_structure,
 		const char *_filename);
 
 	// NOTE: Should be called only when mesh label file is already loaded.
@@ -23,7 +26,7 @@ public:
 		const MeshCuboidStructure *_test_cuboid_structure,
 		const char *_filename);
 
-	// NOTE: Cuboid surface points are replaced.
+	// NOTE: Cuboid surface points are replaced unless 'FLAGS_use_exact_cuboid_distance' is true.
 	void evaluate_cuboid_distance(
 		const MeshCuboidStructure *_test_cuboid_structure,
 		const char *_filename);
@@ -34,6 +37,12 @@ private:
 		const std::vector<MeshSamplePoint *> _test_sample_points,
 		const char *_filename, bool _record_error = false);
 
+	// Minimum distances from points to cuboid surfaces.
+	static void get_cuboid_surface_distances(
+		const std::vector<MeshCuboid *> &_cuboids,
+		const Eigen::MatrixXd &_points,
+		Eigen::VectorXd &_distances);
+
 protected:
 	MeshCuboidStructure *ground_truth_cuboid_structure_;
 	const std::string mesh_name_;
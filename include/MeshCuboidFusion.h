@@ -25,6 +25,18 @@ public:
 		const std::vector<MyMesh::Point> &_points,
 		std::vector<int> &_points_to_voxels,
 		std::vector< std::list<int> > &_voxels_to_points) const;
+
+	// Voxel-to-point correspondences in the compressed sparse row layout, built by
+	// counting sort. The points in the voxel 'voxel_index' are
+	// '_voxel_point_indices[_voxel_point_offsets[voxel_index]]', ...,
+	// '_voxel_point_indices[_voxel_point_offsets[voxel_index + 1] - 1]' in increasing order.
+	// '_points_to_voxels' is -1 for points out of the voxel grid range.
+	void get_point_correspondences(
+		const std::vector<MyMesh::Point> &_points,
+		std::vector<int> &_points_to_voxels,
+		std::vector<int> &_voxel_point_offsets,
+		std::vector<int> &_voxel_point_indices) const;
+
 	void get_voxel_occupancies(
 		const std::vector<MyMesh::Point> &_points,
 		Eigen::VectorXd &_voxel_occupancies) const;
@@ -32,7 +44,21 @@ public:
 		ANNpointArray &_ann_points, ANNkd_tree *_ann_kd_tree,
 		Eigen::VectorXd &_voxel_to_point_distances) const;
 
+	// Exact Euclidean distance transform of the voxels occupied by '_points'.
+	// NOTE:
+	// Distances are measured between voxel centers. Points out of the voxel grid range
+	// are placed in a grid padded by '_max_distance', so distances up to '_max_distance'
+	// agree with the kd-tree distance map. Voxels are infinitely far if no point is in
+	// the padded grid.
+	void get_distance_map(
+		const std::vector<MyMesh::Point> &_points,
+		const Real _max_distance,
+		Eigen::VectorXd &_voxel_to_point_distances) const;
+
 private:
+	// Same with 'get_voxel_index(const MyMesh::Point)' without converting 3D indices.
+	int get_point_voxel_index(const MyMesh::Point &_point) const;
+
 	MyMesh::Point min_;
 	MyMesh::Point max_;
 	MeshCuboidVoxelIndex3D n_voxels_;
@@ -0,0 +1,91 @@
+#ifndef _MESH_CUBOID_GRID_GRAPH_CUT_H_
+#define _MESH_CUBOID_GRID_GRAPH_CUT_H_
+
+#include "MyMesh.h"
+
+#include <deque>
+#include <vector>
+
+
+// Exact minimizer of binary labeling energies on a 6-connected 3D grid,
+//	E(l) = sum_p D_p(l_p) + w * sum_(p, q) [l_p != l_q],
+// using the Boykov-Kolmogorov max-flow algorithm
+// (Y. Boykov and V. Kolmogorov, An Experimental Comparison of Min-Cut/Max-Flow
+// Algorithms for Energy Minimization in Vision, 2004).
+// Nodes are indexed by 'x * (n_y * n_z) + y * n_z + z' (see 'MeshCuboidVoxelGrid').
+// NOTE:
+// Neighbors are found from the node index and a per-node boundary mask, so edges are
+// not allocated separately. Only the residual capacities of the six outgoing edges of
+// each node are stored.
+class MeshCuboidGridGraphCut
+{
+public:
+	MeshCuboidGridGraphCut(const int _n_x, const int _n_y, const int _n_z);
+	~MeshCuboidGridGraphCut();
+
+	int num_nodes() const { return num_nodes_; }
+
+	// Adds the costs of labels 0 and 1 to the node.
+	void add_unary_cost(const int _node_index, const Real _cost_0, const Real _cost_1);
+
+	// Sets the cost of different labels of neighbor nodes. Must not be negative.
+	void set_smoothness_cost(const Real _weight);
+
+	// Returns the minimum energy.
+	Real minimize();
+
+	// Nodes which are not connected to either terminal have label 0.
+	int get_label(const int _node_index) const;
+
+private:
+	enum { k_num_directions = 6 };
+	enum { k_free = 0, k_source_tree = 1, k_sink_tree = 2 };
+	enum { k_terminal_parent = k_num_directions, k_orphan_parent, k_no_parent };
+
+	// Directions are (+x, -x, +y, -y, +z, -z), so 'direction ^ 1' is the opposite.
+	int get_neighbor(const int _node_index, const int _direction) const
+	{
+		return _node_index + direction_offsets_[_direction];
+	}
+	bool has_neighbor(const int _node_index, const int _direction) const
+	{
+		return ((boundary_masks_[_node_index] >> _direction) & 1) == 0;
+	}
+	Real &residual(const int _node_index, const int _direction)
+	{
+		return residuals_[k_num_directions * _node_index + _direction];
+	}
+
+	void set_active(const int _node_index);
+	int get_next_active();
+
+	// Returns false if there is no more augmenting path.
+	bool grow(int &_source_side_node, int &_direction);
+	void augment(const int _source_side_node, const int _direction);
+	void adopt(const int _orphan);
+
+	int num_nodes_;
+	int direction_offsets_[k_num_directions];
+	std::vector<unsigned char> boundary_masks_;
+
+	// Positive values are capacities from the source, and negative values are
+	// capacities to the sink.
+	std::vector<Real> terminal_residuals_;
+	std::vector<Real> residuals_;
+	Real flow_;
+
+	std::vector<unsigned char> trees_;
+	// Direction to the parent, or one of 'k_*_parent'.
+	std::vector<unsigned char> parents_;
+	std::vector<unsigned char> is_active_;
+
+	// Distance heuristic of the adoption stage.
+	std::vector<int> timestamps_;
+	std::vector<int> distances_;
+	int time_;
+
+	std::deque<int> active_nodes_;
+	std::deque<int> orphans_;
+};
+
+#endif	// _MESH_CUBOID_GRID_GRAPH_CUT_H_
@@ -15,8 +15,53 @@
 
 #include "ANN/ANN.h"
 #include <Eigen/Core>
+#include <Eigen/SparseCore>
 
 
+// IPOPT problems kept across 'MeshCuboidNonLinearSolver::optimize()' calls.
+// NOTE:
+// A problem is identified by its constraint structure (cuboids and symmetry groups),
+// and keeps the formulation with all constraints and the IPOPT application.
+// When the same problem is solved again, only the energy functions are replaced, and
+// IPOPT is warm-started from the previous multipliers with 'ReOptimizeTNLP()' if the
+// Hessian structure is not changed.
+class MeshCuboidNonLinearSolverSession
+{
+public:
+	MeshCuboidNonLinearSolverSession();
+	~MeshCuboidNonLinearSolverSession();
+
+	void clear();
+
+	unsigned int num_problems() const { return problems_.size(); }
+
+	// Number of warm-started solves.
+	unsigned int num_warm_starts() const { return num_warm_starts_; }
+
+private:
+	friend class MeshCuboidNonLinearSolver;
+
+	struct Problem
+	{
+		Problem();
+		~Problem();
+
+		std::vector<unsigned int> signature_;
+		NLPFormulation *formulation_;
+		SmartPtr<IPOPTSolver> nlp_;
+		SmartPtr<IpoptApplication> app_;
+		bool is_solved_;
+	};
+
+	Problem *find_problem(const std::vector<unsigned int> &_signature) const;
+
+	MeshCuboidNonLinearSolverSession(const MeshCuboidNonLinearSolverSession&);
+	MeshCuboidNonLinearSolverSession& operator=(const MeshCuboidNonLinearSolverSession&);
+
+	std::vector<Problem *> problems_;
+	unsigned int num_warm_starts_;
+};
+
 class MeshCuboidNonLinearSolver
 {
 public:
@@ -68,23 +113,29 @@ public:
 
 
 	void optimize(
-		const Eigen::MatrixXd& _cuboid_quadratic_term,
+		const Eigen::SparseMatrix<double>& _cuboid_quadratic_term,
 		const Eigen::VectorXd& _cuboid_linear_term,
 		const double _cuboid_constant_term,
 		Eigen::VectorXd* _init_values_vec = NULL,
-		const std::vector<unsigned int> *_fixed_cuboid_indices = NULL);
+		const std::vector<unsigned int> *_fixed_cuboid_indices = NULL,
+		MeshCuboidNonLinearSolverSession *_session = NULL);
 
 
 private:
 	// Core functions.
 	void create_energy_functions(
-		const Eigen::MatrixXd &_quadratic_term,
+		const Eigen::SparseMatrix<double> &_quadratic_term,
 		const Eigen::VectorXd &_linear_term,
 		const double _constant_term,
 		std::vector<NLPFunction *> &_functions);
 
 	void add_constraints(NLPFormulation &_formulation);
 
+	// Values determining the constraints added in 'add_constraints()'.
+	void get_constraint_signature(std::vector<unsigned int> &_signature) const;
+
+	static SmartPtr<IpoptApplication> create_ipopt_application();
+
 	bool compute_initial_values(const Eigen::VectorXd &_input, Eigen::VectorXd &_output);
 
 	void update(const std::vector< Number >& _values);
@@ -97,7 +148,7 @@ private:
 		const unsigned int _symmetry_group_index,
 		const std::vector<ANNpointArray>& _cuboid_ann_points,
 		const std::vector<ANNkd_tree *>& _cuboid_ann_kd_tree,
-		Eigen::MatrixXd& _quadratic_term,
+		std::vector< Eigen::Triplet<double> >& _quadratic_term_triplets,
 		Eigen::VectorXd& _linear_term,
 		double &_constant_term);
 
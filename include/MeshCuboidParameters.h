@@ -52,6 +52,53 @@ DECLARE_bool(disable_symmetry_terms);
 DECLARE_bool(disable_per_point_classifier_terms);
 DECLARE_bool(disable_label_smoothness_terms);
 DECLARE_bool(disable_part_relation_terms);
+
+// Use single precision in the occlusion test (for large scans).
+DECLARE_bool(use_float_visibility_test);
+
+// Find sample to cuboid surface point correspondences in the cuboid local coordinates
+// instead of using KD-trees (in closed form for grid cuboid surface points).
+// Cuboid surface to sample point correspondences still use the sample point KD-tree.
+DECLARE_bool(use_incremental_point_correspondences);
+
+// Compute exact Hausdorff distances between cuboid surfaces
+// instead of using cuboid surface points.
+DECLARE_bool(use_exact_cuboid_distance);
+
+// Evaluate batched pair potentials in recognition with single precision matrix products.
+DECLARE_bool(use_single_precision_pair_potentials);
+
+// Compress trained joint normal relations to 'diagonal - low-rank' inverse covariances
+// preserving this ratio of the total variance. Relations are not compressed if it is 1.
+DECLARE_double(param_relation_energy_threshold);
+
+// Render occlusion views with the CPU depth buffer instead of OpenGL.
+// The rendering size is (viewer size) * 'param_occlusion_rendering_scale'.
+DECLARE_bool(use_software_occlusion_rendering);
+DECLARE_double(param_occlusion_rendering_scale);
+
+// Keep IPOPT problems across the iterations of the attribute optimization,
+// and warm-start them from the previous solutions.
+DECLARE_bool(use_warm_start_non_linear_solver);
+
+// Optimize attributes without symmetry terms by minimizing the quadratic energy subject to
+// the linearized cuboid constraints with a sparse LDL^T KKT solver instead of IPOPT.
+// Cuboids are refitted after each iteration.
+DECLARE_bool(use_sparse_quadratic_solver);
+
+// Stop the attribute optimization when the relative energy change is less than
+// 'param_opt_energy_tolerance', or when no cuboid corner moves more than
+// 'param_opt_corner_tolerance' * (object diameter). Zero disables each criterion.
+// Per-iteration energies and timings are written to '(log filename).trace.csv'.
+DECLARE_double(param_opt_energy_tolerance);
+DECLARE_double(param_opt_corner_tolerance);
+
+// Compute voxel distance maps in part assembly with the exact Euclidean distance
+// transform of occupied voxels instead of kd-tree queries from voxel centers.
+DECLARE_bool(use_voxel_distance_transform);
+
+// Smooth voxel visibility in fusion with an exact grid graph cut instead of TRW-S.
+DECLARE_bool(use_grid_graph_cut_visibility_smoothing);
 // ---- //
 
 
@@ -67,6 +114,8 @@ DECLARE_bool(run_render_assembly);
 DECLARE_bool(run_render_output);
 DECLARE_bool(run_render_evaluation);
 DECLARE_bool(run_extract_symmetry_info);
+// Compare the sparse KKT solver with IPOPT on the test cuboids (see 'test_initialize()').
+DECLARE_bool(run_quadratic_solver_benchmark);
 
 // NOTE: Set true when the input is scan data.
 DECLARE_bool(no_evaluation);
@@ -124,6 +173,12 @@ DECLARE_string(joint_normal_relation_filename_prefix);
 DECLARE_string(cond_normal_relation_filename_prefix);
 DECLARE_string(object_list_filename);
 
+// Relation bundle file in the training directory (see 'MeshCuboidRelationBundle').
+// If empty, relations are trained for each object when predicting.
+// Training also writes a leave-one-out bundle '(object name)_(filename)' for each
+// object, which is used when predicting the object.
+DECLARE_string(relation_bundle_filename);
+
 DECLARE_int32(random_view_seed);
 
 // To be removed.
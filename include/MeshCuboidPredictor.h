@@ -7,6 +7,40 @@
 
 #include <vector>
 
+// Factors of the pair quadratic form (see 'MeshCuboidPredictor::get_pair_quadratic_form()')
+// which depend only on the labels, in the space of the attributes of cuboid 1 followed by
+// those of cuboid 2.
+// NOTE:
+// The pairwise features are 'sum_i G_i * Q_i * x + b', where 'G_i' is a constant map and
+// 'Q_i' rotates each corner point in 'x' with the axes of the rotation group 'i'
+// (0: none (heights), 1: cuboid 1, 2: cuboid 2). The rotations can be moved to the attribute
+// space since the local points are computed from the corner points coordinate-wise.
+// The quadratic term is thus 'sum_(i, j) Q_i^T K_ij Q_j' with constant 'K_ij = G_i^T C G_j',
+// and is computed in O((2 * num attributes)^2) without forming the pairwise feature map.
+class MeshCuboidPairQuadraticFormFactors
+{
+public:
+	enum { k_num_rotation_groups = 3 };
+
+	MeshCuboidPairQuadraticFormFactors();
+
+	// The quadratic form is zero if '_relation' is NULL.
+	void compute(const MeshCuboidJointNormalRelations *_relation);
+
+	bool is_zero()const { return is_zero_; }
+
+	// '_quadratic_term' is a (2 * num attributes)^2 matrix, and
+	// '_linear_term' is a (2 * num attributes) vector.
+	void get_pair_quadratic_form(const MeshCuboid *_cuboid_1, const MeshCuboid *_cuboid_2,
+		Eigen::MatrixXd &_quadratic_term, Eigen::VectorXd &_linear_term, double& _constant_term)const;
+
+private:
+	bool is_zero_;
+	Eigen::MatrixXd quadratic_terms_[k_num_rotation_groups][k_num_rotation_groups];
+	Eigen::VectorXd linear_terms_[k_num_rotation_groups];
+	double constant_term_;
+};
+
 // Recognition:
 // Recognize primitive labels and local coordinates.
 class MeshCuboidPredictor {
@@ -27,6 +61,27 @@ public:
 		const MeshCuboidTransformation *_transformation_1, const MeshCuboidTransformation *_transformation_2,
 		const LabelIndex _label_index_1, const LabelIndex _label_index_2)const;
 
+	// Same with the above, but with precomputed cuboid features.
+	// If '_scratch' is given, its buffers are used instead of allocating memory.
+	virtual Real get_pair_potential(
+		const MeshCuboidFeatures &_features_1, const MeshCuboidFeatures &_features_2,
+		const MeshCuboidTransformation *_transformation_1, const MeshCuboidTransformation *_transformation_2,
+		const LabelIndex _label_index_1, const LabelIndex _label_index_2,
+		MeshCuboidRelationScratch *_scratch = NULL)const;
+
+	// Pair potentials of all axis configurations of cuboid 1 (in '_cache_1') with the given
+	// cuboid 2. '_potentials[k]' is the potential with the k-th axis configuration of cuboid 1.
+	virtual void get_pair_potentials(const MeshCuboidAxisConfigurationCache &_cache_1,
+		const MeshCuboidFeatures &_features_2, const MeshCuboidTransformation *_transformation_2,
+		const LabelIndex _label_index_1, const LabelIndex _label_index_2,
+		Eigen::VectorXd &_potentials, MeshCuboidRelationScratch *_scratch = NULL)const;
+
+	// Returns true if the pair potential of the given labels does not depend on cuboids.
+	// Then, the potential value is returned in '_potential'.
+	virtual bool get_constant_pair_potential(
+		const LabelIndex _label_index_1, const LabelIndex _label_index_2,
+		Real &_potential)const;
+
 	virtual void get_single_quadratic_form(MeshCuboid *_cuboid, const unsigned int _cuboid_index,
 		Eigen::MatrixXd &_quadratic_term, Eigen::VectorXd &_linear_term, double& _constant_term)const;
 
@@ -35,6 +90,12 @@ public:
 		const LabelIndex _label_index_1, const LabelIndex _label_index_2,
 		Eigen::MatrixXd &_quadratic_term, Eigen::VectorXd &_linear_term, double& _constant_term)const;
 
+	// Returns false if the pair quadratic form of the given labels cannot be factorized.
+	// Then, 'get_pair_quadratic_form()' should be used.
+	virtual bool get_pair_quadratic_form_factors(
+		const LabelIndex _label_index_1, const LabelIndex _label_index_2,
+		MeshCuboidPairQuadraticFormFactors &_factors)const;
+
 	// 1 is fixed and 2 is unknown.
 	virtual Real get_pair_conditional_quadratic_form(const MeshCuboid *_cuboid_1, const MeshCuboid *_cuboid_2,
 		const unsigned int _cuboid_index_1, const unsigned int _cuboid_index_2,
@@ -60,11 +121,30 @@ public:
 		const MeshCuboidTransformation *_transformation_1, const MeshCuboidTransformation *_transformation_2,
 		const LabelIndex _label_index_1, const LabelIndex _label_index_2)const;
 
+	virtual Real get_pair_potential(
+		const MeshCuboidFeatures &_features_1, const MeshCuboidFeatures &_features_2,
+		const MeshCuboidTransformation *_transformation_1, const MeshCuboidTransformation *_transformation_2,
+		const LabelIndex _label_index_1, const LabelIndex _label_index_2,
+		MeshCuboidRelationScratch *_scratch = NULL)const;
+
+	virtual void get_pair_potentials(const MeshCuboidAxisConfigurationCache &_cache_1,
+		const MeshCuboidFeatures &_features_2, const MeshCuboidTransformation *_transformation_2,
+		const LabelIndex _label_index_1, const LabelIndex _label_index_2,
+		Eigen::VectorXd &_potentials, MeshCuboidRelationScratch *_scratch = NULL)const;
+
+	virtual bool get_constant_pair_potential(
+		const LabelIndex _label_index_1, const LabelIndex _label_index_2,
+		Real &_potential)const;
+
 	virtual Real get_pair_quadratic_form(const MeshCuboid *_cuboid_1, const MeshCuboid *_cuboid_2,
 		const LabelIndex _label_index_1, const LabelIndex _label_index_2,
 		const unsigned int _cuboid_index_1, const unsigned int _cuboid_index_2,
 		Eigen::MatrixXd &_quadratic_term, Eigen::VectorXd &_linear_term, double& _constant_term)const;
 
+	virtual bool get_pair_quadratic_form_factors(
+		const LabelIndex _label_index_1, const LabelIndex _label_index_2,
+		MeshCuboidPairQuadraticFormFactors &_factors)const;
+
 	// 1 is fixed and 2 is unknown.
 	virtual Real get_pair_conditional_quadratic_form(const MeshCuboid *_cuboid_1, const MeshCuboid *_cuboid_2,
 		const LabelIndex _label_index_1, const LabelIndex _label_index_2,
@@ -90,6 +170,16 @@ public:
 		const MeshCuboidTransformation *_transformation_1, const MeshCuboidTransformation *_transformation_2,
 		const LabelIndex _label_index_1, const LabelIndex _label_index_2)const;
 
+	virtual Real get_pair_potential(
+		const MeshCuboidFeatures &_features_1, const MeshCuboidFeatures &_features_2,
+		const MeshCuboidTransformation *_transformation_1, const MeshCuboidTransformation *_transformation_2,
+		const LabelIndex _label_index_1, const LabelIndex _label_index_2,
+		MeshCuboidRelationScratch *_scratch = NULL)const;
+
+	virtual bool get_constant_pair_potential(
+		const LabelIndex _label_index_1, const LabelIndex _label_index_2,
+		Real &_potential)const;
+
 	virtual Real get_pair_quadratic_form(const MeshCuboid *_cuboid_1, const MeshCuboid *_cuboid_2,
 		const LabelIndex _label_index_1, const LabelIndex _label_index_2,
 		const unsigned int _cuboid_index_1, const unsigned int _cuboid_index_2,
@@ -13,6 +13,8 @@
 #include "MeshCuboid.h"
 #include "MeshCuboidStructure.h"
 
+#include <array>
+#include <memory>
 #include <string>
 #include <vector>
 #include <Eigen/Core>
@@ -38,7 +40,7 @@ public:
 
 	void compute_attributes(const MeshCuboid *_cuboid);
 
-	const Eigen::VectorXd get_attributes()const { return attributes_; }
+	const Eigen::VectorXd &get_attributes()const { return attributes_; }
 
 	bool has_nan()const { return attributes_.hasNaN(); }
 
@@ -49,6 +51,8 @@ public:
 		const char* _filename);
 
 private:
+	friend class MeshCuboidAxisConfigurationCache;
+
 	std::string object_name_;
 	Eigen::VectorXd attributes_;
 };
@@ -76,7 +80,10 @@ public:
 	void compute_features(const MeshCuboid *_cuboid,
 		Eigen::MatrixXd *_attributes_to_features_map = NULL);
 
-	const Eigen::VectorXd get_features()const { return features_; }
+	// (num features) x (num attributes) linear map, which is the same for all cuboids.
+	static const Eigen::MatrixXd &get_attributes_to_features_map();
+
+	const Eigen::VectorXd &get_features()const { return features_; }
 
 	bool has_nan()const { return features_.hasNaN(); }
 
@@ -90,6 +97,10 @@ public:
 		const std::list<MeshCuboidFeatures *>& _stats);
 
 private:
+	friend class MeshCuboidAxisConfigurationCache;
+
+	static Eigen::MatrixXd compute_attributes_to_features_map();
+
 	std::string object_name_;
 	Eigen::VectorXd features_;
 };
@@ -105,6 +116,11 @@ public:
 	void compute_transformation(const MeshCuboid *_cuboid);
 	Eigen::VectorXd get_transformed_features(const MeshCuboidFeatures& _other_features)const;
 	Eigen::VectorXd get_transformed_features(const MeshCuboid *_other_cuboid)const;
+
+	// Writes the transformed feature values from '_begin_index' to '_output_vec' starting
+	// at '_output_index', without allocating memory.
+	void get_transformed_features(const MeshCuboidFeatures& _other_features,
+		const int _begin_index, Eigen::VectorXd &_output_vec, const int _output_index)const;
 	Eigen::VectorXd get_inverse_transformed_features(const MeshCuboidFeatures& _other_features)const;
 	Eigen::VectorXd get_inverse_transformed_features(const MeshCuboid *_other_cuboid)const;
 
@@ -121,11 +137,80 @@ public:
 		const std::list<MeshCuboidTransformation *>& _stats);
 
 private:
+	friend class MeshCuboidAxisConfigurationCache;
+
 	std::string object_name_;
 	Eigen::Vector3d first_translation_;
 	Eigen::Matrix3d second_rotation_;
 };
 
+// Attributes, features, and transformations of a cuboid for all axis configurations
+// in 'MeshCuboid::k_all_axis_configuration'.
+// NOTE:
+// All axis configurations are signed permutations of the local axes of the same box.
+// The values are computed only once for the current axes of the given cuboid, and
+// those of the other configurations are derived by permuting corners and local axes,
+// which is the same as calling 'MeshCuboid::set_axis_configuration()' for each configuration.
+class MeshCuboidAxisConfigurationCache {
+public:
+	MeshCuboidAxisConfigurationCache(const MeshCuboid *_cuboid);
+	~MeshCuboidAxisConfigurationCache();
+
+	static unsigned int num_axis_configurations() { return MeshCuboid::num_axis_configurations(); }
+
+	const MeshCuboidAttributes &get_attributes(const unsigned int _axis_configuration_index)const;
+	const MeshCuboidFeatures &get_features(const unsigned int _axis_configuration_index)const;
+	const MeshCuboidTransformation &get_transformation(const unsigned int _axis_configuration_index)const;
+
+	// Signed permutation matrix whose rows are the new local axes in the current local coordinates.
+	static const Eigen::Matrix3d &get_axis_permutation(const unsigned int _axis_configuration_index);
+
+	// Corner 'i' in the given axis configuration is the corner of the returned index
+	// in the current axes.
+	static const std::array<unsigned int, MeshCuboid::k_num_corners> &get_corner_permutation(
+		const unsigned int _axis_configuration_index);
+
+private:
+	struct PermutationTables
+	{
+		PermutationTables();
+
+		std::vector<Eigen::Matrix3d> axis_permutations_;
+		std::vector< std::array<unsigned int, MeshCuboid::k_num_corners> > corner_permutations_;
+	};
+
+	static const PermutationTables &get_permutation_tables();
+
+	std::vector<MeshCuboidAttributes> attributes_;
+	std::vector<MeshCuboidFeatures> features_;
+	std::vector<MeshCuboidTransformation> transformations_;
+};
+
+// Preallocated buffers for evaluating relations without memory allocation.
+// NOTE:
+// Buffers are resized when first used, and not shared between threads.
+// Each thread should have its own instance.
+struct MeshCuboidRelationScratch {
+	Eigen::VectorXd features_vec_;
+	Eigen::VectorXd diff_;
+	Eigen::VectorXd product_;
+
+	// For batched evaluation.
+	Eigen::MatrixXd features_mat_;
+	Eigen::MatrixXd diff_mat_;
+	Eigen::MatrixXd product_mat_;
+	Eigen::MatrixXf diff_mat_f_;
+	Eigen::MatrixXf product_mat_f_;
+};
+
+class MeshCuboidRelationBundle;
+
+// Read-only views of relation matrices, which are either owned by the relations or
+// stored in a memory-mapped relation bundle (see 'MeshCuboidRelationBundle').
+typedef Eigen::Map<const Eigen::VectorXd> MeshCuboidConstVectorMap;
+typedef Eigen::Map<const Eigen::MatrixXd> MeshCuboidConstMatrixMap;
+typedef Eigen::Map<const Eigen::MatrixXf> MeshCuboidConstMatrixfMap;
+
 class MeshCuboidJointNormalRelations {
 public:
 	MeshCuboidJointNormalRelations();
@@ -139,6 +224,24 @@ public:
 
 	bool load_joint_normal_dat(const char* _filename);
 
+	// Low-rank relation file: mean, diagonal, and low-rank factor matrices
+	// in the same binary matrix format with the '.dat' file.
+	bool load_joint_normal_low_rank(const char* _filename);
+	bool save_joint_normal_low_rank(const char* _filename)const;
+
+	// Approximates the inverse covariance with 'diag(d) - W * W^T'.
+	// The columns of 'W' are the principal directions of the covariance, and the fewest
+	// directions are kept so that '_energy_threshold' of the total variance above the
+	// isotropic level of 'diag(d)' is preserved. The inverse covariance is replaced with
+	// the approximation, and errors are computed in O(k_mat_size * rank).
+	// NOTE:
+	// The dense inverse covariance is released, so only 'k_mat_size * (rank + 1)' values
+	// are stored.
+	void compress(const Real _energy_threshold);
+
+	bool is_low_rank()const { return is_low_rank_; }
+	unsigned int get_rank()const { return static_cast<unsigned int>(low_rank_factor().cols()); }
+
 	static void get_pairwise_cuboid_features(
 		const MeshCuboid *_cuboid_1, const MeshCuboid *_cuboid_2,
 		const MeshCuboidTransformation *_transformation_1, const MeshCuboidTransformation *_transformation_2,
@@ -152,19 +255,125 @@ public:
 	double compute_error(const MeshCuboid *_cuboid_1, const MeshCuboid *_cuboid_2,
 		const MeshCuboidTransformation *_transformation_1, const MeshCuboidTransformation *_transformation_2)const;
 
+	double compute_error(const MeshCuboidFeatures &_features_1, const MeshCuboidFeatures &_features_2,
+		const MeshCuboidTransformation *_transformation_1, const MeshCuboidTransformation *_transformation_2,
+		MeshCuboidRelationScratch *_scratch = NULL)const;
+
+	// Batched version of 'compute_error()'.
+	// Each column of '_pairwise_features_mat' is a pairwise feature vector
+	// (see 'get_pairwise_cuboid_features()'), and '_errors' has the error of each column.
+	// NOTE:
+	// The error is computed as '|| U * (f - mean) ||^2' with a precomputed factor
+	// 'inv_cov = U^T * U', so that all columns are evaluated with a single matrix product.
+	void compute_errors(const Eigen::MatrixXd &_pairwise_features_mat, Eigen::VectorXd &_errors,
+		MeshCuboidRelationScratch *_scratch = NULL)const;
+
+	// Same with 'compute_errors()', but the matrix product is computed in single precision.
+	void compute_errors_single_precision(
+		const Eigen::MatrixXd &_pairwise_features_mat, Eigen::VectorXd &_errors,
+		MeshCuboidRelationScratch *_scratch = NULL)const;
+
+	// Writes the pairwise feature vector to '_pairwise_features_vec' without allocating memory
+	// if it already has 'k_mat_size' rows.
+	static void get_pairwise_cuboid_features_in_place(
+		const MeshCuboidFeatures &_features_1, const MeshCuboidFeatures &_features_2,
+		const MeshCuboidTransformation *_transformation_1, const MeshCuboidTransformation *_transformation_2,
+		Eigen::VectorXd &_pairwise_features_vec);
+
 	// 1 is fixed and 2 is unknown.
 	double compute_conditional_error(const MeshCuboid *_cuboid_1, const MeshCuboid *_cuboid_2,
 		const MeshCuboidTransformation *_transformation_1)const;
 
-	const Eigen::VectorXd &get_mean()const { return mean_; }
-	const Eigen::MatrixXd &get_inv_cov()const { return inv_cov_; }
+	MeshCuboidConstVectorMap get_mean()const { return mean(); }
+	// NOTE:
+	// The dense inverse covariance of a low-rank relation is not stored,
+	// and it is built from 'diag(d) - W * W^T' for each call.
+	Eigen::MatrixXd get_inv_cov()const;
 
-	void set_mean(const Eigen::VectorXd &_mean) { mean_ = _mean; }
-	void set_inv_cov(const Eigen::MatrixXd &_inv_cov_) { inv_cov_ = _inv_cov_; }
+	void set_mean(const Eigen::VectorXd &_mean) { detach_from_bundle(); mean_ = _mean; }
+	void set_inv_cov(const Eigen::MatrixXd &_inv_cov_) { detach_from_bundle();
+		inv_cov_ = _inv_cov_; is_low_rank_ = false; update_batch_data(); }
 
 private:
+	friend class MeshCuboidRelationBundle;
+
+	// Updates the factors of the inverse covariance used in 'compute_errors()'.
+	void update_batch_data();
+
+	// Copies the matrices in the relation bundle to the members before modifying them.
+	void detach_from_bundle();
+	void release_bundle();
+
+	// NOTE:
+	// All matrices are read through these views. They refer to the relation bundle
+	// if the relation is loaded from a bundle, and to the members otherwise.
+	MeshCuboidConstVectorMap mean()const {
+		return bundle_ ? MeshCuboidConstVectorMap(bundle_matrices_.mean_, k_mat_size)
+			: MeshCuboidConstVectorMap(mean_.data(), mean_.rows()); }
+	// Empty for low-rank relations.
+	MeshCuboidConstMatrixMap inv_cov()const {
+		return bundle_ ? MeshCuboidConstMatrixMap(bundle_matrices_.inv_cov_,
+			bundle_matrices_.inv_cov_factor_size_, bundle_matrices_.inv_cov_factor_size_)
+			: MeshCuboidConstMatrixMap(inv_cov_.data(), inv_cov_.rows(), inv_cov_.cols()); }
+	MeshCuboidConstMatrixMap inv_cov_factor()const {
+		return bundle_ ? MeshCuboidConstMatrixMap(bundle_matrices_.inv_cov_factor_,
+			bundle_matrices_.inv_cov_factor_size_, bundle_matrices_.inv_cov_factor_size_)
+			: MeshCuboidConstMatrixMap(inv_cov_factor_.data(), inv_cov_factor_.rows(), inv_cov_factor_.cols()); }
+	MeshCuboidConstMatrixfMap inv_cov_factor_f()const {
+		return bundle_ ? MeshCuboidConstMatrixfMap(bundle_matrices_.inv_cov_factor_f_,
+			bundle_matrices_.inv_cov_factor_size_, bundle_matrices_.inv_cov_factor_size_)
+			: MeshCuboidConstMatrixfMap(inv_cov_factor_f_.data(), inv_cov_factor_f_.rows(), inv_cov_factor_f_.cols()); }
+	MeshCuboidConstVectorMap low_rank_diagonal()const {
+		return bundle_ ? MeshCuboidConstVectorMap(bundle_matrices_.low_rank_diagonal_, bundle_matrices_.low_rank_size_)
+			: MeshCuboidConstVectorMap(low_rank_diagonal_.data(), low_rank_diagonal_.rows()); }
+	MeshCuboidConstMatrixMap low_rank_factor()const {
+		return bundle_ ? MeshCuboidConstMatrixMap(bundle_matrices_.low_rank_factor_,
+			bundle_matrices_.low_rank_size_, bundle_matrices_.rank_)
+			: MeshCuboidConstMatrixMap(low_rank_factor_.data(), low_rank_factor_.rows(), low_rank_factor_.cols()); }
+	MeshCuboidConstMatrixfMap low_rank_factor_f()const {
+		return bundle_ ? MeshCuboidConstMatrixfMap(bundle_matrices_.low_rank_factor_f_,
+			bundle_matrices_.low_rank_size_, bundle_matrices_.rank_)
+			: MeshCuboidConstMatrixfMap(low_rank_factor_f_.data(), low_rank_factor_f_.rows(), low_rank_factor_f_.cols()); }
+
 	Eigen::VectorXd mean_;
+	// Empty if 'is_low_rank_' is true.
 	Eigen::MatrixXd inv_cov_;
+
+	// The inverse covariance is 'diag(low_rank_diagonal_) - low_rank_factor_ * low_rank_factor_^T'
+	// if 'is_low_rank_' is true.
+	bool is_low_rank_;
+	Eigen::VectorXd low_rank_diagonal_;
+	Eigen::MatrixXd low_rank_factor_;
+	Eigen::MatrixXf low_rank_factor_f_;
+
+	// 'inv_cov_ = inv_cov_factor_^T * inv_cov_factor_'.
+	// It is upper triangular if 'inv_cov_' is positive definite.
+	Eigen::MatrixXd inv_cov_factor_;
+	bool is_inv_cov_factor_triangular_;
+	Eigen::MatrixXf inv_cov_factor_f_;
+
+	// Matrices in the relation bundle, which is kept mapped while 'bundle_' is not NULL.
+	struct BundleMatrices
+	{
+		BundleMatrices() : mean_(NULL), inv_cov_(NULL), inv_cov_factor_(NULL), inv_cov_factor_f_(NULL),
+			low_rank_diagonal_(NULL), low_rank_factor_(NULL), low_rank_factor_f_(NULL),
+			inv_cov_factor_size_(0), low_rank_size_(0), rank_(0) {}
+
+		const double *mean_;
+		const double *inv_cov_;
+		const double *inv_cov_factor_;
+		const float *inv_cov_factor_f_;
+		const double *low_rank_diagonal_;
+		const double *low_rank_factor_;
+		const float *low_rank_factor_f_;
+		// Size of the dense inverse covariance and its factor. Zero for low-rank relations.
+		int inv_cov_factor_size_;
+		int low_rank_size_;
+		int rank_;
+	};
+
+	std::shared_ptr<const MeshCuboidRelationBundle> bundle_;
+	BundleMatrices bundle_matrices_;
 };
 
 class MeshCuboidCondNormalRelations {
@@ -190,18 +399,53 @@ public:
 	double compute_error(const MeshCuboid *_cuboid_1, const MeshCuboid *_cuboid_2,
 		const MeshCuboidTransformation *_transformation_1, const MeshCuboidTransformation *_transformation_2)const;
 
-	const Eigen::MatrixXd &get_mean_A()const { return mean_A_; }
-	const Eigen::VectorXd &get_mean_b()const { return mean_b_; }
-	const Eigen::MatrixXd &get_inv_cov()const { return inv_cov_; }
+	double compute_error(const MeshCuboidFeatures &_features_1, const MeshCuboidFeatures &_features_2,
+		const MeshCuboidTransformation *_transformation_1, const MeshCuboidTransformation *_transformation_2,
+		MeshCuboidRelationScratch *_scratch = NULL)const;
 
-	void set_mean_A(const Eigen::MatrixXd &_mean_A) { mean_A_ = _mean_A; }
-	void set_mean_b(const Eigen::VectorXd &_mean_b) { mean_b_ = _mean_b; }
-	void set_inv_cov(const Eigen::MatrixXd &_inv_cov_) { inv_cov_ = _inv_cov_; }
+	MeshCuboidConstMatrixMap get_mean_A()const { return mean_A(); }
+	MeshCuboidConstVectorMap get_mean_b()const { return mean_b(); }
+	MeshCuboidConstMatrixMap get_inv_cov()const { return inv_cov(); }
+
+	void set_mean_A(const Eigen::MatrixXd &_mean_A) { detach_from_bundle(); mean_A_ = _mean_A; }
+	void set_mean_b(const Eigen::VectorXd &_mean_b) { detach_from_bundle(); mean_b_ = _mean_b; }
+	void set_inv_cov(const Eigen::MatrixXd &_inv_cov_) { detach_from_bundle(); inv_cov_ = _inv_cov_; }
 
 private:
+	friend class MeshCuboidRelationBundle;
+
+	// Copies the matrices in the relation bundle to the members before modifying them.
+	void detach_from_bundle();
+	void release_bundle();
+
+	// See 'MeshCuboidJointNormalRelations'.
+	MeshCuboidConstMatrixMap mean_A()const {
+		return bundle_ ? MeshCuboidConstMatrixMap(bundle_matrices_.mean_A_,
+			MeshCuboidFeatures::k_num_features, MeshCuboidFeatures::k_num_global_feature_values)
+			: MeshCuboidConstMatrixMap(mean_A_.data(), mean_A_.rows(), mean_A_.cols()); }
+	MeshCuboidConstVectorMap mean_b()const {
+		return bundle_ ? MeshCuboidConstVectorMap(bundle_matrices_.mean_b_, MeshCuboidFeatures::k_num_features)
+			: MeshCuboidConstVectorMap(mean_b_.data(), mean_b_.rows()); }
+	MeshCuboidConstMatrixMap inv_cov()const {
+		return bundle_ ? MeshCuboidConstMatrixMap(bundle_matrices_.inv_cov_,
+			MeshCuboidFeatures::k_num_features, MeshCuboidFeatures::k_num_features)
+			: MeshCuboidConstMatrixMap(inv_cov_.data(), inv_cov_.rows(), inv_cov_.cols()); }
+
 	Eigen::MatrixXd mean_A_;
 	Eigen::VectorXd mean_b_;
 	Eigen::MatrixXd inv_cov_;
+
+	struct BundleMatrices
+	{
+		BundleMatrices() : mean_A_(NULL), mean_b_(NULL), inv_cov_(NULL) {}
+
+		const double *mean_A_;
+		const double *mean_b_;
+		const double *inv_cov_;
+	};
+
+	std::shared_ptr<const MeshCuboidRelationBundle> bundle_;
+	BundleMatrices bundle_matrices_;
 };
 
 /*
@@ -0,0 +1,75 @@
+#ifndef _MESH_CUBOID_RELATION_BUNDLE_H_
+#define _MESH_CUBOID_RELATION_BUNDLE_H_
+
+#include "MeshCuboidRelation.h"
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+class MeshCuboidTrainer;
+
+
+// Single-file bundle of all joint and conditional normal relations of a category.
+// NOTE:
+// The file is memory-mapped when loaded, and the loaded relations read their matrices
+// directly from the mapped file through 'Eigen::Map' views without copying.
+// The mapping is released when all relations loaded from it are deleted.
+// Relations are validated (matrix sizes, symmetry, and positive semi-definiteness of
+// the inverse covariances) only when the bundle is saved. Low-rank joint normal relations
+// are stored without their dense inverse covariances. When loading, the header and
+// the matrix table are checked, and the checksum of the data is verified unless disabled.
+// For leave-one-out evaluation, the bundle also keeps the training features of the joint
+// normal relations, and the relations of the label pairs which the excluded object has
+// are refitted without the object when loading.
+//
+// File layout (in the byte order of the writing machine, which must be the same when loading):
+//	Header (64 bytes): magic, version, number of labels, number of matrices,
+//		matrix table offset, data offset, data size, 64-bit FNV-1a checksum of the data,
+//		and byte order mark.
+//	Matrix table (32 bytes per matrix): data offset, rows, cols, label indices,
+//		matrix type, and flags.
+//	Data: Column-major matrices, each aligned to 64 bytes.
+class MeshCuboidRelationBundle
+{
+public:
+	~MeshCuboidRelationBundle();
+
+	static const uint32_t k_version = 3;
+
+	// NULL relations are not stored.
+	// If '_trainer' is given, the training features of the joint normal relations are
+	// also stored for leave-one-out relations. The relations must be trained on all objects.
+	// Returns false without writing the file if any relation is invalid.
+	static bool save(const char* _filename,
+		const std::vector< std::vector<MeshCuboidJointNormalRelations *> > &_joint_normal_relations,
+		const std::vector< std::vector<MeshCuboidCondNormalRelations *> > &_cond_normal_relations,
+		const MeshCuboidTrainer *_trainer = NULL);
+
+	// Relations in the given vectors are deleted. Relations not in the bundle are NULL.
+	// If '_ignored_object_name' is given, joint normal relations are trained without the object.
+	// Returns false if the object may be in the training data but the bundle has no training features.
+	static bool load(const char* _filename,
+		std::vector< std::vector<MeshCuboidJointNormalRelations *> > &_joint_normal_relations,
+		std::vector< std::vector<MeshCuboidCondNormalRelations *> > &_cond_normal_relations,
+		const std::string &_ignored_object_name = std::string(),
+		const bool _verify_checksum = true);
+
+private:
+	MeshCuboidRelationBundle();
+	MeshCuboidRelationBundle(const MeshCuboidRelationBundle&);
+	MeshCuboidRelationBundle& operator=(const MeshCuboidRelationBundle&);
+
+	bool open(const char* _filename);
+	void close();
+
+	const unsigned char *data_;
+	uint64_t size_;
+
+	bool is_mapped_;
+	// Used instead of the mapping on platforms without 'mmap'.
+	std::vector<uint64_t> buffer_;
+};
+
+#endif	// _MESH_CUBOID_RELATION_BUNDLE_H_
@@ -6,16 +6,275 @@
 #include "MeshCuboidRelation.h"
 #include "MeshCuboidPredictor.h"
 
+#include <array>
+#include <map>
 #include <vector>
 #include <string>
 #include <Eigen/Core>
+#include <Eigen/SparseCore>
+#include <Eigen/SparseCholesky>
 
+class MeshCuboidNonLinearSolverSession;
+
+
+// Potentials of labels and axes configurations of cuboids.
+// Each cuboid is a node, and each (label, axis configuration) pair is a case of the node.
+// An additional dummy case is appended if '_add_dummy_label' is true.
+// NOTE:
+// Pair potentials are computed on demand for each pair of nodes instead of being stored
+// in a (num cuboids * num cases)^2 matrix. Pair potentials of label pairs which do not
+// depend on cuboids (see 'MeshCuboidPredictor::get_constant_pair_potential()') are filled
+// without evaluating the predictor.
+class MeshCuboidLabelAndAxesPotentials
+{
+public:
+	MeshCuboidLabelAndAxesPotentials(
+		const std::vector<Label>& _labels,
+		const std::vector<MeshCuboid *>& _cuboids,
+		const MeshCuboidPredictor &_predictor,
+		const std::vector< std::list<LabelIndex> > *_label_symmetries,
+		bool _add_dummy_label = false);
+	~MeshCuboidLabelAndAxesPotentials();
+
+	unsigned int num_nodes()const { return num_cuboids_; }
+	unsigned int num_cases()const { return num_cases_; }
+
+	Real get_single_potential(const unsigned int _node_index, const unsigned int _case_index)const;
+
+	// If '_scratch' is given, its buffers are used instead of allocating memory.
+	Real get_pair_potential(const unsigned int _node_index_1, const unsigned int _node_index_2,
+		const unsigned int _case_index_1, const unsigned int _case_index_2,
+		MeshCuboidRelationScratch *_scratch = NULL)const;
+
+	// '_pair_potentials' has (num cases)^2 values, and the potential of
+	// (case_index_1, case_index_2) is at 'case_index_1 + case_index_2 * (num cases)'.
+	void get_pair_potentials(const unsigned int _node_index_1, const unsigned int _node_index_2,
+		std::vector<Real> &_pair_potentials)const;
+
+	unsigned int num_node_pairs()const { return num_cuboids_ * (num_cuboids_ - 1) / 2; }
+
+	// Node pairs (node_index_1 < node_index_2) in lexicographic order.
+	void get_node_pairs(std::vector< std::pair<unsigned int, unsigned int> > &_node_pairs)const;
+
+	// The number of node pairs of which pair potentials fit in a batch of bounded size.
+	unsigned int num_batch_node_pairs()const;
+
+	// Pair potentials of '_num_pairs' node pairs from '_node_pairs[_first_pair_index]'
+	// computed in a single parallel sweep. The potentials of each node pair are in
+	// '_pair_potentials' one after another, in the same layout with 'get_pair_potentials()'.
+	// '_thread_scratches' has a scratch buffer for each thread, and is reused across calls.
+	void get_pair_potentials(
+		const std::vector< std::pair<unsigned int, unsigned int> > &_node_pairs,
+		const unsigned int _first_pair_index, const unsigned int _num_pairs,
+		std::vector<Real> &_pair_potentials,
+		std::vector<MeshCuboidRelationScratch> &_thread_scratches)const;
+
+	// Pair potentials of all node pairs in the order of 'get_node_pairs()', computed in
+	// batches. '_all_pair_potentials[pair_index]' is the same with the output of
+	// 'get_pair_potentials()'.
+	void get_all_pair_potentials(std::vector< std::vector<Real> > &_all_pair_potentials)const;
+
+	// Sum of single potentials and pair potentials of the given cases.
+	Real compute_energy(const std::vector<int> &_case_indices)const;
+
+	// Symmetric (num cuboids * num cases)^2 matrix.
+	// Single potentials are in the diagonal.
+	void get_potential_matrix(Eigen::MatrixXd &_potential_mat)const;
+
+private:
+	// Not copyable.
+	MeshCuboidLabelAndAxesPotentials(const MeshCuboidLabelAndAxesPotentials &_other);
+	MeshCuboidLabelAndAxesPotentials& operator=(const MeshCuboidLabelAndAxesPotentials &_other);
+
+	bool is_dummy_case(const unsigned int _case_index)const;
+
+	const MeshCuboidPredictor &predictor_;
+	unsigned int num_labels_;
+	unsigned int num_cuboids_;
+	unsigned int num_axis_configurations_;
+	unsigned int num_cases_;
+	bool add_dummy_label_;
+
+	// Features and transformations of each cuboid for all axis configurations.
+	// NOTE:
+	// They do not depend on labels, and are shared by all cases with the same axis configuration.
+	std::vector<MeshCuboidAxisConfigurationCache *> axis_configuration_caches_;
+
+	// (num cuboids) x (num cases) matrix.
+	Eigen::MatrixXd single_potentials_;
+
+	// Potentials of label pairs not depending on cuboids, indexed by
+	// 'label_index_1 * (num labels) + label_index_2'.
+	std::vector<bool> is_constant_label_pair_;
+	std::vector<Real> constant_label_pair_potentials_;
+};
+
+// Pairwise quadratic forms (see 'MeshCuboidPredictor::get_pair_quadratic_form()') of all
+// cuboid pairs, stored in the space of the attributes of each pair.
+// NOTE:
+// The pairwise quadratic form depends on the cuboids only through their labels and local
+// axes, since the translations to the local coordinates are linear in the attributes.
+// Each (2 * num attributes)^2 block is thus recomputed only when the labels or axes of
+// the pair are changed, and blocks are scattered into a sparse global matrix.
+// Since the axes are re-estimated in every iteration, the factors of each label pair
+// (see 'MeshCuboidPairQuadraticFormFactors') are also cached, and blocks are recomputed
+// from them in the space of the attributes of each pair.
+class MeshCuboidPairQuadraticFormCache
+{
+public:
+	MeshCuboidPairQuadraticFormCache();
+
+	// NOTE:
+	// The statistics are not cleared.
+	void clear();
+
+	// '_quadratic_term' is a (num cuboids * num attributes)^2 matrix, and
+	// '_linear_term' is a (num cuboids * num attributes) vector.
+	void get_pair_quadratic_form(
+		const std::vector<MeshCuboid *>& _cuboids,
+		const MeshCuboidPredictor &_predictor,
+		Eigen::SparseMatrix<double> &_quadratic_term,
+		Eigen::VectorXd &_linear_term,
+		double &_constant_term);
+
+	// Number of blocks recomputed in the last 'get_pair_quadratic_form()' call.
+	unsigned int num_updated_blocks()const { return num_updated_blocks_; }
+
+	// Numbers of blocks reused and recomputed in all 'get_pair_quadratic_form()' calls.
+	unsigned long get_total_num_hits()const { return total_num_hits_; }
+	unsigned long get_total_num_misses()const { return total_num_misses_; }
+	void print_statistics()const;
+
+private:
+	struct LabelPairFactors
+	{
+		LabelPairFactors() : is_supported_(false) {}
+
+		// False if the predictor does not support the factors.
+		bool is_supported_;
+		MeshCuboidPairQuadraticFormFactors factors_;
+	};
+
+	struct Block
+	{
+		Block() : is_valid_(false), is_zero_(true), constant_term_(0) {}
+
+		bool is_valid_;
+		bool is_zero_;
+		LabelIndex label_index_1_;
+		LabelIndex label_index_2_;
+		std::array<MyMesh::Normal, 3> axes_1_;
+		std::array<MyMesh::Normal, 3> axes_2_;
+
+		// The variables are the attributes of cuboid 1 followed by those of cuboid 2,
+		// or only those of cuboid 1 if both cuboids are the same.
+		Eigen::MatrixXd quadratic_term_;
+		Eigen::VectorXd linear_term_;
+		double constant_term_;
+	};
+
+	bool is_block_changed(const Block &_block,
+		const MeshCuboid *_cuboid_1, const MeshCuboid *_cuboid_2)const;
+
+	// '_factors' is NULL if the predictor does not support the factors.
+	void update_block(const MeshCuboidPredictor &_predictor,
+		const MeshCuboidPairQuadraticFormFactors *_factors,
+		const MeshCuboid *_cuboid_1, const MeshCuboid *_cuboid_2,
+		const bool _is_same_cuboid, Block &_block)const;
+
+	const MeshCuboidPredictor *predictor_;
+	unsigned int num_cuboids_;
+
+	// Indexed by 'cuboid_index_1 * (num cuboids) + cuboid_index_2' (cuboid_index_1 <= cuboid_index_2).
+	std::vector<Block> blocks_;
+
+	// Indexed by '(label_index_1, label_index_2)'.
+	std::map< std::pair<LabelIndex, LabelIndex>, LabelPairFactors > label_pair_factors_;
+
+	unsigned int num_updated_blocks_;
+	unsigned long total_num_hits_;
+	unsigned long total_num_misses_;
+};
+
+// Sparse LDL^T solver of equality-constrained quadratic programs,
+// min (x^T A x + 2 b^T x + c) subject to C x = d,
+// with a positive definite 'A' and a full row rank 'C'.
+// The KKT system [A C^T; C 0] is regularized to be quasi-definite, [A C^T; C -delta I],
+// so that LDL^T exists for any symmetric ordering, and the solution is refined with
+// the unregularized system.
+// NOTE:
+// The symbolic analysis (fill-reducing ordering and elimination tree) is reused
+// while the sparsity pattern of the KKT system is not changed.
+class MeshCuboidSparseKKTSolver
+{
+public:
+	MeshCuboidSparseKKTSolver();
+
+	void clear();
+
+	// Returns false if the KKT system is not quasi-definite.
+	bool solve(const Eigen::SparseMatrix<double> &_quadratic_term,
+		const Eigen::VectorXd &_linear_term,
+		const Eigen::SparseMatrix<double> &_constraint_matrix,
+		const Eigen::VectorXd &_constraint_values,
+		Eigen::VectorXd &_x);
+
+	unsigned int num_symbolic_analyses() const { return num_symbolic_analyses_; }
+	unsigned int num_numeric_factorizations() const { return num_numeric_factorizations_; }
+
+private:
+	bool is_same_pattern(const Eigen::SparseMatrix<double> &_matrix) const;
+
+	Eigen::SimplicialLDLT< Eigen::SparseMatrix<double> > solver_;
+
+	bool is_analyzed_;
+	std::vector<int> outer_indices_;
+	std::vector<int> inner_indices_;
+
+	unsigned int num_symbolic_analyses_;
+	unsigned int num_numeric_factorizations_;
+};
+
+// Cuboid poses and symmetry group parameters, which are the only values changed
+// by the attribute optimization.
+// NOTE:
+// Used to keep the lowest energy iterate of the attribute optimization without
+// copying the whole cuboid structure.
+class MeshCuboidPoseSnapshot
+{
+public:
+	void save(const MeshCuboidStructure &_cuboid_structure);
+
+	// The structure must have the same cuboids and symmetry groups as when saved.
+	void restore(MeshCuboidStructure &_cuboid_structure) const;
+
+	// Max distance between the current and saved corners of each cuboid.
+	Real get_max_corner_distance(const MeshCuboidStructure &_cuboid_structure) const;
+
+	bool empty() const { return cuboid_poses_.empty(); }
+
+private:
+	struct CuboidPose
+	{
+		std::array<MyMesh::Normal, 3> axes_;
+		MyMesh::Point center_;
+		MyMesh::Normal size_;
+		std::array<MyMesh::Point, MeshCuboid::k_num_corners> corners_;
+	};
+
+	std::vector<CuboidPose> cuboid_poses_;
+	std::vector< std::pair<MyMesh::Normal, double> > reflection_planes_;
+	std::vector< std::pair<MyMesh::Normal, MyMesh::Point> > rotation_axes_;
+};
 
 std::vector<int> solve_markov_random_field(
 	const unsigned int _num_nodes,
 	const unsigned int _num_labels,
 	const Eigen::MatrixXd& _energy_mat);
 
+std::vector<int> solve_markov_random_field(
+	const MeshCuboidLabelAndAxesPotentials &_potentials);
+
 Eigen::VectorXd solve_quadratic_programming(
 	const Eigen::MatrixXd& _quadratic_term,
 	const Eigen::VectorXd& _linear_term,
@@ -49,31 +308,60 @@ void test_recognize_labels_and_axes_configurations(
 	const std::vector<MeshCuboid *>& _cuboids,
 	const MeshCuboidPredictor &_predictor);
 
+// If '_pair_quadratic_form_cache' is given, pairwise quadratic forms are reused
+// for the cuboid pairs whose labels and axes are not changed.
 void get_optimization_formulation(
 	const std::vector<MeshCuboid *>& _cuboids,
 	const MeshCuboidPredictor &_predictor,
 	Eigen::VectorXd &_init_values,
-	Eigen::MatrixXd &_single_quadratic_term, Eigen::MatrixXd &_pair_quadratic_term,
+	Eigen::SparseMatrix<double> &_single_quadratic_term, Eigen::SparseMatrix<double> &_pair_quadratic_term,
 	Eigen::VectorXd &_single_linear_term, Eigen::VectorXd &_pair_linear_term,
 	double &_single_constant_term, double &_pair_constant_term,
-	double &_single_total_energy, double &_pair_total_energy);
+	double &_single_total_energy, double &_pair_total_energy,
+	MeshCuboidPairQuadraticFormCache *_pair_quadratic_form_cache = NULL);
 
 void get_optimization_error(
 	const std::vector<MeshCuboid *>& _cuboids,
 	const MeshCuboidPredictor &_predictor,
-	double &_single_total_energy, double &_pair_total_energy);
+	double &_single_total_energy, double &_pair_total_energy,
+	MeshCuboidPairQuadraticFormCache *_pair_quadratic_form_cache = NULL);
 
 void optimize_attributes_quadratic_once(
 	const std::vector<MeshCuboid *>& _cuboids,
 	const MeshCuboidPredictor &_predictor,
-	const double _single_energy_term_weight);
+	const double _single_energy_term_weight,
+	MeshCuboidPairQuadraticFormCache *_pair_quadratic_form_cache = NULL);
+
+// Linearizes the cuboid constraints of 'MeshCuboidNonLinearSolver' (unit and
+// orthogonal axes, and cuboid edges orthogonal to the other axes) at the current
+// cuboids. Variables are the cuboid attributes followed by 3x3 axes of each cuboid.
+// NOTE:
+// Only 3 of the 4 edges on each cuboid face are constrained since the 4th
+// constraint is linearly dependent on the others.
+void get_linearized_cuboid_constraints(
+	const std::vector<MeshCuboid *>& _cuboids,
+	Eigen::SparseMatrix<double> &_constraint_matrix,
+	Eigen::VectorXd &_constraint_values);
+
+// Attribute optimization without symmetry terms as one sequential quadratic
+// programming step: the quadratic energy is minimized subject to the linearized
+// cuboid constraints with the sparse KKT solver.
+// Returns false (and does not change cuboids) if the KKT solver fails.
+bool optimize_attributes_sparse_quadratic_once(
+	const std::vector<MeshCuboid *>& _cuboids,
+	const MeshCuboidPredictor &_predictor,
+	const double _single_energy_term_weight,
+	MeshCuboidSparseKKTSolver &_kkt_solver,
+	MeshCuboidPairQuadraticFormCache *_pair_quadratic_form_cache = NULL);
 
 void optimize_attributes_once(
 	MeshCuboidStructure &_cuboid_structure,
 	const MeshCuboidPredictor &_predictor,
 	const double _single_energy_term_weight,
 	const double _symmetry_energy_term_weight,
-	bool _use_symmetry);
+	bool _use_symmetry,
+	MeshCuboidPairQuadraticFormCache *_pair_quadratic_form_cache = NULL,
+	MeshCuboidNonLinearSolverSession *_non_linear_solver_session = NULL);
 
 void optimize_attributes(
 	MeshCuboidStructure &_cuboid_structure,
@@ -12,7 +12,10 @@
 #include "MyMesh.h"
 #include "MeshCuboid.h"
 #include "MeshCuboidSymmetryGroup.h"
+#include "MeshSamplePointStore.h"
 
+#include <memory>
+#include <mutex>
 #include <vector>
 #include <set>
 
@@ -44,6 +47,42 @@ public:
 		return static_cast<unsigned int>(sample_points_.size());
 	}
 
+	// NOTE:
+	// Copies of a structure share sample points until one of them changes sample points
+	// (copy-on-write). Cuboids and symmetry groups are always copied.
+	// Sample point values should not be changed through these functions.
+	inline const std::vector<MeshSamplePoint *> &get_sample_points()const {
+		return sample_points_;
+	}
+	inline MeshSamplePoint *get_sample_point(const SamplePointIndex _sample_point_index)const {
+		assert(_sample_point_index < sample_points_.size());
+		return sample_points_[_sample_point_index];
+	}
+
+	// Sample points that can be changed.
+	// NOTE:
+	// Sample points (also in cuboids) are copied here if they are shared with copies,
+	// and the sample point store is invalidated (see 'get_sample_point_store()').
+	// Call this function before collecting sample points from cuboids to change them.
+	std::vector<MeshSamplePoint *> &get_mutable_sample_points();
+	bool is_sample_point_shared()const;
+
+	void get_sample_points(Eigen::MatrixXd &_sample_points)const;
+
+	// NOTE:
+	// The store is updated from sample points only when it has been invalidated.
+	// Member functions changing sample points or labels invalidate the store. When changing
+	// sample points directly, do not read the store between 'get_mutable_sample_points()'
+	// and the end of the change, or call 'invalidate_sample_point_store()' after the change.
+	// Do not keep the returned reference after changing sample points.
+	const MeshSamplePointStore &get_sample_point_store()const;
+	void invalidate_sample_point_store();
+
+	// NOTE:
+	// The tree is cached, and rebuilt only when the sample points are changed.
+	// Do not delete the returned tree and ANN points.
+	ANNkd_tree *get_sample_point_kd_tree(ANNpointArray *_ann_points = NULL)const;
+
 	inline unsigned int num_labels()const {
 		return static_cast<unsigned int>(labels_.size());
 	}
@@ -78,7 +117,7 @@ public:
 	std::vector<MeshCuboid *> get_all_cuboids() const;
 
 	void get_all_cuboid_surface_points(
-		std::vector<MeshCuboidSurfacePoint *> &all_cuboid_surface_points) const;
+		std::vector<const MeshCuboidSurfacePoint *> &all_cuboid_surface_points) const;
 
 	// Get sample point labels from the confidence values.
 	void get_sample_point_label_indices_from_confidences(std::vector<LabelIndex> &_sample_point_label_indices);
@@ -156,11 +195,29 @@ public:
 private:
 	inline Label get_new_label()const;
 
+	// Member functions changing sample points call this function first.
+	// It also invalidates the sample point store.
+	void make_sample_points_unique();
+
+	struct SharedSamplePoints;
+
+	// Shared by all copies sharing the sample points of this structure.
+	// NOTE:
+	// The last structure holding it deletes the sample points.
+	std::shared_ptr<SharedSamplePoints> shared_sample_points_;
+	std::vector<MeshSamplePoint *> sample_points_;
+
+	// NOTE:
+	// The store is updated with the mutex locked, so that it can be read by multiple threads.
+	mutable MeshSamplePointStore sample_point_store_;
+	mutable bool is_sample_point_store_valid_;
+	mutable std::mutex sample_point_store_mutex_;
+	mutable ICP::KdTreeCache sample_point_kd_tree_cache_;
+
 
 public:
 	const MyMesh *mesh_;
 
-	std::vector<MeshSamplePoint *> sample_points_;
 	std::vector<Label> labels_;
 	std::vector<std::string> label_names_;
 	std::vector< std::list<LabelIndex> > label_symmetries_;
@@ -19,6 +19,8 @@ public:
 	bool load_features(const std::string &_filename_prefix);
 	bool load_transformations(const std::string &_filename_prefix);
 
+	const std::list<std::string> &get_object_list()const { return object_list_; }
+
 	void get_conflicted_labels(
 		std::vector< std::list<LabelIndex> > &_cooccurrence_labels)const;
 
@@ -27,10 +29,26 @@ public:
 		std::list< std::list<LabelIndex> > &_missing_label_index_groups,
 		const std::set<LabelIndex> *_ignored_label_indices = NULL)const;
 
+	// Each row of '_features' is the pairwise feature vector of an object, and
+	// '_object_indices' has the index of the object in the object list.
+	// Objects without the labels are skipped.
+	void get_joint_normal_features(
+		const LabelIndex _label_index_1, const LabelIndex _label_index_2,
+		Eigen::MatrixXd &_features,
+		std::vector<unsigned int> &_object_indices,
+		const std::list<std::string> *_ignored_object_list = NULL)const;
+
 	void get_joint_normal_relations(
 		std::vector< std::vector<MeshCuboidJointNormalRelations *> > &_relations,
 		const std::list<std::string> *_ignored_object_list = NULL)const;
 
+	// The relation is compressed if '_energy_threshold' is less than 1
+	// (see 'MeshCuboidJointNormalRelations::compress()').
+	static void fit_joint_normal_relation(
+		const Eigen::MatrixXd &_features,
+		const Real _energy_threshold,
+		MeshCuboidJointNormalRelations *_relation);
+
 	void get_cond_normal_relations(
 		std::vector< std::vector<MeshCuboidCondNormalRelations *> > &_relations,
 		const std::list<std::string> *_ignored_object_list = NULL)const;
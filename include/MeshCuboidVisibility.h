@@ -0,0 +1,88 @@
+#ifndef _MESH_CUBOID_VISIBILITY_H_
+#define _MESH_CUBOID_VISIBILITY_H_
+
+#include "MeshCuboid.h"
+
+#include <vector>
+#include <Eigen/Core>
+
+
+// Occlusion test against observed sample points.
+// The sample points are transformed to the model view coordinates once, and binned
+// into a 2D grid over the (x, y) components of their view directions. A test point
+// is compared only with the sample points in its grid cell.
+// NOTE:
+// Each sample point is inserted to all cells overlapped by its occlusion cone,
+// so the grid does not change the result of the occlusion test.
+//
+// The occlusion test 'acos(cos_angle) <= atan(radius / len)' is evaluated as the
+// equivalent squared-cosine comparison over structure-of-arrays in each cell,
+// and test points are processed in parallel.
+class MeshCuboidVisibilityEngine
+{
+public:
+	MeshCuboidVisibilityEngine(
+		const Real _modelview_matrix[16],
+		const Real _radius,
+		const std::vector<MeshSamplePoint *> &_given_sample_points);
+	// '_given_points' is a 3 x (num points) matrix (see 'MeshSamplePointStore').
+	MeshCuboidVisibilityEngine(
+		const Real _modelview_matrix[16],
+		const Real _radius,
+		const Eigen::MatrixXd &_given_points);
+	~MeshCuboidVisibilityEngine();
+
+	Real get_radius() const { return radius_; }
+	const Real *get_modelview_matrix() const { return modelview_matrix_; }
+	unsigned int num_occluders() const;
+	bool is_float_precision() const { return use_float_precision_; }
+
+	void compute_visibility(
+		const std::vector<MyMesh::Point> &_test_points,
+		const std::vector<MyMesh::Normal> *_test_normals,
+		std::vector<Real> &_visibility_values) const;
+
+private:
+	void initialize(const Real _modelview_matrix[16], const Eigen::MatrixXd &_given_points);
+	void build_grid();
+	void get_occluder_grid_range(const unsigned int _occluder_index,
+		int _range_min[2], int _range_max[2]) const;
+	int get_grid_coord(const Real _value, const unsigned int _axis) const;
+
+	// Returns 0 if any sample point occludes the given test point.
+	Real compute_occlusion_visibility(const MyMesh::Point &_test_point) const;
+
+	template<typename T>
+	static bool is_occluded(
+		const std::vector<T> &_x, const std::vector<T> &_y,
+		const std::vector<T> &_z, const std::vector<T> &_inv_cos_squared,
+		const unsigned int _begin, const unsigned int _end,
+		const Eigen::Vector3d &_lc_surface_point, const Real _lc_surface_point_squared_len);
+
+	Real modelview_matrix_[16];
+	Eigen::Matrix4d modelview_transformation_;
+	Real radius_;
+	MyMesh::Normal view_direction_;
+	bool use_float_precision_;
+
+	// Sample points in front of the camera, in the model view coordinates.
+	std::vector<Eigen::Vector3d> lc_occluder_points_;
+	std::vector<Real> lc_occluder_point_lens_;
+	std::vector<Real> occluder_cone_angles_;
+
+	// Grid cells are stored in the compressed row format.
+	Real grid_min_[2];
+	Real grid_cell_size_;
+	int grid_size_[2];
+	std::vector<unsigned int> grid_cell_offsets_;
+
+	// Sample point values sorted by grid cells.
+	// 'inv_cos_squared' is (len^2 + radius^2) / len^4 (see 'is_occluded()').
+	std::vector<double> cell_x_, cell_y_, cell_z_, cell_inv_cos_squared_;
+	std::vector<float> cell_x_f_, cell_y_f_, cell_z_f_, cell_inv_cos_squared_f_;
+
+public:
+	EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+};
+
+#endif	// _MESH_CUBOID_VISIBILITY_H_
@@ -0,0 +1,63 @@
+#ifndef _MESH_SAMPLE_POINT_STORE_H_
+#define _MESH_SAMPLE_POINT_STORE_H_
+
+#include "MeshCuboid.h"
+
+#include <vector>
+#include <Eigen/Core>
+
+
+// Structure-of-arrays copy of sample point values.
+// Each column of the point, normal, and barycentric coordinate matrices is a sample
+// point, so the matrices can be passed to KD-trees and Eigen expressions without copying.
+// NOTE:
+// 'MeshSamplePoint' instances are still the primary representation. The store is
+// refreshed from them by 'update()', which rewrites the arrays in place and increases
+// the version only when any value is changed.
+class MeshSamplePointStore
+{
+public:
+	MeshSamplePointStore();
+	~MeshSamplePointStore();
+
+	void clear();
+
+	// Returns true if any value is changed.
+	// Missing label confidence values are set to zero.
+	bool update(const std::vector<MeshSamplePoint *> &_sample_points,
+		const unsigned int _num_labels);
+
+	unsigned int num_points() const { return static_cast<unsigned int>(points_.cols()); }
+	unsigned int num_labels() const { return static_cast<unsigned int>(label_index_confidences_.cols()); }
+
+	// The version is increased whenever any value is changed.
+	unsigned int get_version() const { return version_; }
+
+	// 3 x (num points) matrices.
+	const Eigen::MatrixXd &get_points() const { return points_; }
+	const Eigen::MatrixXd &get_normals() const { return normals_; }
+	const Eigen::MatrixXd &get_bary_coords() const { return bary_coords_; }
+
+	const Eigen::VectorXi &get_face_indices() const { return face_indices_; }
+
+	// (num points) x (num labels) matrix.
+	const Eigen::MatrixXd &get_label_index_confidences() const { return label_index_confidences_; }
+
+	const Eigen::VectorXd &get_errors() const { return errors_; }
+
+	// '_indices' are sample point indices.
+	void get_points(const std::vector<SamplePointIndex> &_indices,
+		Eigen::MatrixXd &_points) const;
+
+private:
+	Eigen::MatrixXd points_;
+	Eigen::MatrixXd normals_;
+	Eigen::MatrixXd bary_coords_;
+	Eigen::VectorXi face_indices_;
+	Eigen::MatrixXd label_index_confidences_;
+	Eigen::VectorXd errors_;
+
+	unsigned int version_;
+};
+
+#endif	// _MESH_SAMPLE_POINT_STORE_H_
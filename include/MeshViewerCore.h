@@ -80,6 +80,7 @@ public:
 	void test_scale(const Real _scale_x, const Real _scale_y);
 	void test_rotate(const Real _angle);
 	void test_optimize();
+	void test_quadratic_solver_benchmark();
 
 	void test_figure_1();
 	//
@@ -0,0 +1,102 @@
+#ifndef _OCCLUSION_DEPTH_BUFFER_H_
+#define _OCCLUSION_DEPTH_BUFFER_H_
+
+#include "MyMesh.h"
+
+#include <vector>
+#include <Eigen/Core>
+
+
+// CPU depth buffer renderer of object indices.
+// It replaces OpenGL index rendering and 'glReadPixels()' when finding visible
+// objects from a view, and does not require any OpenGL context.
+// NOTE:
+// The screen is divided into tiles. Primitives are binned into the tiles in the
+// order they are added, and the tiles are rasterized in parallel.
+// As in OpenGL with 'GL_LESS' depth test, the earlier primitive wins at the same depth.
+class OcclusionDepthBuffer
+{
+public:
+	OcclusionDepthBuffer(const unsigned int _width, const unsigned int _height,
+		const Real _modelview_matrix[16], const Real _projection_matrix[16]);
+	~OcclusionDepthBuffer();
+
+	unsigned int width() const { return width_; }
+	unsigned int height() const { return height_; }
+
+	void clear();
+
+	// Each face has index '_index_offset + (face index)'.
+	void add_mesh(const MyMesh &_mesh, const int _index_offset);
+
+	// Each sphere has index '_index_offset + (point index)'.
+	void add_spheres(const std::vector<MyMesh::Point> &_centers, const Real _radius,
+		const int _index_offset);
+
+	void render();
+
+	// Pixel (0, 0) is the bottom-left corner as in 'glReadPixels()'.
+	// Returns -1 for background pixels.
+	int get_index(const unsigned int _x, const unsigned int _y) const;
+	Real get_depth(const unsigned int _x, const unsigned int _y) const;
+
+	// '_is_visible[i]' is true if index '_begin + i' is rendered in any pixel.
+	void get_visible_indices(const int _begin, const int _end,
+		std::vector<bool> &_is_visible) const;
+
+private:
+	struct Triangle
+	{
+		// Window coordinates (x, y) and normalized device depth (z).
+		Eigen::Vector3d vertices_[3];
+		int index_;
+	};
+
+	struct Sphere
+	{
+		// Center in the model view coordinates.
+		Eigen::Vector3d center_;
+		Real radius_;
+		int index_;
+	};
+
+	struct Primitive
+	{
+		bool is_sphere_;
+		unsigned int primitive_index_;
+		int bbox_[4];	// [x_min, y_min, x_max, y_max] in pixels.
+	};
+
+	void add_triangle(const Eigen::Vector4d _clip_vertices[3], const int _index);
+	void add_primitive(const bool _is_sphere, const unsigned int _primitive_index,
+		const Eigen::Vector2d &_bbox_min, const Eigen::Vector2d &_bbox_max);
+	Eigen::Vector3d clip_to_window(const Eigen::Vector4d &_clip_vertex) const;
+
+	void render_tile(const unsigned int _tile_index);
+	void rasterize_triangle(const Triangle &_triangle, const int _range[4]);
+	void rasterize_sphere(const Sphere &_sphere, const int _range[4]);
+
+	unsigned int width_;
+	unsigned int height_;
+	Eigen::Matrix4d modelview_matrix_;
+	Eigen::Matrix4d projection_matrix_;
+	Eigen::Matrix4d inverse_projection_matrix_;
+
+	std::vector<Triangle> triangles_;
+	std::vector<Sphere> spheres_;
+	std::vector<Primitive> primitives_;
+
+	unsigned int num_tiles_x_;
+	unsigned int num_tiles_y_;
+
+	// Indices of the primitives overlapping each tile, in the order they are added.
+	std::vector< std::vector<unsigned int> > tile_primitive_indices_;
+
+	std::vector<Real> depth_buffer_;
+	std::vector<int> index_buffer_;
+
+public:
+	EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+};
+
+#endif	// _OCCLUSION_DEPTH_BUFFER_H_
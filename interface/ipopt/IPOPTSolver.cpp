@@ -59,15 +59,32 @@ bool IPOPTSolver::get_starting_point(Index n, bool init_x, Number* x,
 	Index m, bool init_lambda,
 	Number* lambda)
 {
-	// Here, we assume we only have starting values for x, if you code
-	// your own NLP, you can provide starting values for the dual variables
-	// if you wish
+	// Here, we assume we always have starting values for x, and have
+	// starting values for the dual variables only if the problem was solved before.
 	assert(init_x == true);
-	assert(init_z == false);
-	assert(init_lambda == false);
 
 	formulation_->get_values(x);
 
+	if (init_z)
+	{
+		if (z_L_.size() != n || z_U_.size() != n)
+			return false;
+
+		for (Index i = 0; i < n; i++) {
+			z_L[i] = z_L_[i];
+			z_U[i] = z_U_[i];
+		}
+	}
+
+	if (init_lambda)
+	{
+		if (lambda_.size() != m)
+			return false;
+
+		for (Index i = 0; i < m; i++)
+			lambda[i] = lambda_[i];
+	}
+
 	return true;
 }
 
@@ -141,6 +158,11 @@ void IPOPTSolver::finalize_solution(SolverReturn status,
 
 	formulation_->set_values(x);
 
+	// Store the multipliers for warm start.
+	z_L_.assign(z_L, z_L + n);
+	z_U_.assign(z_U, z_U + n);
+	lambda_.assign(lambda, lambda + m);
+
 	/*
 	// For this example, we write the solution to the console
 	std::cout << std::endl << std::endl << "Solution of the primal variables, x" << std::endl;
@@ -75,6 +75,12 @@ public:
 		IpoptCalculatedQuantities* ip_cq);
 	//@}
 
+	/** Returns true if the multipliers of the last solution are stored.
+	*  The stored multipliers are returned as the starting point when
+	*  IPOPT asks for them ("warm_start_init_point" option).
+	*/
+	bool has_multipliers() const { return !z_L_.empty(); }
+
 private:
 	/**@name Methods to block default compiler methods.
 	* The compiler automatically generates the following three methods.
@@ -94,6 +100,11 @@ private:
 
 	NLPFormulation *formulation_;
 	std::vector<Number> output_;
+
+	// Multipliers of the last solution.
+	std::vector<Number> z_L_;
+	std::vector<Number> z_U_;
+	std::vector<Number> lambda_;
 };
 
 
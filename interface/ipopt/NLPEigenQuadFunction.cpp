@@ -2,10 +2,26 @@
 
 #include <stdio.h>
 #include <string.h>
+#include <algorithm>
 #include <cassert>
+#include <map>
 
 
 NLPEigenQuadFunction::NLPEigenQuadFunction(const Eigen::MatrixXd &_quadratic_term_,
+	const Eigen::VectorXd &_linear_term, const double &_constant_term)
+	: NLPFunction(0)
+	, quadratic_term_(_quadratic_term_.sparseView())
+	, linear_term_(_linear_term)
+	, constant_term_(_constant_term)
+{
+	num_vars_ = quadratic_term_.cols();
+	assert(quadratic_term_.rows() == num_vars_);
+	assert(linear_term_.rows() == num_vars_);
+
+	compute_hessian();
+}
+
+NLPEigenQuadFunction::NLPEigenQuadFunction(const Eigen::SparseMatrix<double> &_quadratic_term_,
 	const Eigen::VectorXd &_linear_term, const double &_constant_term)
 	: NLPFunction(0)
 	, quadratic_term_(_quadratic_term_)
@@ -15,6 +31,8 @@ NLPEigenQuadFunction::NLPEigenQuadFunction(const Eigen::MatrixXd &_quadratic_ter
 	num_vars_ = quadratic_term_.cols();
 	assert(quadratic_term_.rows() == num_vars_);
 	assert(linear_term_.rows() == num_vars_);
+
+	compute_hessian();
 }
 
 NLPEigenQuadFunction::~NLPEigenQuadFunction()
@@ -22,17 +40,47 @@ NLPEigenQuadFunction::~NLPEigenQuadFunction()
 
 }
 
+void NLPEigenQuadFunction::compute_hessian()
+{
+	// Hessian = (A + A^T).
+	std::map< std::pair<Index, Index>, Number > hessian_map;
+
+	for (int k = 0; k < quadratic_term_.outerSize(); ++k)
+	{
+		for (Eigen::SparseMatrix<double>::InnerIterator it(quadratic_term_, k); it; ++it)
+		{
+			Index row = static_cast<Index>(it.row());
+			Index col = static_cast<Index>(it.col());
+			Index index_i = std::max(row, col);
+			Index index_j = std::min(row, col);
+
+			// Diagonal entries are counted twice.
+			Number value = (index_i == index_j) ? (2 * it.value()) : it.value();
+			hessian_map[std::make_pair(index_i, index_j)] += value;
+		}
+	}
+
+	hessian_indices_.clear();
+	hessian_values_.clear();
+	hessian_indices_.reserve(hessian_map.size());
+	hessian_values_.reserve(hessian_map.size());
+
+	for (std::map< std::pair<Index, Index>, Number >::const_iterator it = hessian_map.begin();
+		it != hessian_map.end(); ++it)
+	{
+		if ((*it).second == 0) continue;
+		hessian_indices_.push_back((*it).first);
+		hessian_values_.push_back((*it).second);
+	}
+}
+
 Ipopt::Number NLPEigenQuadFunction::eval(const Number* _x) const
 {
-	// FIXME:
-	// Change the following code in more efficient way.
-	Eigen::VectorXd x(num_vars_);
-	for (int i = 0; i < num_vars_; ++i)
-		x[i] = static_cast<double>(_x[i]);
+	Eigen::Map<const Eigen::VectorXd> x(_x, num_vars_);
 
 	double output = 0;
-	output += x.transpose() * quadratic_term_ * x;
-	output += 2 * linear_term_.transpose() * x;
+	output += x.dot(quadratic_term_ * x);
+	output += 2 * linear_term_.dot(x);
 	output += constant_term_;
 
 	return static_cast<Number>(output);
@@ -43,8 +91,8 @@ Ipopt::Number NLPEigenQuadFunction::eval(const Eigen::VectorXd &_x) const
 	assert(_x.rows() == num_vars_);
 
 	double output = 0;
-	output += _x.transpose() * quadratic_term_ * _x;
-	output += 2 * linear_term_.transpose() * _x;
+	output += _x.dot(quadratic_term_ * _x);
+	output += 2 * linear_term_.dot(_x);
 	output += constant_term_;
 
 	return static_cast<Number>(output);
@@ -52,34 +100,29 @@ Ipopt::Number NLPEigenQuadFunction::eval(const Eigen::VectorXd &_x) const
 
 void NLPEigenQuadFunction::eval_gradient(const Number* _x, Number* _output) const
 {
-	// FIXME:
-	// Change the following code in more efficient way.
-	Eigen::VectorXd x(num_vars_);
-	for (int i = 0; i < num_vars_; ++i)
-		x[i] = static_cast<double>(_x[i]);
+	Eigen::Map<const Eigen::VectorXd> x(_x, num_vars_);
+	Eigen::Map<Eigen::VectorXd> output(_output, num_vars_);
 
-	Eigen::VectorXd output(num_vars_);
-	output = 2 * (quadratic_term_ * x + linear_term_);
+	// Gradient = (A + A^T) x + 2b.
+	output = quadratic_term_ * x;
+	output += quadratic_term_.transpose() * x;
+	output += 2 * linear_term_;
+}
 
-	for (int i = 0; i < num_vars_; ++i)
-		_output[i] = static_cast<Number>(output[i]);
+void NLPEigenQuadFunction::get_hessian_structure(
+	std::vector< std::pair<Index, Index> > &_indices) const
+{
+	_indices = hessian_indices_;
 }
 
-void NLPEigenQuadFunction::eval_hessian(const Number* _x,
-	const Number _weight, Number* _output) const
+void NLPEigenQuadFunction::eval_hessian(const Number* _x, const Number _weight,
+	const Index* _output_indices, Number* _output) const
 {
-	for (Index index_i = 0; index_i < num_vars_; ++index_i)
-	{
-		for (Index index_j = 0; index_j <= index_i; ++index_j)
-		{
-			assert(index_i <= quadratic_term_.rows());
-			assert(index_j <= quadratic_term_.cols());
-			assert(index_i >= index_j);
-
-			Index index = index_i * (index_i + 1) / 2 + index_j;
-			Number value = 0.5 * (quadratic_term_(index_i, index_j) +
-				quadratic_term_(index_j, index_i));
-			_output[index] += _weight * (2 * value);
-		}
-	}
+	assert(_output_indices != NULL);
+	assert(_output != NULL);
+	// Assume that output values are initialized.
+
+	const unsigned int nnz_funcion_hessian = hessian_values_.size();
+	for (unsigned int i = 0; i < nnz_funcion_hessian; ++i)
+		_output[_output_indices[i]] += _weight * hessian_values_[i];
 }
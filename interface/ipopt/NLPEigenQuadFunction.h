@@ -11,6 +11,7 @@
 #include "NLPFormulation.h"
 
 #include <Eigen/Core>
+#include <Eigen/SparseCore>
 
 class NLPSparseFunction;
 class NLPSparseConstraint;
@@ -24,19 +25,31 @@ public:
 
 	NLPEigenQuadFunction(const Eigen::MatrixXd &_quadratic_term,
 		const Eigen::VectorXd &_linear_term, const double &_constant_term);
+	NLPEigenQuadFunction(const Eigen::SparseMatrix<double> &_quadratic_term,
+		const Eigen::VectorXd &_linear_term, const double &_constant_term);
 	~NLPEigenQuadFunction();
 
 	virtual Number eval(const Number* _x) const;
 	virtual void eval_gradient(const Number* _x, Number* _output) const;
+	virtual void get_hessian_structure(
+		std::vector< std::pair<Index, Index> > &_indices) const;
 	virtual void eval_hessian(const Number* _x, const Number _weight,
-		Number* _output) const;
+		const Index* _output_indices, Number* _output) const;
 
 	virtual Number eval(const Eigen::VectorXd &_x) const;
 
 private:
-	const Eigen::MatrixXd quadratic_term_;
+	// NOTE:
+	// The Hessian is constant, so its lower-triangular non-zero entries are
+	// computed once when the function is created.
+	void compute_hessian();
+
+	const Eigen::SparseMatrix<double> quadratic_term_;
 	const Eigen::VectorXd linear_term_;
 	const double constant_term_;
+
+	std::vector< std::pair<Index, Index> > hessian_indices_;
+	std::vector< Number > hessian_values_;
 };
 
 #endif	// __NLP_EIGEN_QUAD_FUNCTION_H__
@@ -16,6 +16,7 @@ using namespace Ipopt;
 
 class NLPTerm;
 class NLPExpression;
+class NLPExpressionTape;
 
 
 class NLPTerm
@@ -69,6 +70,8 @@ public:
 	}
 
 private:
+	friend class NLPExpressionTape;
+
 	Number coeff_;
 	std::list< std::pair<Index, int> > vars_;	// (index, power).
 };
@@ -165,6 +168,8 @@ public:
 	}
 
 private:
+	friend class NLPExpressionTape;
+
 	std::list< NLPTerm > terms_;
 };
 
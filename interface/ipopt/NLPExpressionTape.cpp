@@ -0,0 +1,141 @@
+#include "NLPExpressionTape.h"
+
+#include <algorithm>
+#include <cassert>
+#include <map>
+
+
+NLPExpressionTape::NLPExpressionTape()
+{
+	clear();
+}
+
+NLPExpressionTape::NLPExpressionTape(const NLPExpression &_expression)
+{
+	compile(std::vector< NLPExpression >(1, _expression));
+}
+
+NLPExpressionTape::NLPExpressionTape(const std::vector< NLPExpression > &_expressions)
+{
+	compile(_expressions);
+}
+
+NLPExpressionTape::~NLPExpressionTape()
+{
+
+}
+
+void NLPExpressionTape::clear()
+{
+	expression_offsets_.clear();
+	expression_offsets_.push_back(0);
+	coeffs_.clear();
+	monomial_offsets_.clear();
+	monomial_offsets_.push_back(0);
+	var_indices_.clear();
+	var_powers_.clear();
+}
+
+void NLPExpressionTape::compile(const std::vector< NLPExpression > &_expressions)
+{
+	typedef std::vector< std::pair<Index, int> > Monomial;
+
+	clear();
+
+	for (std::vector< NLPExpression >::const_iterator e_it = _expressions.begin();
+		e_it != _expressions.end(); ++e_it)
+	{
+		// Merge monomials with the same variables.
+		// Variables in each monomial are sorted by their indices.
+		std::map< Monomial, Number > monomials;
+
+		for (std::list< NLPTerm >::const_iterator t_it = (*e_it).terms_.begin();
+			t_it != (*e_it).terms_.end(); ++t_it)
+		{
+			Monomial monomial;
+			monomial.reserve((*t_it).vars_.size());
+			for (std::list< std::pair<Index, int> >::const_iterator v_it = (*t_it).vars_.begin();
+				v_it != (*t_it).vars_.end(); ++v_it)
+			{
+				if ((*v_it).second > 0)
+					monomial.push_back(*v_it);
+			}
+			std::sort(monomial.begin(), monomial.end());
+
+			monomials[monomial] += (*t_it).coeff_;
+		}
+
+		for (std::map< Monomial, Number >::const_iterator m_it = monomials.begin();
+			m_it != monomials.end(); ++m_it)
+		{
+			if ((*m_it).second == 0) continue;
+
+			coeffs_.push_back((*m_it).second);
+			for (Monomial::const_iterator v_it = (*m_it).first.begin();
+				v_it != (*m_it).first.end(); ++v_it)
+			{
+				var_indices_.push_back((*v_it).first);
+				var_powers_.push_back((*v_it).second);
+			}
+			monomial_offsets_.push_back(var_indices_.size());
+		}
+
+		expression_offsets_.push_back(coeffs_.size());
+	}
+
+	assert(monomial_offsets_.size() == coeffs_.size() + 1);
+	assert(var_powers_.size() == var_indices_.size());
+}
+
+inline Number NLPExpressionTape::eval_monomial(const Number* _x,
+	const unsigned int _monomial_index) const
+{
+	Number ret = coeffs_[_monomial_index];
+
+	const unsigned int end = monomial_offsets_[_monomial_index + 1];
+	for (unsigned int k = monomial_offsets_[_monomial_index]; k < end; ++k)
+	{
+		const Number x = _x[var_indices_[k]];
+		switch (var_powers_[k])
+		{
+		case 1: ret *= x; break;
+		case 2: ret *= (x * x); break;
+		default:
+			for (int count = 0; count < var_powers_[k]; ++count)
+				ret *= x;
+		}
+	}
+
+	return ret;
+}
+
+Number NLPExpressionTape::eval(const Number* _x, const unsigned int _expression_index) const
+{
+	assert(_expression_index < num_expressions());
+
+	Number ret = 0;
+	const unsigned int end = expression_offsets_[_expression_index + 1];
+	for (unsigned int i = expression_offsets_[_expression_index]; i < end; ++i)
+		ret += eval_monomial(_x, i);
+	return ret;
+}
+
+void NLPExpressionTape::eval_all(const Number* _x, Number* _output) const
+{
+	assert(_output != NULL);
+
+	const unsigned int num_expressions = this->num_expressions();
+	for (unsigned int expression_index = 0; expression_index < num_expressions; ++expression_index)
+		_output[expression_index] = eval(_x, expression_index);
+}
+
+void NLPExpressionTape::eval_all(const Number* _x, const Number _weight,
+	const Index* _output_indices, Number* _output) const
+{
+	assert(_output_indices != NULL);
+	assert(_output != NULL);
+
+	const unsigned int num_expressions = this->num_expressions();
+	for (unsigned int expression_index = 0; expression_index < num_expressions; ++expression_index)
+		_output[_output_indices[expression_index]] += _weight * eval(_x, expression_index);
+}
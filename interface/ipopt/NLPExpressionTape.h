@@ -0,0 +1,52 @@
+#ifndef __NLP_EXPRESSION_TAPE_H__
+#define __NLP_EXPRESSION_TAPE_H__
+
+#include <vector>
+
+#include "NLPExpression.h"
+
+
+// Flattened form of a list of expressions for fast evaluation.
+// NOTE:
+// Each expression is stored as a contiguous range of monomials, and each monomial as
+// a coefficient and a contiguous range of (variable index, power) pairs (CSR layout).
+// Monomials with the same variables in an expression are merged when compiled.
+class NLPExpressionTape
+{
+public:
+	NLPExpressionTape();
+	NLPExpressionTape(const NLPExpression &_expression);
+	NLPExpressionTape(const std::vector< NLPExpression > &_expressions);
+	~NLPExpressionTape();
+
+	void clear();
+	void compile(const std::vector< NLPExpression > &_expressions);
+
+	inline unsigned int num_expressions() const { return expression_offsets_.size() - 1; }
+	inline unsigned int num_monomials() const { return coeffs_.size(); }
+
+	Number eval(const Number* _x, const unsigned int _expression_index) const;
+
+	// '_output' has (num expressions) values.
+	void eval_all(const Number* _x, Number* _output) const;
+
+	// The value of the k-th expression is added to '_output[_output_indices[k]]'
+	// after being multiplied by '_weight'.
+	void eval_all(const Number* _x, const Number _weight,
+		const Index* _output_indices, Number* _output) const;
+
+private:
+	inline Number eval_monomial(const Number* _x, const unsigned int _monomial_index) const;
+
+	// (num expressions + 1) offsets to monomials.
+	std::vector< unsigned int > expression_offsets_;
+
+	std::vector< Number > coeffs_;
+	// (num monomials + 1) offsets to variables.
+	std::vector< unsigned int > monomial_offsets_;
+
+	std::vector< Index > var_indices_;
+	std::vector< int > var_powers_;
+};
+
+#endif	// __NLP_EXPRESSION_TAPE_H__
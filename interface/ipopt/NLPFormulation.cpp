@@ -4,6 +4,7 @@
 #include <string.h>
 #include <cassert>
 #include <iostream>
+#include <map>
 #include <sstream>
 
 NLPFunction::NLPFunction(const Index _num_vars)
@@ -31,6 +32,10 @@ NLPSparseFunction::NLPSparseFunction(const Index _num_vars,
 	assert(ret);
 	ret = _expression.get_sparse_hessian(_num_vars, hessian_.indices_, hessian_.expressions_);
 	assert(ret);
+
+	expression_tape_.compile(std::vector< NLPExpression >(1, expression_));
+	gradient_tape_.compile(gradient_.expressions_);
+	hessian_tape_.compile(hessian_.expressions_);
 }
 
 NLPSparseFunction::~NLPSparseFunction()
@@ -40,7 +45,7 @@ NLPSparseFunction::~NLPSparseFunction()
 
 Ipopt::Number NLPSparseFunction::eval(const Number* _x) const
 {
-	return expression_.eval(_x);
+	return expression_tape_.eval(_x, 0);
 }
 
 void NLPSparseFunction::eval_gradient(const Number* _x, Number* _output) const
@@ -48,44 +53,30 @@ void NLPSparseFunction::eval_gradient(const Number* _x, Number* _output) const
 	// Initialize all output values to zero.
 	memset(_output, 0, num_vars_ * sizeof(Number));
 
-	unsigned int nnz_gradient = gradient_.expressions_.size();
+	unsigned int nnz_gradient = gradient_tape_.num_expressions();
 	assert(gradient_.indices_.size() == nnz_gradient);
+	if (nnz_gradient == 0) return;
 
-	for (unsigned int i = 0; i < nnz_gradient; ++i)
-	{
-		Index index = gradient_.indices_[i];
-		const NLPExpression &expression = gradient_.expressions_[i];
-
-		assert(index <= num_variables());
-		_output[index] = expression.eval(_x);
-	}
+	// NOTE:
+	// Gradient indices are unique.
+	gradient_tape_.eval_all(_x, 1.0, &(gradient_.indices_[0]), _output);
 }
 
-void NLPSparseFunction::eval_hessian(const Number* _x,
-	const Number _weight, Number* _output) const
+void NLPSparseFunction::get_hessian_structure(
+	std::vector< std::pair<Index, Index> > &_indices) const
 {
-	// NOTE:
-	// Make dense Hessian matrix.
+	_indices = hessian_.indices_;
+}
 
+void NLPSparseFunction::eval_hessian(const Number* _x, const Number _weight,
+	const Index* _output_indices, Number* _output) const
+{
+	assert(_output_indices != NULL);
 	assert(_output != NULL);
 	// Assume that output values are initialized.
 
-	unsigned int nnz_funcion_hessian = hessian_.expressions_.size();
-	assert(hessian_.indices_.size() == nnz_funcion_hessian);
-
-	for (unsigned int i = 0; i < nnz_funcion_hessian; ++i)
-	{
-		Index index_i = hessian_.indices_[i].first;
-		Index index_j = hessian_.indices_[i].second;
-		const NLPExpression &expression = hessian_.expressions_[i];
-
-		assert(index_i <= num_variables());
-		assert(index_j <= num_variables());
-		assert(index_i >= index_j);
-
-		Index index = index_i * (index_i + 1) / 2 + index_j;
-		_output[index] += _weight * expression.eval(_x);
-	}
+	assert(hessian_.indices_.size() == hessian_tape_.num_expressions());
+	hessian_tape_.eval_all(_x, _weight, _output_indices, _output);
 }
 
 NLPSparseConstraint::NLPSparseConstraint(const Index _num_vars,
@@ -99,6 +90,10 @@ NLPSparseConstraint::NLPSparseConstraint(const Index _num_vars,
 	assert(ret);
 	ret = _expression.get_sparse_hessian(_num_vars, hessian_.indices_, hessian_.expressions_);
 	assert(ret);
+
+	expression_tape_.compile(std::vector< NLPExpression >(1, expression_));
+	gradient_tape_.compile(gradient_.expressions_);
+	hessian_tape_.compile(hessian_.expressions_);
 }
 
 NLPSparseConstraint::~NLPSparseConstraint()
@@ -115,7 +110,7 @@ Ipopt::Number NLPSparseConstraint::nnz_gradients() const
 
 Ipopt::Number NLPSparseConstraint::eval(const Number* _x) const
 {
-	return expression_.eval(_x);
+	return expression_tape_.eval(_x, 0);
 }
 
 void NLPSparseConstraint::eval_gradient(const Number* _x,
@@ -130,43 +125,32 @@ void NLPSparseConstraint::eval_gradient(const Number* _x,
 	for (unsigned int i = 0; i < nnz_gradient; ++i)
 	{
 		Index index = gradient_.indices_[i];
-		const NLPExpression &expression = gradient_.expressions_[i];
 		assert(index <= num_vars_);
 
 		// NOTE:
 		// If '_x' is NULL, ignore the output value.
 		Number value = 0;
-		if (_x) value = expression.eval(_x);
+		if (_x) value = gradient_tape_.eval(_x, i);
 
 		_output.push_back(std::make_pair(index, value));
 	}
 }
 
-void NLPSparseConstraint::eval_hessian(const Number* _x,
-	const Number _weight, Number* _output) const
+void NLPSparseConstraint::get_hessian_structure(
+	std::vector< std::pair<Index, Index> > &_indices) const
 {
-	// NOTE:
-	// Make dense Hessian matrix.
+	_indices = hessian_.indices_;
+}
 
+void NLPSparseConstraint::eval_hessian(const Number* _x, const Number _weight,
+	const Index* _output_indices, Number* _output) const
+{
+	assert(_output_indices != NULL);
 	assert(_output != NULL);
 	// Assume that output values are initialized.
 
-	unsigned int nnz_funcion_hessian = hessian_.expressions_.size();
-	assert(hessian_.indices_.size() == nnz_funcion_hessian);
-
-	for (unsigned int i = 0; i < nnz_funcion_hessian; ++i)
-	{
-		Index index_i = hessian_.indices_[i].first;
-		Index index_j = hessian_.indices_[i].second;
-		const NLPExpression &expression = hessian_.expressions_[i];
-
-		assert(index_i <= num_variables());
-		assert(index_j <= num_variables());
-		assert(index_i >= index_j);
-
-		Index index = index_i * (index_i + 1) / 2 + index_j;
-		_output[index] += _weight * expression.eval(_x);
-	}
+	assert(hessian_.indices_.size() == hessian_tape_.num_expressions());
+	hessian_tape_.eval_all(_x, _weight, _output_indices, _output);
 }
 
 NLPFormulation::NLPFormulation(NLPFunction *_function)
@@ -179,6 +163,8 @@ NLPFormulation::NLPFormulation(NLPFunction *_function)
 	lower_bound_.resize(num_vars_, -NLP_BOUND_INFINITY);
 	upper_bound_.resize(num_vars_, NLP_BOUND_INFINITY);
 	values_.resize(num_vars_, 0);
+
+	is_hessian_structure_updated_ = false;
 }
 
 NLPFormulation::NLPFormulation(const std::vector<NLPFunction *> &_functions)
@@ -196,6 +182,8 @@ NLPFormulation::NLPFormulation(const std::vector<NLPFunction *> &_functions)
 	lower_bound_.resize(num_vars_, -NLP_BOUND_INFINITY);
 	upper_bound_.resize(num_vars_, NLP_BOUND_INFINITY);
 	values_.resize(num_vars_, 0);
+
+	is_hessian_structure_updated_ = false;
 }
 
 NLPFormulation::~NLPFormulation()
@@ -231,9 +219,101 @@ Number NLPFormulation::nnz_constraint_gradients() const
 
 Number NLPFormulation::nnz_hessian() const
 {
-	// NOTE:
-	// Make dense Hessian matrix.
-	return num_vars_ * (num_vars_ + 1) / 2;
+	update_hessian_structure();
+	return hessian_indices_.size();
+}
+
+void NLPFormulation::update_hessian_structure() const
+{
+	if (is_hessian_structure_updated_)
+		return;
+
+	const unsigned int num_functions = functions_.size();
+	const unsigned int num_constraints = constraints_.size();
+
+	std::vector< std::vector< std::pair<Index, Index> > > function_hessian_indices(num_functions);
+	std::vector< std::vector< std::pair<Index, Index> > > constraint_hessian_indices(num_constraints);
+
+	// Union of all structures, sorted in row-major order.
+	std::map< std::pair<Index, Index>, Index > hessian_index_map;
+
+	// Keep the previous structure.
+	for (std::vector< std::pair<Index, Index> >::const_iterator it = hessian_indices_.begin();
+		it != hessian_indices_.end(); ++it)
+		hessian_index_map[(*it)] = 0;
+
+	for (unsigned int i = 0; i < num_functions; ++i)
+	{
+		assert(functions_[i]);
+		functions_[i]->get_hessian_structure(function_hessian_indices[i]);
+		for (std::vector< std::pair<Index, Index> >::const_iterator it = function_hessian_indices[i].begin();
+			it != function_hessian_indices[i].end(); ++it)
+			hessian_index_map[(*it)] = 0;
+	}
+
+	for (unsigned int i = 0; i < num_constraints; ++i)
+	{
+		assert(constraints_[i]);
+		constraints_[i]->get_hessian_structure(constraint_hessian_indices[i]);
+		for (std::vector< std::pair<Index, Index> >::const_iterator it = constraint_hessian_indices[i].begin();
+			it != constraint_hessian_indices[i].end(); ++it)
+			hessian_index_map[(*it)] = 0;
+	}
+
+	hessian_indices_.clear();
+	hessian_indices_.reserve(hessian_index_map.size());
+	for (std::map< std::pair<Index, Index>, Index >::iterator it = hessian_index_map.begin();
+		it != hessian_index_map.end(); ++it)
+	{
+		assert((*it).first.first < num_vars_);
+		assert((*it).first.second <= (*it).first.first);
+		(*it).second = hessian_indices_.size();
+		hessian_indices_.push_back((*it).first);
+	}
+
+	function_hessian_scatter_maps_.resize(num_functions);
+	for (unsigned int i = 0; i < num_functions; ++i)
+	{
+		function_hessian_scatter_maps_[i].clear();
+		function_hessian_scatter_maps_[i].reserve(function_hessian_indices[i].size());
+		for (std::vector< std::pair<Index, Index> >::const_iterator it = function_hessian_indices[i].begin();
+			it != function_hessian_indices[i].end(); ++it)
+			function_hessian_scatter_maps_[i].push_back(hessian_index_map[(*it)]);
+	}
+
+	constraint_hessian_scatter_maps_.resize(num_constraints);
+	for (unsigned int i = 0; i < num_constraints; ++i)
+	{
+		constraint_hessian_scatter_maps_[i].clear();
+		constraint_hessian_scatter_maps_[i].reserve(constraint_hessian_indices[i].size());
+		for (std::vector< std::pair<Index, Index> >::const_iterator it = constraint_hessian_indices[i].begin();
+			it != constraint_hessian_indices[i].end(); ++it)
+			constraint_hessian_scatter_maps_[i].push_back(hessian_index_map[(*it)]);
+	}
+
+	is_hessian_structure_updated_ = true;
+}
+
+void NLPFormulation::set_functions(const std::vector<NLPFunction *> &_functions)
+{
+	assert(!_functions.empty());
+
+	for (std::vector<NLPFunction*>::iterator it = functions_.begin();
+		it != functions_.end(); ++it)
+	{
+		assert(*it);
+		delete (*it);
+	}
+
+	functions_ = _functions;
+
+	for (std::vector<NLPFunction*>::iterator it = functions_.begin();
+		it != functions_.end(); ++it)
+	{
+		assert((*it)->num_variables() == num_vars_);
+	}
+
+	is_hessian_structure_updated_ = false;
 }
 
 bool NLPFormulation::set_variable_bounds(const std::vector< Number > &_lower_bound,
@@ -309,6 +389,8 @@ void NLPFormulation::get_values(std::vector< Number > &_values) const
 bool NLPFormulation::add_constraint(const NLPExpression &_expression,
 	Number _lower_bound, Number _upper_bound)
 {
+	is_hessian_structure_updated_ = false;
+
 	NLPSparseConstraint *new_constraint = new NLPSparseConstraint(
 		num_vars_, _lower_bound, _upper_bound, _expression);
 	constraints_.push_back(new_constraint);
@@ -318,6 +400,8 @@ bool NLPFormulation::add_constraint(const NLPExpression &_expression,
 bool NLPFormulation::add_constraint(const NLPVectorExpression &_vector_expression,
 	Number _lower_bound, Number _upper_bound)
 {
+	is_hessian_structure_updated_ = false;
+
 	for (unsigned int i = 0; i < _vector_expression.dimension(); ++i)
 	{
 		NLPSparseConstraint *new_constraint = new NLPSparseConstraint(
@@ -374,11 +458,15 @@ void NLPFormulation::eval_function_hessian(const Number* _x,
 	// NOTE:
 	// When evaluating Hessian, assume that '_output' is initialized.
 
-	for (std::vector<NLPFunction*>::const_iterator it = functions_.begin();
-		it != functions_.end(); ++it)
+	update_hessian_structure();
+
+	const unsigned int num_functions = functions_.size();
+	for (unsigned int i = 0; i < num_functions; i++)
 	{
-		assert(*it);
-		(*it)->eval_hessian(_x, _obj_factor, _output);
+		assert(functions_[i]);
+		const std::vector<Index> &scatter_map = function_hessian_scatter_maps_[i];
+		if (scatter_map.empty()) continue;
+		functions_[i]->eval_hessian(_x, _obj_factor, &(scatter_map[0]), _output);
 	}
 }
 
@@ -425,11 +513,15 @@ void NLPFormulation::eval_constraint_gradients(const Number* _x,
 void NLPFormulation::eval_constraint_hessian(const Number* _x,
 	const Number* _lambda, Number* _output) const
 {
+	update_hessian_structure();
+
 	const unsigned int num_constraints = constraints_.size();
 	for (unsigned int i = 0; i < num_constraints; i++)
 	{
 		assert(constraints_[i]);
-		constraints_[i]->eval_hessian(_x, _lambda[i], _output);
+		const std::vector<Index> &scatter_map = constraint_hessian_scatter_maps_[i];
+		if (scatter_map.empty()) continue;
+		constraints_[i]->eval_hessian(_x, _lambda[i], &(scatter_map[0]), _output);
 	}
 }
 
@@ -437,28 +529,24 @@ void NLPFormulation::eval_hessian(const Number* _x,
 	const Number _obj_factor, const Number* _lambda,
 	Index* _variable_indices_i, Index *_variable_indices_j, Number* _output) const
 {
-	// NOTE:
-	// Make dense Hessian matrix.
+	update_hessian_structure();
 
 	if (_output == NULL)
 	{
-		// Return the structure of the constraint gradients.
+		// Return the structure of the Hessian.
 
-		Index count = 0;
-		for (Index index_i = 0; index_i < num_vars_; index_i++) {
-			for (Index index_j = 0; index_j <= index_i; index_j++) {
-				_variable_indices_i[count] = index_i;
-				_variable_indices_j[count] = index_j;
-				count++;
-			}
+		const Index nnz = hessian_indices_.size();
+		for (Index count = 0; count < nnz; count++) {
+			_variable_indices_i[count] = hessian_indices_[count].first;
+			_variable_indices_j[count] = hessian_indices_[count].second;
 		}
 	}
 	else
 	{
-		// Return the values of the constraint gradients.
-                
-        // Initialize all output values to zero.
-        memset(_output, 0, nnz_hessian() * sizeof(Number));
+		// Return the values of the Hessian.
+
+		// Initialize all output values to zero.
+		memset(_output, 0, hessian_indices_.size() * sizeof(Number));
 
 		eval_function_hessian(_x, _obj_factor, _output);
 		eval_constraint_hessian(_x, _lambda, _output);
@@ -9,6 +9,7 @@
 #include <vector>
 
 #include "NLPExpression.h"
+#include "NLPExpressionTape.h"
 #include "NLPVectorExpression.h"
 
 #define NLP_BOUND_INFINITY	1e19
@@ -27,8 +28,15 @@ public:
 	virtual Number num_variables() const { return num_vars_; }
 	virtual Number eval(const Number* _x) const = 0;
 	virtual void eval_gradient(const Number* _x, Number* _output) const = 0;
+
+	// Lower-triangular (i >= j) non-zero entries of the Hessian.
+	virtual void get_hessian_structure(
+		std::vector< std::pair<Index, Index> > &_indices) const = 0;
+
+	// The k-th value in the Hessian structure is added to '_output[_output_indices[k]]'
+	// after being multiplied by '_weight'.
 	virtual void eval_hessian(const Number* _x, const Number _weight,
-		Number* _output) const = 0;
+		const Index* _output_indices, Number* _output) const = 0;
 
 	Index num_vars_;
 };
@@ -45,8 +53,12 @@ public:
 	virtual Number eval(const Number* _x) const = 0;
 	virtual void eval_gradient(const Number* _x,
 		std::vector < std::pair < Index, Number > > &_output) const = 0;
+
+	// See 'NLPFunction::get_hessian_structure()' and 'NLPFunction::eval_hessian()'.
+	virtual void get_hessian_structure(
+		std::vector< std::pair<Index, Index> > &_indices) const = 0;
 	virtual void eval_hessian(const Number* _x, const Number _weight,
-		Number* _output) const = 0;
+		const Index* _output_indices, Number* _output) const = 0;
 
 	Index num_vars_;
 	Number lower_bound_;
@@ -61,13 +73,21 @@ public:
 
 	virtual Number eval(const Number* _x) const;
 	virtual void eval_gradient(const Number* _x, Number* _output) const;
+	virtual void get_hessian_structure(
+		std::vector< std::pair<Index, Index> > &_indices) const;
 	virtual void eval_hessian(const Number* _x, const Number _weight,
-		Number* _output) const;
+		const Index* _output_indices, Number* _output) const;
 
 private:
 	NLPExpression expression_;
 	NLPSparseGradientExpression gradient_;
 	NLPSparseHessianExpression hessian_;
+
+	// NOTE:
+	// Expressions are evaluated with the compiled tapes.
+	NLPExpressionTape expression_tape_;
+	NLPExpressionTape gradient_tape_;
+	NLPExpressionTape hessian_tape_;
 };
 
 class NLPSparseConstraint : public NLPConstraint
@@ -82,13 +102,21 @@ public:
 	virtual Number eval(const Number* _x) const;
 	virtual void eval_gradient(const Number* _x,
 		std::vector < std::pair < Index, Number > > &_output) const;
+	virtual void get_hessian_structure(
+		std::vector< std::pair<Index, Index> > &_indices) const;
 	virtual void eval_hessian(const Number* _x, const Number _weight,
-		Number* _output) const;
+		const Index* _output_indices, Number* _output) const;
 
 private:
 	NLPExpression expression_;
 	NLPSparseGradientExpression gradient_;
 	NLPSparseHessianExpression hessian_;
+
+	// NOTE:
+	// Expressions are evaluated with the compiled tapes.
+	NLPExpressionTape expression_tape_;
+	NLPExpressionTape gradient_tape_;
+	NLPExpressionTape hessian_tape_;
 };
 
 
@@ -115,6 +143,10 @@ public:
 	void set_values(const Number* _x);
 	bool set_values(const std::vector< Number > &_values);
 
+	// NOTE:
+	// The previous functions are deleted. Constraints are kept.
+	void set_functions(const std::vector<NLPFunction *> &_functions);
+
 	bool add_constraint(const NLPExpression &_expression,
 		Number _lower_bound, Number _upper_bound);
 
@@ -141,12 +173,26 @@ public:
 
 
 private:
+	// NOTE:
+	// The Hessian structure is the union of the structures of all functions and
+	// constraints. It is built when it is first requested after changing functions or
+	// adding constraints, together with the maps from the entries of each function and
+	// constraint to the entries of the union.
+	// Entries are never removed from the structure, so it is not changed when new
+	// functions have the same or fewer non-zero entries than the previous ones.
+	void update_hessian_structure() const;
+
 	Index num_vars_;
 	std::vector< NLPFunction *> functions_;
 	std::vector< Number > lower_bound_;
 	std::vector< Number > upper_bound_;
 	std::vector< Number > values_;
 	std::vector< NLPConstraint* > constraints_;
+
+	mutable bool is_hessian_structure_updated_;
+	mutable std::vector< std::pair<Index, Index> > hessian_indices_;
+	mutable std::vector< std::vector<Index> > function_hessian_scatter_maps_;
+	mutable std::vector< std::vector<Index> > constraint_hessian_scatter_maps_;
 };
 
 
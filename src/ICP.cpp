@@ -1,6 +1,10 @@
 #include "ICP.h"
 
+#include <algorithm>
 #include <assert.h>
+#include <atomic>
+#include <iostream>
+#include <limits>
 #include <Eigen/Geometry>
 #include <Eigen/LU> 
 #include <Eigen/SVD>
@@ -108,6 +112,344 @@ namespace ICP {
 		delete[] dd;
 	}
 
+	KdTree::KdTree()
+	{
+
+	}
+
+	KdTree::KdTree(const Eigen::MatrixXd &_points)
+	{
+		build(_points);
+	}
+
+	void KdTree::build(const Eigen::MatrixXd &_points)
+	{
+		assert(_points.rows() == 3);
+		clear();
+
+		const int num_points = static_cast<int>(_points.cols());
+		if (num_points == 0)
+			return;
+
+		point_indices_.resize(num_points);
+		for (int point_index = 0; point_index < num_points; ++point_index)
+			point_indices_[point_index] = point_index;
+
+		nodes_.reserve(2 * (num_points / k_max_leaf_size + 1));
+		build_node(_points, 0, num_points);
+
+		x_.resize(num_points);
+		y_.resize(num_points);
+		z_.resize(num_points);
+		for (int i = 0; i < num_points; ++i)
+		{
+			x_[i] = _points(0, point_indices_[i]);
+			y_[i] = _points(1, point_indices_[i]);
+			z_[i] = _points(2, point_indices_[i]);
+		}
+	}
+
+	void KdTree::clear()
+	{
+		nodes_.clear();
+		x_.clear();
+		y_.clear();
+		z_.clear();
+		point_indices_.clear();
+	}
+
+	int KdTree::build_node(const Eigen::MatrixXd &_points, const int _begin, const int _end)
+	{
+		assert(_begin < _end);
+
+		const int node_index = static_cast<int>(nodes_.size());
+		nodes_.push_back(Node());
+		nodes_[node_index].axis_ = -1;
+		nodes_[node_index].split_ = 0.0;
+		nodes_[node_index].begin_ = _begin;
+		nodes_[node_index].end_ = _end;
+		nodes_[node_index].left_ = -1;
+		nodes_[node_index].right_ = -1;
+
+		if (_end - _begin <= k_max_leaf_size)
+			return node_index;
+
+		// Split along the axis of the largest extent.
+		Eigen::Vector3d bbox_min = _points.col(point_indices_[_begin]);
+		Eigen::Vector3d bbox_max = bbox_min;
+		for (int i = _begin + 1; i < _end; ++i)
+		{
+			bbox_min = bbox_min.cwiseMin(_points.col(point_indices_[i]));
+			bbox_max = bbox_max.cwiseMax(_points.col(point_indices_[i]));
+		}
+
+		int axis;
+		(bbox_max - bbox_min).maxCoeff(&axis);
+
+		// NOTE:
+		// Split at the median so that the depth of the tree is bounded.
+		const int middle = (_begin + _end) / 2;
+		std::nth_element(point_indices_.begin() + _begin, point_indices_.begin() + middle,
+			point_indices_.begin() + _end,
+			[&_points, axis](const int _lhs, const int _rhs) {
+			return _points(axis, _lhs) < _points(axis, _rhs); });
+
+		const double split = _points(axis, point_indices_[middle]);
+		const int left = build_node(_points, _begin, middle);
+		const int right = build_node(_points, middle, _end);
+
+		// NOTE: 'nodes_' may be reallocated in the recursion.
+		nodes_[node_index].axis_ = axis;
+		nodes_[node_index].split_ = split;
+		nodes_[node_index].left_ = left;
+		nodes_[node_index].right_ = right;
+		return node_index;
+	}
+
+	int KdTree::search(const double _query_point[3], const double _squared_radius,
+		const int _k, int *_indices, double *_squared_distances) const
+	{
+		assert(_k > 0);
+		if (nodes_.empty())
+			return 0;
+
+		int num_neighbors = 0;
+
+		// Neighbors are kept sorted in the output arrays.
+		// The search region is bounded by the k-th neighbor distance once 'k' neighbors are found.
+		struct StackItem { int node_index_; double squared_distance_; };
+		StackItem stack[k_max_depth + 1];
+		int stack_size = 0;
+		stack[stack_size].node_index_ = 0;
+		stack[stack_size].squared_distance_ = 0.0;
+		++stack_size;
+
+		while (stack_size > 0)
+		{
+			--stack_size;
+			const Node &node = nodes_[stack[stack_size].node_index_];
+			const double node_squared_distance = stack[stack_size].squared_distance_;
+			const double max_squared_distance = (num_neighbors < _k) ? _squared_radius :
+				std::min(_squared_radius, _squared_distances[_k - 1]);
+
+			if (node_squared_distance > max_squared_distance)
+				continue;
+
+			if (node.axis_ < 0)
+			{
+				for (int i = node.begin_; i < node.end_; ++i)
+				{
+					const double dx = x_[i] - _query_point[0];
+					const double dy = y_[i] - _query_point[1];
+					const double dz = z_[i] - _query_point[2];
+					const double squared_distance = dx * dx + dy * dy + dz * dz;
+
+					if (squared_distance > _squared_radius)
+						continue;
+					if (num_neighbors == _k && squared_distance >= _squared_distances[_k - 1])
+						continue;
+
+					int j = (num_neighbors < _k) ? num_neighbors++ : (_k - 1);
+					for (; j > 0 && _squared_distances[j - 1] > squared_distance; --j)
+					{
+						_indices[j] = _indices[j - 1];
+						_squared_distances[j] = _squared_distances[j - 1];
+					}
+					_indices[j] = point_indices_[i];
+					_squared_distances[j] = squared_distance;
+				}
+			}
+			else
+			{
+				const double diff = _query_point[node.axis_] - node.split_;
+				const int near_node_index = (diff < 0) ? node.left_ : node.right_;
+				const int far_node_index = (diff < 0) ? node.right_ : node.left_;
+
+				// NOTE:
+				// The stack size is at most (depth + 1).
+				assert(stack_size + 2 <= k_max_depth + 1);
+				stack[stack_size].node_index_ = far_node_index;
+				stack[stack_size].squared_distance_ = std::max(node_squared_distance, diff * diff);
+				++stack_size;
+				stack[stack_size].node_index_ = near_node_index;
+				stack[stack_size].squared_distance_ = node_squared_distance;
+				++stack_size;
+			}
+		}
+
+		return num_neighbors;
+	}
+
+	int KdTree::knn_search(const double _query_point[3], const int _k,
+		int *_indices, double *_squared_distances) const
+	{
+		return search(_query_point, std::numeric_limits<double>::infinity(),
+			_k, _indices, _squared_distances);
+	}
+
+	int KdTree::radius_search(const double _query_point[3], const double _squared_radius,
+		const int _k, int *_indices, double *_squared_distances) const
+	{
+		return search(_query_point, _squared_radius, _k, _indices, _squared_distances);
+	}
+
+	void KdTree::knn_search(const Eigen::MatrixXd &_query_points, const int _k,
+		Eigen::MatrixXi &_indices, Eigen::MatrixXd &_squared_distances) const
+	{
+		Eigen::VectorXi num_neighbors;
+		radius_search(_query_points, std::numeric_limits<double>::infinity(), _k,
+			_indices, _squared_distances, num_neighbors);
+	}
+
+	void KdTree::radius_search(const Eigen::MatrixXd &_query_points, const double _squared_radius,
+		const int _k, Eigen::MatrixXi &_indices, Eigen::MatrixXd &_squared_distances,
+		Eigen::VectorXi &_num_neighbors) const
+	{
+		assert(_query_points.rows() == 3);
+		assert(_k > 0);
+
+		const int num_queries = static_cast<int>(_query_points.cols());
+		_indices.resize(_k, num_queries);
+		_squared_distances.resize(_k, num_queries);
+		_num_neighbors.resize(num_queries);
+
+#pragma omp parallel for schedule(static)
+		for (int query_index = 0; query_index < num_queries; ++query_index)
+		{
+			int *indices = _indices.col(query_index).data();
+			double *squared_distances = _squared_distances.col(query_index).data();
+
+			const int num_neighbors = search(_query_points.col(query_index).data(),
+				_squared_radius, _k, indices, squared_distances);
+			_num_neighbors[query_index] = num_neighbors;
+
+			for (int i = num_neighbors; i < _k; ++i)
+			{
+				indices[i] = -1;
+				squared_distances[i] = std::numeric_limits<double>::infinity();
+			}
+		}
+	}
+
+	void get_closest_points(
+		const KdTree &_data_kd_tree,
+		const Eigen::MatrixXd &_query_points,
+		Eigen::VectorXd &_distances)
+	{
+		assert(_data_kd_tree.num_points() > 0);
+		assert(_query_points.rows() == 3);
+		assert(_query_points.cols() > 0);
+
+		const int num_queries = static_cast<int>(_query_points.cols());
+		_distances.resize(num_queries);
+
+#pragma omp parallel for schedule(static)
+		for (int point_index = 0; point_index < num_queries; point_index++)
+		{
+			int index;
+			double squared_distance;
+			const int num_neighbors = _data_kd_tree.knn_search(
+				_query_points.col(point_index).data(), 1, &index, &squared_distance);
+			assert(num_neighbors == 1);
+			_distances[point_index] = std::sqrt(squared_distance);
+		}
+	}
+
+	static std::atomic<unsigned long> g_kd_tree_cache_num_hits(0);
+	static std::atomic<unsigned long> g_kd_tree_cache_num_misses(0);
+
+	KdTreeCache::KdTreeCache()
+		: ann_points_(NULL)
+		, ann_kd_tree_(NULL)
+		, version_(0)
+		, num_hits_(0)
+		, num_misses_(0)
+	{
+
+	}
+
+	KdTreeCache::KdTreeCache(const KdTreeCache &_other)
+		: ann_points_(NULL)
+		, ann_kd_tree_(NULL)
+		, version_(0)
+		, num_hits_(0)
+		, num_misses_(0)
+	{
+		// NOTE:
+		// The tree is not copied. It is rebuilt when it is requested.
+	}
+
+	KdTreeCache::~KdTreeCache()
+	{
+		clear();
+	}
+
+	KdTreeCache& KdTreeCache::operator=(const KdTreeCache &_other)
+	{
+		if (this != &_other)
+			clear();
+		return *this;
+	}
+
+	ANNkd_tree *KdTreeCache::get_kd_tree(
+		const Eigen::MatrixXd &_points,
+		ANNpointArray *_ann_points)
+	{
+		assert(_points.rows() == 3);
+
+		if (_points.cols() == 0)
+		{
+			clear();
+			if (_ann_points) (*_ann_points) = NULL;
+			return NULL;
+		}
+
+		if (ann_kd_tree_ && points_.cols() == _points.cols() && points_ == _points)
+		{
+			++num_hits_;
+			++g_kd_tree_cache_num_hits;
+		}
+		else
+		{
+			clear();
+			points_ = _points;
+			ann_kd_tree_ = create_kd_tree(points_, ann_points_);
+			assert(ann_kd_tree_);
+
+			++version_;
+			++num_misses_;
+			++g_kd_tree_cache_num_misses;
+		}
+
+		if (_ann_points) (*_ann_points) = ann_points_;
+		return ann_kd_tree_;
+	}
+
+	void KdTreeCache::clear()
+	{
+		if (ann_points_) annDeallocPts(ann_points_);
+		delete ann_kd_tree_;
+		ann_points_ = NULL;
+		ann_kd_tree_ = NULL;
+		points_.resize(3, 0);
+	}
+
+	unsigned long KdTreeCache::get_total_num_hits()
+	{
+		return g_kd_tree_cache_num_hits;
+	}
+
+	unsigned long KdTreeCache::get_total_num_misses()
+	{
+		return g_kd_tree_cache_num_misses;
+	}
+
+	void KdTreeCache::print_statistics()
+	{
+		std::cout << "KD-tree cache: " << get_total_num_hits() << " hit(s), "
+			<< get_total_num_misses() << " miss(es)." << std::endl;
+	}
+
 	double compute_rigid_transformation(const Eigen::MatrixXd &_X, const Eigen::MatrixXd &_Y,
 		Eigen::Matrix3d &_rotation_mat, Eigen::Vector3d &_translation_vec,
 		const double *_distance_threshold)
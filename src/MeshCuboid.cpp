@@ -1,6 +1,7 @@
 #include "MeshCuboid.h"
 
 #include "MeshCuboidParameters.h"
+#include "MeshCuboidVisibility.h"
 #include "Utilities.h"
 #include "simplerandom.h"
 
@@ -233,18 +234,12 @@ void MeshCuboid::deep_copy(const MeshCuboid& _other)
 	this->bbox_size_ = _other.bbox_size_;
 	this->bbox_corners_ = _other.bbox_corners_;
 
-	// Deep copy cuboid surface points.
-	assert(_other.cuboid_surface_points_.size() == _other.num_cuboid_surface_points());
-	this->cuboid_surface_points_.clear();
-	this->cuboid_surface_points_.reserve(_other.num_cuboid_surface_points());
-
-	for (std::vector<MeshCuboidSurfacePoint *>::const_iterator it =
-		_other.cuboid_surface_points_.begin();
-		it != _other.cuboid_surface_points_.end(); ++it)
-	{
-		MeshCuboidSurfacePoint *cuboid_surface_point = new MeshCuboidSurfacePoint(**it);
-		this->cuboid_surface_points_.push_back(cuboid_surface_point);
-	}
+	// NOTE:
+	// Do not deep copy cuboid surface points.
+	// The template is shared, and the points are recomputed with the copied corners and axes.
+	this->cuboid_surface_point_template_ = _other.cuboid_surface_point_template_;
+	this->cuboid_surface_point_visibilities_ = _other.cuboid_surface_point_visibilities_;
+	update_cuboid_surface_point_values();
 }
 
 MeshCuboid::~MeshCuboid()
@@ -257,7 +252,9 @@ unsigned int MeshCuboid::num_sample_points()const {
 }
 
 unsigned int MeshCuboid::num_cuboid_surface_points()const {
-	return static_cast<unsigned int>(cuboid_surface_points_.size());
+	if (!cuboid_surface_point_template_)
+		return 0;
+	return cuboid_surface_point_template_->size();
 }
 
 const std::vector<MeshSamplePoint *> &MeshCuboid::get_sample_points() const
@@ -303,19 +300,109 @@ MeshSamplePoint *MeshCuboid::get_sample_point(
 	return sample_points_[_point_index];
 }
 
-const std::vector<MeshCuboidSurfacePoint *>&
+const std::vector<const MeshCuboidSurfacePoint *>&
 MeshCuboid::get_cuboid_surface_points() const
 {
+	assert(cuboid_surface_points_.size() == num_cuboid_surface_points());
 	return cuboid_surface_points_;
 }
 
-MeshCuboidSurfacePoint *MeshCuboid::get_cuboid_surface_point(
+void MeshCuboid::get_cuboid_surface_points(Eigen::MatrixXd &_cuboid_surface_points) const
+{
+	assert(cuboid_surface_point_values_.size() == num_cuboid_surface_points());
+	_cuboid_surface_points = Eigen::MatrixXd(3, num_cuboid_surface_points());
+
+	for (unsigned int point_index = 0; point_index < num_cuboid_surface_points(); ++point_index)
+	{
+		const MeshCuboidSurfacePoint &cuboid_surface_point = cuboid_surface_point_values_[point_index];
+
+		for (unsigned int i = 0; i < 3; ++i)
+			_cuboid_surface_points.col(point_index)(i) = cuboid_surface_point.point_[i];
+	}
+}
+
+const MeshCuboidSurfacePoint *MeshCuboid::get_cuboid_surface_point(
 	const unsigned int _point_index) const
 {
 	assert(_point_index < cuboid_surface_points_.size());
 	return cuboid_surface_points_[_point_index];
 }
 
+const std::array<Real, 8> &MeshCuboid::get_cuboid_surface_point_corner_weights(
+	const unsigned int _point_index) const
+{
+	assert(_point_index < num_cuboid_surface_points());
+	return cuboid_surface_point_template_->corner_weights_[_point_index];
+}
+
+Real MeshCuboid::get_cuboid_surface_point_visibility(
+	const unsigned int _point_index) const
+{
+	assert(_point_index < cuboid_surface_point_visibilities_.size());
+	return cuboid_surface_point_visibilities_[_point_index];
+}
+
+void MeshCuboid::set_cuboid_surface_point_template(
+	const std::shared_ptr<const MeshCuboidSurfacePointTemplate> &_template)
+{
+	cuboid_surface_point_template_ = _template;
+	cuboid_surface_point_visibilities_.assign(num_cuboid_surface_points(), 1.0f);
+	update_cuboid_surface_point_values();
+}
+
+void MeshCuboid::update_cuboid_surface_point_values()
+{
+	const unsigned int num_points = num_cuboid_surface_points();
+
+	cuboid_surface_point_values_.clear();
+	cuboid_surface_points_.clear();
+
+	if (num_points == 0)
+		return;
+
+	std::array<MyMesh::Normal, k_num_faces> face_normals;
+	for (unsigned int face_index = 0; face_index < k_num_faces; ++face_index)
+	{
+		face_normals[face_index] = bbox_axes_[face_index / 2];
+		if ((face_index % 2) != 0)
+			face_normals[face_index] = -face_normals[face_index];
+	}
+
+	cuboid_surface_point_values_.reserve(num_points);
+	for (unsigned int point_index = 0; point_index < num_points; ++point_index)
+	{
+		const std::array<Real, 8> &corner_weights =
+			cuboid_surface_point_template_->corner_weights_[point_index];
+		const unsigned int face_index = cuboid_surface_point_template_->face_indices_[point_index];
+		assert(face_index < k_num_faces);
+
+		MyMesh::Point point(0.0);
+		for (unsigned int corner_index = 0; corner_index < k_num_corners; ++corner_index)
+			point += corner_weights[corner_index] * bbox_corners_[corner_index];
+
+		cuboid_surface_point_values_.push_back(
+			MeshCuboidSurfacePoint(point, face_normals[face_index], face_index));
+	}
+
+	cuboid_surface_points_.reserve(num_points);
+	for (unsigned int point_index = 0; point_index < num_points; ++point_index)
+		cuboid_surface_points_.push_back(&cuboid_surface_point_values_[point_index]);
+}
+
+ANNkd_tree *MeshCuboid::get_sample_point_kd_tree(ANNpointArray *_ann_points) const
+{
+	Eigen::MatrixXd sample_points;
+	get_sample_points(sample_points);
+	return sample_point_kd_tree_cache_.get_kd_tree(sample_points, _ann_points);
+}
+
+ANNkd_tree *MeshCuboid::get_cuboid_surface_point_kd_tree(ANNpointArray *_ann_points) const
+{
+	Eigen::MatrixXd cuboid_surface_points;
+	get_cuboid_surface_points(cuboid_surface_points);
+	return cuboid_surface_point_kd_tree_cache_.get_kd_tree(cuboid_surface_points, _ann_points);
+}
+
 MyMesh::Point MeshCuboid::get_bbox_min() const
 {
 	MyMesh::Point bbox_min = bbox_center_;
@@ -586,11 +673,18 @@ void MeshCuboid::set_bbox_axes(const std::array<MyMesh::Normal, 3> &_bbox_axes,
 	{
 		update_corner_points();
 	}
+	else
+	{
+		// NOTE:
+		// The cuboid surface point normals are changed with the axes.
+		update_cuboid_surface_point_values();
+	}
 }
 
 void MeshCuboid::set_bbox_corners(const std::array<MyMesh::Point, k_num_corners> &_bbox_corners)
 {
 	bbox_corners_ = _bbox_corners;
+	update_cuboid_surface_point_values();
 }
 
 void MeshCuboid::translate(const Eigen::Vector3d _translation_vec)
@@ -602,6 +696,8 @@ void MeshCuboid::translate(const Eigen::Vector3d _translation_vec)
 		for (unsigned int corner_index = 0; corner_index < k_num_corners; ++corner_index)
 			bbox_corners_[corner_index][i] = bbox_corners_[corner_index][i] + _translation_vec[i];
 	}
+
+	update_cuboid_surface_point_values();
 }
 
 void MeshCuboid::rotate(const Eigen::Matrix3d _rotation_mat, bool _update_center_size)
@@ -652,6 +748,8 @@ void MeshCuboid::rotate(const Eigen::Matrix3d _rotation_mat, bool _update_center
 			bbox_size_[axis_index] = bbox_size_vec[axis_index];
 		}
 	}
+
+	update_cuboid_surface_point_values();
 }
 
 void MeshCuboid::flip_axis(const unsigned int _axis_index)
@@ -672,6 +770,7 @@ void MeshCuboid::flip_axis(const unsigned int _axis_index)
 	}
 
 	bbox_corners_.swap(new_bbox_corners);
+	update_cuboid_surface_point_values();
 }
 
 void MeshCuboid::clear_sample_points()
@@ -715,18 +814,16 @@ void MeshCuboid::remove_sample_points(const bool *is_sample_point_removed)
 
 void MeshCuboid::clear_cuboid_surface_points()
 {
-	for (std::vector<MeshCuboidSurfacePoint *>::iterator it = cuboid_surface_points_.begin();
-		it != cuboid_surface_points_.end(); ++it)
-		delete (*it);
-
-	cuboid_surface_points_.clear();
+	set_cuboid_surface_point_template(std::shared_ptr<const MeshCuboidSurfacePointTemplate>());
 }
 
 void MeshCuboid::create_random_points_on_cuboid_surface(
 	const unsigned int _num_cuboid_surface_points)
 {
-	clear_cuboid_surface_points();
-	cuboid_surface_points_.reserve(_num_cuboid_surface_points);
+	std::shared_ptr<MeshCuboidSurfacePointTemplate> surface_point_template =
+		std::make_shared<MeshCuboidSurfacePointTemplate>();
+	surface_point_template->face_indices_.reserve(_num_cuboid_surface_points);
+	surface_point_template->corner_weights_.reserve(_num_cuboid_surface_points);
 
 	Real all_faces_area = 0;
 	for (unsigned int face_index = 0; face_index < k_num_faces; ++face_index)
@@ -741,47 +838,37 @@ void MeshCuboid::create_random_points_on_cuboid_surface(
 	for (unsigned int face_index = 0; face_index < k_num_faces; ++face_index)
 	{
 		const unsigned int *corner_indices = k_face_corner_indices[face_index];
-		std::array<MyMesh::Point, k_num_face_corners> corner_point;
-		for (unsigned int i = 0; i < k_num_face_corners; ++i)
-			corner_point[i] = bbox_corners_[corner_indices[i]];
-
-		MyMesh::Normal normal = get_bbox_axis(face_index / 2);
-		if ((face_index % 2) != 0)
-			normal = -normal;
 
 		Real face_area = get_bbox_face_area(face_index);
 		int num_face_points = std::round(face_area / all_faces_area * _num_cuboid_surface_points);
 
 		for (int point_index = 0; point_index < num_face_points
-			&& cuboid_surface_points_.size() < _num_cuboid_surface_points; ++point_index)
+			&& surface_point_template->size() < _num_cuboid_surface_points; ++point_index)
 		{
 			Real w1 = static_cast<Real>(simplerandom_cong_next(&rng_cong))
 				/ std::numeric_limits<uint32_t>::max();
 			Real w2 = static_cast<Real>(simplerandom_cong_next(&rng_cong))
 				/ std::numeric_limits<uint32_t>::max();
 
-			MyMesh::Point p1 = w1 * (corner_point[1] - corner_point[0]) + corner_point[0];
-			MyMesh::Point p2 = w1 * (corner_point[2] - corner_point[3]) + corner_point[3];
-			MyMesh::Point point = w2 * (p2 - p1) + p1;
-
-			Real sum_corner_weights = 0;
+			// NOTE:
+			// The point is the bilinear interpolation of the face corners, and the corner
+			// weights are the bilinear weights as in 'create_grid_points_on_cuboid_surface()'.
+			// The previous normalized inverse-distance weights did not reproduce the point,
+			// but this function is not used in the optimization, which uses grid points.
 			std::array<Real, k_num_corners> corner_weights;
 			corner_weights.fill(0.0);
-
-			for (unsigned int i = 0; i < k_num_face_corners; ++i)
-			{
-				corner_weights[ corner_indices[i] ] = (point - corner_point[i]).length();
-				sum_corner_weights += corner_weights[i];
-			}
-
-			assert(sum_corner_weights > 0);
-			for (unsigned int i = 0; i < k_num_face_corners; ++i)
-			{
-				corner_weights[ corner_indices[i] ] =
-					(sum_corner_weights - corner_weights[ corner_indices[i] ]) / sum_corner_weights;
-			}
+			corner_weights[ corner_indices[0] ] = (1 - w1)*(1 - w2);
+			corner_weights[ corner_indices[1] ] = (w1)*(1 - w2);
+			corner_weights[ corner_indices[2] ] = (w1)*(w2);
+			corner_weights[ corner_indices[3] ] = (1 - w1)*(w2);
 
 #ifdef DEBUG_TEST
+			MyMesh::Point p1 = w1 * (bbox_corners_[corner_indices[1]] - bbox_corners_[corner_indices[0]])
+				+ bbox_corners_[corner_indices[0]];
+			MyMesh::Point p2 = w1 * (bbox_corners_[corner_indices[2]] - bbox_corners_[corner_indices[3]])
+				+ bbox_corners_[corner_indices[3]];
+			MyMesh::Point point = w2 * (p2 - p1) + p1;
+
 			MyMesh::Point same_point(0.0);
 			for (unsigned int i = 0; i < k_num_corners; ++i)
 				same_point += corner_weights[i] * bbox_corners_[i];
@@ -789,12 +876,13 @@ void MeshCuboid::create_random_points_on_cuboid_surface(
 			CHECK_NUMERICAL_ERROR(__FUNCTION__, error);
 #endif
 
-			MeshCuboidSurfacePoint *cuboid_surface_point = new MeshCuboidSurfacePoint(
-				point, normal, face_index, corner_weights);
-			cuboid_surface_points_.push_back(cuboid_surface_point);
+			surface_point_template->face_indices_.push_back(face_index);
+			surface_point_template->corner_weights_.push_back(corner_weights);
 		}
 	}
 
+	set_cuboid_surface_point_template(surface_point_template);
+
 
 	// Update point correspondences.
 	update_point_correspondences();
@@ -803,27 +891,30 @@ void MeshCuboid::create_random_points_on_cuboid_surface(
 void MeshCuboid::create_grid_points_on_cuboid_surface(
 	const unsigned int _num_cuboid_surface_points)
 {
-	clear_cuboid_surface_points();
-	cuboid_surface_points_.reserve(_num_cuboid_surface_points);
+	std::shared_ptr<MeshCuboidSurfacePointTemplate> surface_point_template =
+		std::make_shared<MeshCuboidSurfacePointTemplate>();
+	surface_point_template->face_indices_.reserve(_num_cuboid_surface_points);
+	surface_point_template->corner_weights_.reserve(_num_cuboid_surface_points);
 
 	Real all_faces_area = 0;
 	for (unsigned int face_index = 0; face_index < k_num_faces; ++face_index)
 		all_faces_area += get_bbox_face_area(face_index);
 
+	surface_point_template->is_face_grid_ = true;
+
 
 	// NOTE:
 	// The number of points may not be exactly the same with the given '_num_cuboid_surface_points'.
 	for (unsigned int face_index = 0; face_index < k_num_faces; ++face_index)
 	{
+		surface_point_template->face_grid_offsets_[face_index] = surface_point_template->size();
+		surface_point_template->face_grid_sizes_[face_index].fill(0);
+
 		const unsigned int *corner_indices = k_face_corner_indices[face_index];
 		std::array<MyMesh::Point, k_num_face_corners> corner_point;
 		for (unsigned int i = 0; i < k_num_face_corners; ++i)
 			corner_point[i] = bbox_corners_[corner_indices[i]];
 
-		MyMesh::Normal normal = get_bbox_axis(face_index / 2);
-		if ((face_index % 2) != 0)
-			normal = -normal;
-
 		//
 		Real face_area = get_bbox_face_area(face_index);
 		Real num_face_points = (face_area / all_faces_area * _num_cuboid_surface_points);
@@ -845,6 +936,7 @@ void MeshCuboid::create_grid_points_on_cuboid_surface(
 			num_axis_points[i] = static_cast<unsigned int>(std::round(ratio * axis_length[i]));
 			num_axis_points[i] = std::min(num_axis_points[i], static_cast<unsigned int>(num_face_points / 2));
 			num_axis_points[i] = std::max(num_axis_points[i], 2u);
+			surface_point_template->face_grid_sizes_[face_index][i] = num_axis_points[i];
 		}
 		//
 
@@ -856,11 +948,6 @@ void MeshCuboid::create_grid_points_on_cuboid_surface(
 			{
 				Real w2 = static_cast<Real>(point_index_2) / (num_axis_points[1] - 1);
 
-				MyMesh::Point p1 = w1 * (corner_point[1] - corner_point[0]) + corner_point[0];
-				MyMesh::Point p2 = w1 * (corner_point[2] - corner_point[3]) + corner_point[3];
-				MyMesh::Point point = w2 * (p2 - p1) + p1;
-
-				Real sum_corner_weights = 0;
 				std::array<Real, k_num_corners> corner_weights;
 				corner_weights.fill(0.0);
 
@@ -874,27 +961,315 @@ void MeshCuboid::create_grid_points_on_cuboid_surface(
 				corner_weights[ corner_indices[2] ] = (w1)*(w2);
 				corner_weights[ corner_indices[3] ] = (1 - w1)*(w2);
 
-#ifdef DEBUG_TEST
-				MyMesh::Point same_point(0.0);
-				for (unsigned int i = 0; i < k_num_corners; ++i)
-					same_point += corner_weights[i] * bbox_corners_[i];
-				Real error = (same_point - point).length();
-				CHECK_NUMERICAL_ERROR(__FUNCTION__, error);
-#endif
-
-				MeshCuboidSurfacePoint *cuboid_surface_point = new MeshCuboidSurfacePoint(
-					point, normal, face_index, corner_weights);
-				cuboid_surface_points_.push_back(cuboid_surface_point);
+				surface_point_template->face_indices_.push_back(face_index);
+				surface_point_template->corner_weights_.push_back(corner_weights);
 			}
 		}
 	}
 
+	set_cuboid_surface_point_template(surface_point_template);
+
 	// Update point correspondences.
 	update_point_correspondences();
 }
 
+// Cuboid surface points on a face, binned into a 2D grid in the cuboid local coordinates.
+struct MeshCuboidFaceGrid
+{
+	// [0]: normal axis, [1], [2]: grid axes.
+	unsigned int axes_[3];
+	// Bounding box of the points in the local coordinates.
+	Real bbox_min_[3];
+	Real bbox_max_[3];
+
+	int grid_size_[2];
+	Real grid_cell_size_[2];
+	std::vector<unsigned int> grid_cell_offsets_;
+	std::vector<unsigned int> point_indices_;
+
+	int get_grid_coord(const Real _value, const unsigned int _grid_axis) const
+	{
+		const unsigned int axis = axes_[_grid_axis + 1];
+		int coord = static_cast<int>(std::floor(
+			(_value - bbox_min_[axis]) / grid_cell_size_[_grid_axis]));
+		return std::min(std::max(coord, 0), grid_size_[_grid_axis] - 1);
+	}
+
+	// Squared distance from a value to the range of cells ['_begin', '_end'] along a grid axis.
+	Real get_grid_range_squared_distance(const Real _value, const unsigned int _grid_axis,
+		const int _begin, const int _end) const
+	{
+		const unsigned int axis = axes_[_grid_axis + 1];
+		const Real range_min = (_begin <= 0) ? bbox_min_[axis] :
+			bbox_min_[axis] + _begin * grid_cell_size_[_grid_axis];
+		const Real range_max = (_end >= grid_size_[_grid_axis] - 1) ? bbox_max_[axis] :
+			bbox_min_[axis] + (_end + 1) * grid_cell_size_[_grid_axis];
+
+		Real distance = 0.0;
+		if (_value < range_min) distance = range_min - _value;
+		else if (_value > range_max) distance = _value - range_max;
+		return distance * distance;
+	}
+
+	Real get_bbox_squared_distance(const Eigen::Vector3d &_point) const
+	{
+		Real squared_distance = 0.0;
+		for (unsigned int i = 0; i < 3; ++i)
+		{
+			Real distance = 0.0;
+			if (_point[i] < bbox_min_[i]) distance = bbox_min_[i] - _point[i];
+			else if (_point[i] > bbox_max_[i]) distance = _point[i] - bbox_max_[i];
+			squared_distance += distance * distance;
+		}
+		return squared_distance;
+	}
+
+	void build(const unsigned int _face_index,
+		const std::vector<const MeshCuboidSurfacePoint *> &_cuboid_surface_points,
+		const std::vector<Eigen::Vector3d> &_local_cuboid_surface_points)
+	{
+		axes_[0] = _face_index / 2;
+		axes_[1] = (axes_[0] + 1) % 3;
+		axes_[2] = (axes_[0] + 2) % 3;
+
+		point_indices_.clear();
+		for (unsigned int point_index = 0; point_index < _cuboid_surface_points.size(); ++point_index)
+			if (_cuboid_surface_points[point_index]->cuboid_face_index_ == _face_index)
+				point_indices_.push_back(point_index);
+
+		const unsigned int num_points = point_indices_.size();
+		if (num_points == 0)
+		{
+			grid_cell_offsets_.clear();
+			return;
+		}
+
+		for (unsigned int i = 0; i < 3; ++i)
+		{
+			bbox_min_[i] = std::numeric_limits<Real>::max();
+			bbox_max_[i] = std::numeric_limits<Real>::lowest();
+		}
+
+		for (unsigned int i = 0; i < num_points; ++i)
+		{
+			const Eigen::Vector3d &point = _local_cuboid_surface_points[point_indices_[i]];
+			for (unsigned int j = 0; j < 3; ++j)
+			{
+				bbox_min_[j] = std::min(bbox_min_[j], point[j]);
+				bbox_max_[j] = std::max(bbox_max_[j], point[j]);
+			}
+		}
+
+		// NOTE:
+		// Each cell has about four points.
+		const Real extent_1 = std::max(bbox_max_[axes_[1]] - bbox_min_[axes_[1]], MIN_CUBOID_SIZE);
+		const Real extent_2 = std::max(bbox_max_[axes_[2]] - bbox_min_[axes_[2]], MIN_CUBOID_SIZE);
+		const Real num_cells = std::max(num_points / 4.0, 1.0);
+		const int max_grid_size = 256;
+
+		grid_size_[0] = static_cast<int>(std::round(std::sqrt(num_cells * extent_1 / extent_2)));
+		grid_size_[0] = std::min(std::max(grid_size_[0], 1), max_grid_size);
+		grid_size_[1] = static_cast<int>(std::round(num_cells / grid_size_[0]));
+		grid_size_[1] = std::min(std::max(grid_size_[1], 1), max_grid_size);
+		grid_cell_size_[0] = extent_1 / grid_size_[0];
+		grid_cell_size_[1] = extent_2 / grid_size_[1];
+
+		// Sort points by grid cells.
+		std::vector<unsigned int> point_cell_indices(num_points);
+		grid_cell_offsets_.assign(grid_size_[0] * grid_size_[1] + 1, 0);
+
+		for (unsigned int i = 0; i < num_points; ++i)
+		{
+			const Eigen::Vector3d &point = _local_cuboid_surface_points[point_indices_[i]];
+			point_cell_indices[i] = get_grid_coord(point[axes_[2]], 1) * grid_size_[0]
+				+ get_grid_coord(point[axes_[1]], 0);
+			++grid_cell_offsets_[point_cell_indices[i] + 1];
+		}
+
+		for (unsigned int cell_index = 0; cell_index + 1 < grid_cell_offsets_.size(); ++cell_index)
+			grid_cell_offsets_[cell_index + 1] += grid_cell_offsets_[cell_index];
+
+		std::vector<unsigned int> cell_point_indices(num_points);
+		std::vector<unsigned int> cell_counts(grid_cell_offsets_.begin(), grid_cell_offsets_.end() - 1);
+		for (unsigned int i = 0; i < num_points; ++i)
+			cell_point_indices[cell_counts[point_cell_indices[i]]++] = point_indices_[i];
+		point_indices_.swap(cell_point_indices);
+	}
+
+	// Updates '_min_squared_distance' and '_closest_point_index' if any point on this
+	// face is closer than '_min_squared_distance'.
+	void find_closest_point(const Eigen::Vector3d &_point,
+		const std::vector<Eigen::Vector3d> &_local_cuboid_surface_points,
+		Real &_min_squared_distance, int &_closest_point_index) const
+	{
+		if (point_indices_.empty())
+			return;
+
+		Real normal_distance = 0.0;
+		if (_point[axes_[0]] < bbox_min_[axes_[0]]) normal_distance = bbox_min_[axes_[0]] - _point[axes_[0]];
+		else if (_point[axes_[0]] > bbox_max_[axes_[0]]) normal_distance = _point[axes_[0]] - bbox_max_[axes_[0]];
+		const Real normal_squared_distance = normal_distance * normal_distance;
+
+		const Real value_1 = _point[axes_[1]];
+		const Real value_2 = _point[axes_[2]];
+		const int center_1 = get_grid_coord(value_1, 0);
+		const int center_2 = get_grid_coord(value_2, 1);
+
+		// Search cells in rings around the cell of the projected point.
+		const int max_ring = std::max(
+			std::max(center_1, grid_size_[0] - 1 - center_1),
+			std::max(center_2, grid_size_[1] - 1 - center_2));
+
+		for (int ring = 0; ring <= max_ring; ++ring)
+		{
+			if (ring > 0)
+			{
+				// All cells in the ring are outside of the inner block.
+				Real ring_squared_distance = std::numeric_limits<Real>::max();
+				if (center_1 - ring >= 0)
+					ring_squared_distance = std::min(ring_squared_distance,
+					get_grid_range_squared_distance(value_1, 0, 0, center_1 - ring));
+				if (center_1 + ring < grid_size_[0])
+					ring_squared_distance = std::min(ring_squared_distance,
+					get_grid_range_squared_distance(value_1, 0, center_1 + ring, grid_size_[0] - 1));
+				if (center_2 - ring >= 0)
+					ring_squared_distance = std::min(ring_squared_distance,
+					get_grid_range_squared_distance(value_2, 1, 0, center_2 - ring));
+				if (center_2 + ring < grid_size_[1])
+					ring_squared_distance = std::min(ring_squared_distance,
+					get_grid_range_squared_distance(value_2, 1, center_2 + ring, grid_size_[1] - 1));
+
+				if (normal_squared_distance + ring_squared_distance >= _min_squared_distance)
+					break;
+			}
+
+			const int begin_2 = std::max(center_2 - ring, 0);
+			const int end_2 = std::min(center_2 + ring, grid_size_[1] - 1);
+
+			for (int coord_2 = begin_2; coord_2 <= end_2; ++coord_2)
+			{
+				const bool is_ring_row = (coord_2 == center_2 - ring || coord_2 == center_2 + ring);
+				const int step_1 = (is_ring_row || ring == 0) ? 1 : 2 * ring;
+
+				for (int coord_1 = center_1 - ring; coord_1 <= center_1 + ring; coord_1 += step_1)
+				{
+					if (coord_1 < 0 || coord_1 >= grid_size_[0])
+						continue;
+
+					const Real cell_squared_distance = normal_squared_distance
+						+ get_grid_range_squared_distance(value_1, 0, coord_1, coord_1)
+						+ get_grid_range_squared_distance(value_2, 1, coord_2, coord_2);
+					if (cell_squared_distance >= _min_squared_distance)
+						continue;
+
+					const unsigned int cell_index = coord_2 * grid_size_[0] + coord_1;
+					for (unsigned int i = grid_cell_offsets_[cell_index];
+						i < grid_cell_offsets_[cell_index + 1]; ++i)
+					{
+						const unsigned int point_index = point_indices_[i];
+						const Real squared_distance =
+							(_local_cuboid_surface_points[point_index] - _point).squaredNorm();
+						if (squared_distance < _min_squared_distance)
+						{
+							_min_squared_distance = squared_distance;
+							_closest_point_index = static_cast<int>(point_index);
+						}
+					}
+				}
+			}
+		}
+	}
+};
+
+// Cuboid surface points on a face which are a regular grid of the bilinear weights
+// (see 'MeshCuboidSurfacePointTemplate::is_face_grid_'), in the cuboid local coordinates.
+// NOTE:
+// The face is a rectangle in the local coordinates, so the grid is separable along the face
+// axes. The closest grid point is found in closed form by projecting the point to the face
+// plane and rounding the weights of the projection.
+struct MeshCuboidFaceLattice
+{
+	unsigned int offset_;
+	unsigned int size_[2];
+	Eigen::Vector3d origin_;
+	Eigen::Vector3d axes_[2];
+	Real axis_squared_lengths_[2];
+
+	bool empty() const { return (size_[0] == 0 || size_[1] == 0); }
+
+	// Returns false if the points are not a rectangular grid.
+	bool build(const unsigned int _offset, const std::array<unsigned int, 2> &_size,
+		const std::vector<Eigen::Vector3d> &_local_cuboid_surface_points)
+	{
+		offset_ = _offset;
+		size_[0] = _size[0];
+		size_[1] = _size[1];
+		if (empty())
+			return true;
+
+		assert(size_[0] >= 2 && size_[1] >= 2);
+		assert(offset_ + size_[0] * size_[1] <= _local_cuboid_surface_points.size());
+
+		origin_ = _local_cuboid_surface_points[offset_];
+		axes_[0] = _local_cuboid_surface_points[offset_ + (size_[0] - 1) * size_[1]] - origin_;
+		axes_[1] = _local_cuboid_surface_points[offset_ + (size_[1] - 1)] - origin_;
+		const Eigen::Vector3d &last_point =
+			_local_cuboid_surface_points[offset_ + size_[0] * size_[1] - 1];
+
+		for (unsigned int i = 0; i < 2; ++i)
+		{
+			axis_squared_lengths_[i] = axes_[i].squaredNorm();
+			if (axis_squared_lengths_[i] <= MIN_CUBOID_SIZE * MIN_CUBOID_SIZE)
+				return false;
+		}
+
+		const Real tolerance = 1.0E-6;
+		return (std::abs(axes_[0].dot(axes_[1]))
+			<= tolerance * std::sqrt(axis_squared_lengths_[0] * axis_squared_lengths_[1])
+			&& (last_point - (origin_ + axes_[0] + axes_[1])).squaredNorm()
+			<= tolerance * tolerance * (axis_squared_lengths_[0] + axis_squared_lengths_[1]));
+	}
+
+	int find_closest_point(const Eigen::Vector3d &_point) const
+	{
+		assert(!empty());
+		const Eigen::Vector3d offset = _point - origin_;
+
+		int coords[2];
+		for (unsigned int i = 0; i < 2; ++i)
+		{
+			const Real weight = offset.dot(axes_[i]) / axis_squared_lengths_[i];
+			coords[i] = static_cast<int>(std::round(weight * (size_[i] - 1)));
+			coords[i] = std::min(std::max(coords[i], 0), static_cast<int>(size_[i]) - 1);
+		}
+
+		return static_cast<int>(offset_ + coords[0] * size_[1] + coords[1]);
+	}
+};
+
+bool MeshCuboid::has_orthonormal_bbox_axes() const
+{
+	const Real tolerance = 1.0E-6;
+	for (unsigned int axis_index_1 = 0; axis_index_1 < 3; ++axis_index_1)
+	{
+		for (unsigned int axis_index_2 = axis_index_1; axis_index_2 < 3; ++axis_index_2)
+		{
+			Real value = dot(bbox_axes_[axis_index_1], bbox_axes_[axis_index_2]);
+			if (axis_index_1 == axis_index_2) value -= 1.0;
+			if (std::abs(value) > tolerance)
+				return false;
+		}
+	}
+	return true;
+}
+
 void MeshCuboid::update_point_correspondences()
 {
+	// NOTE:
+	// The previous correspondences are used in the incremental update.
+	std::vector<int> prev_sample_to_cuboid_surface_correspondence;
+	prev_sample_to_cuboid_surface_correspondence.swap(sample_to_cuboid_surface_correspondence_);
+
 	sample_to_cuboid_surface_correspondence_.clear();
 	cuboid_surface_to_sample_corresopndence_.clear();
 
@@ -910,6 +1285,12 @@ void MeshCuboid::update_point_correspondences()
 	if (num_X_points == 0 || num_Y_points == 0)
 		return;
 
+	if (FLAGS_use_incremental_point_correspondences && has_orthonormal_bbox_axes())
+	{
+		update_point_correspondences_incrementally(prev_sample_to_cuboid_surface_correspondence);
+		return;
+	}
+
 	Eigen::MatrixXd X_points(3, num_X_points);
 	Eigen::MatrixXd Y_points(3, num_Y_points);
 
@@ -933,12 +1314,10 @@ void MeshCuboid::update_point_correspondences()
 		Y_indices.col(Y_point_index)(0) = Y_point_index;
 	}
 
-	ANNpointArray X_ann_points = NULL;
-	ANNkd_tree* X_ann_kd_tree = ICP::create_kd_tree(X_points, X_ann_points);
+	ANNkd_tree* X_ann_kd_tree = sample_point_kd_tree_cache_.get_kd_tree(X_points);
 	assert(X_ann_kd_tree);
 
-	ANNpointArray Y_ann_points = NULL;
-	ANNkd_tree* Y_ann_kd_tree = ICP::create_kd_tree(Y_points, Y_ann_points);
+	ANNkd_tree* Y_ann_kd_tree = cuboid_surface_point_kd_tree_cache_.get_kd_tree(Y_points);
 	assert(Y_ann_kd_tree);
 
 	// X -> Y.
@@ -967,134 +1346,171 @@ void MeshCuboid::update_point_correspondences()
 		cuboid_surface_to_sample_corresopndence_[Y_point_index] =
 			static_cast<int>(closest_X_indices.col(Y_point_index)(0));
 	}
-
-	if (X_ann_points) annDeallocPts(X_ann_points);
-	if (Y_ann_points) annDeallocPts(Y_ann_points);
-	delete X_ann_kd_tree;
-	delete Y_ann_kd_tree;
 }
 
-void MeshCuboid::compute_cuboid_surface_point_visibility(
-	const Real _modelview_matrix[16],
-	const Real _radius,
-	const std::vector<MeshSamplePoint *> &_given_sample_points,
-	const std::vector<MyMesh::Point> &_test_points,
-	const std::vector<MyMesh::Normal> *_test_normals,
-	std::vector<Real> &_visibility_values)
+void MeshCuboid::update_point_correspondences_incrementally(
+	const std::vector<int> &_prev_sample_to_cuboid_surface_correspondence)
 {
-	assert(_modelview_matrix);
-	assert(_radius > 0);
+	// NOTE:
+	// X: sample points, Y: cuboid surface_points.
+	const unsigned int num_X_points = num_sample_points();
+	const unsigned int num_Y_points = num_cuboid_surface_points();
+	assert(num_X_points > 0);
+	assert(num_Y_points > 0);
+	assert(sample_to_cuboid_surface_correspondence_.size() == num_X_points);
+	assert(cuboid_surface_to_sample_corresopndence_.size() == num_Y_points);
 
-	Eigen::Matrix4d modelview_matrix;
-	for (unsigned int col = 0; col < 4; ++col)
-		for (unsigned int row = 0; row < 4; ++row)
-			modelview_matrix(row, col) = _modelview_matrix[4 * col + row];
+	// NOTE:
+	// Distances are preserved in the local coordinates since the axes are orthonormal.
+	std::vector<Eigen::Vector3d> local_X_points(num_X_points);
+	for (unsigned int X_point_index = 0; X_point_index < num_X_points; ++X_point_index)
+	{
+		MyMesh::Point local_point = get_local_coord(sample_points_[X_point_index]->point_);
+		local_X_points[X_point_index] = Eigen::Vector3d(local_point[0], local_point[1], local_point[2]);
+	}
+
+	const std::vector<const MeshCuboidSurfacePoint *> &Y_points = get_cuboid_surface_points();
+	std::vector<Eigen::Vector3d> local_Y_points(num_Y_points);
+	for (unsigned int Y_point_index = 0; Y_point_index < num_Y_points; ++Y_point_index)
+	{
+		MyMesh::Point local_point = get_local_coord(Y_points[Y_point_index]->point_);
+		local_Y_points[Y_point_index] = Eigen::Vector3d(local_point[0], local_point[1], local_point[2]);
+	}
 
-	MyMesh::Normal view_direction(
-		-_modelview_matrix[2], -_modelview_matrix[6], -_modelview_matrix[10]);
 
-	unsigned int num_test_points = _test_points.size();
-	assert(!_test_normals || (*_test_normals).size() == num_test_points);
-	_visibility_values.resize(num_test_points);
+	// X -> Y.
+	assert(cuboid_surface_point_template_);
+	const MeshCuboidSurfacePointTemplate &surface_point_template = *cuboid_surface_point_template_;
 
-	for (unsigned int test_point_index = 0; test_point_index < num_test_points; ++test_point_index)
+	std::array<MeshCuboidFaceLattice, k_num_faces> face_lattices;
+	bool use_face_lattices = surface_point_template.is_face_grid_;
+	for (unsigned int face_index = 0; face_index < k_num_faces && use_face_lattices; ++face_index)
 	{
-		Real &visibility = _visibility_values[test_point_index];
-		visibility = 1.0;
+		use_face_lattices = face_lattices[face_index].build(
+			surface_point_template.face_grid_offsets_[face_index],
+			surface_point_template.face_grid_sizes_[face_index], local_Y_points);
+	}
 
-		// Ignore a surface point if its normal is not heading to the viewing direction.
-		if (_test_normals && dot((*_test_normals)[test_point_index], view_direction) >= 0)
+	if (use_face_lattices)
+	{
+		for (unsigned int X_point_index = 0; X_point_index < num_X_points; ++X_point_index)
 		{
-			visibility = 0.0;
-			continue;
-		}
+			const Eigen::Vector3d &point = local_X_points[X_point_index];
 
-		Eigen::Vector3d surface_point;
-		for (unsigned int i = 0; i < 3; ++i)
-			surface_point[i] = _test_points[test_point_index][i];
+			Real min_squared_distance = std::numeric_limits<Real>::max();
+			int closest_Y_point_index = -1;
 
-		Eigen::Vector4d surface_point_4;
-		surface_point_4 << surface_point, 1.0;
+			for (unsigned int face_index = 0; face_index < k_num_faces; ++face_index)
+			{
+				if (face_lattices[face_index].empty())
+					continue;
 
-		for (std::vector<MeshSamplePoint *>::const_iterator jt = _given_sample_points.begin();
-			jt != _given_sample_points.end(); jt++)
-		{
-			Eigen::Vector3d observed_point;
-			for (unsigned int i = 0; i < 3; ++i)
-				observed_point[i] = (*jt)->point_[i];
+				const int Y_point_index = face_lattices[face_index].find_closest_point(point);
+				const Real squared_distance = (local_Y_points[Y_point_index] - point).squaredNorm();
+				if (squared_distance < min_squared_distance)
+				{
+					min_squared_distance = squared_distance;
+					closest_Y_point_index = Y_point_index;
+				}
+			}
 
-			Eigen::Vector4d observed_point_4;
-			observed_point_4 << observed_point, 1.0;
+			assert(closest_Y_point_index >= 0);
+			sample_to_cuboid_surface_correspondence_[X_point_index] = closest_Y_point_index;
+		}
+	}
+	else
+	{
+		std::array<MeshCuboidFaceGrid, k_num_faces> face_grids;
+		for (unsigned int face_index = 0; face_index < k_num_faces; ++face_index)
+			face_grids[face_index].build(face_index, Y_points, local_Y_points);
 
-			// Positions in the model view coordinates.
-			Eigen::Vector4d lc_observed_point_4 = modelview_matrix * observed_point_4;
-			Eigen::Vector3d lc_observed_point = lc_observed_point_4.topRows(3) / lc_observed_point_4[3];
-			lc_observed_point[2] -= _radius;
+		const bool use_prev_correspondence =
+			(_prev_sample_to_cuboid_surface_correspondence.size() == num_X_points);
 
-			Eigen::Vector4d lc_surface_point_4 = modelview_matrix * surface_point_4;
-			Eigen::Vector3d lc_surface_point = lc_surface_point_4.topRows(3) / lc_surface_point_4[3];
+		for (unsigned int X_point_index = 0; X_point_index < num_X_points; ++X_point_index)
+		{
+			const Eigen::Vector3d &point = local_X_points[X_point_index];
 
-			Real lc_surface_point_len = lc_surface_point.norm();
-			Real lc_observed_point_len = lc_observed_point.norm();
+			Real min_squared_distance = std::numeric_limits<Real>::max();
+			int closest_Y_point_index = -1;
 
-			Real dot_prod = lc_surface_point.dot(lc_observed_point);
+			if (use_prev_correspondence)
+			{
+				int prev_Y_point_index = _prev_sample_to_cuboid_surface_correspondence[X_point_index];
+				if (prev_Y_point_index >= 0 && prev_Y_point_index < static_cast<int>(num_Y_points))
+				{
+					closest_Y_point_index = prev_Y_point_index;
+					min_squared_distance = (local_Y_points[prev_Y_point_index] - point).squaredNorm();
+				}
+			}
 
-			// Ignore a sample point if either it or the voxel point is not visible
-			// from this model view.
-			if (lc_observed_point[2] >= 0 || lc_surface_point[2] >= 0
-				|| lc_observed_point[2] <= lc_surface_point[2]
-				|| lc_surface_point_len == 0 || lc_observed_point_len == 0)
-				continue;
+			// Search faces in the order of the distance to the projection on each face.
+			std::array< std::pair<Real, unsigned int>, k_num_faces > face_distances;
+			for (unsigned int face_index = 0; face_index < k_num_faces; ++face_index)
+			{
+				face_distances[face_index].second = face_index;
+				face_distances[face_index].first = face_grids[face_index].point_indices_.empty() ?
+					std::numeric_limits<Real>::max() : face_grids[face_index].get_bbox_squared_distance(point);
+			}
+			std::sort(face_distances.begin(), face_distances.end());
 
-			Real cos_angle = dot_prod / (lc_surface_point_len * lc_observed_point_len);
-			if (std::acos(cos_angle) <= std::atan(_radius / lc_observed_point_len))
+			for (unsigned int i = 0; i < k_num_faces; ++i)
 			{
-				visibility = 0;
+				if (face_distances[i].first >= min_squared_distance)
+					break;
+
+				face_grids[face_distances[i].second].find_closest_point(
+					point, local_Y_points, min_squared_distance, closest_Y_point_index);
 			}
 
-			//Real cos_angle = dot_prod / (lc_surface_point_len * lc_observed_point_len);
-			//Real sin_angle = std::sqrt(1 - cos_angle * cos_angle);
-			//Real tan_angle = sin_angle / cos_angle;
-
-			//if (dot_prod < lc_observed_point_len * lc_observed_point_len)
-			//{
-			//	// NOTE:
-			//	// If the following code is uncommented, a point is considered as a sphere.
-			//	//Real distance = (surface_point - observed_point).norm() / _radius;
-			//	//visibility = min(frag_color.a, distance);
-			//}
-			//else
-			//{
-			//	Real distance = (lc_observed_point_len * tan_angle) / _radius;
-			//	//visibility = min(visibility, distance);
-			//	// NOTE:
-			//	//
-			//	if (distance < 1) visibility = 0;
-			//}
+			assert(closest_Y_point_index >= 0);
+			sample_to_cuboid_surface_correspondence_[X_point_index] = closest_Y_point_index;
 		}
-
-		assert(visibility >= 0.0);
-		assert(visibility <= 1.0);
 	}
 
 
-	// Test 2D view plane mask for occlusion.
-	//
-	if (FLAGS_use_view_plane_mask)
+	// Y -> X.
+	// NOTE:
+	// Sample points have no structure to project to, so the sample point KD-tree is used.
+	// It is not rebuilt while the sample points are not changed.
+	Eigen::MatrixXd X_points;
+	get_sample_points(X_points);
+	ANNkd_tree* X_ann_kd_tree = sample_point_kd_tree_cache_.get_kd_tree(X_points);
+	assert(X_ann_kd_tree);
+
+	ANNpoint q = annAllocPt(3);
+	ANNidx nn_idx[1];
+	ANNdist dd[1];
+
+	for (unsigned int Y_point_index = 0; Y_point_index < num_Y_points; ++Y_point_index)
 	{
-		std::list<SamplePointIndex> occluded_test_point_indices;
-		MeshCuboid::compute_view_plane_mask_visibility(_modelview_matrix,
-			_test_points, occluded_test_point_indices);
+		for (unsigned int i = 0; i < 3; ++i)
+			q[i] = Y_points[Y_point_index]->point_[i];
 
-		for (std::list<SamplePointIndex>::iterator it = occluded_test_point_indices.begin();
-			it != occluded_test_point_indices.end(); ++it)
-		{
-			SamplePointIndex test_point_index = *it;
-			assert(test_point_index < _visibility_values.size());
-			_visibility_values[test_point_index] = 0.0;
-		}
+		X_ann_kd_tree->annkSearch(q, 1, nn_idx, dd);
+		assert(nn_idx[0] >= 0 && nn_idx[0] < static_cast<int>(num_X_points));
+		cuboid_surface_to_sample_corresopndence_[Y_point_index] = nn_idx[0];
 	}
-	//
+
+	annDeallocPt(q);
+}
+
+void MeshCuboid::compute_cuboid_surface_point_visibility(
+	const Real _modelview_matrix[16],
+	const Real _radius,
+	const std::vector<MeshSamplePoint *> &_given_sample_points,
+	const std::vector<MyMesh::Point> &_test_points,
+	const std::vector<MyMesh::Normal> *_test_normals,
+	std::vector<Real> &_visibility_values)
+{
+	assert(_modelview_matrix);
+	assert(_radius > 0);
+
+	// NOTE:
+	// Build the visibility engine once and reuse it when testing multiple point sets
+	// with the same model view.
+	MeshCuboidVisibilityEngine visibility_engine(_modelview_matrix, _radius, _given_sample_points);
+	visibility_engine.compute_visibility(_test_points, _test_normals, _visibility_values);
 }
 
 void MeshCuboid::compute_view_plane_mask_visibility(const Real _modelview_matrix[16],
@@ -1152,13 +1568,21 @@ void MeshCuboid::compute_cuboid_surface_point_visibility(
 	const Real _radius,
 	const std::vector<MeshSamplePoint *>& _given_sample_points,
 	bool _use_cuboid_normal)
+{
+	MeshCuboidVisibilityEngine visibility_engine(_modelview_matrix, _radius, _given_sample_points);
+	compute_cuboid_surface_point_visibility(visibility_engine, _use_cuboid_normal);
+}
+
+void MeshCuboid::compute_cuboid_surface_point_visibility(
+	const MeshCuboidVisibilityEngine &_visibility_engine,
+	bool _use_cuboid_normal)
 {
 	std::vector<MyMesh::Point> test_points(num_cuboid_surface_points());
 	std::vector<MyMesh::Normal> test_normals(num_cuboid_surface_points());
 	
 	for (unsigned int point_index = 0; point_index < num_cuboid_surface_points(); ++point_index)
 	{
-		MeshCuboidSurfacePoint *cuboid_surface_point = cuboid_surface_points_[point_index];
+		const MeshCuboidSurfacePoint *cuboid_surface_point = get_cuboid_surface_point(point_index);
 		assert(cuboid_surface_point);
 		test_points[point_index] = cuboid_surface_point->point_;
 		test_normals[point_index] = cuboid_surface_point->normal_;
@@ -1167,36 +1591,31 @@ void MeshCuboid::compute_cuboid_surface_point_visibility(
 	std::vector<Real> visibility_values;
 
 	if (_use_cuboid_normal)
-		compute_cuboid_surface_point_visibility(_modelview_matrix, _radius,
-		_given_sample_points, test_points, &test_normals, visibility_values);
+		_visibility_engine.compute_visibility(test_points, &test_normals, visibility_values);
 	else
-		compute_cuboid_surface_point_visibility(_modelview_matrix, _radius,
-		_given_sample_points, test_points, NULL, visibility_values);
+		_visibility_engine.compute_visibility(test_points, NULL, visibility_values);
 
 	assert(visibility_values.size() == num_cuboid_surface_points());
 
+	assert(cuboid_surface_point_visibilities_.size() == num_cuboid_surface_points());
 	for (unsigned int point_index = 0; point_index < num_cuboid_surface_points(); ++point_index)
-	{
-		MeshCuboidSurfacePoint *cuboid_surface_point = cuboid_surface_points_[point_index];
-		assert(cuboid_surface_point);
-		cuboid_surface_point->visibility_ = visibility_values[point_index];
-	}
+		cuboid_surface_point_visibilities_[point_index] = static_cast<float>(visibility_values[point_index]);
 }
 
 Real MeshCuboid::get_cuboid_overvall_visibility() const
 {
 	// Assume that visibility of each surface point is already computed.
 	Real sum_visibility = 0.0;
-	if (cuboid_surface_points_.empty())
+	if (cuboid_surface_point_visibilities_.empty())
 		return sum_visibility;
 
-	for (std::vector<MeshCuboidSurfacePoint *>::const_iterator it = cuboid_surface_points_.begin();
-		it != cuboid_surface_points_.end(); it++)
+	for (std::vector<float>::const_iterator it = cuboid_surface_point_visibilities_.begin();
+		it != cuboid_surface_point_visibilities_.end(); it++)
 	{
-		sum_visibility += (*it)->visibility_;
+		sum_visibility += (*it);
 	}
 
-	sum_visibility /= static_cast<Real>(cuboid_surface_points_.size());
+	sum_visibility /= static_cast<Real>(cuboid_surface_point_visibilities_.size());
 	return sum_visibility;
 }
 
@@ -1249,6 +1668,8 @@ void MeshCuboid::update_corner_points()
 		for (unsigned int axis_index = 0; axis_index < 3; ++axis_index)
 			bbox_corners_[corner_index][axis_index] = bbox_corner_vec[axis_index];
 	}
+
+	update_cuboid_surface_point_values();
 }
 
 void MeshCuboid::update_center_size_corner_points()
@@ -1601,7 +2022,10 @@ std::vector<MeshCuboid *> MeshCuboid::split_cuboid(const Real _object_diameter)
 
 	if (data_pts) annDeallocPts(data_pts);
 	delete kd_tree;
-	annClose();
+
+	// NOTE:
+	// Do not call 'annClose()' here. It deletes the shared empty leaf of ANN,
+	// which is still referenced by the cached KD-trees.
 
 	return sub_cuboids;
 }
@@ -1833,88 +2257,214 @@ void MeshCuboid::draw_cuboid()const
 }
 
 void MeshCuboid::points_to_cuboid_distances(const Eigen::MatrixXd& _points,
-	Eigen::VectorXd &_distances)
+	Eigen::VectorXd &_distances) const
 {
 	// NOTE:
 	// Do not use corner points, but use only center, size, and axes.
 	// The distance becomes less than zero when the point is inside the cuboid.
-	unsigned int num_points = _points.cols();
+	assert(_points.rows() == 3);
 
 	Eigen::Vector3d bbox_center_vec;
-	for (unsigned int i = 0; i < 3; ++i)
-		bbox_center_vec[i] = bbox_center_[i];
-
-	Eigen::MatrixXd centered_points = (_points.colwise() - bbox_center_vec);
-	Eigen::MatrixXd axis_distances(3, num_points);
-
+	Eigen::Matrix3d bbox_axes_mat;
+	Eigen::Array3d bbox_half_size;
 	for (unsigned int axis_index = 0; axis_index < 3; ++axis_index)
 	{
-		Eigen::Vector3d bbox_axis_vec;
+		bbox_center_vec[axis_index] = bbox_center_[axis_index];
 		for (unsigned int i = 0; i < 3; ++i)
-			bbox_axis_vec[i] = bbox_axes_[axis_index][i];
-		bbox_axis_vec.normalize();
+			bbox_axes_mat(axis_index, i) = bbox_axes_[axis_index][i];
+		bbox_axes_mat.row(axis_index).normalize();
+		bbox_half_size[axis_index] = 0.5 * bbox_size_[axis_index];
+	}
 
-		// Distance from center along each direction.
-		axis_distances.row(axis_index) =
-			(bbox_axis_vec.transpose() * centered_points).array();
+	// Distance from cuboid surface along each direction.
+	Eigen::ArrayXXd axis_distances =
+		(bbox_axes_mat * (_points.colwise() - bbox_center_vec)).array().abs().colwise()
+		- bbox_half_size;
 
-		axis_distances.row(axis_index) = axis_distances.row(axis_index).cwiseAbs();
+	// Inside: the maximum of axis distances (<= 0).
+	// Outside: the norm of positive axis distances.
+	Eigen::ArrayXd max_axis_distances = axis_distances.colwise().maxCoeff().transpose();
+	Eigen::ArrayXd outside_distances =
+		axis_distances.max(0.0).matrix().colwise().norm().transpose().array();
 
-		// Compute the distance from cuboid surface.
-		axis_distances.row(axis_index) = axis_distances.row(axis_index).array()
-			- (0.5 * bbox_size_[axis_index]);
-	}
+	_distances = (max_axis_distances <= 0).select(max_axis_distances, outside_distances).matrix();
+}
 
-	_distances = Eigen::VectorXd(num_points);
-	for (unsigned int point_index = 0; point_index < num_points; ++point_index)
+void MeshCuboid::points_to_cuboid_surface_distances(const Eigen::MatrixXd& _points,
+	Eigen::VectorXd &_distances) const
+{
+	points_to_cuboid_distances(_points, _distances);
+	_distances = _distances.cwiseAbs();
+}
+
+// Maximum of 'min_j (a_j + b_j * s + c_j * t)' for 's' in [-_half_size_s, _half_size_s]
+// and 't' in [-_half_size_t, _half_size_t]. Each row of '_affine' is (a_j, b_j, c_j).
+// NOTE:
+// This is a linear program of (s, t, z), and the maximum is attained where three of
+// the constraints 'z <= a_j + b_j * s + c_j * t', '|s| <= _half_size_s', and
+// '|t| <= _half_size_t' are active. All such points are enumerated. Every candidate
+// is clamped to the rectangle, so singular cases only add lower bounds.
+static Real max_min_affine_on_rectangle(const Eigen::Matrix<Real, 6, 3> &_affine,
+	const Real _half_size_s, const Real _half_size_t)
+{
+	const int num_functions = _affine.rows();
+	Real max_value = -std::numeric_limits<Real>::max();
+
+	auto evaluate = [&](Real _s, Real _t) {
+		_s = std::min(std::max(_s, -_half_size_s), _half_size_s);
+		_t = std::min(std::max(_t, -_half_size_t), _half_size_t);
+		Real value = (_affine.col(0) + _affine.col(1) * _s + _affine.col(2) * _t).minCoeff();
+		max_value = std::max(max_value, value);
+	};
+
+	// Rectangle corners.
+	for (int i = -1; i <= 1; i += 2)
+		for (int j = -1; j <= 1; j += 2)
+			evaluate(i * _half_size_s, j * _half_size_t);
+
+	for (int j = 0; j < num_functions; ++j)
 	{
-		Eigen::Vector3d axis_distance = axis_distances.col(point_index);
-		if ((axis_distance.array() <= 0).all())
-		{
-			_distances[point_index] = axis_distance.maxCoeff();
-		}
-		else
+		for (int k = j + 1; k < num_functions; ++k)
 		{
-			axis_distance = (axis_distance.array() < 0).select(0, axis_distance);
-			_distances[point_index] = axis_distance.norm();
+			// (a_j - a_k) + (b_j - b_k) * s + (c_j - c_k) * t = 0.
+			const Real da = _affine(j, 0) - _affine(k, 0);
+			const Real db = _affine(j, 1) - _affine(k, 1);
+			const Real dc = _affine(j, 2) - _affine(k, 2);
+
+			// Rectangle edges.
+			for (int i = -1; i <= 1; i += 2)
+			{
+				if (dc != 0) evaluate(i * _half_size_s, -(da + db * i * _half_size_s) / dc);
+				if (db != 0) evaluate(-(da + dc * i * _half_size_t) / db, i * _half_size_t);
+			}
+
+			// Interior.
+			for (int l = k + 1; l < num_functions; ++l)
+			{
+				const Real da2 = _affine(j, 0) - _affine(l, 0);
+				const Real db2 = _affine(j, 1) - _affine(l, 1);
+				const Real dc2 = _affine(j, 2) - _affine(l, 2);
+				const Real det = db * dc2 - dc * db2;
+				if (det == 0)
+					continue;
+
+				evaluate((-da * dc2 + dc * da2) / det, (-db * da2 + da * db2) / det);
+			}
 		}
 	}
+
+	return max_value;
 }
 
-Real MeshCuboid::distance_between_cuboids(
+Real MeshCuboid::directed_hausdorff_distance_between_cuboids(
 	const MeshCuboid *_cuboid_1, const MeshCuboid *_cuboid_2)
 {
-	// NOTE: Assume that cuboid surface points exist.
 	assert(_cuboid_1);
 	assert(_cuboid_2);
 
-	unsigned int num_cuboid_surface_points_1 = _cuboid_1->cuboid_surface_points_.size();
-	unsigned int num_cuboid_surface_points_2 = _cuboid_2->cuboid_surface_points_.size();
-
-	// TODO: Pre-compute KD-trees.
-	Eigen::MatrixXd cuboid_surface_points_1(3, num_cuboid_surface_points_1);
-	Eigen::MatrixXd cuboid_surface_points_2(3, num_cuboid_surface_points_2);
-
-	for (unsigned int point_index = 0; point_index < num_cuboid_surface_points_1; ++point_index)
+	Eigen::Vector3d center_1, center_2;
+	Eigen::Matrix3d axes_1, axes_2;
+	Eigen::Vector3d half_size_1, half_size_2;
+	for (unsigned int axis_index = 0; axis_index < 3; ++axis_index)
 	{
+		center_1[axis_index] = _cuboid_1->bbox_center_[axis_index];
+		center_2[axis_index] = _cuboid_2->bbox_center_[axis_index];
 		for (unsigned int i = 0; i < 3; ++i)
-			cuboid_surface_points_1.col(point_index)(i) =
-			_cuboid_1->cuboid_surface_points_[point_index]->point_[i];
+		{
+			axes_1(i, axis_index) = _cuboid_1->bbox_axes_[axis_index][i];
+			axes_2(i, axis_index) = _cuboid_2->bbox_axes_[axis_index][i];
+		}
+		axes_1.col(axis_index).normalize();
+		axes_2.col(axis_index).normalize();
+		half_size_1[axis_index] = 0.5 * _cuboid_1->bbox_size_[axis_index];
+		half_size_2[axis_index] = 0.5 * _cuboid_2->bbox_size_[axis_index];
 	}
 
-	for (unsigned int point_index = 0; point_index < num_cuboid_surface_points_2; ++point_index)
+	// NOTE:
+	// The distance from a point on the surface of '_cuboid_1' to the surface of '_cuboid_2'
+	// is the absolute value of its signed distance to '_cuboid_2'.
+	// (1) Outside '_cuboid_2': The signed distance is convex, and its maximum on
+	// the surface of '_cuboid_1' is attained at a corner.
+	Eigen::MatrixXd corners_1(3, k_num_corners);
+	for (unsigned int corner_index = 0; corner_index < k_num_corners; ++corner_index)
 	{
-		for (unsigned int i = 0; i < 3; ++i)
-			cuboid_surface_points_2.col(point_index)(i) =
-			_cuboid_2->cuboid_surface_points_[point_index]->point_[i];
+		corners_1.col(corner_index) = center_1;
+		for (unsigned int axis_index = 0; axis_index < 3; ++axis_index)
+		{
+			const Real sign = ((corner_index >> (2 - axis_index)) & 1) ? 1.0 : -1.0;
+			corners_1.col(corner_index) += sign * half_size_1[axis_index] * axes_1.col(axis_index);
+		}
 	}
 
-	ANNpointArray ann_points_1 = NULL;
-	ANNkd_tree* ann_kd_tree_1 = ICP::create_kd_tree(cuboid_surface_points_1, ann_points_1);
+	Eigen::VectorXd corner_distances;
+	_cuboid_2->points_to_cuboid_distances(corners_1, corner_distances);
+	Real max_distance = corner_distances.maxCoeff();
+
+	// (2) Inside '_cuboid_2': The depth is the minimum of the distances to the six face
+	// planes of '_cuboid_2', which are affine on each face of '_cuboid_1'.
+	for (unsigned int face_index = 0; face_index < k_num_faces; ++face_index)
+	{
+		const unsigned int normal_axis = face_index / 2;
+		const unsigned int axis_s = (normal_axis + 1) % 3;
+		const unsigned int axis_t = (normal_axis + 2) % 3;
+		const Real sign = ((face_index % 2) == 0) ? 1.0 : -1.0;
+
+		Eigen::Vector3d face_center = center_1
+			+ sign * half_size_1[normal_axis] * axes_1.col(normal_axis);
+
+		Eigen::Matrix<Real, 6, 3> affine;
+		for (unsigned int axis_index = 0; axis_index < 3; ++axis_index)
+		{
+			const Eigen::Vector3d axis = axes_2.col(axis_index);
+			const Real offset = axis.dot(face_center - center_2);
+			const Real slope_s = axis.dot(axes_1.col(axis_s));
+			const Real slope_t = axis.dot(axes_1.col(axis_t));
+
+			affine.row(2 * axis_index + 0) << half_size_2[axis_index] - offset, -slope_s, -slope_t;
+			affine.row(2 * axis_index + 1) << half_size_2[axis_index] + offset, slope_s, slope_t;
+		}
+
+		max_distance = std::max(max_distance, max_min_affine_on_rectangle(
+			affine, half_size_1[axis_s], half_size_1[axis_t]));
+	}
+
+	return max_distance;
+}
+
+Real MeshCuboid::hausdorff_distance_between_cuboids(
+	const MeshCuboid *_cuboid_1, const MeshCuboid *_cuboid_2)
+{
+	return std::max(
+		directed_hausdorff_distance_between_cuboids(_cuboid_1, _cuboid_2),
+		directed_hausdorff_distance_between_cuboids(_cuboid_2, _cuboid_1));
+}
+
+Real MeshCuboid::distance_between_cuboids(
+	const MeshCuboid *_cuboid_1, const MeshCuboid *_cuboid_2)
+{
+	assert(_cuboid_1);
+	assert(_cuboid_2);
+
+	if (FLAGS_use_exact_cuboid_distance)
+		return hausdorff_distance_between_cuboids(_cuboid_1, _cuboid_2);
+
+	// NOTE: Assume that cuboid surface points exist.
+	Eigen::MatrixXd cuboid_surface_points_1;
+	Eigen::MatrixXd cuboid_surface_points_2;
+	_cuboid_1->get_cuboid_surface_points(cuboid_surface_points_1);
+	_cuboid_2->get_cuboid_surface_points(cuboid_surface_points_2);
+
+	unsigned int num_cuboid_surface_points_1 = cuboid_surface_points_1.cols();
+	unsigned int num_cuboid_surface_points_2 = cuboid_surface_points_2.cols();
+
+	// NOTE:
+	// KD-trees are cached in each cuboid.
+	ANNkd_tree* ann_kd_tree_1 = _cuboid_1->cuboid_surface_point_kd_tree_cache_.get_kd_tree(
+		cuboid_surface_points_1);
 	assert(ann_kd_tree_1);
 
-	ANNpointArray ann_points_2 = NULL;
-	ANNkd_tree* ann_kd_tree_2 = ICP::create_kd_tree(cuboid_surface_points_2, ann_points_2);
+	ANNkd_tree* ann_kd_tree_2 = _cuboid_2->cuboid_surface_point_kd_tree_cache_.get_kd_tree(
+		cuboid_surface_points_2);
 	assert(ann_kd_tree_2);
 
 	// 1 -> 2.
@@ -1927,12 +2477,7 @@ Real MeshCuboid::distance_between_cuboids(
 	ICP::get_closest_points(ann_kd_tree_1, cuboid_surface_points_2, distances_21);
 	assert(distances_21.rows() == num_cuboid_surface_points_2);
 
-	if (ann_points_1) annDeallocPts(ann_points_1);
-	if (ann_points_2) annDeallocPts(ann_points_2);
-	delete ann_kd_tree_1;
-	delete ann_kd_tree_2;
-
-	Real max_distance = (distances_12.maxCoeff(), distances_21.maxCoeff());
+	Real max_distance = std::max(distances_12.maxCoeff(), distances_21.maxCoeff());
 	return max_distance;
 }
 
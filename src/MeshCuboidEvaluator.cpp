@@ -5,6 +5,7 @@
 
 #include <fstream>
 #include <iostream>
+#include <limits>
 
 
 MeshCuboidEvaluator::MeshCuboidEvaluator(
@@ -48,11 +49,8 @@ void MeshCuboidEvaluator::evaluate_point_to_point_distances(
 			_ground_truth_sample_points[sample_point_index]->point_[i];
 	}
 
-	ANNpointArray ground_truth_sample_ann_points;
-	ANNkd_tree *ground_truth_sample_ann_kd_tree = ICP::create_kd_tree(ground_truth_sample_points,
-		ground_truth_sample_ann_points);
-	assert(ground_truth_sample_ann_points);
-	assert(ground_truth_sample_ann_kd_tree);
+	ICP::KdTree ground_truth_sample_kd_tree(ground_truth_sample_points);
+	assert(!ground_truth_sample_kd_tree.empty());
 
 
 	// Create a test sample point KD-tree.
@@ -66,22 +64,19 @@ void MeshCuboidEvaluator::evaluate_point_to_point_distances(
 			_test_sample_points[sample_point_index]->point_[i];
 	}
 
-	ANNpointArray test_sample_ann_points;
-	ANNkd_tree *test_sample_ann_kd_tree = ICP::create_kd_tree(test_sample_points,
-		test_sample_ann_points);
-	assert(test_sample_ann_points);
-	assert(test_sample_ann_kd_tree);
+	ICP::KdTree test_sample_kd_tree(test_sample_points);
+	assert(!test_sample_kd_tree.empty());
 
 
 	// Ground truth -> test.
 	Eigen::VectorXd ground_truth_to_test_distances;
-	ICP::get_closest_points(test_sample_ann_kd_tree, ground_truth_sample_points,
+	ICP::get_closest_points(test_sample_kd_tree, ground_truth_sample_points,
 		ground_truth_to_test_distances);
 	assert(ground_truth_to_test_distances.rows() == num_ground_truth_sample_points);
 
 	// Test -> ground truth.
 	Eigen::VectorXd test_to_ground_truth_distances;
-	ICP::get_closest_points(ground_truth_sample_ann_kd_tree, test_sample_points,
+	ICP::get_closest_points(ground_truth_sample_kd_tree, test_sample_points,
 		test_to_ground_truth_distances);
 	assert(test_to_ground_truth_distances.rows() == num_test_sample_points);
 
@@ -160,16 +155,10 @@ void MeshCuboidEvaluator::evaluate_point_to_point_distances(
 	file << accuracy.transpose().format(csv_format) << std::endl;
 	file << completeness.transpose().format(csv_format) << std::endl;
 	file.close();
-
-
-	annDeallocPts(ground_truth_sample_ann_points);
-	annDeallocPts(test_sample_ann_points);
-	delete ground_truth_sample_ann_kd_tree;
-	delete test_sample_ann_kd_tree;
 }
 
 void MeshCuboidEvaluator::evaluate_point_to_point_distances(
-	const MeshCuboidStructure *_test_cuboid_structure,
+	MeshCuboidStructure *_test_cuboid_structure,
 	const char *_filename)
 {
 	assert(_test_cuboid_structure);
@@ -181,9 +170,12 @@ void MeshCuboidEvaluator::evaluate_point_to_point_distances(
 	output_filename_sstr.clear(); output_filename_sstr.str("");
 	output_filename_sstr << _filename << ".csv";
 
+	// NOTE:
+	// Sample point errors are written. Cuboid sample points below are collected after
+	// mutable sample points are taken here (see 'get_mutable_sample_points()').
 	evaluate_point_to_point_distances(
-		ground_truth_cuboid_structure_->sample_points_,
-		_test_cuboid_structure->sample_points_,
+		ground_truth_cuboid_structure_->get_mutable_sample_points(),
+		_test_cuboid_structure->get_mutable_sample_points(),
 		output_filename_sstr.str().c_str(), true);
 
 
@@ -347,6 +339,22 @@ void MeshCuboidEvaluator::evaluate_point_labeling(
 	file.close();
 }
 
+void MeshCuboidEvaluator::get_cuboid_surface_distances(
+	const std::vector<MeshCuboid *> &_cuboids,
+	const Eigen::MatrixXd &_points,
+	Eigen::VectorXd &_distances)
+{
+	_distances = Eigen::VectorXd::Constant(_points.cols(), std::numeric_limits<Real>::max());
+
+	Eigen::VectorXd cuboid_distances;
+	for (std::vector<MeshCuboid *>::const_iterator it = _cuboids.begin(); it != _cuboids.end(); ++it)
+	{
+		assert(*it);
+		(*it)->points_to_cuboid_surface_distances(_points, cuboid_distances);
+		_distances = _distances.cwiseMin(cuboid_distances);
+	}
+}
+
 void MeshCuboidEvaluator::evaluate_cuboid_distance(
 	const MeshCuboidStructure *_test_cuboid_structure, const char *_filename)
 {
@@ -396,9 +404,12 @@ void MeshCuboidEvaluator::evaluate_cuboid_distance(
 			if (!ground_truth_cuboid || !test_cuboid)
 				continue;
 
-			// NOTE: Cuboid surface points are replaced.
-			ground_truth_cuboid->create_grid_points_on_cuboid_surface(FLAGS_param_num_cuboid_surface_points);
-			test_cuboid->create_grid_points_on_cuboid_surface(FLAGS_param_num_cuboid_surface_points);
+			if (!FLAGS_use_exact_cuboid_distance)
+			{
+				// NOTE: Cuboid surface points are replaced.
+				ground_truth_cuboid->create_grid_points_on_cuboid_surface(FLAGS_param_num_cuboid_surface_points);
+				test_cuboid->create_grid_points_on_cuboid_surface(FLAGS_param_num_cuboid_surface_points);
+			}
 
 			Real cuboid_distance = MeshCuboid::distance_between_cuboids(ground_truth_cuboid, test_cuboid);
 			max_cuboid_distance = std::max(cuboid_distance, max_cuboid_distance);
@@ -413,8 +424,25 @@ void MeshCuboidEvaluator::evaluate_cuboid_distance(
 
 
 	// For entire object.
-	std::vector<MeshCuboidSurfacePoint *> all_test_cuboid_surface_points;
-	std::vector<MeshCuboidSurfacePoint *> all_ground_truth_cuboid_surface_points;
+	if (FLAGS_use_exact_cuboid_distance)
+	{
+		// NOTE:
+		// Cuboid surface points are not created for each label above with exact distances,
+		// but they are measured to the other cuboid surfaces below.
+		std::vector<MeshCuboid *> all_cuboids = _test_cuboid_structure->get_all_cuboids();
+		const std::vector<MeshCuboid *> all_ground_truth_cuboids =
+			ground_truth_cuboid_structure_->get_all_cuboids();
+		all_cuboids.insert(all_cuboids.end(), all_ground_truth_cuboids.begin(), all_ground_truth_cuboids.end());
+
+		for (std::vector<MeshCuboid *>::iterator it = all_cuboids.begin(); it != all_cuboids.end(); ++it)
+		{
+			// NOTE: Cuboid surface points are replaced.
+			(*it)->create_grid_points_on_cuboid_surface(FLAGS_param_num_cuboid_surface_points);
+		}
+	}
+
+	std::vector<const MeshCuboidSurfacePoint *> all_test_cuboid_surface_points;
+	std::vector<const MeshCuboidSurfacePoint *> all_ground_truth_cuboid_surface_points;
 
 	_test_cuboid_structure->get_all_cuboid_surface_points(all_test_cuboid_surface_points);
 	ground_truth_cuboid_structure_->get_all_cuboid_surface_points(all_ground_truth_cuboid_surface_points);
@@ -440,30 +468,42 @@ void MeshCuboidEvaluator::evaluate_cuboid_distance(
 			all_ground_truth_cuboid_surface_points[point_index]->point_[i];
 	}
 
-	ANNpointArray ann_points_1 = NULL;
-	ANNkd_tree* ann_kd_tree_1 = ICP::create_kd_tree(test_cuboid_surface_points_mat, ann_points_1);
-	assert(ann_kd_tree_1);
+	Eigen::VectorXd distances_12;
+	Eigen::VectorXd distances_21;
+
+	if (FLAGS_use_exact_cuboid_distance)
+	{
+		// NOTE:
+		// Distances from cuboid surface points to the other cuboid surfaces are exact.
+		// 1 -> 2.
+		get_cuboid_surface_distances(ground_truth_cuboid_structure_->get_all_cuboids(),
+			test_cuboid_surface_points_mat, distances_12);
+
+		// 2 -> 1.
+		get_cuboid_surface_distances(_test_cuboid_structure->get_all_cuboids(),
+			ground_truth_cuboid_surface_points_mat, distances_21);
+	}
+	else
+	{
+		ICP::KdTree kd_tree_1(test_cuboid_surface_points_mat);
+		assert(!kd_tree_1.empty());
+
+		ICP::KdTree kd_tree_2(ground_truth_cuboid_surface_points_mat);
+		assert(!kd_tree_2.empty());
 
-	ANNpointArray ann_points_2 = NULL;
-	ANNkd_tree* ann_kd_tree_2 = ICP::create_kd_tree(ground_truth_cuboid_surface_points_mat, ann_points_2);
-	assert(ann_kd_tree_2);
+		// 1 -> 2.
+		ICP::get_closest_points(kd_tree_2, test_cuboid_surface_points_mat, distances_12);
 
-	// 1 -> 2.
-	Eigen::VectorXd distances_12;
-	ICP::get_closest_points(ann_kd_tree_2, test_cuboid_surface_points_mat, distances_12);
-	assert(distances_12.rows() == num_test_cuboid_surface_points);
+		// 2 -> 1.
+		ICP::get_closest_points(kd_tree_1, ground_truth_cuboid_surface_points_mat, distances_21);
+	}
 
-	// 2 -> 1.
-	Eigen::VectorXd distances_21;
-	ICP::get_closest_points(ann_kd_tree_1, ground_truth_cuboid_surface_points_mat, distances_21);
+	assert(distances_12.rows() == num_test_cuboid_surface_points);
 	assert(distances_21.rows() == num_ground_truth_cuboid_surface_points);
 
-	if (ann_points_1) annDeallocPts(ann_points_1);
-	if (ann_points_2) annDeallocPts(ann_points_2);
-	delete ann_kd_tree_1;
-	delete ann_kd_tree_2;
-
-	Real total_max_cuboid_distance = (distances_12.maxCoeff(), distances_21.maxCoeff());
+	Real total_max_cuboid_distance = -1;
+	if (num_test_cuboid_surface_points > 0 && num_ground_truth_cuboid_surface_points > 0)
+		total_max_cuboid_distance = std::max(distances_12.maxCoeff(), distances_21.maxCoeff());
 
 	file << "all,";
 	if (total_max_cuboid_distance < 0)
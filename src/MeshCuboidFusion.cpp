@@ -1,9 +1,13 @@
 #include "MeshCuboidFusion.h"
 
+#include "MeshCuboidGridGraphCut.h"
 #include "MeshCuboidParameters.h"
+#include "MeshCuboidVisibility.h"
 #include "ICP.h"
 #include "Utilities.h"
 
+#include <limits>
+#include <omp.h>
 #include <Eigen/Core>
 #include <MRFEnergy.h>
 
@@ -116,6 +120,30 @@ int MeshCuboidVoxelGrid::get_voxel_index(const MyMesh::Point _point) const
 	return get_voxel_index(xyz_index);
 }
 
+int MeshCuboidVoxelGrid::get_point_voxel_index(const MyMesh::Point &_point) const
+{
+	int voxel_index = 0;
+
+	for (unsigned int i = 0; i < 3; ++i)
+	{
+		const Real diff = max_[i] - min_[i];
+		assert(diff > 0);
+		if (_point[i] < min_[i] || _point[i] > max_[i])
+		{
+			// Out of voxel grid range.
+			return -1;
+		}
+
+		int axis_index = static_cast<int>((_point[i] - min_[i]) / diff * n_voxels_[i]);
+		axis_index = std::max(axis_index, 0);
+		axis_index = std::min(axis_index, n_voxels_[i] - 1);
+		voxel_index = voxel_index * n_voxels_[i] + axis_index;
+	}
+
+	assert(voxel_index < n_voxels());
+	return voxel_index;
+}
+
 MyMesh::Point MeshCuboidVoxelGrid::get_center(const int _voxel_index) const
 {
 	MeshCuboidVoxelIndex3D xyz_index = get_voxel_index(_voxel_index);
@@ -165,6 +193,49 @@ void MeshCuboidVoxelGrid::get_point_correspondences(
 	}
 }
 
+void MeshCuboidVoxelGrid::get_point_correspondences(
+	const std::vector<MyMesh::Point> &_points,
+	std::vector<int> &_points_to_voxels,
+	std::vector<int> &_voxel_point_offsets,
+	std::vector<int> &_voxel_point_indices) const
+{
+	const int num_points = static_cast<int>(_points.size());
+	const int num_voxels = n_voxels();
+	_points_to_voxels.resize(num_points);
+	_voxel_point_offsets.assign(num_voxels + 1, 0);
+
+#pragma omp parallel for
+	for (int point_index = 0; point_index < num_points; ++point_index)
+		_points_to_voxels[point_index] = get_point_voxel_index(_points[point_index]);
+
+	// Count points in each voxel.
+	int num_voxel_points = 0;
+	for (int point_index = 0; point_index < num_points; ++point_index)
+	{
+		const int voxel_index = _points_to_voxels[point_index];
+		if (voxel_index < 0)
+			continue;
+		++_voxel_point_offsets[voxel_index + 1];
+		++num_voxel_points;
+	}
+
+	for (int voxel_index = 0; voxel_index < num_voxels; ++voxel_index)
+		_voxel_point_offsets[voxel_index + 1] += _voxel_point_offsets[voxel_index];
+	assert(_voxel_point_offsets[num_voxels] == num_voxel_points);
+
+	// Scatter point indices.
+	std::vector<int> voxel_point_positions(_voxel_point_offsets.begin(), _voxel_point_offsets.end() - 1);
+	_voxel_point_indices.resize(num_voxel_points);
+
+	for (int point_index = 0; point_index < num_points; ++point_index)
+	{
+		const int voxel_index = _points_to_voxels[point_index];
+		if (voxel_index < 0)
+			continue;
+		_voxel_point_indices[voxel_point_positions[voxel_index]++] = point_index;
+	}
+}
+
 void MeshCuboidVoxelGrid::get_voxel_occupancies(const std::vector<MyMesh::Point> &_points,
 	Eigen::VectorXd &_voxel_occupancies) const
 {
@@ -173,7 +244,7 @@ void MeshCuboidVoxelGrid::get_voxel_occupancies(const std::vector<MyMesh::Point>
 
 	for (unsigned int point_index = 0; point_index < num_points; ++point_index)
 	{
-		int voxel_index = get_voxel_index(_points[point_index]);
+		int voxel_index = get_point_voxel_index(_points[point_index]);
 
 		// Out of voxel grid range.
 		if (voxel_index < 0)
@@ -201,8 +272,178 @@ void MeshCuboidVoxelGrid::get_distance_map(ANNpointArray &_ann_points, ANNkd_tre
 	ICP::get_closest_points(__ann_kd_tree, center_points_mat, _voxel_to_point_distances);
 }
 
+// Squared distance transform of a sampled function on a line with the given spacing
+// (P. Felzenszwalb and D. Huttenlocher, Distance Transforms of Sampled Functions, 2012).
+// Infinite values of '_f' are ignored. The buffers must have at least (n) and (n + 1) elements.
+static void squared_distance_transform_1d(const int _n, const Real _spacing,
+	const Real *_f, Real *_d, int *_v, Real *_z)
+{
+	const Real infinity = std::numeric_limits<Real>::infinity();
+	int k = -1;
+
+	for (int q = 0; q < _n; ++q)
+	{
+		if (_f[q] == infinity)
+			continue;
+
+		const Real x_q = q * _spacing;
+		if (k < 0)
+		{
+			k = 0;
+			_v[0] = q;
+			_z[0] = -infinity;
+			_z[1] = infinity;
+			continue;
+		}
+
+		Real s;
+		while (true)
+		{
+			const Real x_v = _v[k] * _spacing;
+			s = ((_f[q] + x_q * x_q) - (_f[_v[k]] + x_v * x_v)) / (2 * (x_q - x_v));
+			if (s > _z[k]) break;
+			// NOTE: '_z[0]' is negative infinity, so 'k' does not become negative.
+			--k;
+		}
+
+		++k;
+		_v[k] = q;
+		_z[k] = s;
+		_z[k + 1] = infinity;
+	}
+
+	if (k < 0)
+	{
+		for (int q = 0; q < _n; ++q)
+			_d[q] = infinity;
+		return;
+	}
+
+	k = 0;
+	for (int q = 0; q < _n; ++q)
+	{
+		const Real x_q = q * _spacing;
+		while (_z[k + 1] < x_q) ++k;
+		const Real diff = (q - _v[k]) * _spacing;
+		_d[q] = diff * diff + _f[_v[k]];
+	}
+}
+
+void MeshCuboidVoxelGrid::get_distance_map(const std::vector<MyMesh::Point> &_points,
+	const Real _max_distance, Eigen::VectorXd &_voxel_to_point_distances) const
+{
+	const Real infinity = std::numeric_limits<Real>::infinity();
+	assert(_max_distance >= 0);
+	assert(_max_distance < infinity);
+
+	// NOTE:
+	// The transform is computed on a grid padded by '_max_distance' on each side, so that
+	// points out of the voxel grid range but within '_max_distance' are also taken into
+	// account as in the kd-tree distance map.
+	MeshCuboidVoxelIndex3D n_padding_voxels, n_padded_voxels;
+	Real spacings[3];
+	for (unsigned int i = 0; i < 3; ++i)
+	{
+		spacings[i] = (max_[i] - min_[i]) / n_voxels_[i];
+		assert(spacings[i] > 0);
+		n_padding_voxels[i] = static_cast<int>(std::ceil(_max_distance / spacings[i]));
+		n_padded_voxels[i] = n_voxels_[i] + 2 * n_padding_voxels[i];
+	}
+
+	const int num_padded_voxels = n_padded_voxels[0] * n_padded_voxels[1] * n_padded_voxels[2];
+
+	// NOTE:
+	// Voxel index = x * (n_y * n_z) + y * n_z + z.
+	const int strides[3] = { n_padded_voxels[1] * n_padded_voxels[2], n_padded_voxels[2], 1 };
+
+	// Squared distances.
+	std::vector<Real> padded_distances(num_padded_voxels, infinity);
+	for (std::vector<MyMesh::Point>::const_iterator it = _points.begin(); it != _points.end(); ++it)
+	{
+		int padded_voxel_index = 0;
+		for (unsigned int i = 0; i < 3; ++i)
+		{
+			int axis_index = static_cast<int>(std::floor(((*it)[i] - min_[i]) / spacings[i]));
+
+			// NOTE:
+			// Points in the voxel grid range are assigned to the same voxels with
+			// 'get_voxel_occupancies()'.
+			if ((*it)[i] >= min_[i] && (*it)[i] <= max_[i])
+			{
+				axis_index = std::max(axis_index, 0);
+				axis_index = std::min(axis_index, n_voxels_[i] - 1);
+			}
+
+			axis_index += n_padding_voxels[i];
+			if (axis_index < 0 || axis_index >= n_padded_voxels[i])
+			{
+				// Out of the padded voxel grid range.
+				padded_voxel_index = -1;
+				break;
+			}
+
+			padded_voxel_index += axis_index * strides[i];
+		}
+
+		if (padded_voxel_index >= 0)
+			padded_distances[padded_voxel_index] = 0;
+	}
+
+	// The transform is separable, and is applied along each axis in turn.
+	for (int axis_index = 0; axis_index < 3; ++axis_index)
+	{
+		const int n = n_padded_voxels[axis_index];
+		const int stride = strides[axis_index];
+		const Real spacing = spacings[axis_index];
+
+		// The other two axes (axis_1 < axis_2).
+		const int axis_1 = (axis_index == 0) ? 1 : 0;
+		const int axis_2 = (axis_index == 2) ? 1 : 2;
+		const int num_lines = n_padded_voxels[axis_1] * n_padded_voxels[axis_2];
+
+#pragma omp parallel
+		{
+			std::vector<Real> f(n), d(n), z(n + 1);
+			std::vector<int> v(n);
+
+#pragma omp for
+			for (int line_index = 0; line_index < num_lines; ++line_index)
+			{
+				const int start_voxel_index =
+					(line_index / n_padded_voxels[axis_2]) * strides[axis_1]
+					+ (line_index % n_padded_voxels[axis_2]) * strides[axis_2];
+
+				for (int i = 0; i < n; ++i)
+					f[i] = padded_distances[start_voxel_index + i * stride];
+
+				squared_distance_transform_1d(n, spacing, &f[0], &d[0], &v[0], &z[0]);
+
+				for (int i = 0; i < n; ++i)
+					padded_distances[start_voxel_index + i * stride] = d[i];
+			}
+		}
+	}
+
+	// Crop the padding.
+	const int num_voxels = n_voxels();
+	_voxel_to_point_distances.resize(num_voxels);
+	for (int voxel_index = 0; voxel_index < num_voxels; ++voxel_index)
+	{
+		MeshCuboidVoxelIndex3D xyz_index = get_voxel_index(voxel_index);
+		int padded_voxel_index = 0;
+		for (unsigned int i = 0; i < 3; ++i)
+			padded_voxel_index += (xyz_index[i] + n_padding_voxels[i]) * strides[i];
+		_voxel_to_point_distances[voxel_index] = std::sqrt(padded_distances[padded_voxel_index]);
+	}
+}
+
 void run_part_ICP(MeshCuboidStructure &_input, const MeshCuboidStructure &_ground_truth)
 {
+	// NOTE:
+	// Sample point positions are directly changed.
+	// Cuboid sample points below are collected after mutable sample points are taken.
+	std::vector<MeshSamplePoint *> &input_structure_sample_points = _input.get_mutable_sample_points();
+
 	const Real neighbor_distance = FLAGS_param_sparse_neighbor_distance
 		* _ground_truth.mesh_->get_object_diameter();
 
@@ -275,8 +516,9 @@ void run_part_ICP(MeshCuboidStructure &_input, const MeshCuboidStructure &_groun
 		for (SamplePointIndex sample_point_index = 0; sample_point_index < input_cuboid->num_sample_points();
 			++sample_point_index)
 		{
-			MeshSamplePoint* input_sample_point = input_cuboid->get_sample_point(sample_point_index);
-			assert(input_sample_point);
+			MeshSamplePoint* input_sample_point = input_structure_sample_points[
+				input_cuboid->get_sample_point(sample_point_index)->sample_point_index_];
+			assert(input_sample_point == input_cuboid->get_sample_point(sample_point_index));
 
 			for (unsigned int i = 0; i < 3; ++i)
 				input_sample_point->point_[i] = input_sample_points.col(sample_point_index)[i];
@@ -314,6 +556,29 @@ void get_smoothed_voxel_visibility(
 	const Real &_smoothing_parameter,
 	std::vector<Real> &_voxel_visibility)
 {
+	// NOTE:
+	// The binary Potts energy on the voxel grid is submodular, so a graph cut
+	// finds the exact minimum.
+	if (FLAGS_use_grid_graph_cut_visibility_smoothing)
+	{
+		MeshCuboidGridGraphCut graph_cut(_voxels.n_axis_voxels(0),
+			_voxels.n_axis_voxels(1), _voxels.n_axis_voxels(2));
+		assert(graph_cut.num_nodes() == _voxels.n_voxels());
+
+		for (int voxel_index = 0; voxel_index < _voxels.n_voxels(); ++voxel_index)
+		{
+			graph_cut.add_unary_cost(voxel_index,
+				_voxel_visibility[voxel_index], 1.0 - _voxel_visibility[voxel_index]);
+		}
+		graph_cut.set_smoothness_cost(_smoothing_parameter);
+		graph_cut.minimize();
+
+		_voxel_visibility.resize(_voxels.n_voxels(), 0.0);
+		for (int voxel_index = 0; voxel_index < _voxels.n_voxels(); ++voxel_index)
+			_voxel_visibility[voxel_index] = static_cast<Real>(graph_cut.get_label(voxel_index));
+		return;
+	}
+
 	// Smoothing using MRF.
 	MRFEnergy<TypeBinary>* mrf;
 	MRFEnergy<TypeBinary>::NodeId* nodes;
@@ -409,35 +674,32 @@ void fill_voxels_using_visibility(
 {
 	std::vector<MyMesh::Point> symmetry_points;
 	std::vector<int> symmetry_points_to_voxels;
-	std::vector< std::list<int> > symmetry_voxels_to_points;
+	std::vector<int> symmetry_voxel_point_offsets, symmetry_voxel_point_indices;
 
 	_symmetry_cuboid->get_sample_points(symmetry_points);
-	_voxels.get_point_correspondences(symmetry_points,
-		symmetry_points_to_voxels, symmetry_voxels_to_points);
+	_voxels.get_point_correspondences(symmetry_points, symmetry_points_to_voxels,
+		symmetry_voxel_point_offsets, symmetry_voxel_point_indices);
 
 	std::vector<MyMesh::Point> database_points;
 	std::vector<int> database_points_to_voxels;
-	std::vector< std::list<int> > database_voxels_to_points;
+	std::vector<int> database_voxel_point_offsets, database_voxel_point_indices;
 
 	_database_cuboid->get_sample_points(database_points);
-	_voxels.get_point_correspondences(database_points,
-		database_points_to_voxels, database_voxels_to_points);
+	_voxels.get_point_correspondences(database_points, database_points_to_voxels,
+		database_voxel_point_offsets, database_voxel_point_indices);
 
 	for (unsigned int voxel_index = 0; voxel_index < _voxels.n_voxels(); ++voxel_index)
 	{
-		assert(voxel_index < symmetry_voxels_to_points.size());
-		assert(voxel_index < database_voxels_to_points.size());
-		MeshCuboidVoxelIndex3D xyz_index = _voxels.get_voxel_index(voxel_index);
-
-		const std::list<int>& symmetry_voxel_point_indices = symmetry_voxels_to_points[voxel_index];
-		const std::list<int>& database_voxel_point_indices = database_voxels_to_points[voxel_index];
+		assert(voxel_index + 1 < symmetry_voxel_point_offsets.size());
+		assert(voxel_index + 1 < database_voxel_point_offsets.size());
 
 		if (_voxel_visibility_values[voxel_index] > 0.5)
 		{
-			for (std::list<int>::const_iterator it = symmetry_voxel_point_indices.begin();
-				it != symmetry_voxel_point_indices.end(); ++it)
+			for (int i = symmetry_voxel_point_offsets[voxel_index];
+				i < symmetry_voxel_point_offsets[voxel_index + 1]; ++i)
 			{
-				MeshSamplePoint *sample_point = _symmetry_cuboid->get_sample_point(*it);
+				MeshSamplePoint *sample_point = _symmetry_cuboid->get_sample_point(
+					symmetry_voxel_point_indices[i]);
 				assert(sample_point);
 
 				MeshSamplePoint *new_sample_point = _output_cuboid_structure.add_sample_point(
@@ -447,10 +709,11 @@ void fill_voxels_using_visibility(
 		}
 		else
 		{
-			for (std::list<int>::const_iterator it = database_voxel_point_indices.begin();
-				it != database_voxel_point_indices.end(); ++it)
+			for (int i = database_voxel_point_offsets[voxel_index];
+				i < database_voxel_point_offsets[voxel_index + 1]; ++i)
 			{
-				MeshSamplePoint *sample_point = _database_cuboid->get_sample_point(*it);
+				MeshSamplePoint *sample_point = _database_cuboid->get_sample_point(
+					database_voxel_point_indices[i]);
 				assert(sample_point);
 
 				MeshSamplePoint *new_sample_point = _output_cuboid_structure.add_sample_point(
@@ -670,7 +933,7 @@ void fusing_single_symmetry_cuboid(LabelIndex _label_index,
 
 	std::vector<Real> voxel_visibility;
 	MeshCuboid::compute_cuboid_surface_point_visibility(
-		_occlusion_modelview_matrix, occlusion_radius, _original_cuboid_structure.sample_points_,
+		_occlusion_modelview_matrix, occlusion_radius, _original_cuboid_structure.get_sample_points(),
 		voxel_centers, NULL, voxel_visibility);
 
 	// Merge visibility values for voxels in symmetric cuboids.
@@ -761,15 +1024,15 @@ void fusing_pair_symmetry_cuboids(LabelIndex _label_index_1, LabelIndex _label_i
 
 	std::cout << "Computing visibility values... ";
 
+	MeshCuboidVisibilityEngine visibility_engine(
+		_occlusion_modelview_matrix, occlusion_radius,
+		_original_cuboid_structure.get_sample_point_store().get_points());
+
 	std::vector<Real> voxel_visibility_1;
-	MeshCuboid::compute_cuboid_surface_point_visibility(
-		_occlusion_modelview_matrix, occlusion_radius, _original_cuboid_structure.sample_points_,
-		voxel_centers_1, NULL, voxel_visibility_1);
+	visibility_engine.compute_visibility(voxel_centers_1, NULL, voxel_visibility_1);
 
 	std::vector<Real> voxel_visibility_2;
-	MeshCuboid::compute_cuboid_surface_point_visibility(
-		_occlusion_modelview_matrix, occlusion_radius, _original_cuboid_structure.sample_points_,
-		voxel_centers_2, NULL, voxel_visibility_2);
+	visibility_engine.compute_visibility(voxel_centers_2, NULL, voxel_visibility_2);
 
 	// Merge visibility values for voxels in symmetric cuboids.
 	merge_symmetric_cuboids_visibility(_symmetry_group, voxels_1, voxels_2, voxel_visibility_1, voxel_visibility_2);
@@ -882,6 +1145,10 @@ void reconstruct_fusion(const char *_mesh_filepath,
 
 
 	// Other single cuboids.
+	MeshCuboidVisibilityEngine visibility_engine(
+		_occlusion_modelview_matrix, occlusion_radius,
+		_original_cuboid_structure.get_sample_point_store().get_points());
+
 	unsigned int num_labels = _symmetry_cuboid_structure.num_labels();
 	for (LabelIndex label_index = 0; label_index < num_labels; ++label_index)
 	{
@@ -910,9 +1177,7 @@ void reconstruct_fusion(const char *_mesh_filepath,
 
 		std::cout << "Computing visibility values... ";
 		std::vector<Real> voxel_visibility;
-		MeshCuboid::compute_cuboid_surface_point_visibility(
-			_occlusion_modelview_matrix, occlusion_radius, _original_cuboid_structure.sample_points_,
-			voxel_centers, NULL, voxel_visibility);
+		visibility_engine.compute_visibility(voxel_centers, NULL, voxel_visibility);
 
 		get_smoothed_voxel_visibility(
 			voxels, symmetry_cuboid, _occlusion_modelview_matrix, _original_cuboid_structure,
@@ -932,7 +1197,7 @@ void reconstruct_fusion(const char *_mesh_filepath,
 	{
 		if (!is_symmetry_point_visited[sample_point_index])
 		{
-			const MeshSamplePoint *sample_point = _symmetry_cuboid_structure.sample_points_[sample_point_index];
+			const MeshSamplePoint *sample_point = _symmetry_cuboid_structure.get_sample_point(sample_point_index);
 			assert(sample_point);
 			MeshSamplePoint *new_sample_point = _output_cuboid_structure.add_sample_point(
 				sample_point->point_, sample_point->normal_);
@@ -0,0 +1,390 @@
+#include "MeshCuboidGridGraphCut.h"
+
+#include <algorithm>
+#include <cassert>
+#include <limits>
+
+
+MeshCuboidGridGraphCut::MeshCuboidGridGraphCut(const int _n_x, const int _n_y, const int _n_z)
+	: num_nodes_(_n_x * _n_y * _n_z)
+	, flow_(0)
+	, time_(0)
+{
+	assert(_n_x > 0);
+	assert(_n_y > 0);
+	assert(_n_z > 0);
+
+	direction_offsets_[0] = _n_y * _n_z;
+	direction_offsets_[1] = -_n_y * _n_z;
+	direction_offsets_[2] = _n_z;
+	direction_offsets_[3] = -_n_z;
+	direction_offsets_[4] = 1;
+	direction_offsets_[5] = -1;
+
+	boundary_masks_.resize(num_nodes_);
+	int node_index = 0;
+	for (int x = 0; x < _n_x; ++x)
+	{
+		for (int y = 0; y < _n_y; ++y)
+		{
+			for (int z = 0; z < _n_z; ++z, ++node_index)
+			{
+				unsigned char mask = 0;
+				if (x == _n_x - 1) mask |= (1 << 0);
+				if (x == 0) mask |= (1 << 1);
+				if (y == _n_y - 1) mask |= (1 << 2);
+				if (y == 0) mask |= (1 << 3);
+				if (z == _n_z - 1) mask |= (1 << 4);
+				if (z == 0) mask |= (1 << 5);
+				boundary_masks_[node_index] = mask;
+			}
+		}
+	}
+
+	terminal_residuals_.resize(num_nodes_, 0);
+	residuals_.resize(k_num_directions * num_nodes_, 0);
+
+	trees_.resize(num_nodes_, k_free);
+	parents_.resize(num_nodes_, k_no_parent);
+	is_active_.resize(num_nodes_, 0);
+	timestamps_.resize(num_nodes_, 0);
+	distances_.resize(num_nodes_, 0);
+}
+
+MeshCuboidGridGraphCut::~MeshCuboidGridGraphCut()
+{
+}
+
+void MeshCuboidGridGraphCut::add_unary_cost(const int _node_index,
+	const Real _cost_0, const Real _cost_1)
+{
+	assert(_node_index >= 0);
+	assert(_node_index < num_nodes_);
+
+	// NOTE:
+	// Label 0 is the source side, so the cost of label 0 is the capacity to the sink,
+	// and the cost of label 1 is the capacity from the source.
+	Real source_capacity = _cost_1;
+	Real sink_capacity = _cost_0;
+
+	const Real residual = terminal_residuals_[_node_index];
+	if (residual > 0) source_capacity += residual;
+	else sink_capacity -= residual;
+
+	flow_ += std::min(source_capacity, sink_capacity);
+	terminal_residuals_[_node_index] = source_capacity - sink_capacity;
+}
+
+void MeshCuboidGridGraphCut::set_smoothness_cost(const Real _weight)
+{
+	assert(_weight >= 0);
+
+	for (int node_index = 0; node_index < num_nodes_; ++node_index)
+		for (int direction = 0; direction < k_num_directions; ++direction)
+			residual(node_index, direction) = (has_neighbor(node_index, direction) ? _weight : 0);
+}
+
+Real MeshCuboidGridGraphCut::minimize()
+{
+	active_nodes_.clear();
+	orphans_.clear();
+	time_ = 0;
+
+	for (int node_index = 0; node_index < num_nodes_; ++node_index)
+	{
+		is_active_[node_index] = 0;
+		timestamps_[node_index] = 0;
+
+		if (terminal_residuals_[node_index] != 0)
+		{
+			trees_[node_index] = (terminal_residuals_[node_index] > 0) ? k_source_tree : k_sink_tree;
+			parents_[node_index] = k_terminal_parent;
+			distances_[node_index] = 1;
+			set_active(node_index);
+		}
+		else
+		{
+			trees_[node_index] = k_free;
+			parents_[node_index] = k_no_parent;
+		}
+	}
+
+	int source_side_node, direction;
+	while (grow(source_side_node, direction))
+	{
+		++time_;
+		augment(source_side_node, direction);
+
+		while (!orphans_.empty())
+		{
+			const int orphan = orphans_.front();
+			orphans_.pop_front();
+			adopt(orphan);
+		}
+	}
+
+	return flow_;
+}
+
+int MeshCuboidGridGraphCut::get_label(const int _node_index) const
+{
+	assert(_node_index >= 0);
+	assert(_node_index < num_nodes_);
+	return (trees_[_node_index] == k_sink_tree) ? 1 : 0;
+}
+
+void MeshCuboidGridGraphCut::set_active(const int _node_index)
+{
+	if (!is_active_[_node_index])
+	{
+		is_active_[_node_index] = 1;
+		active_nodes_.push_back(_node_index);
+	}
+}
+
+int MeshCuboidGridGraphCut::get_next_active()
+{
+	while (!active_nodes_.empty())
+	{
+		const int node_index = active_nodes_.front();
+		active_nodes_.pop_front();
+		is_active_[node_index] = 0;
+
+		// Nodes freed in the adoption stage are skipped.
+		if (trees_[node_index] != k_free)
+			return node_index;
+	}
+
+	return -1;
+}
+
+bool MeshCuboidGridGraphCut::grow(int &_source_side_node, int &_direction)
+{
+	int node_index;
+	while ((node_index = get_next_active()) >= 0)
+	{
+		const bool is_source_tree = (trees_[node_index] == k_source_tree);
+
+		for (int direction = 0; direction < k_num_directions; ++direction)
+		{
+			if (!has_neighbor(node_index, direction))
+				continue;
+
+			const int n_node_index = get_neighbor(node_index, direction);
+			const Real capacity = is_source_tree ?
+				residual(node_index, direction) : residual(n_node_index, direction ^ 1);
+			if (capacity <= 0)
+				continue;
+
+			if (trees_[n_node_index] == k_free)
+			{
+				trees_[n_node_index] = trees_[node_index];
+				parents_[n_node_index] = static_cast<unsigned char>(direction ^ 1);
+				timestamps_[n_node_index] = timestamps_[node_index];
+				distances_[n_node_index] = distances_[node_index] + 1;
+				set_active(n_node_index);
+			}
+			else if (trees_[n_node_index] != trees_[node_index])
+			{
+				// Found an augmenting path.
+				if (is_source_tree)
+				{
+					_source_side_node = node_index;
+					_direction = direction;
+				}
+				else
+				{
+					_source_side_node = n_node_index;
+					_direction = direction ^ 1;
+				}
+
+				// NOTE:
+				// The node may have more paths, so it is processed again first.
+				is_active_[node_index] = 1;
+				active_nodes_.push_front(node_index);
+				return true;
+			}
+		}
+	}
+
+	return false;
+}
+
+void MeshCuboidGridGraphCut::augment(const int _source_side_node, const int _direction)
+{
+	const int sink_side_node = get_neighbor(_source_side_node, _direction);
+
+	// Find the bottleneck capacity.
+	Real bottleneck = residual(_source_side_node, _direction);
+
+	int node_index = _source_side_node;
+	while (parents_[node_index] != k_terminal_parent)
+	{
+		const int direction = parents_[node_index];
+		const int p_node_index = get_neighbor(node_index, direction);
+		bottleneck = std::min(bottleneck, residual(p_node_index, direction ^ 1));
+		node_index = p_node_index;
+	}
+	bottleneck = std::min(bottleneck, terminal_residuals_[node_index]);
+
+	node_index = sink_side_node;
+	while (parents_[node_index] != k_terminal_parent)
+	{
+		const int direction = parents_[node_index];
+		bottleneck = std::min(bottleneck, residual(node_index, direction));
+		node_index = get_neighbor(node_index, direction);
+	}
+	bottleneck = std::min(bottleneck, -terminal_residuals_[node_index]);
+	assert(bottleneck > 0);
+
+	// Push flow. Nodes whose edges to their parents are saturated become orphans.
+	residual(_source_side_node, _direction) -= bottleneck;
+	residual(sink_side_node, _direction ^ 1) += bottleneck;
+
+	node_index = _source_side_node;
+	while (parents_[node_index] != k_terminal_parent)
+	{
+		const int direction = parents_[node_index];
+		const int p_node_index = get_neighbor(node_index, direction);
+		residual(node_index, direction) += bottleneck;
+		residual(p_node_index, direction ^ 1) -= bottleneck;
+		if (residual(p_node_index, direction ^ 1) <= 0)
+		{
+			parents_[node_index] = k_orphan_parent;
+			orphans_.push_front(node_index);
+		}
+		node_index = p_node_index;
+	}
+	terminal_residuals_[node_index] -= bottleneck;
+	if (terminal_residuals_[node_index] <= 0)
+	{
+		parents_[node_index] = k_orphan_parent;
+		orphans_.push_front(node_index);
+	}
+
+	node_index = sink_side_node;
+	while (parents_[node_index] != k_terminal_parent)
+	{
+		const int direction = parents_[node_index];
+		const int p_node_index = get_neighbor(node_index, direction);
+		residual(p_node_index, direction ^ 1) += bottleneck;
+		residual(node_index, direction) -= bottleneck;
+		if (residual(node_index, direction) <= 0)
+		{
+			parents_[node_index] = k_orphan_parent;
+			orphans_.push_front(node_index);
+		}
+		node_index = p_node_index;
+	}
+	terminal_residuals_[node_index] += bottleneck;
+	if (terminal_residuals_[node_index] >= 0)
+	{
+		parents_[node_index] = k_orphan_parent;
+		orphans_.push_front(node_index);
+	}
+
+	flow_ += bottleneck;
+}
+
+void MeshCuboidGridGraphCut::adopt(const int _orphan)
+{
+	const int infinite_distance = std::numeric_limits<int>::max();
+	const unsigned char tree = trees_[_orphan];
+	const bool is_source_tree = (tree == k_source_tree);
+
+	int min_direction = -1;
+	int min_distance = infinite_distance;
+
+	// Find a new parent in the same tree which is connected to the terminal.
+	for (int direction = 0; direction < k_num_directions; ++direction)
+	{
+		if (!has_neighbor(_orphan, direction))
+			continue;
+
+		const int n_node_index = get_neighbor(_orphan, direction);
+		if (trees_[n_node_index] != tree)
+			continue;
+
+		const Real capacity = is_source_tree ?
+			residual(n_node_index, direction ^ 1) : residual(_orphan, direction);
+		if (capacity <= 0)
+			continue;
+
+		int distance = 0;
+		int node_index = n_node_index;
+		while (true)
+		{
+			if (timestamps_[node_index] == time_)
+			{
+				distance += distances_[node_index];
+				break;
+			}
+
+			++distance;
+			const unsigned char parent = parents_[node_index];
+			if (parent == k_terminal_parent)
+			{
+				timestamps_[node_index] = time_;
+				distances_[node_index] = 1;
+				break;
+			}
+			else if (parent == k_orphan_parent)
+			{
+				distance = infinite_distance;
+				break;
+			}
+			node_index = get_neighbor(node_index, parent);
+		}
+
+		if (distance == infinite_distance)
+			continue;
+
+		if (distance < min_distance)
+		{
+			min_direction = direction;
+			min_distance = distance;
+		}
+
+		// Mark the distances of the nodes in the path.
+		for (node_index = n_node_index; timestamps_[node_index] != time_;
+			node_index = get_neighbor(node_index, parents_[node_index]))
+		{
+			timestamps_[node_index] = time_;
+			distances_[node_index] = distance--;
+		}
+	}
+
+	if (min_direction >= 0)
+	{
+		parents_[_orphan] = static_cast<unsigned char>(min_direction);
+		timestamps_[_orphan] = time_;
+		distances_[_orphan] = min_distance + 1;
+		return;
+	}
+
+	// No parent is found. The orphan becomes free, and its children become orphans.
+	for (int direction = 0; direction < k_num_directions; ++direction)
+	{
+		if (!has_neighbor(_orphan, direction))
+			continue;
+
+		const int n_node_index = get_neighbor(_orphan, direction);
+		if (trees_[n_node_index] != tree)
+			continue;
+
+		const Real capacity = is_source_tree ?
+			residual(n_node_index, direction ^ 1) : residual(_orphan, direction);
+		if (capacity > 0)
+			set_active(n_node_index);
+
+		const unsigned char parent = parents_[n_node_index];
+		if (parent < k_num_directions && get_neighbor(n_node_index, parent) == _orphan)
+		{
+			parents_[n_node_index] = k_orphan_parent;
+			orphans_.push_back(n_node_index);
+		}
+	}
+
+	trees_[_orphan] = k_free;
+	parents_[_orphan] = k_no_parent;
+}
@@ -5,6 +5,53 @@
 #include <Eigen/Eigenvalues> 
 
 
+MeshCuboidNonLinearSolverSession::Problem::Problem()
+	: formulation_(NULL)
+	, is_solved_(false)
+{
+
+}
+
+MeshCuboidNonLinearSolverSession::Problem::~Problem()
+{
+	// NOTE:
+	// IPOPT objects refer to the formulation.
+	app_ = NULL;
+	nlp_ = NULL;
+	delete formulation_;
+}
+
+MeshCuboidNonLinearSolverSession::MeshCuboidNonLinearSolverSession()
+	: num_warm_starts_(0)
+{
+
+}
+
+MeshCuboidNonLinearSolverSession::~MeshCuboidNonLinearSolverSession()
+{
+	clear();
+}
+
+void MeshCuboidNonLinearSolverSession::clear()
+{
+	for (std::vector<Problem *>::iterator it = problems_.begin(); it != problems_.end(); ++it)
+		delete (*it);
+	problems_.clear();
+	num_warm_starts_ = 0;
+}
+
+MeshCuboidNonLinearSolverSession::Problem *MeshCuboidNonLinearSolverSession::find_problem(
+	const std::vector<unsigned int> &_signature) const
+{
+	for (std::vector<Problem *>::const_iterator it = problems_.begin(); it != problems_.end(); ++it)
+	{
+		assert(*it);
+		if ((*it)->signature_ == _signature)
+			return (*it);
+	}
+	return NULL;
+}
+
 MeshCuboidNonLinearSolver::MeshCuboidNonLinearSolver(
 	const std::vector<MeshCuboid *>& _cuboids,
 	const std::vector<MeshCuboidReflectionSymmetryGroup *>& _reflection_symmetry_groups,
@@ -198,7 +245,7 @@ NLPVectorExpression MeshCuboidNonLinearSolver::create_rotation_symmetry_group_va
 }
 
 void MeshCuboidNonLinearSolver::create_energy_functions(
-	const Eigen::MatrixXd &_cuboid_quadratic_term,
+	const Eigen::SparseMatrix<double> &_cuboid_quadratic_term,
 	const Eigen::VectorXd &_cuboid_linear_term,
 	const double _cuboid_constant_term,
 	std::vector<NLPFunction *> &_functions)
@@ -213,12 +260,13 @@ void MeshCuboidNonLinearSolver::create_energy_functions(
 
 	_functions.clear();
 
-	Eigen::MatrixXd quadratic_term = Eigen::MatrixXd::Zero(num_total_variables(), num_total_variables());
+	// NOTE:
+	// Cuboid corner variables are the first variables.
+	Eigen::SparseMatrix<double> quadratic_term = _cuboid_quadratic_term;
+	quadratic_term.conservativeResize(num_total_variables(), num_total_variables());
 	Eigen::VectorXd linear_term = Eigen::VectorXd::Zero(num_total_variables());
 	double constant_term = _cuboid_constant_term;
 
-	quadratic_term.block(0, 0,
-		num_total_cuboid_corner_variables(), num_total_cuboid_corner_variables()) = _cuboid_quadratic_term;
 	linear_term.segment(0, num_total_cuboid_corner_variables()) = _cuboid_linear_term;
 
 	NLPFunction *function_1 = new NLPEigenQuadFunction(quadratic_term, linear_term, constant_term);
@@ -237,7 +285,7 @@ void MeshCuboidNonLinearSolver::create_energy_functions(
 
 NLPFunction *MeshCuboidNonLinearSolver::create_reflection_symmetry_group_energy_function()
 {
-	Eigen::MatrixXd quadratic_term = Eigen::MatrixXd::Zero(num_total_variables(), num_total_variables());
+	std::vector< Eigen::Triplet<double> > quadratic_term_triplets;
 	Eigen::VectorXd linear_term = Eigen::VectorXd::Zero(num_total_variables());
 	double constant_term = 0;
 
@@ -251,11 +299,16 @@ NLPFunction *MeshCuboidNonLinearSolver::create_reflection_symmetry_group_energy_
 	{
 		create_reflection_symmetry_group_energy_function(symmetry_group_index,
 			cuboid_ann_points, cuboid_ann_kd_tree,
-			quadratic_term, linear_term, constant_term);
+			quadratic_term_triplets, linear_term, constant_term);
 	}
 
 	delete_cuboid_sample_point_ann_trees(cuboid_ann_points, cuboid_ann_kd_tree);
 
+	// NOTE:
+	// Duplicated entries are summed.
+	Eigen::SparseMatrix<double> quadratic_term(num_total_variables(), num_total_variables());
+	quadratic_term.setFromTriplets(quadratic_term_triplets.begin(), quadratic_term_triplets.end());
+
 	NLPFunction *function = new NLPEigenQuadFunction(quadratic_term, linear_term, constant_term);
 	return function;
 }
@@ -264,7 +317,7 @@ void MeshCuboidNonLinearSolver::create_reflection_symmetry_group_energy_function
 	const unsigned int _symmetry_group_index,
 	const std::vector<ANNpointArray>& _cuboid_ann_points,
 	const std::vector<ANNkd_tree *>& _cuboid_ann_kd_tree,
-	Eigen::MatrixXd& _quadratic_term,
+	std::vector< Eigen::Triplet<double> >& _quadratic_term_triplets,
 	Eigen::VectorXd& _linear_term,
 	double &_constant_term)
 {
@@ -325,13 +378,15 @@ void MeshCuboidNonLinearSolver::create_reflection_symmetry_group_energy_function
 	std::pair<Index, Index> index_size_pair;
 	index_size_pair = get_reflection_symmetry_group_variable_n_index_size(_symmetry_group_index);
 
-	_quadratic_term.block<3, 3>(index_size_pair.first, index_size_pair.first) +=
-		symmetry_energy_term_weight_ * A1;
-	
 	// NOTE:
 	// Variables 'n' and 't' are adjacent in the variable list.
-	_quadratic_term.block<3 + 1, 3 + 1>(index_size_pair.first, index_size_pair.first) +=
-		symmetry_energy_term_weight_ * A2;
+	Eigen::MatrixXd A = symmetry_energy_term_weight_ * A2;
+	A.block<3, 3>(0, 0) += symmetry_energy_term_weight_ * A1;
+
+	for (unsigned int col = 0; col < 3 + 1; ++col)
+		for (unsigned int row = 0; row < 3 + 1; ++row)
+			_quadratic_term_triplets.push_back(Eigen::Triplet<double>(
+			index_size_pair.first + row, index_size_pair.first + col, A(row, col)));
 
 	_constant_term += symmetry_energy_term_weight_ * c;
 }
@@ -809,6 +864,89 @@ void MeshCuboidNonLinearSolver::fix_cuboid(
 	}
 }
 
+void MeshCuboidNonLinearSolver::get_constraint_signature(
+	std::vector<unsigned int> &_signature) const
+{
+	_signature.clear();
+	_signature.push_back(num_cuboids_);
+
+	_signature.push_back(num_reflection_symmetry_groups_);
+	for (unsigned int symmetry_group_index = 0; symmetry_group_index < num_reflection_symmetry_groups_;
+		++symmetry_group_index)
+	{
+		const MeshCuboidReflectionSymmetryGroup *symmetry_group = reflection_symmetry_groups_[symmetry_group_index];
+		assert(symmetry_group);
+		_signature.push_back(symmetry_group->get_aligned_global_axis_index());
+
+		std::vector< unsigned int > single_cuboid_indices;
+		symmetry_group->get_single_cuboid_indices(cuboids_, single_cuboid_indices);
+		_signature.push_back(single_cuboid_indices.size());
+		_signature.insert(_signature.end(), single_cuboid_indices.begin(), single_cuboid_indices.end());
+
+		std::vector< std::pair<unsigned int, unsigned int> > pair_cuboid_indices;
+		symmetry_group->get_pair_cuboid_indices(cuboids_, pair_cuboid_indices);
+		_signature.push_back(pair_cuboid_indices.size());
+		for (std::vector< std::pair<unsigned int, unsigned int> >::const_iterator it = pair_cuboid_indices.begin();
+			it != pair_cuboid_indices.end(); ++it)
+		{
+			_signature.push_back((*it).first);
+			_signature.push_back((*it).second);
+		}
+	}
+
+	_signature.push_back(num_rotation_symmetry_groups_);
+	for (unsigned int symmetry_group_index = 0; symmetry_group_index < num_rotation_symmetry_groups_;
+		++symmetry_group_index)
+	{
+		const MeshCuboidRotationSymmetryGroup *symmetry_group = rotation_symmetry_groups_[symmetry_group_index];
+		assert(symmetry_group);
+		_signature.push_back(symmetry_group->get_aligned_global_axis_index());
+
+		std::vector< unsigned int > single_cuboid_indices;
+		symmetry_group->get_single_cuboid_indices(cuboids_, single_cuboid_indices);
+		_signature.push_back(single_cuboid_indices.size());
+		_signature.insert(_signature.end(), single_cuboid_indices.begin(), single_cuboid_indices.end());
+	}
+}
+
+SmartPtr<IpoptApplication> MeshCuboidNonLinearSolver::create_ipopt_application()
+{
+	// Create a new instance of IpoptApplication
+	//  (use a SmartPtr, not raw)
+	// We are using the factory, since this allows us to compile this
+	// example with an Ipopt Windows DLL
+	SmartPtr<IpoptApplication> app = IpoptApplicationFactory();
+	//app->RethrowNonIpoptException(true);
+
+	// Change some options
+	// Note: The following choices are only examples, they might not be
+	//       suitable for your optimization problem.
+	app->Options()->SetNumericValue("tol", 1e-8);
+	app->Options()->SetStringValue("mu_strategy", "adaptive");
+	app->Options()->SetIntegerValue("print_level", 0);
+	app->Options()->SetStringValue("fixed_variable_treatment", "relax_bounds");
+	// app->Options()->SetStringValue("output_file", "ipopt.out");
+	// The following overwrites the default name (ipopt.opt) of the
+	// options file
+	// app->Options()->SetStringValue("option_file_name", "ipopt.opt");
+
+	// NOTE:
+	// Used only when warm-started. Starting points close to the bounds are
+	// not pushed away from them.
+	app->Options()->SetNumericValue("warm_start_bound_push", 1e-9);
+	app->Options()->SetNumericValue("warm_start_mult_bound_push", 1e-9);
+
+	// Initialize the IpoptApplication and process the options
+	ApplicationReturnStatus status;
+	status = app->Initialize();
+	if (status != Solve_Succeeded) {
+		std::cout << std::endl << std::endl << "*** Error during initialization!" << std::endl;
+		assert(false);
+	}
+
+	return app;
+}
+
 bool MeshCuboidNonLinearSolver::compute_initial_values(const Eigen::VectorXd &_input,
 	Eigen::VectorXd &_output)
 {
@@ -909,11 +1047,12 @@ void MeshCuboidNonLinearSolver::compute_rotation_symmetry_group_values(Eigen::Ve
 }
 
 void MeshCuboidNonLinearSolver::optimize(
-	const Eigen::MatrixXd& _cuboid_quadratic_term,
+	const Eigen::SparseMatrix<double>& _cuboid_quadratic_term,
 	const Eigen::VectorXd& _cuboid_linear_term,
 	const double _cuboid_constant_term,
 	Eigen::VectorXd* _init_values_vec,
-	const std::vector<unsigned int> *_fixed_cuboid_indices)
+	const std::vector<unsigned int> *_fixed_cuboid_indices,
+	MeshCuboidNonLinearSolverSession *_session)
 {
 	// Update rotation angle.
 	for (unsigned int symmetry_group_index = 0; symmetry_group_index < num_rotation_symmetry_groups_;
@@ -926,19 +1065,60 @@ void MeshCuboidNonLinearSolver::optimize(
 
 	std::vector<NLPFunction *> functions;
 	create_energy_functions(_cuboid_quadratic_term, _cuboid_linear_term, _cuboid_constant_term, functions);
-	NLPFormulation formulation(functions);
-	add_constraints(formulation);
 
-	if (_fixed_cuboid_indices)
+	// NOTE:
+	// Problems with fixed cuboids are not kept in the session since
+	// their constraints depend on the current cuboids.
+	MeshCuboidNonLinearSolverSession::Problem local_problem;
+	MeshCuboidNonLinearSolverSession::Problem *problem = NULL;
+	bool is_hessian_structure_changed = true;
+
+	std::vector<unsigned int> signature;
+	if (_session && !_fixed_cuboid_indices)
+	{
+		get_constraint_signature(signature);
+		problem = _session->find_problem(signature);
+	}
+
+	if (problem)
+	{
+		assert(problem->formulation_);
+		Number nnz_hessian = problem->formulation_->nnz_hessian();
+		problem->formulation_->set_functions(functions);
+		is_hessian_structure_changed = (problem->formulation_->nnz_hessian() != nnz_hessian);
+	}
+	else
 	{
-		for (std::vector<unsigned int>::const_iterator it = (*_fixed_cuboid_indices).begin();
-			it != (*_fixed_cuboid_indices).end(); ++it)
+		if (_session && !_fixed_cuboid_indices)
 		{
-			assert((*it) < cuboids_.size());
-			fix_cuboid((*it), formulation);
+			problem = new MeshCuboidNonLinearSolverSession::Problem();
+			problem->signature_ = signature;
+			_session->problems_.push_back(problem);
 		}
+		else
+			problem = &local_problem;
+
+		problem->formulation_ = new NLPFormulation(functions);
+		add_constraints(*problem->formulation_);
+
+		if (_fixed_cuboid_indices)
+		{
+			for (std::vector<unsigned int>::const_iterator it = (*_fixed_cuboid_indices).begin();
+				it != (*_fixed_cuboid_indices).end(); ++it)
+			{
+				assert((*it) < cuboids_.size());
+				fix_cuboid((*it), *problem->formulation_);
+			}
+		}
+
+		// Create a new instance of your nlp
+		//  (use a SmartPtr, not raw)
+		problem->nlp_ = new IPOPTSolver(problem->formulation_);
+		problem->app_ = create_ipopt_application();
 	}
 
+	NLPFormulation &formulation = *problem->formulation_;
+
 
 	if (_init_values_vec)
 	{
@@ -959,40 +1139,23 @@ void MeshCuboidNonLinearSolver::optimize(
 
 
 	// ---- //
-	// Create a new instance of your nlp
-	//  (use a SmartPtr, not raw)
-	SmartPtr<TNLP> mynlp = new IPOPTSolver(&formulation);
-	//SmartPtr<TNLP> mynlp = new HS071_NLP();
-
-	// Create a new instance of IpoptApplication
-	//  (use a SmartPtr, not raw)
-	// We are using the factory, since this allows us to compile this
-	// example with an Ipopt Windows DLL
-	SmartPtr<IpoptApplication> app = IpoptApplicationFactory();
-	//app->RethrowNonIpoptException(true);
-
-	// Change some options
-	// Note: The following choices are only examples, they might not be
-	//       suitable for your optimization problem.
-	app->Options()->SetNumericValue("tol", 1e-8);
-	app->Options()->SetStringValue("mu_strategy", "adaptive");
-	app->Options()->SetIntegerValue("print_level", 0);
-	app->Options()->SetStringValue("fixed_variable_treatment", "relax_bounds");
-	// app->Options()->SetStringValue("output_file", "ipopt.out");
-	// The following overwrites the default name (ipopt.opt) of the
-	// options file
-	// app->Options()->SetStringValue("option_file_name", "ipopt.opt");
-
-	// Initialize the IpoptApplication and process the options
+	SmartPtr<IpoptApplication> app = problem->app_;
 	ApplicationReturnStatus status;
-	status = app->Initialize();
-	if (status != Solve_Succeeded) {
-		std::cout << std::endl << std::endl << "*** Error during initialization!" << std::endl;
-		assert(false);
-	}
 
-	// Ask Ipopt to solve the problem
-	status = app->OptimizeTNLP(mynlp);
+	if (problem->is_solved_ && !is_hessian_structure_changed && problem->nlp_->has_multipliers())
+	{
+		// Warm-start from the multipliers of the previous solution.
+		// NOTE:
+		// The structure of the problem is the same, so IPOPT reuses its data structures.
+		app->Options()->SetStringValue("warm_start_init_point", "yes");
+		status = app->ReOptimizeTNLP(problem->nlp_);
+		++_session->num_warm_starts_;
+	}
+	else
+	{
+		app->Options()->SetStringValue("warm_start_init_point", "no");
+		status = app->OptimizeTNLP(problem->nlp_);
+	}
 
 	if (status == Solve_Succeeded) {
 		//std::cout << std::endl << std::endl << "*** The problem solved!" << std::endl;
@@ -1003,9 +1166,9 @@ void MeshCuboidNonLinearSolver::optimize(
 		//assert(false);
 	}
 
-	// As the SmartPtrs go out of scope, the reference count
-	// will be decremented and the objects will automatically
-	// be deleted.
+	// NOTE:
+	// Do not warm-start from failed solutions.
+	problem->is_solved_ = (status == Solve_Succeeded || status == Solved_To_Acceptable_Level);
 	// ---- //
 
 
@@ -1108,18 +1271,8 @@ void MeshCuboidNonLinearSolver::update_cuboids(const std::vector< Number >& _val
 		cuboid->set_bbox_corners(new_bbox_corners);
 		cuboid->set_bbox_axes(new_bbox_axes, false);
 
-		// Update cuboid surface points.
-		for (unsigned int point_index = 0; point_index < cuboid->num_cuboid_surface_points();
-			++point_index)
-		{
-			MeshCuboidSurfacePoint *cuboid_surface_point = cuboid->get_cuboid_surface_point(point_index);
-
-			MyMesh::Point new_point(0.0);
-			for (unsigned int corner_index = 0; corner_index < MeshCuboid::k_num_corners; ++corner_index)
-				new_point += cuboid_surface_point->corner_weights_[corner_index] * new_bbox_corners[corner_index];
-
-			cuboid_surface_point->point_ = new_point;
-		}
+		// NOTE:
+		// Cuboid surface points are updated from the new corners when they are requested.
 	}
 }
 
@@ -1184,21 +1337,13 @@ void MeshCuboidNonLinearSolver::create_cuboid_sample_point_ann_trees(
 		_cuboid_ann_points[cuboid_index] = NULL;
 
 		MeshCuboid *cuboid = cuboids_[cuboid_index];
-		unsigned int num_cuboid_sample_points = cuboid->num_sample_points();
-		if (num_cuboid_sample_points == 0)
+		if (cuboid->num_sample_points() == 0)
 			continue;
 
-		Eigen::MatrixXd cuboid_sample_points(3, num_cuboid_sample_points);
-
-		for (unsigned int point_index = 0; point_index < num_cuboid_sample_points; ++point_index)
-		{
-			for (unsigned int i = 0; i < 3; ++i)
-				cuboid_sample_points.col(point_index)(i) =
-				cuboid->get_sample_point(point_index)->point_[i];
-		}
-
-		_cuboid_ann_kd_tree[cuboid_index] = ICP::create_kd_tree(cuboid_sample_points,
-			_cuboid_ann_points[cuboid_index]);
+		// NOTE:
+		// The trees are owned by the cuboids.
+		_cuboid_ann_kd_tree[cuboid_index] = cuboid->get_sample_point_kd_tree(
+			&_cuboid_ann_points[cuboid_index]);
 		assert(_cuboid_ann_points[cuboid_index]);
 		assert(_cuboid_ann_kd_tree[cuboid_index]);
 	}
@@ -1214,12 +1359,8 @@ void MeshCuboidNonLinearSolver::delete_cuboid_sample_point_ann_trees(
 	assert(_cuboid_ann_points.size() == num_cuboids_);
 	assert(_cuboid_ann_kd_tree.size() == num_cuboids_);
 
-	for (unsigned int cuboid_index = 0; cuboid_index < num_cuboids_; ++cuboid_index)
-	{
-		if (_cuboid_ann_points[cuboid_index]) annDeallocPts(_cuboid_ann_points[cuboid_index]);
-		if (_cuboid_ann_kd_tree[cuboid_index]) delete _cuboid_ann_kd_tree[cuboid_index];
-	}
-
+	// NOTE:
+	// The trees are owned by the cuboids, and are not deleted here.
 	_cuboid_ann_points.clear();
 	_cuboid_ann_kd_tree.clear();
 }
@@ -49,6 +49,53 @@ DEFINE_bool(disable_symmetry_terms, false, "");
 DEFINE_bool(disable_per_point_classifier_terms, false, "");
 DEFINE_bool(disable_label_smoothness_terms, false, "");
 DEFINE_bool(disable_part_relation_terms, false, "");
+
+// Use single precision in the occlusion test (for large scans).
+DEFINE_bool(use_float_visibility_test, false, "");
+
+// Find sample to cuboid surface point correspondences in the cuboid local coordinates
+// instead of using KD-trees (in closed form for grid cuboid surface points).
+// Cuboid surface to sample point correspondences still use the sample point KD-tree.
+DEFINE_bool(use_incremental_point_correspondences, false, "");
+
+// Compute exact Hausdorff distances between cuboid surfaces
+// instead of using cuboid surface points.
+DEFINE_bool(use_exact_cuboid_distance, false, "");
+
+// Evaluate batched pair potentials in recognition with single precision matrix products.
+DEFINE_bool(use_single_precision_pair_potentials, false, "");
+
+// Compress trained joint normal relations to 'diagonal - low-rank' inverse covariances
+// preserving this ratio of the total variance. Relations are not compressed if it is 1.
+DEFINE_double(param_relation_energy_threshold, 1.0, "");
+
+// Render occlusion views with the CPU depth buffer instead of OpenGL.
+// The rendering size is (viewer size) * 'param_occlusion_rendering_scale'.
+DEFINE_bool(use_software_occlusion_rendering, false, "");
+DEFINE_double(param_occlusion_rendering_scale, 1.0, "");
+
+// Keep IPOPT problems across the iterations of the attribute optimization,
+// and warm-start them from the previous solutions.
+DEFINE_bool(use_warm_start_non_linear_solver, false, "");
+
+// Optimize attributes without symmetry terms by minimizing the quadratic energy subject to
+// the linearized cuboid constraints with a sparse LDL^T KKT solver instead of IPOPT.
+// Cuboids are refitted after each iteration.
+DEFINE_bool(use_sparse_quadratic_solver, false, "");
+
+// Stop the attribute optimization when the relative energy change is less than
+// 'param_opt_energy_tolerance', or when no cuboid corner moves more than
+// 'param_opt_corner_tolerance' * (object diameter). Zero disables each criterion.
+// Per-iteration energies and timings are written to '(log filename).trace.csv'.
+DEFINE_double(param_opt_energy_tolerance, 1.0E-4, "");
+DEFINE_double(param_opt_corner_tolerance, 1.0E-4, "");
+
+// Compute voxel distance maps in part assembly with the exact Euclidean distance
+// transform of occupied voxels instead of kd-tree queries from voxel centers.
+DEFINE_bool(use_voxel_distance_transform, false, "");
+
+// Smooth voxel visibility in fusion with an exact grid graph cut instead of TRW-S.
+DEFINE_bool(use_grid_graph_cut_visibility_smoothing, false, "");
 // ---- //
 
 
@@ -64,6 +111,8 @@ DEFINE_bool(run_render_assembly, false, "");
 DEFINE_bool(run_render_output, false, "");
 DEFINE_bool(run_render_evaluation, false, "");
 DEFINE_bool(run_extract_symmetry_info, false, "");
+// Compare the sparse KKT solver with IPOPT on the test cuboids (see 'test_initialize()').
+DEFINE_bool(run_quadratic_solver_benchmark, false, "");
 
 DEFINE_bool(no_evaluation, false, "");
 DEFINE_bool(optimize_individual_reflection_symmetry_group, true, "");
@@ -108,6 +157,12 @@ DEFINE_string(joint_normal_relation_filename_prefix, "joint_normal_", "");
 DEFINE_string(cond_normal_relation_filename_prefix, "conditional_normal_", "");
 DEFINE_string(object_list_filename, "object_list.txt", "");
 
+// Relation bundle file in the training directory (see 'MeshCuboidRelationBundle').
+// If empty, relations are trained for each object when predicting.
+// Training also writes a leave-one-out bundle '(object name)_(filename)' for each
+// object, which is used when predicting the object.
+DEFINE_string(relation_bundle_filename, "", "");
+
 DEFINE_int32(random_view_seed, 20150416, "");
 
 // To be removed.
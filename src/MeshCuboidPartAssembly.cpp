@@ -14,14 +14,14 @@ void get_bounding_cylinder(const MeshCuboidStructure &_cuboid_structure,
 	Eigen::MatrixXd &_sample_points, Eigen::VectorXd &_bbox_center,
 	Real &_xy_size, Real &_z_size)
 {
-	const unsigned int num_input_points = _cuboid_structure.sample_points_.size();
+	const unsigned int num_input_points = _cuboid_structure.num_sample_points();
 	assert(num_input_points > 0);
 	_sample_points = Eigen::MatrixXd(3, num_input_points);
 
 	for (SamplePointIndex sample_point_index = 0; sample_point_index < num_input_points;
 		++sample_point_index)
 	{
-		const MeshSamplePoint *sample_point = _cuboid_structure.sample_points_[sample_point_index];
+		const MeshSamplePoint *sample_point = _cuboid_structure.get_sample_point(sample_point_index);
 		assert(sample_point);
 		for (int i = 0; i < 3; ++i)
 			_sample_points.col(sample_point_index)[i] = sample_point->point_[i];
@@ -174,10 +174,11 @@ void MeshViewerCore::run_part_assembly_render_alignment(const std::string _mesh_
 	Eigen::MatrixXd aligned_example_points;
 	get_transformed_sample_points(example_cuboid_structure, _xy_size, _z_size, _angle, aligned_example_points);
 
+	std::vector<MeshSamplePoint *> &sample_points = cuboid_structure_.get_mutable_sample_points();
 	for (SamplePointIndex sample_point_index = 0; sample_point_index < cuboid_structure_.num_sample_points();
 		++sample_point_index)
 	{
-		MeshSamplePoint *sample_point = cuboid_structure_.sample_points_[sample_point_index];
+		MeshSamplePoint *sample_point = sample_points[sample_point_index];
 		sample_point->error_ = 0.0;
 	}
 
@@ -186,7 +187,7 @@ void MeshViewerCore::run_part_assembly_render_alignment(const std::string _mesh_
 	for (SamplePointIndex sample_point_index = 0; sample_point_index < example_cuboid_structure.num_sample_points();
 		++sample_point_index)
 	{
-		MeshSamplePoint *sample_point = example_cuboid_structure.sample_points_[sample_point_index];
+		MeshSamplePoint *sample_point = example_cuboid_structure.get_sample_point(sample_point_index);
 		MyMesh::Normal normal = sample_point->normal_;
 		MyMesh::Point point;
 		for (int i = 0; i < 3; ++i)
@@ -295,6 +296,10 @@ void MeshViewerCore::run_part_assembly_match_parts(const std::string _mesh_filep
 	const Real distance_param = 2 * part_assembly_voxel_variance * part_assembly_voxel_variance;
 	assert(distance_param > 0);
 
+	// NOTE:
+	// Beyond this distance, the Gaussian voxel weight is less than 1.0E-6.
+	const Real max_voxel_distance = std::sqrt(distance_param * std::log(1.0E6));
+
 
 	QFileInfo mesh_file_info(_mesh_filepath.c_str());
 	std::string mesh_name(mesh_file_info.baseName().toLocal8Bit());
@@ -306,7 +311,7 @@ void MeshViewerCore::run_part_assembly_match_parts(const std::string _mesh_filep
 	for (SamplePointIndex sample_point_index = 0; sample_point_index < cuboid_structure_.num_sample_points();
 		++sample_point_index)
 	{
-		MeshSamplePoint *sample_point = cuboid_structure_.sample_points_[sample_point_index];
+		MeshSamplePoint *sample_point = cuboid_structure_.get_sample_point(sample_point_index);
 		assert(sample_point);
 		for (unsigned int i = 0; i < 3; ++i)
 			input_sample_points.col(sample_point_index)(i) = sample_point->point_[i];
@@ -315,6 +320,15 @@ void MeshViewerCore::run_part_assembly_match_parts(const std::string _mesh_filep
 	ANNpointArray input_ann_points;
 	ANNkd_tree* input_ann_kd_tree = ICP::create_kd_tree(input_sample_points, input_ann_points);
 
+	std::vector<MyMesh::Point> input_sample_point_list;
+	if (FLAGS_use_voxel_distance_transform)
+	{
+		input_sample_point_list.resize(cuboid_structure_.num_sample_points());
+		for (SamplePointIndex sample_point_index = 0; sample_point_index < cuboid_structure_.num_sample_points();
+			++sample_point_index)
+			input_sample_point_list[sample_point_index] = cuboid_structure_.get_sample_point(sample_point_index)->point_;
+	}
+
 
 	// Load database.
 	MyMesh example_mesh;
@@ -379,10 +393,12 @@ void MeshViewerCore::run_part_assembly_match_parts(const std::string _mesh_filep
 			get_transformed_sample_points(example_cuboid_structure, _xy_size, _z_size, _angle, transformed_example_points);
 
 			// Assign transformed points.
+			std::vector<MeshSamplePoint *> &example_structure_sample_points =
+				example_cuboid_structure.get_mutable_sample_points();
 			for (SamplePointIndex sample_point_index = 0; sample_point_index < example_cuboid_structure.num_sample_points();
 				++sample_point_index)
 			{
-				MeshSamplePoint *sample_point = example_cuboid_structure.sample_points_[sample_point_index];
+				MeshSamplePoint *sample_point = example_structure_sample_points[sample_point_index];
 				for (int i = 0; i < 3; ++i)
 					sample_point->point_[i] = transformed_example_points.col(sample_point_index)[i];
 			}
@@ -419,7 +435,11 @@ void MeshViewerCore::run_part_assembly_match_parts(const std::string _mesh_filep
 
 				// Compute distance maps.
 				Eigen::VectorXd input_distance_map;
-				local_coord_voxels.get_distance_map(input_ann_points, input_ann_kd_tree, input_distance_map);
+				if (FLAGS_use_voxel_distance_transform)
+					local_coord_voxels.get_distance_map(input_sample_point_list,
+						max_voxel_distance, input_distance_map);
+				else
+					local_coord_voxels.get_distance_map(input_ann_points, input_ann_kd_tree, input_distance_map);
 				assert(input_distance_map.rows() == num_voxels);
 				for (unsigned int i = 0; i < num_voxels; ++i)
 					input_distance_map[i] = std::exp(-input_distance_map[i] * input_distance_map[i] / distance_param);
@@ -505,10 +525,12 @@ void MeshViewerCore::run_part_assembly_reconstruction(const std::string _mesh_fi
 		get_transformed_sample_points(example_cuboid_structure, _xy_size, _z_size, _angle, transformed_example_points);
 
 		// Assign transformed points.
+		std::vector<MeshSamplePoint *> &example_structure_sample_points =
+			example_cuboid_structure.get_mutable_sample_points();
 		for (SamplePointIndex sample_point_index = 0; sample_point_index < example_cuboid_structure.num_sample_points();
 			++sample_point_index)
 		{
-			MeshSamplePoint *sample_point = example_cuboid_structure.sample_points_[sample_point_index];
+			MeshSamplePoint *sample_point = example_structure_sample_points[sample_point_index];
 			for (int i = 0; i < 3; ++i)
 				sample_point->point_[i] = transformed_example_points.col(sample_point_index)[i];
 		}
@@ -12,6 +12,125 @@
 #include <Eigen/Eigenvalues>
 
 
+MeshCuboidPairQuadraticFormFactors::MeshCuboidPairQuadraticFormFactors()
+	: is_zero_(true)
+	, constant_term_(0)
+{
+
+}
+
+void MeshCuboidPairQuadraticFormFactors::compute(
+	const MeshCuboidJointNormalRelations *_relation)
+{
+	const unsigned int num_attributes = MeshCuboidAttributes::k_num_attributes;
+	const unsigned int num_features = MeshCuboidFeatures::k_num_features;
+	const unsigned int num_local_coord_values = 3 * MeshCuboidFeatures::k_num_local_points;
+
+	is_zero_ = (_relation == NULL);
+	constant_term_ = 0;
+	if (is_zero_) return;
+
+
+	// NOTE:
+	// The maps are the same with 'A1_orig' and 'A2_orig' in
+	// 'MeshCuboidJointNormalRelationPredictor::get_pair_quadratic_form()'
+	// with the identity rotation.
+	const Eigen::MatrixXd &attributes_to_features_map = MeshCuboidFeatures::get_attributes_to_features_map();
+
+	MeshCuboidTransformation transformation;
+	Eigen::MatrixXd rotation;
+	Eigen::MatrixXd translation;
+	transformation.get_linear_map_transformation(rotation, translation);
+
+	Eigen::MatrixXd A1_orig = Eigen::MatrixXd::Zero(2 * num_features, 2 * num_attributes);
+	A1_orig.block<num_features, num_attributes>(0, 0) = attributes_to_features_map + translation;
+	A1_orig.block<num_features, num_attributes>(num_features, num_attributes) = attributes_to_features_map;
+	A1_orig.block<num_features, num_attributes>(num_features, 0) = translation;
+
+	Eigen::MatrixXd A2_orig = Eigen::MatrixXd::Zero(2 * num_features, 2 * num_attributes);
+	A2_orig.block<num_features, num_attributes>(0, num_attributes) = attributes_to_features_map + translation;
+	A2_orig.block<num_features, num_attributes>(num_features, 0) = attributes_to_features_map;
+	A2_orig.block<num_features, num_attributes>(num_features, num_attributes) = translation;
+
+
+	// Split the rows by the rotation groups.
+	// NOTE:
+	// Since the center point is always the origin in the local coordinates,
+	// it is not used as the feature values.
+	const unsigned int num_rows = 2 * num_features - MeshCuboidFeatures::k_corner_index;
+	assert(2 * num_rows == MeshCuboidJointNormalRelations::k_mat_size);
+
+	Eigen::MatrixXd G[k_num_rotation_groups];
+	for (unsigned int i = 0; i < k_num_rotation_groups; ++i)
+		G[i] = Eigen::MatrixXd::Zero(MeshCuboidJointNormalRelations::k_mat_size, 2 * num_attributes);
+
+	for (unsigned int row = 0; row < num_rows; ++row)
+	{
+		const unsigned int orig_row = MeshCuboidFeatures::k_corner_index + row;
+		const bool is_local_coord_value = ((orig_row % num_features) < num_local_coord_values);
+		G[is_local_coord_value ? 1 : 0].row(row) = A1_orig.row(orig_row);
+		G[is_local_coord_value ? 2 : 0].row(num_rows + row) = A2_orig.row(orig_row);
+	}
+
+
+	// (Ax + b)'C(Ax + b) = x'(A'CA)x + 2*(b'CA)x.
+	const Eigen::VectorXd b = -_relation->get_mean();
+	const Eigen::MatrixXd C = _relation->get_inv_cov();
+
+	for (unsigned int i = 0; i < k_num_rotation_groups; ++i)
+	{
+		const Eigen::MatrixXd CG = C * G[i];
+		for (unsigned int j = 0; j < k_num_rotation_groups; ++j)
+			quadratic_terms_[j][i] = G[j].transpose() * CG;
+		linear_terms_[i] = (b.transpose() * CG).transpose();
+	}
+	constant_term_ = (b.transpose() * C * b);
+}
+
+void MeshCuboidPairQuadraticFormFactors::get_pair_quadratic_form(
+	const MeshCuboid *_cuboid_1, const MeshCuboid *_cuboid_2,
+	Eigen::MatrixXd &_quadratic_term, Eigen::VectorXd &_linear_term, double& _constant_term)const
+{
+	assert(_cuboid_1); assert(_cuboid_2);
+
+	const unsigned int num_attributes = MeshCuboidAttributes::k_num_attributes;
+	assert(num_attributes == 3 * MeshCuboid::k_num_corners);
+	const unsigned int num_points = 2 * MeshCuboid::k_num_corners;
+
+	_quadratic_term.setZero(2 * num_attributes, 2 * num_attributes);
+	_linear_term.setZero(2 * num_attributes);
+	_constant_term = constant_term_;
+	if (is_zero_) return;
+
+	MeshCuboidTransformation transformation_1;
+	transformation_1.compute_transformation(_cuboid_1);
+	MeshCuboidTransformation transformation_2;
+	transformation_2.compute_transformation(_cuboid_2);
+
+	Eigen::Matrix3d rotations[k_num_rotation_groups];
+	Eigen::Vector3d translation;
+	rotations[0].setIdentity();
+	transformation_1.get_transformation(rotations[1], translation);
+	transformation_2.get_transformation(rotations[2], translation);
+
+	// 'Q_i' rotates each 3x3 block of the corner point coordinates.
+	for (unsigned int i = 0; i < k_num_rotation_groups; ++i)
+	{
+		for (unsigned int j = 0; j < k_num_rotation_groups; ++j)
+		{
+			const Eigen::MatrixXd &quadratic_term = quadratic_terms_[i][j];
+			for (unsigned int col = 0; col < num_points; ++col)
+				for (unsigned int row = 0; row < num_points; ++row)
+					_quadratic_term.block<3, 3>(3 * row, 3 * col) += rotations[i].transpose()
+					* quadratic_term.block<3, 3>(3 * row, 3 * col) * rotations[j];
+		}
+
+		for (unsigned int point = 0; point < num_points; ++point)
+			_linear_term.segment<3>(3 * point) += rotations[i].transpose()
+			* linear_terms_[i].segment<3>(3 * point);
+	}
+}
+
 MeshCuboidPredictor::MeshCuboidPredictor(unsigned int _num_labels)
 	: num_labels_(_num_labels)
 {
@@ -104,6 +223,46 @@ Real MeshCuboidPredictor::get_pair_potential(
 	return potential;
 }
 
+Real MeshCuboidPredictor::get_pair_potential(
+	const MeshCuboidFeatures &_features_1, const MeshCuboidFeatures &_features_2,
+	const MeshCuboidTransformation *_transformation_1, const MeshCuboidTransformation *_transformation_2,
+	const LabelIndex _label_index_1, const LabelIndex _label_index_2,
+	MeshCuboidRelationScratch *_scratch)const
+{
+	assert(_transformation_1); assert(_transformation_2);
+
+	// Not implemented.
+	Real potential = 0.0;
+	return potential;
+}
+
+void MeshCuboidPredictor::get_pair_potentials(const MeshCuboidAxisConfigurationCache &_cache_1,
+	const MeshCuboidFeatures &_features_2, const MeshCuboidTransformation *_transformation_2,
+	const LabelIndex _label_index_1, const LabelIndex _label_index_2,
+	Eigen::VectorXd &_potentials, MeshCuboidRelationScratch *_scratch)const
+{
+	assert(_transformation_2);
+
+	const unsigned int num_axis_configurations = _cache_1.num_axis_configurations();
+	_potentials.resize(num_axis_configurations);
+
+	for (unsigned int axis_configuration_index = 0; axis_configuration_index < num_axis_configurations;
+		++axis_configuration_index)
+	{
+		_potentials[axis_configuration_index] = get_pair_potential(
+			_cache_1.get_features(axis_configuration_index), _features_2,
+			&_cache_1.get_transformation(axis_configuration_index), _transformation_2,
+			_label_index_1, _label_index_2, _scratch);
+	}
+}
+
+bool MeshCuboidPredictor::get_constant_pair_potential(
+	const LabelIndex _label_index_1, const LabelIndex _label_index_2,
+	Real &_potential)const
+{
+	return false;
+}
+
 void MeshCuboidPredictor::get_single_quadratic_form(
 	MeshCuboid *_cuboid, const unsigned int _cuboid_index,
 	Eigen::MatrixXd &_quadratic_term, Eigen::VectorXd &_linear_term, double& _constant_term) const
@@ -132,7 +291,7 @@ void MeshCuboidPredictor::get_single_quadratic_form(
 		cuboid_surface_point_index < num_cuboid_surface_points;
 		++cuboid_surface_point_index)
 	{
-		sum_visibility += _cuboid->get_cuboid_surface_point(cuboid_surface_point_index)->visibility_;
+		sum_visibility += _cuboid->get_cuboid_surface_point_visibility(cuboid_surface_point_index);
 	}
 
 	if (sum_visibility == 0)
@@ -165,8 +324,8 @@ void MeshCuboidPredictor::get_single_quadratic_form(
 		}
 
 		for (unsigned int corner_index = 0; corner_index < MeshCuboid::k_num_corners; ++corner_index)
-			Y_coeff(corner_index) = _cuboid->get_cuboid_surface_point(
-			cuboid_surface_point_index)->corner_weights_[corner_index];
+			Y_coeff(corner_index) = _cuboid->get_cuboid_surface_point_corner_weights(
+			cuboid_surface_point_index)[corner_index];
 
 		all_X_points.col(pair_index) = X_point;
 		all_Y_coeffs.col(pair_index) = Y_coeff;
@@ -198,10 +357,10 @@ void MeshCuboidPredictor::get_single_quadratic_form(
 		}
 
 		for (unsigned int corner_index = 0; corner_index < MeshCuboid::k_num_corners; ++corner_index)
-			Y_coeff(corner_index) = _cuboid->get_cuboid_surface_point(
-			cuboid_surface_point_index)->corner_weights_[corner_index];
+			Y_coeff(corner_index) = _cuboid->get_cuboid_surface_point_corner_weights(
+			cuboid_surface_point_index)[corner_index];
 
-		double visibility = _cuboid->get_cuboid_surface_point(cuboid_surface_point_index)->visibility_;
+		double visibility = _cuboid->get_cuboid_surface_point_visibility(cuboid_surface_point_index);
 
 		all_X_points.col(pair_index) = X_point;
 		all_Y_coeffs.col(pair_index) = Y_coeff;
@@ -285,6 +444,13 @@ Real MeshCuboidPredictor::get_pair_quadratic_form(
 	return 0;
 }
 
+bool MeshCuboidPredictor::get_pair_quadratic_form_factors(
+	const LabelIndex _label_index_1, const LabelIndex _label_index_2,
+	MeshCuboidPairQuadraticFormFactors &_factors)const
+{
+	return false;
+}
+
 Real MeshCuboidPredictor::get_pair_conditional_quadratic_form(
 	const MeshCuboid *_cuboid_1, const MeshCuboid *_cuboid_2,
 	const unsigned int _cuboid_index_1, const unsigned int _cuboid_index_2,
@@ -578,6 +744,17 @@ Real MeshCuboidJointNormalRelationPredictor::get_pair_quadratic_form(
 	return potential;
 }
 
+bool MeshCuboidJointNormalRelationPredictor::get_pair_quadratic_form_factors(
+	const LabelIndex _label_index_1, const LabelIndex _label_index_2,
+	MeshCuboidPairQuadraticFormFactors &_factors)const
+{
+	assert(_label_index_1 < num_labels_);
+	assert(_label_index_2 < num_labels_);
+
+	_factors.compute(relations_[_label_index_1][_label_index_2]);
+	return true;
+}
+
 Real MeshCuboidJointNormalRelationPredictor::get_pair_conditional_quadratic_form(
 	const MeshCuboid *_cuboid_1, const MeshCuboid *_cuboid_2,
 	const unsigned int _cuboid_index_1, const unsigned int _cuboid_index_2,
@@ -770,6 +947,92 @@ void MeshCuboidCondNormalRelationPredictor::get_missing_label_indices(
 	delete[] is_missing_label;
 }
 
+Real MeshCuboidJointNormalRelationPredictor::get_pair_potential(
+	const MeshCuboidFeatures &_features_1, const MeshCuboidFeatures &_features_2,
+	const MeshCuboidTransformation *_transformation_1, const MeshCuboidTransformation *_transformation_2,
+	const LabelIndex _label_index_1, const LabelIndex _label_index_2,
+	MeshCuboidRelationScratch *_scratch) const
+{
+	assert(_transformation_1); assert(_transformation_2);
+
+	assert(_label_index_1 < num_labels_);
+	assert(_label_index_2 < num_labels_);
+
+	Real potential = FLAGS_param_max_potential;
+
+	const MeshCuboidJointNormalRelations *relation_12 = relations_[_label_index_1][_label_index_2];
+	if (relation_12)
+	{
+		potential = relation_12->compute_error(_features_1, _features_2,
+			_transformation_1, _transformation_2, _scratch);
+	}
+
+	return potential;
+}
+
+void MeshCuboidJointNormalRelationPredictor::get_pair_potentials(
+	const MeshCuboidAxisConfigurationCache &_cache_1,
+	const MeshCuboidFeatures &_features_2, const MeshCuboidTransformation *_transformation_2,
+	const LabelIndex _label_index_1, const LabelIndex _label_index_2,
+	Eigen::VectorXd &_potentials, MeshCuboidRelationScratch *_scratch)const
+{
+	assert(_transformation_2);
+
+	assert(_label_index_1 < num_labels_);
+	assert(_label_index_2 < num_labels_);
+
+	const unsigned int num_axis_configurations = _cache_1.num_axis_configurations();
+
+	const MeshCuboidJointNormalRelations *relation_12 = relations_[_label_index_1][_label_index_2];
+	if (!relation_12)
+	{
+		_potentials.setConstant(num_axis_configurations, FLAGS_param_max_potential);
+		return;
+	}
+
+	MeshCuboidRelationScratch local_scratch;
+	MeshCuboidRelationScratch &scratch = (_scratch ? (*_scratch) : local_scratch);
+
+	// NOTE:
+	// Pairwise features of all axis configurations are evaluated with the same relation
+	// in a single batch.
+	Eigen::MatrixXd &features_mat = scratch.features_mat_;
+	features_mat.resize(MeshCuboidJointNormalRelations::k_mat_size, num_axis_configurations);
+
+	for (unsigned int axis_configuration_index = 0; axis_configuration_index < num_axis_configurations;
+		++axis_configuration_index)
+	{
+		MeshCuboidJointNormalRelations::get_pairwise_cuboid_features_in_place(
+			_cache_1.get_features(axis_configuration_index), _features_2,
+			&_cache_1.get_transformation(axis_configuration_index), _transformation_2,
+			scratch.features_vec_);
+		features_mat.col(axis_configuration_index) = scratch.features_vec_;
+	}
+
+	if (FLAGS_use_single_precision_pair_potentials)
+		relation_12->compute_errors_single_precision(features_mat, _potentials, &scratch);
+	else
+		relation_12->compute_errors(features_mat, _potentials, &scratch);
+}
+
+bool MeshCuboidJointNormalRelationPredictor::get_constant_pair_potential(
+	const LabelIndex _label_index_1, const LabelIndex _label_index_2,
+	Real &_potential) const
+{
+	assert(_label_index_1 < num_labels_);
+	assert(_label_index_2 < num_labels_);
+
+	// NOTE:
+	// The potential is the maximum value if the relation is not trained.
+	if (!relations_[_label_index_1][_label_index_2])
+	{
+		_potential = FLAGS_param_max_potential;
+		return true;
+	}
+
+	return false;
+}
+
 Real MeshCuboidCondNormalRelationPredictor::get_pair_potential(
 	const MeshCuboid *_cuboid_1, const MeshCuboid *_cuboid_2,
 	const MeshCuboidAttributes *_attributes_1, const MeshCuboidAttributes *_attributes_2,
@@ -802,6 +1065,52 @@ Real MeshCuboidCondNormalRelationPredictor::get_pair_potential(
 	return potential;
 }
 
+Real MeshCuboidCondNormalRelationPredictor::get_pair_potential(
+	const MeshCuboidFeatures &_features_1, const MeshCuboidFeatures &_features_2,
+	const MeshCuboidTransformation *_transformation_1, const MeshCuboidTransformation *_transformation_2,
+	const LabelIndex _label_index_1, const LabelIndex _label_index_2,
+	MeshCuboidRelationScratch *_scratch) const
+{
+	assert(_transformation_1); assert(_transformation_2);
+
+	assert(_label_index_1 < num_labels_);
+	assert(_label_index_2 < num_labels_);
+
+	Real potential = FLAGS_param_max_potential;
+
+	const MeshCuboidCondNormalRelations *relation_12 = relations_[_label_index_1][_label_index_2];
+	const MeshCuboidCondNormalRelations *relation_21 = relations_[_label_index_2][_label_index_1];
+
+	if (relation_12 && relation_21)
+	{
+		Real potential_12 = relation_12->compute_error(_features_1, _features_2,
+			_transformation_1, _transformation_2, _scratch);
+		Real potential_21 = relation_21->compute_error(_features_2, _features_1,
+			_transformation_2, _transformation_1, _scratch);
+		potential = potential_12 + potential_21;
+	}
+
+	return potential;
+}
+
+bool MeshCuboidCondNormalRelationPredictor::get_constant_pair_potential(
+	const LabelIndex _label_index_1, const LabelIndex _label_index_2,
+	Real &_potential) const
+{
+	assert(_label_index_1 < num_labels_);
+	assert(_label_index_2 < num_labels_);
+
+	// NOTE:
+	// The potential is the maximum value unless both relations are trained.
+	if (!relations_[_label_index_1][_label_index_2] || !relations_[_label_index_2][_label_index_1])
+	{
+		_potential = FLAGS_param_max_potential;
+		return true;
+	}
+
+	return false;
+}
+
 Real MeshCuboidCondNormalRelationPredictor::get_pair_quadratic_form(
 	const MeshCuboid *_cuboid_1, const MeshCuboid *_cuboid_2,
 	const unsigned int _cuboid_index_1, const unsigned int _cuboid_index_2,
@@ -8,6 +8,7 @@
 #include <iostream>
 #include <limits>
 #include <sstream>
+#include <Eigen/Cholesky>
 #include <Eigen/Eigenvalues> 
 #include <Eigen/LU> 
 
@@ -180,17 +181,79 @@ void MeshCuboidFeatures::initialize()
 void MeshCuboidFeatures::compute_features(const MeshCuboid *_cuboid,
 	Eigen::MatrixXd *_attributes_to_features_map)
 {
-	const unsigned int num_attributes = MeshCuboidAttributes::k_num_attributes;
+	assert(_cuboid);
 	assert(features_.size() == static_cast<int>(MeshCuboidFeatures::k_num_features));
 
+	unsigned int next_feature_index = 0;
 
-	// Linear map.
-	Eigen::MatrixXd attributes_to_features_map = 
-		Eigen::MatrixXd::Zero(MeshCuboidFeatures::k_num_features, num_attributes);
 
-	Eigen::RowVector3d up_direction_vec;
-	for (unsigned int axis_index = 0; axis_index < 3; ++axis_index)
-		up_direction_vec(axis_index) = MeshCuboidAttributes::k_up_direction[axis_index];
+	// Center point.
+	for (unsigned int i = 0; i < 3; ++i)
+	{
+		features_[next_feature_index] = _cuboid->get_bbox_center()[i];
+		++next_feature_index;
+	}
+
+
+	// Corner points.
+	for (unsigned int corner_index = 0; corner_index < MeshCuboid::k_num_corners; ++corner_index)
+	{
+		MyMesh::Point corner = _cuboid->get_bbox_corner(corner_index);
+
+		for (unsigned int i = 0; i < 3; ++i)
+		{
+			features_[next_feature_index] = corner[i];
+			++next_feature_index;
+		}
+	}
+
+
+	// Center height.
+	features_[next_feature_index] = dot(MeshCuboidAttributes::k_up_direction, _cuboid->get_bbox_center());
+	++next_feature_index;
+
+
+	// Corner height.
+	for (unsigned int corner_index = 0; corner_index < MeshCuboid::k_num_corners; ++corner_index)
+	{
+		MyMesh::Point corner = _cuboid->get_bbox_corner(corner_index);
+		features_[next_feature_index] = dot(MeshCuboidAttributes::k_up_direction, corner);
+		++next_feature_index;
+	}
+
+	assert(next_feature_index == static_cast<int>(MeshCuboidFeatures::k_num_features));
+
+
+#ifdef DEBUG_TEST
+	MeshCuboidAttributes attributes;
+	attributes.compute_attributes(_cuboid);
+	Eigen::VectorXd same_features = get_attributes_to_features_map() * attributes.get_attributes();
+
+	assert(same_features.rows() == MeshCuboidFeatures::k_num_features);
+	Real error = (same_features - features_).array().abs().sum();
+
+	CHECK_NUMERICAL_ERROR(__FUNCTION__, error);
+#endif
+
+	// Optional.
+	if (_attributes_to_features_map)
+		(*_attributes_to_features_map) = get_attributes_to_features_map();
+}
+
+const Eigen::MatrixXd &MeshCuboidFeatures::get_attributes_to_features_map()
+{
+	// NOTE:
+	// The linear map does not depend on cuboids, and is computed only once.
+	static const Eigen::MatrixXd attributes_to_features_map = compute_attributes_to_features_map();
+	return attributes_to_features_map;
+}
+
+Eigen::MatrixXd MeshCuboidFeatures::compute_attributes_to_features_map()
+{
+	const unsigned int num_attributes = MeshCuboidAttributes::k_num_attributes;
+
+	Eigen::MatrixXd attributes_to_features_map =
+		Eigen::MatrixXd::Zero(MeshCuboidFeatures::k_num_features, num_attributes);
 
 	unsigned int next_feature_index = 0;
 
@@ -198,8 +261,6 @@ void MeshCuboidFeatures::compute_features(const MeshCuboid *_cuboid,
 	// Center point.
 	for (unsigned int i = 0; i < 3; ++i)
 	{
-		features_[next_feature_index] = _cuboid->get_bbox_center()[i];
-
 		//attributes_to_features_map.row(next_feature_index)(
 		//	MeshCuboidAttributes::k_center_index + i) = 1.0;
 		for (unsigned int corner_index = 0; corner_index < MeshCuboid::k_num_corners; ++corner_index)
@@ -216,11 +277,8 @@ void MeshCuboidFeatures::compute_features(const MeshCuboid *_cuboid,
 	// Corner points.
 	for (unsigned int corner_index = 0; corner_index < MeshCuboid::k_num_corners; ++corner_index)
 	{
-		MyMesh::Point corner = _cuboid->get_bbox_corner(corner_index);
-
 		for (unsigned int i = 0; i < 3; ++i)
 		{
-			features_[next_feature_index] = corner[i];
 			attributes_to_features_map.row(next_feature_index)(
 				MeshCuboidAttributes::k_corner_index + 3 * corner_index + i) = 1.0;
 			++next_feature_index;
@@ -229,7 +287,6 @@ void MeshCuboidFeatures::compute_features(const MeshCuboid *_cuboid,
 
 
 	// Center height.
-	features_[next_feature_index] = dot(MeshCuboidAttributes::k_up_direction, _cuboid->get_bbox_center());
 	for (unsigned int i = 0; i < 3; ++i)
 	{
 		//attributes_to_features_map.row(next_feature_index)(
@@ -247,9 +304,6 @@ void MeshCuboidFeatures::compute_features(const MeshCuboid *_cuboid,
 	// Corner height.
 	for (unsigned int corner_index = 0; corner_index < MeshCuboid::k_num_corners; ++corner_index)
 	{
-		MyMesh::Point corner = _cuboid->get_bbox_corner(corner_index);
-		features_[next_feature_index] = dot(MeshCuboidAttributes::k_up_direction, corner);
-
 		for (unsigned int i = 0; i < 3; ++i)
 		{
 			attributes_to_features_map.row(next_feature_index)(
@@ -261,21 +315,7 @@ void MeshCuboidFeatures::compute_features(const MeshCuboid *_cuboid,
 
 	assert(next_feature_index == static_cast<int>(MeshCuboidFeatures::k_num_features));
 
-
-#ifdef DEBUG_TEST
-	MeshCuboidAttributes attributes;
-	attributes.compute_attributes(_cuboid);
-	Eigen::VectorXd same_features = attributes_to_features_map * attributes.get_attributes();
-
-	assert(same_features.rows() == MeshCuboidFeatures::k_num_features);
-	Real error = (same_features - features_).array().abs().sum();
-
-	CHECK_NUMERICAL_ERROR(__FUNCTION__, error);
-#endif
-
-	// Optional.
-	if (_attributes_to_features_map)
-		(*_attributes_to_features_map) = attributes_to_features_map;
+	return attributes_to_features_map;
 }
 
 void MeshCuboidFeatures::get_feature_collection_matrix(const std::list<MeshCuboidFeatures *>& _stats,
@@ -483,6 +523,40 @@ MeshCuboidTransformation::get_transformed_features(const MeshCuboid *_other_cubo
 	return get_transformed_features(other_features);
 }
 
+void MeshCuboidTransformation::get_transformed_features(
+	const MeshCuboidFeatures& _other_features,
+	const int _begin_index, Eigen::VectorXd &_output_vec, const int _output_index)const
+{
+	const Eigen::VectorXd &features = _other_features.get_features();
+	assert(features.rows() == MeshCuboidFeatures::k_num_features);
+
+	// NOTE:
+	// Only entire local points can be skipped.
+	assert(_begin_index >= 0 && _begin_index % 3 == 0);
+	assert(_begin_index <= MeshCuboidFeatures::k_num_features);
+
+	const int num_values = MeshCuboidFeatures::k_num_features - _begin_index;
+	assert(_output_index >= 0 && _output_index + num_values <= _output_vec.rows());
+
+	for (int i = _begin_index; i < MeshCuboidFeatures::k_num_features; ++i)
+	{
+		if (i < 3 * MeshCuboidFeatures::k_num_local_points)
+		{
+			// Local coordinate point.
+			if (i % 3 == 0)
+			{
+				_output_vec.segment<3>(_output_index + i - _begin_index).noalias() =
+					second_rotation_ * (features.segment<3>(i) + first_translation_);
+			}
+		}
+		else
+		{
+			// Global feature value.
+			_output_vec[_output_index + i - _begin_index] = features[i];
+		}
+	}
+}
+
 Eigen::VectorXd
 MeshCuboidTransformation::get_inverse_transformed_features(
 	const MeshCuboidFeatures& _other_features)const
@@ -697,10 +771,184 @@ bool MeshCuboidTransformation::save_transformation_collection(const char* _filen
 	return true;
 }
 
+MeshCuboidAxisConfigurationCache::PermutationTables::PermutationTables()
+{
+	const unsigned int num_configurations = num_axis_configurations();
+	axis_permutations_.resize(num_configurations);
+	corner_permutations_.resize(num_configurations);
+
+	std::array<MyMesh::Normal, 3> identity_axes;
+	identity_axes[0] = MyMesh::Normal(1.0, 0.0, 0.0);
+	identity_axes[1] = MyMesh::Normal(0.0, 1.0, 0.0);
+	identity_axes[2] = MyMesh::Normal(0.0, 0.0, 1.0);
+
+	for (unsigned int configuration_index = 0; configuration_index < num_configurations; ++configuration_index)
+	{
+		// NOTE:
+		// The transformed identity axes are the rows of the permutation matrix 'P'.
+		// The new axes are 'P * (current axes)', and the new sizes are 'abs(P) * (current sizes)'.
+		std::array<MyMesh::Normal, 3> new_axes = MeshCuboid::get_transformed_axes(
+			configuration_index, identity_axes);
+
+		Eigen::Matrix3d &axis_permutation = axis_permutations_[configuration_index];
+		for (unsigned int axis_index = 0; axis_index < 3; ++axis_index)
+			for (unsigned int i = 0; i < 3; ++i)
+				axis_permutation(axis_index, i) = new_axes[axis_index][i];
+
+		// NOTE:
+		// Each bit of the corner index is the sign of the corresponding axis direction
+		// (see 'MeshCuboid::update_corner_points()'). The signs 's' of a new corner are
+		// 'P^T * s' in the current axes.
+		for (unsigned int corner_index = 0; corner_index < MeshCuboid::k_num_corners; ++corner_index)
+		{
+			Eigen::Vector3d axis_directions_vec;
+			for (unsigned int axis_index = 0; axis_index < 3; ++axis_index)
+				axis_directions_vec[axis_index] = ((corner_index >> axis_index) & 1) ? 1.0 : -1.0;
+
+			Eigen::Vector3d current_axis_directions_vec = axis_permutation.transpose() * axis_directions_vec;
+
+			unsigned int current_corner_index = 0;
+			for (unsigned int axis_index = 0; axis_index < 3; ++axis_index)
+				if (current_axis_directions_vec[axis_index] > 0)
+					current_corner_index |= (1 << axis_index);
+
+			assert(current_corner_index < MeshCuboid::k_num_corners);
+			corner_permutations_[configuration_index][corner_index] = current_corner_index;
+		}
+	}
+}
+
+MeshCuboidAxisConfigurationCache::MeshCuboidAxisConfigurationCache(const MeshCuboid *_cuboid)
+{
+	assert(_cuboid);
+
+	const unsigned int num_configurations = num_axis_configurations();
+	attributes_.resize(num_configurations);
+	features_.resize(num_configurations);
+	transformations_.resize(num_configurations);
+
+	MeshCuboidAttributes attributes;
+	attributes.compute_attributes(_cuboid);
+
+	MeshCuboidFeatures features;
+	features.compute_features(_cuboid);
+
+	MeshCuboidTransformation transformation;
+	transformation.compute_transformation(_cuboid);
+
+	const PermutationTables &tables = get_permutation_tables();
+
+	for (unsigned int configuration_index = 0; configuration_index < num_configurations; ++configuration_index)
+	{
+		const std::array<unsigned int, MeshCuboid::k_num_corners> &corner_permutation =
+			tables.corner_permutations_[configuration_index];
+
+		// NOTE:
+		// The center and the center height are not changed.
+		Eigen::VectorXd &new_attributes = attributes_[configuration_index].attributes_;
+		Eigen::VectorXd &new_features = features_[configuration_index].features_;
+		new_attributes = attributes.attributes_;
+		new_features = features.features_;
+
+		for (unsigned int corner_index = 0; corner_index < MeshCuboid::k_num_corners; ++corner_index)
+		{
+			const unsigned int current_corner_index = corner_permutation[corner_index];
+
+			new_attributes.segment<3>(MeshCuboidAttributes::k_corner_index + 3 * corner_index) =
+				attributes.attributes_.segment<3>(MeshCuboidAttributes::k_corner_index + 3 * current_corner_index);
+
+			new_features.segment<3>(MeshCuboidFeatures::k_corner_index + 3 * corner_index) =
+				features.features_.segment<3>(MeshCuboidFeatures::k_corner_index + 3 * current_corner_index);
+
+			// Corner heights.
+			new_features[3 * MeshCuboidFeatures::k_num_local_points + 1 + corner_index] =
+				features.features_[3 * MeshCuboidFeatures::k_num_local_points + 1 + current_corner_index];
+		}
+
+		// The rows of the rotation are the local axes.
+		transformations_[configuration_index].first_translation_ = transformation.first_translation_;
+		transformations_[configuration_index].second_rotation_ =
+			tables.axis_permutations_[configuration_index] * transformation.second_rotation_;
+	}
+
+#ifdef DEBUG_TEST
+	for (unsigned int configuration_index = 0; configuration_index < num_configurations; ++configuration_index)
+	{
+		MeshCuboid cuboid(*_cuboid);	// Copy constructor.
+		cuboid.set_axis_configuration(configuration_index);
+
+		MeshCuboidFeatures same_features;
+		same_features.compute_features(&cuboid);
+
+		Real error = (same_features.get_features() - features_[configuration_index].get_features()).array().abs().sum();
+		CHECK_NUMERICAL_ERROR(__FUNCTION__, error);
+	}
+#endif
+}
+
+MeshCuboidAxisConfigurationCache::~MeshCuboidAxisConfigurationCache()
+{
+}
+
+const MeshCuboidAttributes &MeshCuboidAxisConfigurationCache::get_attributes(
+	const unsigned int _axis_configuration_index) const
+{
+	assert(_axis_configuration_index < attributes_.size());
+	return attributes_[_axis_configuration_index];
+}
+
+const MeshCuboidFeatures &MeshCuboidAxisConfigurationCache::get_features(
+	const unsigned int _axis_configuration_index) const
+{
+	assert(_axis_configuration_index < features_.size());
+	return features_[_axis_configuration_index];
+}
+
+const MeshCuboidTransformation &MeshCuboidAxisConfigurationCache::get_transformation(
+	const unsigned int _axis_configuration_index) const
+{
+	assert(_axis_configuration_index < transformations_.size());
+	return transformations_[_axis_configuration_index];
+}
+
+const Eigen::Matrix3d &MeshCuboidAxisConfigurationCache::get_axis_permutation(
+	const unsigned int _axis_configuration_index)
+{
+	const PermutationTables &tables = get_permutation_tables();
+	assert(_axis_configuration_index < tables.axis_permutations_.size());
+	return tables.axis_permutations_[_axis_configuration_index];
+}
+
+const std::array<unsigned int, MeshCuboid::k_num_corners> &
+MeshCuboidAxisConfigurationCache::get_corner_permutation(const unsigned int _axis_configuration_index)
+{
+	const PermutationTables &tables = get_permutation_tables();
+	assert(_axis_configuration_index < tables.corner_permutations_.size());
+	return tables.corner_permutations_[_axis_configuration_index];
+}
+
+const MeshCuboidAxisConfigurationCache::PermutationTables &
+MeshCuboidAxisConfigurationCache::get_permutation_tables()
+{
+	// NOTE:
+	// The tables depend only on 'MeshCuboid::k_all_axis_configuration', and are built
+	// only once when first used.
+	static const PermutationTables tables;
+	return tables;
+}
+
 MeshCuboidJointNormalRelations::MeshCuboidJointNormalRelations()
+	: is_low_rank_(false)
 {
 	mean_ = Eigen::VectorXd::Zero(k_mat_size);
 	inv_cov_ = Eigen::MatrixXd::Zero(k_mat_size, k_mat_size);
+
+	// NOTE:
+	// The zero matrix is its own (upper triangular) factor, so 'update_batch_data()'
+	// is not called here to avoid a decomposition for every new relation.
+	inv_cov_factor_ = Eigen::MatrixXd::Zero(k_mat_size, k_mat_size);
+	is_inv_cov_factor_triangular_ = true;
+	inv_cov_factor_f_ = Eigen::MatrixXf::Zero(k_mat_size, k_mat_size);
 }
 
 MeshCuboidJointNormalRelations::~MeshCuboidJointNormalRelations()
@@ -708,6 +956,27 @@ MeshCuboidJointNormalRelations::~MeshCuboidJointNormalRelations()
 
 }
 
+void MeshCuboidJointNormalRelations::detach_from_bundle()
+{
+	if (!bundle_)
+		return;
+
+	mean_ = mean();
+	inv_cov_ = inv_cov();
+	inv_cov_factor_ = inv_cov_factor();
+	inv_cov_factor_f_ = inv_cov_factor_f();
+	low_rank_diagonal_ = low_rank_diagonal();
+	low_rank_factor_ = low_rank_factor();
+	low_rank_factor_f_ = low_rank_factor_f();
+	release_bundle();
+}
+
+void MeshCuboidJointNormalRelations::release_bundle()
+{
+	bundle_.reset();
+	bundle_matrices_ = BundleMatrices();
+}
+
 bool MeshCuboidJointNormalRelations::load_joint_normal_csv(const char* _filename)
 {
 	Eigen::IOFormat csv_format(Eigen::StreamPrecision, 0, ", ", "", "", "", "", "");
@@ -719,6 +988,12 @@ bool MeshCuboidJointNormalRelations::load_joint_normal_csv(const char* _filename
 		return false;
 	}
 
+	// NOTE:
+	// All matrices are overwritten, so the relation bundle is released without copying.
+	release_bundle();
+	mean_.resize(k_mat_size);
+	inv_cov_.resize(k_mat_size, k_mat_size);
+
 	std::string buffer;
 	std::stringstream strstr;
 	std::string token;
@@ -770,15 +1045,24 @@ bool MeshCuboidJointNormalRelations::load_joint_normal_csv(const char* _filename
 
 	file.close();
 
-	Eigen::SelfAdjointEigenSolver<Eigen::MatrixXd> es(inv_cov_);
-	Real min_eigenvalue = es.eigenvalues().minCoeff();
-	if (min_eigenvalue < -1.0E-6)
+	is_low_rank_ = false;
+	update_batch_data();
+
+	// NOTE:
+	// The Cholesky decomposition in 'update_batch_data()' succeeds only if the inverse
+	// covariance is positive definite. The eigenvalues are computed only if it fails.
+	if (!is_inv_cov_factor_triangular_)
 	{
-		std::cerr << "Error: The inverse covariance matrix is not positive-semidefinite: ("
-			<< _filename << " = " << min_eigenvalue << ")" << std::endl;
-		do {
-			std::cout << '\n' << "Press the Enter key to continue.";
-		} while (std::cin.get() != '\n');
+		Eigen::SelfAdjointEigenSolver<Eigen::MatrixXd> es(inv_cov_);
+		Real min_eigenvalue = es.eigenvalues().minCoeff();
+		if (min_eigenvalue < -1.0E-6)
+		{
+			std::cerr << "Error: The inverse covariance matrix is not positive-semidefinite: ("
+				<< _filename << " = " << min_eigenvalue << ")" << std::endl;
+			do {
+				std::cout << '\n' << "Press the Enter key to continue.";
+			} while (std::cin.get() != '\n');
+		}
 	}
 
 	Real symmetry_diff = (inv_cov_ - inv_cov_.transpose()).array().abs().sum();
@@ -807,8 +1091,8 @@ bool MeshCuboidJointNormalRelations::save_joint_normal_csv(const char* _filename
 	std::setprecision(std::numeric_limits<long double>::digits10 + 1);
 	std::cout << std::scientific;
 
-	file << mean_.transpose().format(csv_format) << std::endl;
-	file << inv_cov_.format(csv_format) << std::endl;
+	file << mean().transpose().format(csv_format) << std::endl;
+	file << get_inv_cov().format(csv_format) << std::endl;
 
 	file.close();
 	return true;
@@ -823,6 +1107,10 @@ bool MeshCuboidJointNormalRelations::load_joint_normal_dat(const char* _filename
 		return false;
 	}
 
+	// NOTE:
+	// All matrices are overwritten, so the relation bundle is released without copying.
+	release_bundle();
+
 	int16_t rows, cols;
 
 	rows = 0, cols = 0;
@@ -843,15 +1131,24 @@ bool MeshCuboidJointNormalRelations::load_joint_normal_dat(const char* _filename
 
 	file.close();
 
-	Eigen::SelfAdjointEigenSolver<Eigen::MatrixXd> es(inv_cov_);
-	Real min_eigenvalue = es.eigenvalues().minCoeff();
-	if (min_eigenvalue < -1.0E-6)
+	is_low_rank_ = false;
+	update_batch_data();
+
+	// NOTE:
+	// The Cholesky decomposition in 'update_batch_data()' succeeds only if the inverse
+	// covariance is positive definite. The eigenvalues are computed only if it fails.
+	if (!is_inv_cov_factor_triangular_)
 	{
-		std::cerr << "Error: The inverse covariance matrix is not positive-semidefinite: ("
-			<< _filename << " = " << min_eigenvalue << ")" << std::endl;
-		do {
-			std::cout << '\n' << "Press the Enter key to continue.";
-		} while (std::cin.get() != '\n');
+		Eigen::SelfAdjointEigenSolver<Eigen::MatrixXd> es(inv_cov_);
+		Real min_eigenvalue = es.eigenvalues().minCoeff();
+		if (min_eigenvalue < -1.0E-6)
+		{
+			std::cerr << "Error: The inverse covariance matrix is not positive-semidefinite: ("
+				<< _filename << " = " << min_eigenvalue << ")" << std::endl;
+			do {
+				std::cout << '\n' << "Press the Enter key to continue.";
+			} while (std::cin.get() != '\n');
+		}
 	}
 
 	Real symmetry_diff = (inv_cov_ - inv_cov_.transpose()).array().abs().sum();
@@ -867,6 +1164,157 @@ bool MeshCuboidJointNormalRelations::load_joint_normal_dat(const char* _filename
 	return true;
 }
 
+bool MeshCuboidJointNormalRelations::load_joint_normal_low_rank(const char* _filename)
+{
+	std::ifstream file(_filename, std::ios::in | std::ios::binary);
+	if (!file.good())
+	{
+		std::cerr << "Can't open file: \"" << _filename << "\"" << std::endl;
+		return false;
+	}
+
+	// NOTE:
+	// All matrices are overwritten, so the relation bundle is released without copying.
+	release_bundle();
+
+	int16_t rows, cols;
+
+	rows = 0, cols = 0;
+	file.read((char*)(&rows), sizeof(int16_t));
+	file.read((char*)(&cols), sizeof(int16_t));
+	if (static_cast<int>(rows) != k_mat_size || static_cast<int>(cols) != 1)
+	{
+		std::cerr << "Error: Wrong mean vector size: (" << _filename << ")" << std::endl;
+		return false;
+	}
+	mean_.resize(rows);
+	file.read((char *)mean_.data(), rows*cols*sizeof(Eigen::MatrixXd::Scalar));
+
+	rows = 0, cols = 0;
+	file.read((char*)(&rows), sizeof(int16_t));
+	file.read((char*)(&cols), sizeof(int16_t));
+	if (static_cast<int>(rows) != k_mat_size || static_cast<int>(cols) != 1)
+	{
+		std::cerr << "Error: Wrong diagonal vector size: (" << _filename << ")" << std::endl;
+		return false;
+	}
+	low_rank_diagonal_.resize(rows);
+	file.read((char *)low_rank_diagonal_.data(), rows*cols*sizeof(Eigen::MatrixXd::Scalar));
+
+	rows = 0, cols = 0;
+	file.read((char*)(&rows), sizeof(int16_t));
+	file.read((char*)(&cols), sizeof(int16_t));
+	if (static_cast<int>(rows) != k_mat_size || static_cast<int>(cols) > k_mat_size)
+	{
+		std::cerr << "Error: Wrong low-rank factor matrix size: (" << _filename << ")" << std::endl;
+		return false;
+	}
+	low_rank_factor_.resize(rows, cols);
+	file.read((char *)low_rank_factor_.data(), rows*cols*sizeof(Eigen::MatrixXd::Scalar));
+
+	if (!file.good())
+	{
+		std::cerr << "Error: Can't read file: \"" << _filename << "\"" << std::endl;
+		return false;
+	}
+
+	file.close();
+
+	is_low_rank_ = true;
+	update_batch_data();
+
+	return true;
+}
+
+bool MeshCuboidJointNormalRelations::save_joint_normal_low_rank(const char* _filename)const
+{
+	if (!is_low_rank_)
+	{
+		std::cerr << "Error: The relation is not compressed: (" << _filename << ")" << std::endl;
+		return false;
+	}
+
+	std::ofstream file(_filename, std::ios::out | std::ios::binary | std::ios::trunc);
+	if (!file.good())
+	{
+		std::cerr << "Can't save file: \"" << _filename << "\"" << std::endl;
+		return false;
+	}
+
+	const int num_matrices = 3;
+	const int16_t rows[num_matrices] = {
+		static_cast<int16_t>(mean().rows()),
+		static_cast<int16_t>(low_rank_diagonal().rows()),
+		static_cast<int16_t>(low_rank_factor().rows()) };
+	const int16_t cols[num_matrices] = { 1, 1,
+		static_cast<int16_t>(low_rank_factor().cols()) };
+	const double *data[num_matrices] = {
+		mean().data(), low_rank_diagonal().data(), low_rank_factor().data() };
+
+	for (int i = 0; i < num_matrices; ++i)
+	{
+		file.write((char*)(&rows[i]), sizeof(int16_t));
+		file.write((char*)(&cols[i]), sizeof(int16_t));
+		file.write((char*)data[i], rows[i] * cols[i] * sizeof(Eigen::MatrixXd::Scalar));
+	}
+
+	file.close();
+	return true;
+}
+
+void MeshCuboidJointNormalRelations::compress(const Real _energy_threshold)
+{
+	assert(_energy_threshold >= 0.0);
+	assert(_energy_threshold <= 1.0);
+
+	detach_from_bundle();
+
+	// NOTE:
+	// Eigenvalues are sorted in increasing order. Thus, the first eigenvectors are
+	// the principal directions of the covariance.
+	Eigen::SelfAdjointEigenSolver<Eigen::MatrixXd> es(get_inv_cov());
+	const Eigen::VectorXd &eigenvalues = es.eigenvalues();
+	const int num_eigenvalues = static_cast<int>(eigenvalues.rows());
+
+	const Real max_eigenvalue = eigenvalues.maxCoeff();
+	assert(max_eigenvalue > 0);
+
+	// Variance above the isotropic level '1 / max_eigenvalue' in each direction.
+	const Real min_eigenvalue = 1.0E-12 * max_eigenvalue;
+	Eigen::VectorXd excess_variances(num_eigenvalues);
+	for (int i = 0; i < num_eigenvalues; ++i)
+		excess_variances[i] = 1.0 / std::max(eigenvalues[i], min_eigenvalue) - 1.0 / max_eigenvalue;
+
+	const Real total_excess_variance = excess_variances.sum();
+	int rank = 0;
+	Real preserved_excess_variance = 0.0;
+	while (rank < num_eigenvalues
+		&& preserved_excess_variance < _energy_threshold * total_excess_variance)
+	{
+		preserved_excess_variance += excess_variances[rank];
+		++rank;
+	}
+
+	low_rank_diagonal_ = Eigen::VectorXd::Constant(num_eigenvalues, max_eigenvalue);
+	low_rank_factor_ = es.eigenvectors().leftCols(rank);
+	for (int i = 0; i < rank; ++i)
+		low_rank_factor_.col(i) *= std::sqrt(max_eigenvalue - std::max(eigenvalues[i], 0.0));
+
+	is_low_rank_ = true;
+	update_batch_data();
+}
+
+Eigen::MatrixXd MeshCuboidJointNormalRelations::get_inv_cov() const
+{
+	if (!is_low_rank_)
+		return inv_cov();
+
+	// diag(d) - W * W^T.
+	Eigen::MatrixXd inv_cov = -low_rank_factor() * low_rank_factor().transpose();
+	inv_cov.diagonal() += low_rank_diagonal();
+	return inv_cov;
+}
+
 void MeshCuboidJointNormalRelations::get_pairwise_cuboid_features(
 	const MeshCuboid *_cuboid_1, const MeshCuboid *_cuboid_2,
 	const MeshCuboidTransformation *_transformation_1, const MeshCuboidTransformation *_transformation_2,
@@ -928,18 +1376,75 @@ void MeshCuboidJointNormalRelations::get_pairwise_cuboid_features(
 double MeshCuboidJointNormalRelations::compute_error(const MeshCuboid *_cuboid_1, const MeshCuboid *_cuboid_2,
 	const MeshCuboidTransformation *_transformation_1, const MeshCuboidTransformation *_transformation_2) const
 {
-	Eigen::VectorXd pairwise_cuboid_feature;
-	get_pairwise_cuboid_features(_cuboid_1, _cuboid_2, _transformation_1, _transformation_2,
-		pairwise_cuboid_feature);
+	assert(_cuboid_1);
+	assert(_cuboid_2);
 
-	assert(mean_.rows() == pairwise_cuboid_feature.rows());
-	assert(inv_cov_.rows() == pairwise_cuboid_feature.rows());
-	assert(inv_cov_.cols() == pairwise_cuboid_feature.rows());
+	MeshCuboidFeatures features_1;
+	features_1.compute_features(_cuboid_1);
+
+	MeshCuboidFeatures features_2;
+	features_2.compute_features(_cuboid_2);
+
+	return compute_error(features_1, features_2, _transformation_1, _transformation_2);
+}
+
+void MeshCuboidJointNormalRelations::get_pairwise_cuboid_features_in_place(
+	const MeshCuboidFeatures &_features_1, const MeshCuboidFeatures &_features_2,
+	const MeshCuboidTransformation *_transformation_1, const MeshCuboidTransformation *_transformation_2,
+	Eigen::VectorXd &_pairwise_features_vec)
+{
+	assert(_transformation_1);
+	assert(_transformation_2);
+
+	// NOTE:
+	// Same with 'get_pairwise_cuboid_features()', but the values are directly written
+	// to the output vector.
+	const int num_values = MeshCuboidFeatures::k_num_features - MeshCuboidFeatures::k_corner_index;
+	_pairwise_features_vec.resize(k_mat_size);
+
+	_transformation_1->get_transformed_features(_features_1, MeshCuboidFeatures::k_corner_index,
+		_pairwise_features_vec, 0);
+	_transformation_1->get_transformed_features(_features_2, 0,
+		_pairwise_features_vec, num_values);
+	_transformation_2->get_transformed_features(_features_2, MeshCuboidFeatures::k_corner_index,
+		_pairwise_features_vec, num_values + MeshCuboidFeatures::k_num_features);
+	_transformation_2->get_transformed_features(_features_1, 0,
+		_pairwise_features_vec, 2 * num_values + MeshCuboidFeatures::k_num_features);
+}
+
+double MeshCuboidJointNormalRelations::compute_error(
+	const MeshCuboidFeatures &_features_1, const MeshCuboidFeatures &_features_2,
+	const MeshCuboidTransformation *_transformation_1, const MeshCuboidTransformation *_transformation_2,
+	MeshCuboidRelationScratch *_scratch) const
+{
+	MeshCuboidRelationScratch local_scratch;
+	MeshCuboidRelationScratch &scratch = (_scratch ? (*_scratch) : local_scratch);
+
+	Eigen::VectorXd &pairwise_cuboid_feature = scratch.features_vec_;
+	get_pairwise_cuboid_features_in_place(_features_1, _features_2,
+		_transformation_1, _transformation_2, pairwise_cuboid_feature);
 
-	Eigen::VectorXd diff = pairwise_cuboid_feature - mean_;
+	assert(mean().rows() == pairwise_cuboid_feature.rows());
+	assert(is_low_rank_ || inv_cov().rows() == pairwise_cuboid_feature.rows());
+	assert(is_low_rank_ || inv_cov().cols() == pairwise_cuboid_feature.rows());
+
+	Eigen::VectorXd &diff = scratch.diff_;
+	diff = pairwise_cuboid_feature - mean();
 
 	// Mahalanobis norm.
-	double error = diff.transpose() * inv_cov_ * diff;
+	double error = 0.0;
+	if (is_low_rank_)
+	{
+		// diff^T * (diag(d) - W * W^T) * diff.
+		scratch.product_.noalias() = low_rank_factor().transpose() * diff;
+		error = diff.cwiseAbs2().dot(low_rank_diagonal()) - scratch.product_.squaredNorm();
+		error = std::max(error, 0.0);
+	}
+	else
+	{
+		scratch.product_.noalias() = inv_cov() * diff;
+		error = diff.dot(scratch.product_);
+	}
 	assert(error >= 0);
 
 	//std::cerr << "Negative error value (error = " << error << ")" << std::endl;
@@ -963,6 +1468,118 @@ double MeshCuboidJointNormalRelations::compute_error(const MeshCuboid *_cuboid_1
 	return error;
 }
 
+void MeshCuboidJointNormalRelations::update_batch_data()
+{
+	// NOTE:
+	// If the inverse covariance is positive definite, 'inv_cov_ = U^T * U' with the
+	// upper triangular Cholesky factor 'U'. Otherwise, 'U = sqrt(D) * V^T' from the
+	// eigen decomposition 'inv_cov_ = V * D * V^T', where negative eigenvalues
+	// caused by numerical errors are ignored.
+	if (is_low_rank_)
+	{
+		// NOTE:
+		// The dense matrices are released. See 'get_inv_cov()'.
+		inv_cov_.resize(0, 0);
+		inv_cov_factor_.resize(0, 0);
+		inv_cov_factor_f_.resize(0, 0);
+		low_rank_factor_f_ = low_rank_factor_.cast<float>();
+		return;
+	}
+
+	low_rank_diagonal_.resize(0);
+	low_rank_factor_.resize(0, 0);
+	low_rank_factor_f_.resize(0, 0);
+
+	Eigen::LLT<Eigen::MatrixXd> llt(inv_cov_);
+	if (inv_cov_.rows() > 0 && llt.info() == Eigen::Success)
+	{
+		inv_cov_factor_ = llt.matrixU();
+		is_inv_cov_factor_triangular_ = true;
+	}
+	else
+	{
+		Eigen::SelfAdjointEigenSolver<Eigen::MatrixXd> es(inv_cov_);
+		Eigen::VectorXd sqrt_eigenvalues = es.eigenvalues().cwiseMax(0.0).cwiseSqrt();
+		inv_cov_factor_ = sqrt_eigenvalues.asDiagonal() * es.eigenvectors().transpose();
+		is_inv_cov_factor_triangular_ = false;
+	}
+
+	inv_cov_factor_f_ = inv_cov_factor_.cast<float>();
+}
+
+void MeshCuboidJointNormalRelations::compute_errors(
+	const Eigen::MatrixXd &_pairwise_features_mat, Eigen::VectorXd &_errors,
+	MeshCuboidRelationScratch *_scratch) const
+{
+	assert(_pairwise_features_mat.rows() == mean().rows());
+	assert(is_low_rank_ || inv_cov_factor().cols() == mean().rows());
+
+	MeshCuboidRelationScratch local_scratch;
+	MeshCuboidRelationScratch &scratch = (_scratch ? (*_scratch) : local_scratch);
+
+	Eigen::MatrixXd &diff_mat = scratch.diff_mat_;
+	diff_mat = _pairwise_features_mat.colwise() - mean();
+
+	Eigen::MatrixXd &product_mat = scratch.product_mat_;
+
+	if (is_low_rank_)
+	{
+		// diag(D^T * diag(d) * D) - diag((W^T * D)^T * (W^T * D)).
+		product_mat.resize(low_rank_factor().cols(), diff_mat.cols());
+		product_mat.noalias() = low_rank_factor().transpose() * diff_mat;
+		_errors.noalias() = diff_mat.cwiseAbs2().transpose() * low_rank_diagonal();
+		_errors -= product_mat.colwise().squaredNorm().transpose();
+		_errors = _errors.cwiseMax(0.0);
+		return;
+	}
+
+	product_mat.resize(inv_cov_factor().rows(), diff_mat.cols());
+
+	if (is_inv_cov_factor_triangular_)
+		product_mat.noalias() = inv_cov_factor().triangularView<Eigen::Upper>() * diff_mat;
+	else
+		product_mat.noalias() = inv_cov_factor() * diff_mat;
+
+	_errors = product_mat.colwise().squaredNorm().transpose();
+}
+
+void MeshCuboidJointNormalRelations::compute_errors_single_precision(
+	const Eigen::MatrixXd &_pairwise_features_mat, Eigen::VectorXd &_errors,
+	MeshCuboidRelationScratch *_scratch) const
+{
+	assert(_pairwise_features_mat.rows() == mean().rows());
+	assert(is_low_rank_ || inv_cov_factor_f().cols() == mean().rows());
+
+	MeshCuboidRelationScratch local_scratch;
+	MeshCuboidRelationScratch &scratch = (_scratch ? (*_scratch) : local_scratch);
+
+	// NOTE:
+	// The mean is subtracted in double precision to avoid cancellation errors.
+	Eigen::MatrixXf &diff_mat = scratch.diff_mat_f_;
+	diff_mat = (_pairwise_features_mat.colwise() - mean()).cast<float>();
+
+	Eigen::MatrixXf &product_mat = scratch.product_mat_f_;
+
+	if (is_low_rank_)
+	{
+		product_mat.resize(low_rank_factor_f().cols(), diff_mat.cols());
+		product_mat.noalias() = low_rank_factor_f().transpose() * diff_mat;
+		_errors.noalias() = (diff_mat.cwiseAbs2().transpose() * low_rank_diagonal().cast<float>()).cast<double>();
+		_errors -= product_mat.colwise().squaredNorm().transpose().cast<double>();
+		_errors = _errors.cwiseMax(0.0);
+		return;
+	}
+
+	product_mat.resize(inv_cov_factor_f().rows(), diff_mat.cols());
+
+	if (is_inv_cov_factor_triangular_)
+		product_mat.noalias() = inv_cov_factor_f().triangularView<Eigen::Upper>() * diff_mat;
+	else
+		product_mat.noalias() = inv_cov_factor_f() * diff_mat;
+
+	_errors = product_mat.colwise().squaredNorm().transpose().cast<double>();
+}
+
 double MeshCuboidJointNormalRelations::compute_conditional_error(const MeshCuboid *_cuboid_1, const MeshCuboid *_cuboid_2,
 	const MeshCuboidTransformation *_transformation_1) const
 {
@@ -993,8 +1610,8 @@ double MeshCuboidJointNormalRelations::compute_conditional_error(const MeshCuboi
 		transformed_features_vec_11.bottomRows(MeshCuboidFeatures::k_num_features - MeshCuboidFeatures::k_corner_index),
 		transformed_features_vec_12;
 
-	Eigen::VectorXd conditional_mean = mean_.segment(0, num_rows);
-	Eigen::MatrixXd conditional_inv_cov = inv_cov_.block(0, 0, num_rows, num_rows);
+	Eigen::VectorXd conditional_mean = mean().segment(0, num_rows);
+	Eigen::MatrixXd conditional_inv_cov = get_inv_cov().block(0, 0, num_rows, num_rows);
 	Eigen::VectorXd diff = conditional_pairwise_cuboid_feature - conditional_mean;
 
 	// Mahalanobis norm.
@@ -1018,6 +1635,23 @@ MeshCuboidCondNormalRelations::~MeshCuboidCondNormalRelations()
 
 }
 
+void MeshCuboidCondNormalRelations::detach_from_bundle()
+{
+	if (!bundle_)
+		return;
+
+	mean_A_ = mean_A();
+	mean_b_ = mean_b();
+	inv_cov_ = inv_cov();
+	release_bundle();
+}
+
+void MeshCuboidCondNormalRelations::release_bundle()
+{
+	bundle_.reset();
+	bundle_matrices_ = BundleMatrices();
+}
+
 bool MeshCuboidCondNormalRelations::load_cond_normal_csv(const char* _filename)
 {
 	Eigen::IOFormat csv_format(Eigen::StreamPrecision, 0, ", ", "", "", "", "", "");
@@ -1029,6 +1663,10 @@ bool MeshCuboidCondNormalRelations::load_cond_normal_csv(const char* _filename)
 		return false;
 	}
 
+	// NOTE:
+	// All matrices are overwritten, so the relation bundle is released without copying.
+	release_bundle();
+
 	std::string buffer;
 	std::stringstream strstr;
 	std::string token;
@@ -1147,9 +1785,9 @@ bool MeshCuboidCondNormalRelations::save_cond_normal_csv(const char* _filename)c
 
 	// NOTE:
 	// mean_A_. mean_b_: Transposed.
-	file << mean_A_.transpose().format(csv_format) << std::endl;
-	file << mean_b_.transpose().format(csv_format) << std::endl;
-	file << inv_cov_.format(csv_format) << std::endl;
+	file << mean_A().transpose().format(csv_format) << std::endl;
+	file << mean_b().transpose().format(csv_format) << std::endl;
+	file << inv_cov().format(csv_format) << std::endl;
 
 	file.close();
 	return true;
@@ -1164,6 +1802,10 @@ bool MeshCuboidCondNormalRelations::load_cond_normal_dat(const char* _filename)
 		return false;
 	}
 
+	// NOTE:
+	// All matrices are overwritten, so the relation bundle is released without copying.
+	release_bundle();
+
 	int16_t rows, cols;
 
 	rows = 0, cols = 0;
@@ -1257,21 +1899,53 @@ void MeshCuboidCondNormalRelations::get_pairwise_cuboid_features(
 double MeshCuboidCondNormalRelations::compute_error(const MeshCuboid *_cuboid_1, const MeshCuboid *_cuboid_2,
 	const MeshCuboidTransformation *_transformation_1, const MeshCuboidTransformation *_transformation_2)const
 {
-	Eigen::VectorXd global_features_vec_1, transformed_features_vec_12;
-	get_pairwise_cuboid_features(_cuboid_1, _cuboid_2, _transformation_1, _transformation_2,
-		global_features_vec_1, transformed_features_vec_12);
+	assert(_cuboid_1);
+	assert(_cuboid_2);
 
-	assert(mean_A_.rows() == transformed_features_vec_12.rows());
-	assert(mean_A_.cols() == global_features_vec_1.rows());
-	assert(mean_b_.rows() == transformed_features_vec_12.rows());
-	assert(inv_cov_.rows() == transformed_features_vec_12.rows());
-	assert(inv_cov_.cols() == transformed_features_vec_12.rows());
+	MeshCuboidFeatures features_1;
+	features_1.compute_features(_cuboid_1);
 
-	const Eigen::VectorXd mean_2 = mean_A_ * global_features_vec_1 + mean_b_;
-	Eigen::VectorXd diff = transformed_features_vec_12 - mean_2;
+	MeshCuboidFeatures features_2;
+	features_2.compute_features(_cuboid_2);
+
+	return compute_error(features_1, features_2, _transformation_1, _transformation_2);
+}
+
+double MeshCuboidCondNormalRelations::compute_error(
+	const MeshCuboidFeatures &_features_1, const MeshCuboidFeatures &_features_2,
+	const MeshCuboidTransformation *_transformation_1, const MeshCuboidTransformation *_transformation_2,
+	MeshCuboidRelationScratch *_scratch)const
+{
+	assert(_transformation_1);
+	assert(_transformation_2);
+
+	MeshCuboidRelationScratch local_scratch;
+	MeshCuboidRelationScratch &scratch = (_scratch ? (*_scratch) : local_scratch);
+
+	// NOTE:
+	// Same with 'get_pairwise_cuboid_features()', but the values are directly written
+	// to the scratch buffer.
+	Eigen::VectorXd &transformed_features_vec_12 = scratch.features_vec_;
+	transformed_features_vec_12.resize(MeshCuboidFeatures::k_num_features);
+	_transformation_1->get_transformed_features(_features_2, 0, transformed_features_vec_12, 0);
+
+	const int num_global_feature_values = MeshCuboidFeatures::k_num_global_feature_values;
+	const Eigen::VectorXd &features_vec_1 = _features_1.get_features();
+
+	assert(mean_A().rows() == transformed_features_vec_12.rows());
+	assert(mean_A().cols() == num_global_feature_values);
+	assert(mean_b().rows() == transformed_features_vec_12.rows());
+	assert(inv_cov().rows() == transformed_features_vec_12.rows());
+	assert(inv_cov().cols() == transformed_features_vec_12.rows());
+
+	// diff = transformed_features_vec_12 - (mean_A_ * global_features_vec_1 + mean_b_).
+	Eigen::VectorXd &diff = scratch.diff_;
+	diff = transformed_features_vec_12 - mean_b();
+	diff.noalias() -= mean_A() * features_vec_1.bottomRows(num_global_feature_values);
 
 	// Mahalanobis norm.
-	double error = diff.transpose() * inv_cov_ * diff;
+	scratch.product_.noalias() = inv_cov() * diff;
+	double error = diff.dot(scratch.product_);
 	assert(error >= 0);
 
 	//std::cerr << "Negative error value (error = " << error << ")" << std::endl;
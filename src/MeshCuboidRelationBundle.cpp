@@ -0,0 +1,822 @@
+#include "MeshCuboidRelationBundle.h"
+
+#include "MeshCuboidParameters.h"
+#include "MeshCuboidTrainer.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <Eigen/Eigenvalues>
+
+#ifdef _WIN32
+#define RELATION_BUNDLE_NO_MMAP
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+
+namespace
+{
+const char k_bundle_magic[8] = { 'C', 'U', 'B', 'R', 'E', 'L', 'B', 'D' };
+const uint64_t k_bundle_alignment = 64;
+
+// Written in the native byte order. Read as 0x04030201 on a machine with the other byte order.
+const uint32_t k_byte_order_mark = 0x01020304;
+
+struct BundleHeader
+{
+	char magic_[8];
+	uint32_t version_;
+	uint32_t num_labels_;
+	uint64_t num_entries_;
+	uint64_t table_offset_;
+	uint64_t data_offset_;
+	uint64_t data_size_;
+	uint64_t checksum_;
+	uint32_t byte_order_mark_;
+	uint32_t reserved_;
+};
+
+struct BundleEntry
+{
+	// From the beginning of the data.
+	uint64_t offset_;
+	uint32_t rows_;
+	uint32_t cols_;
+	uint16_t label_index_1_;
+	uint16_t label_index_2_;
+	uint16_t matrix_type_;
+	uint16_t flags_;
+	uint64_t reserved_;
+};
+
+static_assert(sizeof(BundleHeader) == 64, "Wrong relation bundle header size.");
+static_assert(sizeof(BundleEntry) == 32, "Wrong relation bundle entry size.");
+
+enum BundleMatrixType
+{
+	JOINT_MEAN = 0,
+	JOINT_INV_COV,
+	JOINT_INV_COV_FACTOR,
+	JOINT_INV_COV_FACTOR_F,
+	JOINT_LOW_RANK_DIAGONAL,
+	JOINT_LOW_RANK_FACTOR,
+	JOINT_LOW_RANK_FACTOR_F,
+	COND_MEAN_A,
+	COND_MEAN_B,
+	COND_INV_COV,
+	// Training data for leave-one-out relations.
+	// 'OBJECT_NAMES' (null-terminated names in bytes) and 'TRAINING_ENERGY_THRESHOLD'
+	// are stored once with label indices (0, 0).
+	OBJECT_NAMES,
+	TRAINING_ENERGY_THRESHOLD,
+	JOINT_FEATURES,
+	JOINT_FEATURE_OBJECT_INDICES,
+	NUM_BUNDLE_MATRIX_TYPES
+};
+
+// Set for 'JOINT_INV_COV_FACTOR' and 'JOINT_INV_COV_FACTOR_F'.
+const uint16_t k_triangular_factor_flag = 1;
+
+const unsigned int k_dense_joint_matrices = (1 << JOINT_MEAN) | (1 << JOINT_INV_COV)
+	| (1 << JOINT_INV_COV_FACTOR) | (1 << JOINT_INV_COV_FACTOR_F);
+// NOTE:
+// The dense inverse covariance of low-rank relations is not stored.
+const unsigned int k_low_rank_joint_matrices = (1 << JOINT_MEAN)
+	| (1 << JOINT_LOW_RANK_DIAGONAL) | (1 << JOINT_LOW_RANK_FACTOR) | (1 << JOINT_LOW_RANK_FACTOR_F);
+const unsigned int k_cond_matrices = (1 << COND_MEAN_A) | (1 << COND_MEAN_B) | (1 << COND_INV_COV);
+const unsigned int k_training_matrices = (1 << OBJECT_NAMES) | (1 << TRAINING_ENERGY_THRESHOLD)
+	| (1 << JOINT_FEATURES) | (1 << JOINT_FEATURE_OBJECT_INDICES);
+const unsigned int k_joint_feature_matrices = (1 << JOINT_FEATURES) | (1 << JOINT_FEATURE_OBJECT_INDICES);
+
+inline bool is_single_precision(const uint16_t _matrix_type)
+{
+	return (_matrix_type == JOINT_INV_COV_FACTOR_F || _matrix_type == JOINT_LOW_RANK_FACTOR_F);
+}
+
+inline uint64_t get_scalar_size(const uint16_t _matrix_type)
+{
+	if (_matrix_type == OBJECT_NAMES) return sizeof(char);
+	else if (is_single_precision(_matrix_type)) return sizeof(float);
+	return sizeof(double);
+}
+
+inline uint64_t align_size(const uint64_t _size)
+{
+	return (_size + k_bundle_alignment - 1) / k_bundle_alignment * k_bundle_alignment;
+}
+
+// 64-bit FNV-1a hash over 8-byte words.
+// '_size' is a multiple of the alignment since every matrix is padded.
+uint64_t compute_checksum(const unsigned char *_data, const uint64_t _size)
+{
+	assert(_size % sizeof(uint64_t) == 0);
+
+	uint64_t hash = 14695981039346656037ULL;
+	for (uint64_t i = 0; i < _size; i += sizeof(uint64_t))
+	{
+		uint64_t word;
+		memcpy(&word, _data + i, sizeof(uint64_t));
+		hash ^= word;
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+bool check_inv_cov(const MeshCuboidConstMatrixMap &_inv_cov, const int _size,
+	const LabelIndex _label_index_1, const LabelIndex _label_index_2)
+{
+	if (_inv_cov.rows() != _size || _inv_cov.cols() != _size)
+	{
+		std::cerr << "Error: Wrong inverse covariance matrix size: ("
+			<< _label_index_1 << ", " << _label_index_2 << ")" << std::endl;
+		return false;
+	}
+
+	Real symmetry_diff = (_inv_cov - _inv_cov.transpose()).array().abs().sum();
+	if (symmetry_diff > 1.0E-6)
+	{
+		std::cerr << "Error: The inverse covariance matrix is not symmetric: ("
+			<< _label_index_1 << ", " << _label_index_2 << " = " << symmetry_diff << ")" << std::endl;
+		return false;
+	}
+
+	Eigen::SelfAdjointEigenSolver<Eigen::MatrixXd> es(_inv_cov);
+	Real min_eigenvalue = es.eigenvalues().minCoeff();
+	if (min_eigenvalue < -1.0E-6)
+	{
+		std::cerr << "Error: The inverse covariance matrix is not positive-semidefinite: ("
+			<< _label_index_1 << ", " << _label_index_2 << " = " << min_eigenvalue << ")" << std::endl;
+		return false;
+	}
+
+	return true;
+}
+
+class BundleWriter
+{
+public:
+	template<typename Derived>
+	void add(const LabelIndex _label_index_1, const LabelIndex _label_index_2,
+		const BundleMatrixType _matrix_type, const uint16_t _flags,
+		const Eigen::MatrixBase<Derived> &_matrix)
+	{
+		typedef typename Derived::Scalar Scalar;
+		assert(get_scalar_size(_matrix_type) == sizeof(Scalar));
+
+		BundleEntry entry;
+		memset(&entry, 0, sizeof(BundleEntry));
+		entry.offset_ = data_.size();
+		entry.rows_ = static_cast<uint32_t>(_matrix.rows());
+		entry.cols_ = static_cast<uint32_t>(_matrix.cols());
+		entry.label_index_1_ = static_cast<uint16_t>(_label_index_1);
+		entry.label_index_2_ = static_cast<uint16_t>(_label_index_2);
+		entry.matrix_type_ = static_cast<uint16_t>(_matrix_type);
+		entry.flags_ = _flags;
+		entries_.push_back(entry);
+
+		// Column-major copy.
+		const Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> matrix = _matrix;
+		const uint64_t num_bytes = matrix.size() * sizeof(Scalar);
+		data_.resize(align_size(entry.offset_ + num_bytes), 0);
+		if (num_bytes > 0)
+			memcpy(&data_[entry.offset_], matrix.data(), num_bytes);
+	}
+
+	bool write(const char* _filename, const unsigned int _num_labels) const
+	{
+		BundleHeader header;
+		memset(&header, 0, sizeof(BundleHeader));
+		memcpy(header.magic_, k_bundle_magic, sizeof(header.magic_));
+		header.version_ = MeshCuboidRelationBundle::k_version;
+		header.num_labels_ = _num_labels;
+		header.num_entries_ = entries_.size();
+		header.table_offset_ = sizeof(BundleHeader);
+		header.data_offset_ = align_size(header.table_offset_ + entries_.size() * sizeof(BundleEntry));
+		header.data_size_ = data_.size();
+		header.checksum_ = compute_checksum(data_.empty() ? NULL : &data_[0], data_.size());
+		header.byte_order_mark_ = k_byte_order_mark;
+
+		std::ofstream file(_filename, std::ios::out | std::ios::binary);
+		if (!file.good())
+		{
+			std::cerr << "Can't save file: \"" << _filename << "\"" << std::endl;
+			return false;
+		}
+
+		file.write((const char *)&header, sizeof(BundleHeader));
+		if (!entries_.empty())
+			file.write((const char *)&entries_[0], entries_.size() * sizeof(BundleEntry));
+
+		const uint64_t padding_size = header.data_offset_
+			- (header.table_offset_ + entries_.size() * sizeof(BundleEntry));
+		const char padding[k_bundle_alignment] = { 0 };
+		file.write(padding, padding_size);
+
+		if (!data_.empty())
+			file.write((const char *)&data_[0], data_.size());
+
+		file.close();
+		return file.good();
+	}
+
+private:
+	std::vector<BundleEntry> entries_;
+	std::vector<unsigned char> data_;
+};
+
+template<typename T>
+void delete_relations(std::vector< std::vector<T *> > &_relations)
+{
+	for (typename std::vector< std::vector<T *> >::iterator it_1 = _relations.begin(); it_1 != _relations.end(); ++it_1)
+		for (typename std::vector<T *>::iterator it_2 = (*it_1).begin(); it_2 != (*it_1).end(); ++it_2)
+			delete (*it_2);
+	_relations.clear();
+}
+}
+
+MeshCuboidRelationBundle::MeshCuboidRelationBundle()
+	: data_(NULL)
+	, size_(0)
+	, is_mapped_(false)
+{
+
+}
+
+MeshCuboidRelationBundle::~MeshCuboidRelationBundle()
+{
+	close();
+}
+
+bool MeshCuboidRelationBundle::open(const char* _filename)
+{
+	close();
+
+#ifdef RELATION_BUNDLE_NO_MMAP
+	std::ifstream file(_filename, std::ios::in | std::ios::binary | std::ios::ate);
+	if (!file.good())
+	{
+		std::cerr << "Can't open file: \"" << _filename << "\"" << std::endl;
+		return false;
+	}
+
+	size_ = static_cast<uint64_t>(file.tellg());
+	buffer_.resize((size_ + sizeof(uint64_t) - 1) / sizeof(uint64_t));
+	file.seekg(0, std::ios::beg);
+	if (size_ > 0)
+		file.read((char *)&buffer_[0], size_);
+	if (!file.good())
+	{
+		std::cerr << "Can't read file: \"" << _filename << "\"" << std::endl;
+		close();
+		return false;
+	}
+	data_ = (const unsigned char *)(buffer_.empty() ? NULL : &buffer_[0]);
+#else
+	int fd = ::open(_filename, O_RDONLY);
+	if (fd < 0)
+	{
+		std::cerr << "Can't open file: \"" << _filename << "\"" << std::endl;
+		return false;
+	}
+
+	struct stat file_stat;
+	if (fstat(fd, &file_stat) != 0 || file_stat.st_size <= 0)
+	{
+		std::cerr << "Can't read file: \"" << _filename << "\"" << std::endl;
+		::close(fd);
+		return false;
+	}
+
+	size_ = static_cast<uint64_t>(file_stat.st_size);
+	void *data = mmap(NULL, size_, PROT_READ, MAP_SHARED, fd, 0);
+
+	// NOTE:
+	// The mapping remains valid after the file descriptor is closed.
+	::close(fd);
+
+	if (data == MAP_FAILED)
+	{
+		std::cerr << "Can't map file: \"" << _filename << "\"" << std::endl;
+		size_ = 0;
+		return false;
+	}
+
+	data_ = (const unsigned char *)data;
+	is_mapped_ = true;
+#endif
+
+	return true;
+}
+
+void MeshCuboidRelationBundle::close()
+{
+#ifndef RELATION_BUNDLE_NO_MMAP
+	if (is_mapped_)
+		munmap((void *)data_, size_);
+#endif
+
+	data_ = NULL;
+	size_ = 0;
+	is_mapped_ = false;
+	buffer_.clear();
+}
+
+bool MeshCuboidRelationBundle::save(const char* _filename,
+	const std::vector< std::vector<MeshCuboidJointNormalRelations *> > &_joint_normal_relations,
+	const std::vector< std::vector<MeshCuboidCondNormalRelations *> > &_cond_normal_relations,
+	const MeshCuboidTrainer *_trainer)
+{
+	const int joint_size = MeshCuboidJointNormalRelations::k_mat_size;
+	const int cond_size = MeshCuboidFeatures::k_num_features;
+	const unsigned int num_labels = static_cast<unsigned int>(
+		std::max(_joint_normal_relations.size(), _cond_normal_relations.size()));
+
+	BundleWriter writer;
+
+	for (LabelIndex label_index_1 = 0; label_index_1 < _joint_normal_relations.size(); ++label_index_1)
+	{
+		for (LabelIndex label_index_2 = 0; label_index_2 < _joint_normal_relations[label_index_1].size(); ++label_index_2)
+		{
+			const MeshCuboidJointNormalRelations *relation = _joint_normal_relations[label_index_1][label_index_2];
+			if (!relation) continue;
+
+			if (relation->mean().rows() != joint_size
+				|| (!relation->is_low_rank_
+				&& !check_inv_cov(relation->inv_cov(), joint_size, label_index_1, label_index_2)))
+			{
+				std::cerr << "Error: Invalid joint normal relation: ("
+					<< label_index_1 << ", " << label_index_2 << ")" << std::endl;
+				return false;
+			}
+
+			writer.add(label_index_1, label_index_2, JOINT_MEAN, 0, relation->mean());
+
+			if (relation->is_low_rank_)
+			{
+				assert(relation->low_rank_diagonal().rows() == joint_size);
+				assert(relation->low_rank_factor().rows() == joint_size);
+				writer.add(label_index_1, label_index_2, JOINT_LOW_RANK_DIAGONAL, 0, relation->low_rank_diagonal());
+				writer.add(label_index_1, label_index_2, JOINT_LOW_RANK_FACTOR, 0, relation->low_rank_factor());
+				writer.add(label_index_1, label_index_2, JOINT_LOW_RANK_FACTOR_F, 0, relation->low_rank_factor_f());
+			}
+			else
+			{
+				assert(relation->inv_cov_factor().rows() == joint_size);
+				assert(relation->inv_cov_factor().cols() == joint_size);
+				writer.add(label_index_1, label_index_2, JOINT_INV_COV, 0, relation->inv_cov());
+				const uint16_t flags = relation->is_inv_cov_factor_triangular_ ? k_triangular_factor_flag : 0;
+				writer.add(label_index_1, label_index_2, JOINT_INV_COV_FACTOR, flags, relation->inv_cov_factor());
+				writer.add(label_index_1, label_index_2, JOINT_INV_COV_FACTOR_F, flags, relation->inv_cov_factor_f());
+			}
+		}
+	}
+
+	for (LabelIndex label_index_1 = 0; label_index_1 < _cond_normal_relations.size(); ++label_index_1)
+	{
+		for (LabelIndex label_index_2 = 0; label_index_2 < _cond_normal_relations[label_index_1].size(); ++label_index_2)
+		{
+			const MeshCuboidCondNormalRelations *relation = _cond_normal_relations[label_index_1][label_index_2];
+			if (!relation) continue;
+
+			if (relation->mean_A().rows() != cond_size
+				|| relation->mean_A().cols() != MeshCuboidFeatures::k_num_global_feature_values
+				|| relation->mean_b().rows() != cond_size
+				|| !check_inv_cov(relation->inv_cov(), cond_size, label_index_1, label_index_2))
+			{
+				std::cerr << "Error: Invalid conditional normal relation: ("
+					<< label_index_1 << ", " << label_index_2 << ")" << std::endl;
+				return false;
+			}
+
+			writer.add(label_index_1, label_index_2, COND_MEAN_A, 0, relation->mean_A());
+			writer.add(label_index_1, label_index_2, COND_MEAN_B, 0, relation->mean_b());
+			writer.add(label_index_1, label_index_2, COND_INV_COV, 0, relation->inv_cov());
+		}
+	}
+
+	if (_trainer)
+	{
+		// Object names.
+		std::string object_names;
+		const std::list<std::string> &object_list = _trainer->get_object_list();
+		for (std::list<std::string>::const_iterator it = object_list.begin(); it != object_list.end(); ++it)
+		{
+			object_names += (*it);
+			object_names.push_back('\0');
+		}
+
+		Eigen::Matrix<char, Eigen::Dynamic, 1> object_names_vec(object_names.size());
+		if (!object_names.empty())
+			memcpy(object_names_vec.data(), object_names.data(), object_names.size());
+		writer.add(0, 0, OBJECT_NAMES, 0, object_names_vec);
+
+		Eigen::Matrix<double, 1, 1> energy_threshold;
+		energy_threshold(0, 0) = FLAGS_param_relation_energy_threshold;
+		writer.add(0, 0, TRAINING_ENERGY_THRESHOLD, 0, energy_threshold);
+
+		// Pairwise features of all objects for the joint normal relations.
+		for (LabelIndex label_index_1 = 0; label_index_1 < _joint_normal_relations.size(); ++label_index_1)
+		{
+			for (LabelIndex label_index_2 = 0; label_index_2 < _joint_normal_relations[label_index_1].size(); ++label_index_2)
+			{
+				if (!_joint_normal_relations[label_index_1][label_index_2]) continue;
+
+				Eigen::MatrixXd features;
+				std::vector<unsigned int> object_indices;
+				_trainer->get_joint_normal_features(label_index_1, label_index_2, features, object_indices);
+				assert(features.rows() == object_indices.size());
+
+				Eigen::VectorXd object_indices_vec(object_indices.size());
+				for (unsigned int i = 0; i < object_indices.size(); ++i)
+					object_indices_vec[i] = object_indices[i];
+
+				// NOTE:
+				// Stored as (k_mat_size x num_objects) so that the features of each object are contiguous.
+				writer.add(label_index_1, label_index_2, JOINT_FEATURES, 0, features.transpose());
+				writer.add(label_index_1, label_index_2, JOINT_FEATURE_OBJECT_INDICES, 0, object_indices_vec);
+			}
+		}
+	}
+
+	return writer.write(_filename, num_labels);
+}
+
+bool MeshCuboidRelationBundle::load(const char* _filename,
+	std::vector< std::vector<MeshCuboidJointNormalRelations *> > &_joint_normal_relations,
+	std::vector< std::vector<MeshCuboidCondNormalRelations *> > &_cond_normal_relations,
+	const std::string &_ignored_object_name,
+	const bool _verify_checksum)
+{
+	delete_relations(_joint_normal_relations);
+	delete_relations(_cond_normal_relations);
+
+	std::shared_ptr<MeshCuboidRelationBundle> bundle(new MeshCuboidRelationBundle());
+	if (!bundle->open(_filename))
+		return false;
+
+	// Check the header and the matrix table.
+	BundleHeader header;
+	if (bundle->size_ < sizeof(BundleHeader))
+	{
+		std::cerr << "Wrong file format: \"" << _filename << "\"" << std::endl;
+		return false;
+	}
+	memcpy(&header, bundle->data_, sizeof(BundleHeader));
+
+	if (memcmp(header.magic_, k_bundle_magic, sizeof(header.magic_)) != 0)
+	{
+		std::cerr << "Wrong file format: \"" << _filename << "\"" << std::endl;
+		return false;
+	}
+
+	// NOTE:
+	// Matrices are read without conversion, so the byte order must be the same.
+	const uint32_t swapped_byte_order_mark = 0x04030201;
+	if (header.byte_order_mark_ == swapped_byte_order_mark)
+	{
+		std::cerr << "Error: The relation bundle is written in a different byte order: \""
+			<< _filename << "\"" << std::endl;
+		return false;
+	}
+
+	if (header.version_ != k_version)
+	{
+		std::cerr << "Error: Unsupported relation bundle version (" << header.version_
+			<< "): \"" << _filename << "\"" << std::endl;
+		return false;
+	}
+
+	// NOTE:
+	// Each bound is checked before it is used in the following subtractions, so that
+	// a corrupt or truncated file does not cause unsigned underflows.
+	// The checksum only covers the data, so these are the only checks of the
+	// matrix table (table_offset + num_entries * sizeof(BundleEntry) <= size).
+	if (header.byte_order_mark_ != k_byte_order_mark
+		|| header.table_offset_ < sizeof(BundleHeader)
+		|| header.table_offset_ > bundle->size_
+		|| header.num_entries_ > (bundle->size_ - header.table_offset_) / sizeof(BundleEntry)
+		|| header.data_offset_ % k_bundle_alignment != 0
+		|| header.data_offset_ > bundle->size_
+		|| header.data_size_ > bundle->size_ - header.data_offset_
+		|| header.data_size_ % k_bundle_alignment != 0)
+	{
+		std::cerr << "Wrong file format: \"" << _filename << "\"" << std::endl;
+		return false;
+	}
+
+	const unsigned char *data = bundle->data_ + header.data_offset_;
+	if (_verify_checksum && compute_checksum(data, header.data_size_) != header.checksum_)
+	{
+		std::cerr << "Error: Wrong checksum: \"" << _filename << "\"" << std::endl;
+		return false;
+	}
+
+	const unsigned int num_labels = header.num_labels_;
+	const int joint_size = MeshCuboidJointNormalRelations::k_mat_size;
+	const int cond_size = MeshCuboidFeatures::k_num_features;
+
+	_joint_normal_relations.resize(num_labels, std::vector<MeshCuboidJointNormalRelations *>(num_labels, NULL));
+	_cond_normal_relations.resize(num_labels, std::vector<MeshCuboidCondNormalRelations *>(num_labels, NULL));
+
+	// Bit masks of the loaded matrix types.
+	std::vector< std::vector<unsigned int> > matrix_types(num_labels, std::vector<unsigned int>(num_labels, 0));
+	unsigned int global_matrix_types = 0;
+
+	// Training data.
+	const char *object_names = NULL;
+	uint64_t object_names_size = 0;
+	Real training_energy_threshold = 1.0;
+	std::vector< std::vector<const double *> > joint_features(num_labels,
+		std::vector<const double *>(num_labels, NULL));
+	std::vector< std::vector<const double *> > joint_feature_object_indices(num_labels,
+		std::vector<const double *>(num_labels, NULL));
+	std::vector< std::vector<int> > num_joint_feature_objects(num_labels, std::vector<int>(num_labels, -1));
+
+	bool ret = true;
+	const BundleEntry *entries = (const BundleEntry *)(bundle->data_ + header.table_offset_);
+
+	for (uint64_t entry_index = 0; entry_index < header.num_entries_ && ret; ++entry_index)
+	{
+		BundleEntry entry;
+		memcpy(&entry, &entries[entry_index], sizeof(BundleEntry));
+
+		const LabelIndex label_index_1 = entry.label_index_1_;
+		const LabelIndex label_index_2 = entry.label_index_2_;
+		const uint16_t matrix_type = entry.matrix_type_;
+		const int rows = static_cast<int>(entry.rows_);
+		const int cols = static_cast<int>(entry.cols_);
+
+		const uint64_t scalar_size = get_scalar_size(matrix_type);
+		const uint64_t num_bytes = static_cast<uint64_t>(entry.rows_) * entry.cols_ * scalar_size;
+
+		// Stored once for all labels.
+		const bool is_global_matrix = (matrix_type == OBJECT_NAMES || matrix_type == TRAINING_ENERGY_THRESHOLD);
+
+		if (matrix_type >= NUM_BUNDLE_MATRIX_TYPES
+			|| (is_global_matrix && (label_index_1 != 0 || label_index_2 != 0))
+			|| (!is_global_matrix && (label_index_1 >= num_labels || label_index_2 >= num_labels))
+			|| entry.offset_ % k_bundle_alignment != 0
+			|| entry.offset_ > header.data_size_
+			|| num_bytes > header.data_size_ - entry.offset_)
+		{
+			ret = false;
+			break;
+		}
+
+		unsigned int &loaded_matrix_types = is_global_matrix ?
+			global_matrix_types : matrix_types[label_index_1][label_index_2];
+		if (loaded_matrix_types & (1 << matrix_type))
+		{
+			ret = false;
+			break;
+		}
+		loaded_matrix_types |= (1 << matrix_type);
+
+		const double *matrix = (const double *)(data + entry.offset_);
+		const float *matrix_f = (const float *)(data + entry.offset_);
+
+		if (matrix_type <= JOINT_LOW_RANK_FACTOR_F)
+		{
+			MeshCuboidJointNormalRelations *&relation = _joint_normal_relations[label_index_1][label_index_2];
+			if (!relation)
+				relation = new MeshCuboidJointNormalRelations();
+			MeshCuboidJointNormalRelations::BundleMatrices &matrices = relation->bundle_matrices_;
+
+			const bool is_triangular = ((entry.flags_ & k_triangular_factor_flag) != 0);
+
+			switch (matrix_type)
+			{
+			case JOINT_MEAN:
+				ret = (rows == joint_size && cols == 1);
+				matrices.mean_ = matrix;
+				break;
+			case JOINT_INV_COV:
+				ret = (rows == joint_size && cols == joint_size);
+				matrices.inv_cov_ = matrix;
+				break;
+			case JOINT_INV_COV_FACTOR:
+				ret = (rows == joint_size && cols == joint_size);
+				matrices.inv_cov_factor_ = matrix;
+				relation->is_inv_cov_factor_triangular_ = is_triangular;
+				break;
+			case JOINT_INV_COV_FACTOR_F:
+				ret = (rows == joint_size && cols == joint_size);
+				matrices.inv_cov_factor_f_ = matrix_f;
+				break;
+			case JOINT_LOW_RANK_DIAGONAL:
+				ret = (rows == joint_size && cols == 1);
+				matrices.low_rank_diagonal_ = matrix;
+				break;
+			case JOINT_LOW_RANK_FACTOR:
+				ret = (rows == joint_size && cols <= joint_size);
+				matrices.low_rank_factor_ = matrix;
+				matrices.rank_ = cols;
+				break;
+			case JOINT_LOW_RANK_FACTOR_F:
+				ret = (rows == joint_size && cols <= joint_size);
+				matrices.low_rank_factor_f_ = matrix_f;
+				break;
+			}
+		}
+		else if (matrix_type <= COND_INV_COV)
+		{
+			MeshCuboidCondNormalRelations *&relation = _cond_normal_relations[label_index_1][label_index_2];
+			if (!relation)
+				relation = new MeshCuboidCondNormalRelations();
+			MeshCuboidCondNormalRelations::BundleMatrices &matrices = relation->bundle_matrices_;
+
+			switch (matrix_type)
+			{
+			case COND_MEAN_A:
+				ret = (rows == cond_size && cols == MeshCuboidFeatures::k_num_global_feature_values);
+				matrices.mean_A_ = matrix;
+				break;
+			case COND_MEAN_B:
+				ret = (rows == cond_size && cols == 1);
+				matrices.mean_b_ = matrix;
+				break;
+			case COND_INV_COV:
+				ret = (rows == cond_size && cols == cond_size);
+				matrices.inv_cov_ = matrix;
+				break;
+			}
+		}
+		else
+		{
+			switch (matrix_type)
+			{
+			case OBJECT_NAMES:
+				// Each name is null-terminated.
+				ret = (cols == 1 && (rows == 0 || data[entry.offset_ + rows - 1] == '\0'));
+				object_names = (const char *)(data + entry.offset_);
+				object_names_size = rows;
+				break;
+			case TRAINING_ENERGY_THRESHOLD:
+				ret = (rows == 1 && cols == 1);
+				if (ret) training_energy_threshold = matrix[0];
+				break;
+			case JOINT_FEATURES:
+				ret = (rows == joint_size && (num_joint_feature_objects[label_index_1][label_index_2] < 0
+					|| num_joint_feature_objects[label_index_1][label_index_2] == cols));
+				joint_features[label_index_1][label_index_2] = matrix;
+				num_joint_feature_objects[label_index_1][label_index_2] = cols;
+				break;
+			case JOINT_FEATURE_OBJECT_INDICES:
+				ret = (cols == 1 && (num_joint_feature_objects[label_index_1][label_index_2] < 0
+					|| num_joint_feature_objects[label_index_1][label_index_2] == rows));
+				joint_feature_object_indices[label_index_1][label_index_2] = matrix;
+				num_joint_feature_objects[label_index_1][label_index_2] = rows;
+				break;
+			}
+		}
+	}
+
+	// Attach the relations to the bundle after checking that all matrices are loaded.
+	for (LabelIndex label_index_1 = 0; label_index_1 < num_labels && ret; ++label_index_1)
+	{
+		for (LabelIndex label_index_2 = 0; label_index_2 < num_labels && ret; ++label_index_2)
+		{
+			const unsigned int joint_matrix_types = matrix_types[label_index_1][label_index_2]
+				& ~(k_cond_matrices | k_training_matrices);
+			const unsigned int cond_matrix_types = matrix_types[label_index_1][label_index_2] & k_cond_matrices;
+			const unsigned int joint_feature_matrix_types = matrix_types[label_index_1][label_index_2]
+				& k_joint_feature_matrices;
+
+			// Features are stored only with their relations.
+			if (joint_feature_matrix_types != 0
+				&& (joint_feature_matrix_types != k_joint_feature_matrices
+				|| !_joint_normal_relations[label_index_1][label_index_2]))
+			{
+				ret = false;
+				break;
+			}
+
+			MeshCuboidJointNormalRelations *joint_relation = _joint_normal_relations[label_index_1][label_index_2];
+			if (joint_relation)
+			{
+				MeshCuboidJointNormalRelations::BundleMatrices &matrices = joint_relation->bundle_matrices_;
+				if (joint_matrix_types == k_dense_joint_matrices)
+				{
+					joint_relation->is_low_rank_ = false;
+					matrices.inv_cov_factor_size_ = joint_size;
+				}
+				else if (joint_matrix_types == k_low_rank_joint_matrices)
+				{
+					joint_relation->is_low_rank_ = true;
+					matrices.low_rank_size_ = joint_size;
+				}
+				else
+				{
+					ret = false;
+					break;
+				}
+
+				// Release the memory of the matrices owned by the relation.
+				joint_relation->mean_.resize(0);
+				joint_relation->inv_cov_.resize(0, 0);
+				joint_relation->inv_cov_factor_.resize(0, 0);
+				joint_relation->inv_cov_factor_f_.resize(0, 0);
+				joint_relation->low_rank_diagonal_.resize(0);
+				joint_relation->low_rank_factor_.resize(0, 0);
+				joint_relation->low_rank_factor_f_.resize(0, 0);
+				joint_relation->bundle_ = bundle;
+			}
+
+			MeshCuboidCondNormalRelations *cond_relation = _cond_normal_relations[label_index_1][label_index_2];
+			if (cond_relation)
+			{
+				if (cond_matrix_types != k_cond_matrices)
+				{
+					ret = false;
+					break;
+				}
+
+				cond_relation->mean_A_.resize(0, 0);
+				cond_relation->mean_b_.resize(0);
+				cond_relation->inv_cov_.resize(0, 0);
+				cond_relation->bundle_ = bundle;
+			}
+		}
+	}
+
+	if (!ret)
+	{
+		std::cerr << "Wrong file format: \"" << _filename << "\"" << std::endl;
+		delete_relations(_joint_normal_relations);
+		delete_relations(_cond_normal_relations);
+		return false;
+	}
+
+	if (_ignored_object_name.empty())
+		return true;
+
+	// Leave-one-out relations.
+	if (!(global_matrix_types & (1 << OBJECT_NAMES)) || !(global_matrix_types & (1 << TRAINING_ENERGY_THRESHOLD)))
+	{
+		std::cerr << "Error: The relation bundle has no training data to exclude '" << _ignored_object_name
+			<< "': \"" << _filename << "\"" << std::endl;
+		delete_relations(_joint_normal_relations);
+		delete_relations(_cond_normal_relations);
+		return false;
+	}
+
+	int ignored_object_index = -1;
+	int num_objects = 0;
+	for (uint64_t offset = 0; offset < object_names_size; ++num_objects)
+	{
+		const std::string object_name(object_names + offset);
+		if (object_name == _ignored_object_name)
+			ignored_object_index = num_objects;
+		offset += object_name.size() + 1;
+	}
+
+	// NOTE:
+	// If the object is not in the training data, the relations already exclude it.
+	if (ignored_object_index < 0)
+		return true;
+
+	std::cout << "Mesh [" << _ignored_object_name << "] is ignored." << std::endl;
+
+	for (LabelIndex label_index_1 = 0; label_index_1 < num_labels; ++label_index_1)
+	{
+		for (LabelIndex label_index_2 = 0; label_index_2 < num_labels; ++label_index_2)
+		{
+			const double *object_indices = joint_feature_object_indices[label_index_1][label_index_2];
+			if (!object_indices) continue;
+
+			const int num_feature_objects = num_joint_feature_objects[label_index_1][label_index_2];
+			MeshCuboidConstMatrixMap features(joint_features[label_index_1][label_index_2],
+				joint_size, num_feature_objects);
+
+			int ignored_col = -1;
+			for (int col = 0; col < num_feature_objects; ++col)
+			{
+				if (object_indices[col] == ignored_object_index)
+					ignored_col = col;
+			}
+			if (ignored_col < 0) continue;
+
+			Eigen::MatrixXd X(num_feature_objects - 1, joint_size);
+			for (int col = 0, row = 0; col < num_feature_objects; ++col)
+				if (col != ignored_col)
+					X.row(row++) = features.col(col).transpose();
+
+			MeshCuboidJointNormalRelations *&relation = _joint_normal_relations[label_index_1][label_index_2];
+			delete relation;
+			relation = NULL;
+
+			if (X.rows() == 0) continue;
+
+			relation = new MeshCuboidJointNormalRelations();
+			MeshCuboidTrainer::fit_joint_normal_relation(X, training_energy_threshold, relation);
+		}
+	}
+
+	return true;
+}
@@ -2,8 +2,11 @@
 
 #include "MeshCuboidParameters.h"
 #include "MeshCuboidNonLinearSolver.h"
+#include "MeshCuboidVisibility.h"
 #include "Utilities.h"
 
+#include <algorithm>
+#include <bitset>
 #include <cstdint>
 #include <fstream>
 #include <iostream>
@@ -12,6 +15,7 @@
 #include <Eigen/Core>
 #include <Eigen/Eigenvalues>
 #include <Eigen/SparseCore>
+#include <Eigen/SparseCholesky>
 #include <MRFEnergy.h>
 #include <EigenQP.h>
 
@@ -175,6 +179,95 @@ std::vector<int> solve_markov_random_field(
 	return output_labels;
 }
 
+std::vector<int> solve_markov_random_field(
+	const MeshCuboidLabelAndAxesPotentials &_potentials)
+{
+	const unsigned int num_nodes = _potentials.num_nodes();
+	const unsigned int num_labels = _potentials.num_cases();
+
+	MRFEnergy<TypeGeneral>* mrf;
+	MRFEnergy<TypeGeneral>::NodeId* nodes;
+	MRFEnergy<TypeGeneral>::Options options;
+	TypeGeneral::REAL energy, lower_bound;
+
+	mrf = new MRFEnergy<TypeGeneral>(TypeGeneral::GlobalSize());
+	nodes = new MRFEnergy<TypeGeneral>::NodeId[num_nodes];
+
+	// NOTE:
+	// The MRF copies node and edge data, so a single buffer is reused for all terms.
+	std::vector<TypeGeneral::REAL> energy_term(std::max(num_labels, num_labels * num_labels));
+
+	// Data term.
+	for (unsigned int node_index = 0; node_index < num_nodes; ++node_index)
+	{
+		for (unsigned int label_index = 0; label_index < num_labels; ++label_index)
+			energy_term[label_index] = _potentials.get_single_potential(node_index, label_index);
+
+		nodes[node_index] = mrf->AddNode(TypeGeneral::LocalSize(num_labels),
+			TypeGeneral::NodeData(&energy_term[0]));
+	}
+
+
+	// Smoothness term.
+	// NOTE:
+	// Pair potentials are computed in bounded batches of edges, each in a single parallel
+	// sweep, and the batch buffer and the per-thread scratch buffers are reused.
+	std::vector< std::pair<unsigned int, unsigned int> > node_pairs;
+	_potentials.get_node_pairs(node_pairs);
+
+	const unsigned int num_pairs = node_pairs.size();
+	const unsigned int num_pair_values = num_labels * num_labels;
+	const unsigned int num_batch_pairs = _potentials.num_batch_node_pairs();
+
+	std::vector<Real> batch_pair_potentials;
+	std::vector<MeshCuboidRelationScratch> thread_scratches;
+
+	for (unsigned int first_pair_index = 0; first_pair_index < num_pairs;
+		first_pair_index += num_batch_pairs)
+	{
+		const unsigned int num_pairs_in_batch = std::min(num_batch_pairs, num_pairs - first_pair_index);
+		_potentials.get_pair_potentials(node_pairs, first_pair_index, num_pairs_in_batch,
+			batch_pair_potentials, thread_scratches);
+		assert(batch_pair_potentials.size() == num_pairs_in_batch * num_pair_values);
+
+		for (unsigned int i = 0; i < num_pairs_in_batch; ++i)
+		{
+			const Real *pair_potentials = &batch_pair_potentials[i * num_pair_values];
+			for (unsigned int j = 0; j < num_pair_values; ++j)
+				energy_term[j] = pair_potentials[j];
+
+			mrf->AddEdge(nodes[node_pairs[first_pair_index + i].first],
+				nodes[node_pairs[first_pair_index + i].second],
+				TypeGeneral::EdgeData(TypeGeneral::GENERAL, &energy_term[0]));
+		}
+	}
+
+	std::vector<int> output_labels(num_nodes);
+
+
+	options.m_iterMax = 100; // maximum number of iterations
+	options.m_printIter = 10;
+	options.m_printMinIter = 0;
+
+	/////////////////////// TRW-S algorithm //////////////////////
+	mrf->ZeroMessages();
+	mrf->AddRandomMessages(0, 0.0, 1.0);
+	mrf->Minimize_TRW_S(options, lower_bound, energy);
+	std::cout << "Energy = " << energy << std::endl;
+
+
+	for (unsigned int node_index = 0; node_index < num_nodes; ++node_index)
+		output_labels[node_index] = mrf->GetSolution(nodes[node_index]);
+
+	double energy_verified = _potentials.compute_energy(output_labels);
+	std::cout << "Energy [Verified] = " << energy_verified << std::endl;
+
+	delete[] nodes;
+	delete mrf;
+
+	return output_labels;
+}
+
 /*
 std::vector<int> solve_markov_random_field(
 	const unsigned int _num_nodes,
@@ -328,6 +421,135 @@ Eigen::VectorXd solve_quadratic_programming(
 	return x;
 }
 
+MeshCuboidSparseKKTSolver::MeshCuboidSparseKKTSolver()
+{
+	clear();
+}
+
+void MeshCuboidSparseKKTSolver::clear()
+{
+	is_analyzed_ = false;
+	outer_indices_.clear();
+	inner_indices_.clear();
+	num_symbolic_analyses_ = 0;
+	num_numeric_factorizations_ = 0;
+}
+
+bool MeshCuboidSparseKKTSolver::is_same_pattern(const Eigen::SparseMatrix<double> &_matrix) const
+{
+	assert(_matrix.isCompressed());
+
+	if (outer_indices_.size() != _matrix.outerSize() + 1
+		|| inner_indices_.size() != _matrix.nonZeros())
+		return false;
+
+	return std::equal(outer_indices_.begin(), outer_indices_.end(), _matrix.outerIndexPtr())
+		&& std::equal(inner_indices_.begin(), inner_indices_.end(), _matrix.innerIndexPtr());
+}
+
+bool MeshCuboidSparseKKTSolver::solve(const Eigen::SparseMatrix<double> &_quadratic_term,
+	const Eigen::VectorXd &_linear_term,
+	const Eigen::SparseMatrix<double> &_constraint_matrix,
+	const Eigen::VectorXd &_constraint_values,
+	Eigen::VectorXd &_x)
+{
+	const unsigned int n = _quadratic_term.cols();
+	const unsigned int m = _constraint_matrix.rows();
+	assert(_quadratic_term.rows() == n);
+	assert(_linear_term.rows() == n);
+	assert(_constraint_matrix.cols() == n);
+	assert(_constraint_values.rows() == m);
+
+	const unsigned int num_refinement_iterations = 3;
+
+	// Make the quadratic term symmetric.
+	Eigen::SparseMatrix<double> quadratic_term_transpose = _quadratic_term.transpose();
+	Eigen::SparseMatrix<double> G = 0.5 * (_quadratic_term + quadratic_term_transpose);
+
+	double max_diagonal = 0.0;
+	for (unsigned int i = 0; i < n; ++i)
+		max_diagonal = std::max(max_diagonal, std::abs(G.coeff(i, i)));
+	if (max_diagonal == 0.0) max_diagonal = 1.0;
+	const double regularization = 1.0E-10 * max_diagonal;
+
+	// KKT system.
+	// NOTE:
+	// Diagonal entries are always stored (even when they are zero) so that
+	// the sparsity pattern does not change with the values.
+	std::vector< Eigen::Triplet<double> > triplets;
+	triplets.reserve(G.nonZeros() + 2 * _constraint_matrix.nonZeros() + n + m);
+
+	for (int k = 0; k < G.outerSize(); ++k)
+		for (Eigen::SparseMatrix<double>::InnerIterator it(G, k); it; ++it)
+			triplets.push_back(Eigen::Triplet<double>(it.row(), it.col(), it.value()));
+
+	for (int k = 0; k < _constraint_matrix.outerSize(); ++k)
+	{
+		for (Eigen::SparseMatrix<double>::InnerIterator it(_constraint_matrix, k); it; ++it)
+		{
+			triplets.push_back(Eigen::Triplet<double>(n + it.row(), it.col(), it.value()));
+			triplets.push_back(Eigen::Triplet<double>(it.col(), n + it.row(), it.value()));
+		}
+	}
+
+	for (unsigned int i = 0; i < n; ++i)
+		triplets.push_back(Eigen::Triplet<double>(i, i, 0.0));
+
+	Eigen::SparseMatrix<double> K(n + m, n + m);
+	K.setFromTriplets(triplets.begin(), triplets.end());
+	K.makeCompressed();
+
+	Eigen::SparseMatrix<double> regularized_K = K;
+	for (unsigned int i = n; i < n + m; ++i)
+		regularized_K.coeffRef(i, i) = -regularization;
+	regularized_K.makeCompressed();
+
+	if (!is_analyzed_ || !is_same_pattern(regularized_K))
+	{
+		solver_.analyzePattern(regularized_K);
+		outer_indices_.assign(regularized_K.outerIndexPtr(),
+			regularized_K.outerIndexPtr() + regularized_K.outerSize() + 1);
+		inner_indices_.assign(regularized_K.innerIndexPtr(),
+			regularized_K.innerIndexPtr() + regularized_K.nonZeros());
+		is_analyzed_ = true;
+		++num_symbolic_analyses_;
+	}
+
+	solver_.factorize(regularized_K);
+	++num_numeric_factorizations_;
+
+	if (solver_.info() != Eigen::Success)
+		return false;
+
+	// NOTE:
+	// LDL^T does not fail with zero pivots, so the quasi-definiteness is checked
+	// with the inertia of 'D': 'n' positive and 'm' negative pivots.
+	const Eigen::VectorXd &D = solver_.vectorD();
+	unsigned int num_positive_pivots = 0, num_negative_pivots = 0;
+	for (unsigned int i = 0; i < n + m; ++i)
+	{
+		if (D[i] > 0) ++num_positive_pivots;
+		else if (D[i] < 0) ++num_negative_pivots;
+	}
+	if (num_positive_pivots != n || num_negative_pivots != m)
+		return false;
+
+	// min (x^T G x + 2 b^T x) s.t. C x = d => [G C^T; C 0][x; y] = [-b; d].
+	Eigen::VectorXd rhs(n + m);
+	rhs.head(n) = -_linear_term;
+	rhs.tail(m) = _constraint_values;
+
+	Eigen::VectorXd solution = solver_.solve(rhs);
+	for (unsigned int iteration = 0; iteration < num_refinement_iterations; ++iteration)
+		solution += solver_.solve(rhs - K * solution);
+
+	if (solver_.info() != Eigen::Success || solution.hasNaN())
+		return false;
+
+	_x = solution.head(n);
+	return true;
+}
+
 /*
 Eigen::VectorXd solve_quadratic_programming(
 	const Eigen::MatrixXd& _quadratic_term,
@@ -403,6 +625,13 @@ void update_cuboid_surface_points(
 {
 	const Real radius = FLAGS_param_occlusion_test_neighbor_distance * _cuboid_structure.mesh_->get_object_diameter();
 
+	// NOTE:
+	// The sample points are shared by all cuboids.
+	MeshCuboidVisibilityEngine *visibility_engine = NULL;
+	if (_modelview_matrix)
+		visibility_engine = new MeshCuboidVisibilityEngine(
+		_modelview_matrix, radius, _cuboid_structure.get_sample_point_store().get_points());
+
 	std::vector<MeshCuboid *> all_cuboids = _cuboid_structure.get_all_cuboids();
 	for (std::vector<MeshCuboid *>::iterator it = all_cuboids.begin(); it != all_cuboids.end(); ++it)
 	{
@@ -410,12 +639,13 @@ void update_cuboid_surface_points(
 		cuboid->create_grid_points_on_cuboid_surface(
 			FLAGS_param_num_cuboid_surface_points);
 
-		if (_modelview_matrix)
+		if (visibility_engine)
 		{
-			cuboid->compute_cuboid_surface_point_visibility(
-				_modelview_matrix, radius, _cuboid_structure.sample_points_);
+			cuboid->compute_cuboid_surface_point_visibility(*visibility_engine);
 		}
 	}
+
+	delete visibility_engine;
 }
 
 void segment_sample_points(
@@ -439,28 +669,16 @@ void segment_sample_points(
 
 
 
-	//
-	std::vector<ANNpointArray> cuboid_ann_points(num_cuboids);
+	// NOTE:
+	// KD-trees are cached in cuboids and the structure.
 	std::vector<ANNkd_tree*> cuboid_ann_kd_tree(num_cuboids);
 
 	for (unsigned int cuboid_index = 0; cuboid_index < num_cuboids; ++cuboid_index)
 	{
 		MeshCuboid *cuboid = all_cuboids[cuboid_index];
+		assert(cuboid->num_cuboid_surface_points() > 0);
 
-		unsigned int num_cuboid_surface_points = cuboid->num_cuboid_surface_points();
-		Eigen::MatrixXd cuboid_surface_points(3, num_cuboid_surface_points);
-		assert(num_cuboid_surface_points > 0);
-
-		for (unsigned int point_index = 0; point_index < num_cuboid_surface_points; ++point_index)
-		{
-			for (unsigned int i = 0; i < 3; ++i)
-				cuboid_surface_points.col(point_index)(i) =
-				cuboid->get_cuboid_surface_point(point_index)->point_[i];
-		}
-
-		cuboid_ann_kd_tree[cuboid_index] = ICP::create_kd_tree(cuboid_surface_points,
-			cuboid_ann_points[cuboid_index]);
-		assert(cuboid_ann_points[cuboid_index]);
+		cuboid_ann_kd_tree[cuboid_index] = cuboid->get_cuboid_surface_point_kd_tree();
 		assert(cuboid_ann_kd_tree[cuboid_index]);
 	}
 
@@ -469,6 +687,13 @@ void segment_sample_points(
 	ANNdistArray dd = new ANNdist[1];
 	//
 
+	// NOTE:
+	// Sample point positions and label confidences are read from the contiguous store.
+	const MeshSamplePointStore &sample_point_store = _cuboid_structure.get_sample_point_store();
+	const Eigen::MatrixXd &sample_points = sample_point_store.get_points();
+	const Eigen::MatrixXd &label_index_confidences =
+		sample_point_store.get_label_index_confidences();
+	assert(sample_points.cols() == num_sample_points);
 
 
 	// Single potential.
@@ -477,9 +702,8 @@ void segment_sample_points(
 
 	for (unsigned int point_index = 0; point_index < num_sample_points; ++point_index)
 	{
-		MeshSamplePoint *sample_point = _cuboid_structure.sample_points_[point_index];
 		for (unsigned int i = 0; i < 3; ++i)
-			q[i] = sample_point->point_[i];
+			q[i] = sample_points(i, point_index);
 
 		for (unsigned int cuboid_index = 0; cuboid_index < num_cuboids; ++cuboid_index)
 		{
@@ -491,7 +715,8 @@ void segment_sample_points(
 			double squared_distance = dd[0];
 			assert(squared_distance >= 0);
 
-			double label_probability = sample_point->label_index_confidence_[label_index];
+			assert(label_index < label_index_confidences.cols());
+			double label_probability = label_index_confidences(point_index, label_index);
 
 			//
 			if (FLAGS_disable_per_point_classifier_terms)
@@ -516,32 +741,11 @@ void segment_sample_points(
 	delete[] nn_idx;
 	delete[] dd;
 
-	for (unsigned int cuboid_index = 0; cuboid_index < num_cuboids; ++cuboid_index)
-	{
-		annDeallocPts(cuboid_ann_points[cuboid_index]);
-		delete cuboid_ann_kd_tree[cuboid_index];
-	}
-
 
 	// Construct a KD-tree.
-	Eigen::MatrixXd sample_points(3, num_sample_points);
-	for (SamplePointIndex point_index = 0; point_index < num_sample_points; ++point_index)
-	{
-		for (unsigned int i = 0; i < 3; ++i)
-			sample_points.col(point_index)(i) =
-			_cuboid_structure.sample_points_[point_index]->point_[i];
-	}
-
 	const int dim = 3;
-	ANNpointArray sample_ann_points = annAllocPts(num_sample_points, dim);	// allocate data points
-
-	for (SamplePointIndex point_index = 0; point_index < num_sample_points; ++point_index)
-	{
-		for (int i = 0; i < dim; i++)
-			sample_ann_points[point_index][i] = sample_points.col(point_index)[i];
-	}
-
-	ANNkd_tree *sample_kd_tree = new ANNkd_tree(sample_ann_points, num_sample_points, dim);
+	ANNkd_tree *sample_kd_tree = _cuboid_structure.get_sample_point_kd_tree();
+	assert(sample_kd_tree);
 	q = annAllocPt(dim);
 	nn_idx = new ANNidx[num_neighbors];
 	dd = new ANNdist[num_neighbors];
@@ -584,9 +788,6 @@ void segment_sample_points(
 	delete[] nn_idx;
 	delete[] dd;
 	annDeallocPt(q);
-	annDeallocPts(sample_ann_points);
-	delete sample_kd_tree;
-	annClose();
 
 
 	// MRF.
@@ -666,7 +867,7 @@ void segment_sample_points(
 
 	for (unsigned int point_index = 0; point_index < num_sample_points; ++point_index)
 	{
-		MeshSamplePoint *sample_point = _cuboid_structure.sample_points_[point_index];
+		MeshSamplePoint *sample_point = _cuboid_structure.get_sample_point(point_index);
 		int cuboid_index = output_labels[point_index];
 		//int cuboid_index;
 		//single_potentials.row(point_index).minCoeff(&cuboid_index);
@@ -683,98 +884,52 @@ void segment_sample_points(
 	}
 }
 
-void compute_labels_and_axes_configuration_potentials(
+MeshCuboidLabelAndAxesPotentials::MeshCuboidLabelAndAxesPotentials(
 	const std::vector<Label>& _labels,
 	const std::vector<MeshCuboid *>& _cuboids,
 	const MeshCuboidPredictor &_predictor,
-	Eigen::MatrixXd &_potential_mat,
 	const std::vector< std::list<LabelIndex> > *_label_symmetries,
 	bool _add_dummy_label)
+	: predictor_(_predictor)
+	, num_labels_(_labels.size())
+	, num_cuboids_(_cuboids.size())
+	, num_axis_configurations_(MeshCuboid::num_axis_configurations())
+	, add_dummy_label_(_add_dummy_label)
 {
-	unsigned int num_labels = _labels.size();
-	unsigned int num_cuboids = _cuboids.size();
-	unsigned int num_axis_configurations = MeshCuboid::num_axis_configurations();
-	assert(num_axis_configurations > 0);
-	if (num_labels == 0 || num_cuboids == 0) return;
+	assert(num_axis_configurations_ > 0);
 
-	unsigned int num_cases = num_labels * num_axis_configurations;
-	
-	if (_add_dummy_label)
+	num_cases_ = num_labels_ * num_axis_configurations_;
+
+	if (add_dummy_label_)
 	{
-		num_cases = num_cases + 1;
+		num_cases_ = num_cases_ + 1;
 	}
-	
-	unsigned int mat_size = num_cuboids * num_cases;
-	_potential_mat = Eigen::MatrixXd(mat_size, mat_size);
-	_potential_mat.setZero();
-
-
-	// NOTE:
-	// The potential matrix should be symmetric.
 
-	// Cuboid with various labels and axes configurations.
-	std::vector< std::vector<MeshCuboid *> > cuboids_with_label_and_axes(num_cuboids);
-	std::vector< std::vector<MeshCuboidAttributes> > attributes_with_label_and_axes(num_cuboids);
-	std::vector< std::vector<MeshCuboidTransformation> > transformations_with_label_and_axes(num_cuboids);
+	axis_configuration_caches_.resize(num_cuboids_, NULL);
 
-	for (unsigned int cuboid_index = 0; cuboid_index < num_cuboids; ++cuboid_index)
+	for (unsigned int cuboid_index = 0; cuboid_index < num_cuboids_; ++cuboid_index)
 	{
-		cuboids_with_label_and_axes[cuboid_index].resize(num_cases);
-		attributes_with_label_and_axes[cuboid_index].resize(num_cases);
-		transformations_with_label_and_axes[cuboid_index].resize(num_cases);
-
-		for (int case_index = 0; case_index < num_cases; ++case_index)
-		{
-			if (_add_dummy_label && case_index >= (num_cases - 1))
-			{
-				continue;
-			}
-
-			unsigned int label_index = (case_index / num_axis_configurations);
-			unsigned int axis_configuration_index =
-				(case_index % num_axis_configurations);
-			assert(label_index < num_labels);
-			assert(axis_configuration_index < num_axis_configurations);
-
-			// FIXME:
-			// The cuboid should not deep copy all cuboid surface points.
-			MeshCuboid *cuboid = new MeshCuboid(*_cuboids[cuboid_index]);	// Copy constructor.
-			cuboid->set_label_index(label_index);
-			cuboid->set_axis_configuration(axis_configuration_index);
-
-			cuboids_with_label_and_axes[cuboid_index][case_index] = cuboid;
-			attributes_with_label_and_axes[cuboid_index][case_index].compute_attributes(cuboid);
-			transformations_with_label_and_axes[cuboid_index][case_index].compute_transformation(cuboid);
-		}
+		assert(_cuboids[cuboid_index]);
+		axis_configuration_caches_[cuboid_index] =
+			new MeshCuboidAxisConfigurationCache(_cuboids[cuboid_index]);
+		assert(axis_configuration_caches_[cuboid_index]->num_axis_configurations()
+			== num_axis_configurations_);
 	}
 
 
 	// Single potentials.
-	std::cout << "Unary potentials..." << std::endl;
+	single_potentials_ = Eigen::MatrixXd::Zero(num_cuboids_, num_cases_);
 
-	for (unsigned int cuboid_index = 0; cuboid_index < num_cuboids; ++cuboid_index)
+	for (unsigned int cuboid_index = 0; cuboid_index < num_cuboids_; ++cuboid_index)
 	{
-		for (unsigned int case_index = 0; case_index < num_cases; ++case_index)
+		for (unsigned int case_index = 0; case_index < num_cases_; ++case_index)
 		{
-			if (_add_dummy_label && case_index >= (num_cases - 1))
+			if (is_dummy_case(case_index))
 			{
 				continue;
 			}
 
-			unsigned int mat_index = cuboid_index * num_cases + case_index;
-			unsigned int label_index = (case_index / num_axis_configurations);
-			unsigned int axis_configuration_index =
-				(case_index % num_axis_configurations);
-			assert(label_index < num_labels);
-			assert(axis_configuration_index < num_axis_configurations);
-			Label label = _labels[label_index];
-
-			const MeshCuboid *cuboid = cuboids_with_label_and_axes[cuboid_index][case_index];
-			const MeshCuboidAttributes &attributes = attributes_with_label_and_axes[cuboid_index][case_index];
-			const MeshCuboidTransformation &transformation = transformations_with_label_and_axes[cuboid_index][case_index];
-
-			//Real potential = _predictor.get_single_potential(cuboid, &attributes, &transformation, label_index);
-			//assert(potential >= 0.0);
+			unsigned int label_index = (case_index / num_axis_configurations_);
 
 			Real potential = 0.0;
 			if (!FLAGS_disable_per_point_classifier_terms)
@@ -786,7 +941,7 @@ void compute_labels_and_axes_configuration_potentials(
 				// If label symmetry information is given, symmetric labels have zero potential value.
 				if (_label_symmetries)
 				{
-					assert((*_label_symmetries).size() == num_labels);
+					assert((*_label_symmetries).size() == num_labels_);
 					const std::list<LabelIndex> &label_symmetry = (*_label_symmetries)[label_index];
 					for (std::list<LabelIndex>::const_iterator it = label_symmetry.begin(); it != label_symmetry.end(); ++it)
 					{
@@ -798,126 +953,330 @@ void compute_labels_and_axes_configuration_potentials(
 					}
 				}
 			}
-			_potential_mat(mat_index, mat_index) = potential;
+			single_potentials_(cuboid_index, case_index) = potential;
 		}
 	}
 
-	// Pairwise potentials.
-	std::cout << "Binary potentials..." << std::endl;
 
-	for (unsigned int cuboid_index_1 = 0; cuboid_index_1 < num_cuboids - 1; ++cuboid_index_1)
+	// Label pairs not depending on cuboids.
+	is_constant_label_pair_.resize(num_labels_ * num_labels_, false);
+	constant_label_pair_potentials_.resize(num_labels_ * num_labels_, 0.0);
+
+	for (LabelIndex label_index_1 = 0; label_index_1 < num_labels_; ++label_index_1)
 	{
-		for (unsigned int case_index_1 = 0; case_index_1 < num_cases; ++case_index_1)
+		for (LabelIndex label_index_2 = 0; label_index_2 < num_labels_; ++label_index_2)
 		{
-			if (_add_dummy_label && case_index_1 >= (num_cases - 1))
+			const unsigned int label_pair_index = label_index_1 * num_labels_ + label_index_2;
+			Real potential = 0.0;
+
+			if (label_index_1 == label_index_2)
 			{
-				continue;
+				// NOTE:
+				// Currently, it is NOT allowed that multiple parts have the same label.
+				is_constant_label_pair_[label_pair_index] = true;
+				constant_label_pair_potentials_[label_pair_index] = FLAGS_param_max_potential;
+			}
+			else if (predictor_.get_constant_pair_potential(label_index_1, label_index_2, potential))
+			{
+				is_constant_label_pair_[label_pair_index] = true;
+				constant_label_pair_potentials_[label_pair_index] = potential;
 			}
+		}
+	}
+}
 
-			unsigned int mat_index_1 = cuboid_index_1 * num_cases + case_index_1;
-			unsigned int label_index_1 = (case_index_1 / num_axis_configurations);
-			unsigned int axis_configuration_index_1 =
-				(case_index_1 % num_axis_configurations);
-			assert(label_index_1 < num_labels);
-			assert(axis_configuration_index_1 < num_axis_configurations);
-			Label label_1 = _labels[label_index_1];
+MeshCuboidLabelAndAxesPotentials::~MeshCuboidLabelAndAxesPotentials()
+{
+	for (std::vector<MeshCuboidAxisConfigurationCache *>::iterator it = axis_configuration_caches_.begin();
+		it != axis_configuration_caches_.end(); ++it)
+	{
+		delete (*it);
+	}
+}
 
-			const MeshCuboid *cuboid_1 = cuboids_with_label_and_axes[cuboid_index_1][case_index_1];
-			const MeshCuboidAttributes &attributes_1 = attributes_with_label_and_axes[cuboid_index_1][case_index_1];
-			const MeshCuboidTransformation &transformation_1 = transformations_with_label_and_axes[cuboid_index_1][case_index_1];
+bool MeshCuboidLabelAndAxesPotentials::is_dummy_case(const unsigned int _case_index) const
+{
+	return (add_dummy_label_ && _case_index >= (num_cases_ - 1));
+}
 
-			for (unsigned int cuboid_index_2 = cuboid_index_1 + 1; cuboid_index_2 < num_cuboids; ++cuboid_index_2)
-			{
-				assert(cuboid_index_1 != cuboid_index_2);
+Real MeshCuboidLabelAndAxesPotentials::get_single_potential(
+	const unsigned int _node_index, const unsigned int _case_index) const
+{
+	assert(_node_index < num_cuboids_);
+	assert(_case_index < num_cases_);
+	return single_potentials_(_node_index, _case_index);
+}
+
+Real MeshCuboidLabelAndAxesPotentials::get_pair_potential(
+	const unsigned int _node_index_1, const unsigned int _node_index_2,
+	const unsigned int _case_index_1, const unsigned int _case_index_2,
+	MeshCuboidRelationScratch *_scratch) const
+{
+	assert(_node_index_1 < num_cuboids_);
+	assert(_node_index_2 < num_cuboids_);
+	assert(_node_index_1 != _node_index_2);
+	assert(_case_index_1 < num_cases_);
+	assert(_case_index_2 < num_cases_);
+
+	if (is_dummy_case(_case_index_1) || is_dummy_case(_case_index_2))
+		return FLAGS_param_dummy_potential;
+
+	unsigned int label_index_1 = (_case_index_1 / num_axis_configurations_);
+	unsigned int label_index_2 = (_case_index_2 / num_axis_configurations_);
+	assert(label_index_1 < num_labels_);
+	assert(label_index_2 < num_labels_);
+
+	const unsigned int label_pair_index = label_index_1 * num_labels_ + label_index_2;
+	if (is_constant_label_pair_[label_pair_index])
+		return constant_label_pair_potentials_[label_pair_index];
+
+	unsigned int axis_configuration_index_1 = (_case_index_1 % num_axis_configurations_);
+	unsigned int axis_configuration_index_2 = (_case_index_2 % num_axis_configurations_);
+
+	const MeshCuboidAxisConfigurationCache *cache_1 = axis_configuration_caches_[_node_index_1];
+	const MeshCuboidAxisConfigurationCache *cache_2 = axis_configuration_caches_[_node_index_2];
+	assert(cache_1);
+	assert(cache_2);
+
+	Real potential = predictor_.get_pair_potential(
+		cache_1->get_features(axis_configuration_index_1),
+		cache_2->get_features(axis_configuration_index_2),
+		&cache_1->get_transformation(axis_configuration_index_1),
+		&cache_2->get_transformation(axis_configuration_index_2),
+		label_index_1, label_index_2, _scratch);
+	assert(potential >= 0.0);
+
+	return potential;
+}
+
+void MeshCuboidLabelAndAxesPotentials::get_pair_potentials(
+	const unsigned int _node_index_1, const unsigned int _node_index_2,
+	std::vector<Real> &_pair_potentials) const
+{
+	_pair_potentials.resize(num_cases_ * num_cases_);
 
 #ifdef WIN32
 #pragma omp parallel for
 #endif
-				for (int case_index_2 = 0; case_index_2 < num_cases; ++case_index_2)
-				{
-					if (_add_dummy_label && case_index_2 >= (num_cases - 1))
-					{
-						continue;
-					}
+	for (int case_index_2 = 0; case_index_2 < num_cases_; ++case_index_2)
+	{
+		for (unsigned int case_index_1 = 0; case_index_1 < num_cases_; ++case_index_1)
+		{
+			_pair_potentials[case_index_1 + case_index_2 * num_cases_] = get_pair_potential(
+				_node_index_1, _node_index_2, case_index_1, case_index_2);
+		}
+	}
+}
 
-					unsigned int mat_index_2 = cuboid_index_2 * num_cases + case_index_2;
+void MeshCuboidLabelAndAxesPotentials::get_node_pairs(
+	std::vector< std::pair<unsigned int, unsigned int> > &_node_pairs) const
+{
+	_node_pairs.clear();
+	_node_pairs.reserve(num_node_pairs());
 
-					// Symmetric matrix. Diagonals are for single potentials.
-					if (mat_index_1 >= mat_index_2)
-						continue;
+	for (unsigned int node_index_1 = 0; node_index_1 < num_cuboids_; ++node_index_1)
+		for (unsigned int node_index_2 = node_index_1 + 1; node_index_2 < num_cuboids_; ++node_index_2)
+			_node_pairs.push_back(std::make_pair(node_index_1, node_index_2));
 
-					unsigned int label_index_2 = (case_index_2 / num_axis_configurations);
-					unsigned int axis_configuration_index_2 =
-						(case_index_2 % num_axis_configurations);
-					assert(label_index_2 < num_labels);
-					assert(axis_configuration_index_2 < num_axis_configurations);
-					Label label_2 = _labels[label_index_2];
+	assert(_node_pairs.size() == num_node_pairs());
+}
 
-					MeshCuboid *cuboid_2 = cuboids_with_label_and_axes[cuboid_index_2][case_index_2];
-					const MeshCuboidAttributes &attributes_2 = attributes_with_label_and_axes[cuboid_index_2][case_index_2];
-					const MeshCuboidTransformation &transformation_2 = transformations_with_label_and_axes[cuboid_index_2][case_index_2];
+unsigned int MeshCuboidLabelAndAxesPotentials::num_batch_node_pairs() const
+{
+	// NOTE:
+	// The number of pair potential values in a batch is bounded (32 MB in double).
+	const unsigned int k_max_num_batch_values = (1 << 22);
+	const unsigned int num_pair_values = num_cases_ * num_cases_;
+	return std::max(k_max_num_batch_values / num_pair_values, 1u);
+}
 
-					if (label_index_1 == label_index_2)
-					{
-						// NOTE:
-						// Currently, it is NOT allowed that multiple parts have the same label.
-						_potential_mat(mat_index_1, mat_index_2) = FLAGS_param_max_potential;
-						_potential_mat(mat_index_2, mat_index_1) = FLAGS_param_max_potential;
-						continue;
-					}
-					assert(label_1 != label_2);
+void MeshCuboidLabelAndAxesPotentials::get_pair_potentials(
+	const std::vector< std::pair<unsigned int, unsigned int> > &_node_pairs,
+	const unsigned int _first_pair_index, const unsigned int _num_pairs,
+	std::vector<Real> &_pair_potentials,
+	std::vector<MeshCuboidRelationScratch> &_thread_scratches) const
+{
+	assert(_first_pair_index + _num_pairs <= _node_pairs.size());
 
-					Real potential = _predictor.get_pair_potential(
-						cuboid_1, cuboid_2, &attributes_1, &attributes_2,
-						&transformation_1, &transformation_2, label_index_1, label_index_2);
-					assert(potential >= 0.0);
+	const unsigned int num_pair_values = num_cases_ * num_cases_;
+	_pair_potentials.resize(_num_pairs * num_pair_values);
 
-					// Symmetric matrix.
-					_potential_mat(mat_index_1, mat_index_2) = potential;
-					_potential_mat(mat_index_2, mat_index_1) = potential;
-				}
-			}
-		}
-	}
+	// NOTE:
+	// Each tile is a (node pair, case_index_2) combination, and computes the potentials of
+	// all 'case_index_1' values. Tiles of all node pairs are distributed in a single
+	// parallel loop, and each thread reuses its own scratch buffers.
+	// In each tile, the cases of node 1 with the same label are evaluated in a batch.
+	const int num_threads = omp_get_max_threads();
+	if (_thread_scratches.size() < static_cast<size_t>(num_threads))
+		_thread_scratches.resize(num_threads);
 
+	const int num_tiles = static_cast<int>(_num_pairs * num_cases_);
 
-	// Set dummy label pair potentials.
-	if (_add_dummy_label)
+#pragma omp parallel
 	{
-		const unsigned int dummy_case_index = num_cases - 1;
-		const Real dummy_potential = FLAGS_param_dummy_potential;
+		Eigen::VectorXd potentials;
 
-		for (unsigned int cuboid_index = 0; cuboid_index < num_cuboids; ++cuboid_index)
+#pragma omp for schedule(dynamic, 16)
+		for (int tile_index = 0; tile_index < num_tiles; ++tile_index)
 		{
-			for (unsigned int case_index = 0; case_index < num_cases; ++case_index)
+			const unsigned int batch_pair_index = static_cast<unsigned int>(tile_index) / num_cases_;
+			const unsigned int case_index_2 = static_cast<unsigned int>(tile_index) % num_cases_;
+
+			const unsigned int node_index_1 = _node_pairs[_first_pair_index + batch_pair_index].first;
+			const unsigned int node_index_2 = _node_pairs[_first_pair_index + batch_pair_index].second;
+
+			assert(omp_get_thread_num() < num_threads);
+			MeshCuboidRelationScratch &scratch = _thread_scratches[omp_get_thread_num()];
+			Real *pair_potentials = &(_pair_potentials[
+				batch_pair_index * num_pair_values + case_index_2 * num_cases_]);
+
+			if (is_dummy_case(case_index_2))
 			{
-				unsigned int mat_index = cuboid_index * num_cases + case_index;
+				for (unsigned int case_index_1 = 0; case_index_1 < num_cases_; ++case_index_1)
+					pair_potentials[case_index_1] = FLAGS_param_dummy_potential;
+				continue;
+			}
+
+			const unsigned int label_index_2 = (case_index_2 / num_axis_configurations_);
+			const unsigned int axis_configuration_index_2 = (case_index_2 % num_axis_configurations_);
+			const MeshCuboidAxisConfigurationCache *cache_1 = axis_configuration_caches_[node_index_1];
+			const MeshCuboidAxisConfigurationCache *cache_2 = axis_configuration_caches_[node_index_2];
 
-				for (unsigned int dummy_cuboid_index = 0; dummy_cuboid_index < num_cuboids; ++dummy_cuboid_index)
+			for (LabelIndex label_index_1 = 0; label_index_1 < num_labels_; ++label_index_1)
+			{
+				const unsigned int label_pair_index = label_index_1 * num_labels_ + label_index_2;
+				Real *label_pair_potentials = &pair_potentials[label_index_1 * num_axis_configurations_];
+
+				if (is_constant_label_pair_[label_pair_index])
 				{
-					if (cuboid_index == dummy_cuboid_index)
-						continue;
+					for (unsigned int i = 0; i < num_axis_configurations_; ++i)
+						label_pair_potentials[i] = constant_label_pair_potentials_[label_pair_index];
+					continue;
+				}
+
+				predictor_.get_pair_potentials(*cache_1,
+					cache_2->get_features(axis_configuration_index_2),
+					&cache_2->get_transformation(axis_configuration_index_2),
+					label_index_1, label_index_2, potentials, &scratch);
+				assert(potentials.size() == num_axis_configurations_);
 
-					unsigned int dummy_mat_index = dummy_cuboid_index * num_cases + dummy_case_index;
-					_potential_mat(mat_index, dummy_mat_index) = dummy_potential;
-					_potential_mat(dummy_mat_index, mat_index) = dummy_potential;
+				for (unsigned int i = 0; i < num_axis_configurations_; ++i)
+				{
+					assert(potentials[i] >= 0.0);
+					label_pair_potentials[i] = potentials[i];
 				}
 			}
+
+			if (add_dummy_label_)
+				pair_potentials[num_cases_ - 1] = FLAGS_param_dummy_potential;
+		}
+	}
+}
+
+void MeshCuboidLabelAndAxesPotentials::get_all_pair_potentials(
+	std::vector< std::vector<Real> > &_all_pair_potentials) const
+{
+	std::vector< std::pair<unsigned int, unsigned int> > node_pairs;
+	get_node_pairs(node_pairs);
+
+	const unsigned int num_pairs = node_pairs.size();
+	const unsigned int num_pair_values = num_cases_ * num_cases_;
+	const unsigned int num_batch_pairs = num_batch_node_pairs();
+
+	_all_pair_potentials.resize(num_pairs);
+
+	std::vector<Real> batch_pair_potentials;
+	std::vector<MeshCuboidRelationScratch> thread_scratches;
+
+	for (unsigned int first_pair_index = 0; first_pair_index < num_pairs;
+		first_pair_index += num_batch_pairs)
+	{
+		const unsigned int num_pairs_in_batch = std::min(num_batch_pairs, num_pairs - first_pair_index);
+		get_pair_potentials(node_pairs, first_pair_index, num_pairs_in_batch,
+			batch_pair_potentials, thread_scratches);
+
+		for (unsigned int i = 0; i < num_pairs_in_batch; ++i)
+		{
+			_all_pair_potentials[first_pair_index + i].assign(
+				batch_pair_potentials.begin() + i * num_pair_values,
+				batch_pair_potentials.begin() + (i + 1) * num_pair_values);
 		}
 	}
+}
 
+Real MeshCuboidLabelAndAxesPotentials::compute_energy(
+	const std::vector<int> &_case_indices) const
+{
+	assert(_case_indices.size() == num_cuboids_);
+	Real energy = 0.0;
 
-	// Deallocate.
-	for (std::vector< std::vector<MeshCuboid *> >::iterator it = cuboids_with_label_and_axes.begin();
-		it != cuboids_with_label_and_axes.end(); ++it)
+	for (unsigned int node_index_1 = 0; node_index_1 < num_cuboids_; ++node_index_1)
 	{
-		for (std::vector<MeshCuboid *>::iterator jt = (*it).begin(); jt != (*it).end(); ++jt)
+		energy += get_single_potential(node_index_1, _case_indices[node_index_1]);
+
+		for (unsigned int node_index_2 = node_index_1 + 1; node_index_2 < num_cuboids_; ++node_index_2)
 		{
-			delete (*jt);
+			energy += get_pair_potential(node_index_1, node_index_2,
+				_case_indices[node_index_1], _case_indices[node_index_2]);
+		}
+	}
+
+	return energy;
+}
+
+void MeshCuboidLabelAndAxesPotentials::get_potential_matrix(Eigen::MatrixXd &_potential_mat) const
+{
+	unsigned int mat_size = num_cuboids_ * num_cases_;
+	_potential_mat = Eigen::MatrixXd::Zero(mat_size, mat_size);
+
+	std::vector< std::vector<Real> > all_pair_potentials;
+	get_all_pair_potentials(all_pair_potentials);
+	unsigned int pair_index = 0;
+
+	for (unsigned int node_index_1 = 0; node_index_1 < num_cuboids_; ++node_index_1)
+	{
+		for (unsigned int case_index = 0; case_index < num_cases_; ++case_index)
+		{
+			unsigned int mat_index = node_index_1 * num_cases_ + case_index;
+			_potential_mat(mat_index, mat_index) = get_single_potential(node_index_1, case_index);
+		}
+
+		for (unsigned int node_index_2 = node_index_1 + 1; node_index_2 < num_cuboids_; ++node_index_2)
+		{
+			const std::vector<Real> &pair_potentials = all_pair_potentials[pair_index++];
+
+			for (unsigned int case_index_1 = 0; case_index_1 < num_cases_; ++case_index_1)
+			{
+				for (unsigned int case_index_2 = 0; case_index_2 < num_cases_; ++case_index_2)
+				{
+					unsigned int mat_index_1 = node_index_1 * num_cases_ + case_index_1;
+					unsigned int mat_index_2 = node_index_2 * num_cases_ + case_index_2;
+					Real potential = pair_potentials[case_index_1 + case_index_2 * num_cases_];
+
+					// Symmetric matrix.
+					_potential_mat(mat_index_1, mat_index_2) = potential;
+					_potential_mat(mat_index_2, mat_index_1) = potential;
+				}
+			}
 		}
 	}
 }
 
+void compute_labels_and_axes_configuration_potentials(
+	const std::vector<Label>& _labels,
+	const std::vector<MeshCuboid *>& _cuboids,
+	const MeshCuboidPredictor &_predictor,
+	Eigen::MatrixXd &_potential_mat,
+	const std::vector< std::list<LabelIndex> > *_label_symmetries,
+	bool _add_dummy_label)
+{
+	if (_labels.empty() || _cuboids.empty()) return;
+
+	MeshCuboidLabelAndAxesPotentials potentials(
+		_labels, _cuboids, _predictor, _label_symmetries, _add_dummy_label);
+	potentials.get_potential_matrix(_potential_mat);
+}
+
 void recognize_labels_and_axes_configurations(
 	MeshCuboidStructure &_cuboid_structure,
 	const MeshCuboidPredictor &_predictor,
@@ -944,33 +1303,23 @@ void recognize_labels_and_axes_configurations(
 		num_cases = num_cases + 1;
 	}
 
-	// NOTE:
-	// This matrix should be symmetric.
-	Eigen::MatrixXd potential_mat;
-
+	std::vector< std::list<LabelIndex> > symmetric_labels;
 	if (_use_symmetry_info)
-	{
-		std::vector< std::list<LabelIndex> > symmetric_labels;
 		_cuboid_structure.get_symmetric_label_indices_for_each(symmetric_labels);
-		compute_labels_and_axes_configuration_potentials(
-			labels, all_cuboids, _predictor, potential_mat, &symmetric_labels, _add_dummy_label);
-	}
-	else
-	{
-		compute_labels_and_axes_configuration_potentials(
-			labels, all_cuboids, _predictor, potential_mat, NULL, _add_dummy_label);
-	}
+
+	MeshCuboidLabelAndAxesPotentials potentials(labels, all_cuboids, _predictor,
+		(_use_symmetry_info ? &symmetric_labels : NULL), _add_dummy_label);
+	assert(potentials.num_cases() == num_cases);
 
 
 	// Solve MRF.
-	std::vector<int> output = solve_markov_random_field(num_cuboids, num_cases, potential_mat);
+	std::vector<int> output = solve_markov_random_field(potentials);
 	assert(output.size() == num_cuboids);
 
 
 	// Print results.
-	Eigen::VectorXd part_case_pair_vec;
+	std::vector<int> case_indices(num_cuboids);
 
-	part_case_pair_vec = Eigen::VectorXd::Zero(num_cuboids * num_cases);
 	log_file << " -- Input -- " << std::endl;
 
 	// TEST.
@@ -986,8 +1335,7 @@ void recognize_labels_and_axes_configurations(
 		if (is_label_visited[label_index])
 		{
 			log_file << "[" << cuboid_index << "]: Dummy" << std::endl;
-			unsigned int mat_index = cuboid_index * num_cases + (num_cases - 1);
-			part_case_pair_vec(mat_index) = 1.0;
+			case_indices[cuboid_index] = num_cases - 1;
 			continue;
 		}
 		is_label_visited[label_index] = true;
@@ -995,8 +1343,7 @@ void recognize_labels_and_axes_configurations(
 		Label label = labels[label_index];
 		unsigned int axis_configuration_index = 0;
 		unsigned int case_index = label_index * num_axis_configurations + axis_configuration_index;
-		unsigned int mat_index = cuboid_index * num_cases + case_index;
-		part_case_pair_vec(mat_index) = 1.0;
+		case_indices[cuboid_index] = case_index;
 
 		log_file << "[" << cuboid_index << "]: " << label << ", " << axis_configuration_index << std::endl;
 	}
@@ -1004,11 +1351,10 @@ void recognize_labels_and_axes_configurations(
 	// TEST.
 	delete [] is_label_visited;
 
-	log_file << "Energy = " << part_case_pair_vec.transpose() * potential_mat * part_case_pair_vec;
+	log_file << "Energy = " << potentials.compute_energy(case_indices);
 	log_file << std::endl;
 
 
-	part_case_pair_vec = Eigen::VectorXd::Zero(num_cuboids * num_cases);
 	log_file << " -- Output -- " << std::endl;
 
 	for (unsigned int cuboid_index = 0; cuboid_index < num_cuboids; ++cuboid_index)
@@ -1022,17 +1368,12 @@ void recognize_labels_and_axes_configurations(
 		if (_add_dummy_label && case_index >= (num_cases - 1))
 		{
 			log_file << "[" << cuboid_index << "]: Dummy" << std::endl;
-			unsigned int mat_index = cuboid_index * num_cases + (num_cases - 1);
-			part_case_pair_vec(mat_index) = 1.0;
 
 			delete cuboid;
 			all_cuboids[cuboid_index] = NULL;
 			continue;
 		}
 
-		unsigned int mat_index = cuboid_index * num_cases + case_index;
-		part_case_pair_vec(mat_index) = 1.0;
-
 		LabelIndex label_index = (case_index / num_axis_configurations);
 		unsigned int axis_configuration_index =
 			(case_index % num_axis_configurations);
@@ -1043,7 +1384,7 @@ void recognize_labels_and_axes_configurations(
 
 		log_file << "[" << cuboid_index << "]: " << label << ", " << axis_configuration_index << std::endl;
 	}
-	log_file << "Energy = " << part_case_pair_vec.transpose() * potential_mat * part_case_pair_vec;
+	log_file << "Energy = " << potentials.compute_energy(output);
 	log_file << std::endl;
 
 	log_file.close();
@@ -1175,51 +1516,287 @@ void test_recognize_labels_and_axes_configurations(
 	}
 
 
-	// Print results.
-	Real sum_potential = 0;
-	for (unsigned int label_index_1 = 0; label_index_1 < num_labels - 1; ++label_index_1)
+	// Print results.
+	Real sum_potential = 0;
+	for (unsigned int label_index_1 = 0; label_index_1 < num_labels - 1; ++label_index_1)
+	{
+		for (unsigned int label_index_2 = label_index_1 + 1; label_index_2 < num_labels; ++label_index_2)
+		{
+			// NOTE:
+			// Symmetric potential matrix.
+			assert(potential_mat(label_index_1, label_index_2) == potential_mat(label_index_2, label_index_1));
+
+			log_file << " - (" << label_index_1 << ", " << label_index_2 << "): "
+				<< potential_mat(label_index_1, label_index_2) << std::endl;
+
+			sum_potential += potential_mat(label_index_1, label_index_2);
+		}
+	}
+
+	log_file << "Total: " << sum_potential << std::endl;
+	log_file.close();
+	//
+}
+
+MeshCuboidPairQuadraticFormCache::MeshCuboidPairQuadraticFormCache()
+	: predictor_(NULL)
+	, num_cuboids_(0)
+	, num_updated_blocks_(0)
+	, total_num_hits_(0)
+	, total_num_misses_(0)
+{
+
+}
+
+void MeshCuboidPairQuadraticFormCache::clear()
+{
+	predictor_ = NULL;
+	num_cuboids_ = 0;
+	blocks_.clear();
+	label_pair_factors_.clear();
+	num_updated_blocks_ = 0;
+}
+
+void MeshCuboidPairQuadraticFormCache::print_statistics()const
+{
+	const unsigned long total_num_blocks = total_num_hits_ + total_num_misses_;
+	std::cout << "Pair quadratic form cache: " << total_num_hits_ << " hit(s), "
+		<< total_num_misses_ << " miss(es) ("
+		<< (total_num_blocks > 0 ? (100.0 * total_num_hits_) / total_num_blocks : 0.0)
+		<< "% hit rate), " << label_pair_factors_.size() << " label pair factor(s)." << std::endl;
+}
+
+bool MeshCuboidPairQuadraticFormCache::is_block_changed(const Block &_block,
+	const MeshCuboid *_cuboid_1, const MeshCuboid *_cuboid_2)const
+{
+	assert(_cuboid_1); assert(_cuboid_2);
+
+	if (!_block.is_valid_
+		|| _block.label_index_1_ != _cuboid_1->get_label_index()
+		|| _block.label_index_2_ != _cuboid_2->get_label_index())
+		return true;
+
+	for (unsigned int axis_index = 0; axis_index < 3; ++axis_index)
+	{
+		if (_block.axes_1_[axis_index] != _cuboid_1->get_bbox_axis(axis_index)
+			|| _block.axes_2_[axis_index] != _cuboid_2->get_bbox_axis(axis_index))
+			return true;
+	}
+
+	return false;
+}
+
+void MeshCuboidPairQuadraticFormCache::update_block(const MeshCuboidPredictor &_predictor,
+	const MeshCuboidPairQuadraticFormFactors *_factors,
+	const MeshCuboid *_cuboid_1, const MeshCuboid *_cuboid_2,
+	const bool _is_same_cuboid, Block &_block)const
+{
+	assert(_cuboid_1); assert(_cuboid_2);
+
+	const unsigned int num_attributes = MeshCuboidAttributes::k_num_attributes;
+	const unsigned int block_size = (_is_same_cuboid ? 1 : 2) * num_attributes;
+
+	_block.label_index_1_ = _cuboid_1->get_label_index();
+	_block.label_index_2_ = _cuboid_2->get_label_index();
+	for (unsigned int axis_index = 0; axis_index < 3; ++axis_index)
+	{
+		_block.axes_1_[axis_index] = _cuboid_1->get_bbox_axis(axis_index);
+		_block.axes_2_[axis_index] = _cuboid_2->get_bbox_axis(axis_index);
+	}
+
+	if (_factors && !_is_same_cuboid)
+	{
+		_factors->get_pair_quadratic_form(_cuboid_1, _cuboid_2,
+			_block.quadratic_term_, _block.linear_term_, _block.constant_term_);
+	}
+	else if (_factors)
+	{
+		// NOTE:
+		// The attributes of cuboid 1 and 2 are the same variables.
+		Eigen::MatrixXd pair_quadratic_term;
+		Eigen::VectorXd pair_linear_term;
+		_factors->get_pair_quadratic_form(_cuboid_1, _cuboid_2,
+			pair_quadratic_term, pair_linear_term, _block.constant_term_);
+
+		_block.quadratic_term_ =
+			pair_quadratic_term.topLeftCorner<num_attributes, num_attributes>()
+			+ pair_quadratic_term.topRightCorner<num_attributes, num_attributes>()
+			+ pair_quadratic_term.bottomLeftCorner<num_attributes, num_attributes>()
+			+ pair_quadratic_term.bottomRightCorner<num_attributes, num_attributes>();
+		_block.linear_term_ = pair_linear_term.head<num_attributes>()
+			+ pair_linear_term.tail<num_attributes>();
+	}
+	else
+	{
+		// NOTE:
+		// The quadratic form is computed for the two cuboids only
+		// (cuboid indices 0 and 1 in the block).
+		_block.quadratic_term_.resize(block_size, block_size);
+		_block.linear_term_.resize(block_size);
+		_predictor.get_pair_quadratic_form(_cuboid_1, _cuboid_2,
+			0, (_is_same_cuboid ? 0 : 1),
+			_block.label_index_1_, _block.label_index_2_,
+			_block.quadratic_term_, _block.linear_term_, _block.constant_term_);
+	}
+
+#ifdef DEBUG_TEST
+	if (_factors)
+	{
+		Eigen::MatrixXd same_quadratic_term(block_size, block_size);
+		Eigen::VectorXd same_linear_term(block_size);
+		double same_constant_term;
+		_predictor.get_pair_quadratic_form(_cuboid_1, _cuboid_2,
+			0, (_is_same_cuboid ? 0 : 1),
+			_block.label_index_1_, _block.label_index_2_,
+			same_quadratic_term, same_linear_term, same_constant_term);
+
+		Real error = (same_quadratic_term - _block.quadratic_term_).array().abs().sum()
+			+ (same_linear_term - _block.linear_term_).array().abs().sum()
+			+ std::abs(same_constant_term - _block.constant_term_);
+		CHECK_NUMERICAL_ERROR(__FUNCTION__, error);
+	}
+#endif
+
+	_block.is_zero_ = (_block.quadratic_term_.isZero(0)
+		&& _block.linear_term_.isZero(0) && _block.constant_term_ == 0);
+	_block.is_valid_ = true;
+}
+
+void MeshCuboidPairQuadraticFormCache::get_pair_quadratic_form(
+	const std::vector<MeshCuboid *>& _cuboids,
+	const MeshCuboidPredictor &_predictor,
+	Eigen::SparseMatrix<double> &_quadratic_term,
+	Eigen::VectorXd &_linear_term,
+	double &_constant_term)
+{
+	const unsigned int num_attributes = MeshCuboidAttributes::k_num_attributes;
+	const unsigned int num_cuboids = _cuboids.size();
+	const unsigned int mat_size = num_cuboids * num_attributes;
+
+	if (predictor_ != &_predictor || num_cuboids_ != num_cuboids)
+	{
+		clear();
+		predictor_ = &_predictor;
+		num_cuboids_ = num_cuboids;
+		blocks_.resize(num_cuboids * num_cuboids);
+	}
+
+	// Find changed blocks.
+	// NOTE:
+	// Using bilateral relations. (A, B) and (B, A) pairs are the same.
+	std::vector<unsigned int> changed_block_indices;
+	for (unsigned int cuboid_index_1 = 0; cuboid_index_1 < num_cuboids; ++cuboid_index_1)
+	{
+		for (unsigned int cuboid_index_2 = cuboid_index_1; cuboid_index_2 < num_cuboids; ++cuboid_index_2)
+		{
+			const unsigned int block_index = cuboid_index_1 * num_cuboids + cuboid_index_2;
+			if (is_block_changed(blocks_[block_index], _cuboids[cuboid_index_1], _cuboids[cuboid_index_2]))
+				changed_block_indices.push_back(block_index);
+		}
+	}
+
+	num_updated_blocks_ = changed_block_indices.size();
+	total_num_misses_ += num_updated_blocks_;
+	total_num_hits_ += (num_cuboids * (num_cuboids + 1)) / 2 - num_updated_blocks_;
+
+	// Compute the factors of new label pairs.
+	// NOTE:
+	// Entries are added before the parallel loops, so that they are not modified while read.
+	std::vector< std::pair<LabelIndex, LabelIndex> > new_label_pairs;
+	std::vector<LabelPairFactors *> new_label_pair_factors;
+	std::vector<LabelPairFactors *> changed_block_factors(changed_block_indices.size());
+	for (unsigned int i = 0; i < changed_block_indices.size(); ++i)
+	{
+		const unsigned int block_index = changed_block_indices[i];
+		const std::pair<LabelIndex, LabelIndex> label_pair(
+			_cuboids[block_index / num_cuboids]->get_label_index(),
+			_cuboids[block_index % num_cuboids]->get_label_index());
+
+		const bool is_new_label_pair = (label_pair_factors_.find(label_pair) == label_pair_factors_.end());
+		changed_block_factors[i] = &label_pair_factors_[label_pair];
+		if (is_new_label_pair)
+		{
+			new_label_pairs.push_back(label_pair);
+			new_label_pair_factors.push_back(changed_block_factors[i]);
+		}
+	}
+
+#pragma omp parallel for schedule(dynamic)
+	for (int i = 0; i < static_cast<int>(new_label_pairs.size()); ++i)
+	{
+		new_label_pair_factors[i]->is_supported_ = _predictor.get_pair_quadratic_form_factors(
+			new_label_pairs[i].first, new_label_pairs[i].second, new_label_pair_factors[i]->factors_);
+	}
+
+#pragma omp parallel for schedule(dynamic)
+	for (int i = 0; i < static_cast<int>(changed_block_indices.size()); ++i)
 	{
-		for (unsigned int label_index_2 = label_index_1 + 1; label_index_2 < num_labels; ++label_index_2)
+		const unsigned int block_index = changed_block_indices[i];
+		const unsigned int cuboid_index_1 = block_index / num_cuboids;
+		const unsigned int cuboid_index_2 = block_index % num_cuboids;
+		const LabelPairFactors *label_pair_factors = changed_block_factors[i];
+		update_block(_predictor,
+			(label_pair_factors->is_supported_ ? &label_pair_factors->factors_ : NULL),
+			_cuboids[cuboid_index_1], _cuboids[cuboid_index_2],
+			(cuboid_index_1 == cuboid_index_2), blocks_[block_index]);
+	}
+
+
+	// Scatter blocks.
+	std::vector< Eigen::Triplet<double> > triplets;
+	_linear_term = Eigen::VectorXd::Zero(mat_size);
+	_constant_term = 0;
+
+	for (unsigned int cuboid_index_1 = 0; cuboid_index_1 < num_cuboids; ++cuboid_index_1)
+	{
+		for (unsigned int cuboid_index_2 = cuboid_index_1; cuboid_index_2 < num_cuboids; ++cuboid_index_2)
 		{
-			// NOTE:
-			// Symmetric potential matrix.
-			assert(potential_mat(label_index_1, label_index_2) == potential_mat(label_index_2, label_index_1));
+			const Block &block = blocks_[cuboid_index_1 * num_cuboids + cuboid_index_2];
+			assert(block.is_valid_);
+			if (block.is_zero_) continue;
 
-			log_file << " - (" << label_index_1 << ", " << label_index_2 << "): "
-				<< potential_mat(label_index_1, label_index_2) << std::endl;
+			const unsigned int block_size = block.quadratic_term_.rows();
+			unsigned int start_indices[2] = {
+				cuboid_index_1 * num_attributes, cuboid_index_2 * num_attributes };
 
-			sum_potential += potential_mat(label_index_1, label_index_2);
+			for (unsigned int col = 0; col < block_size; ++col)
+			{
+				const unsigned int global_col = start_indices[col / num_attributes] + (col % num_attributes);
+				for (unsigned int row = 0; row < block_size; ++row)
+				{
+					const double value = block.quadratic_term_(row, col);
+					if (value == 0) continue;
+					const unsigned int global_row = start_indices[row / num_attributes] + (row % num_attributes);
+					triplets.push_back(Eigen::Triplet<double>(global_row, global_col, value));
+				}
+
+				_linear_term[global_col] += block.linear_term_[col];
+			}
+
+			_constant_term += block.constant_term_;
 		}
 	}
 
-	log_file << "Total: " << sum_potential << std::endl;
-	log_file.close();
-	//
+	// NOTE:
+	// Duplicated entries are summed.
+	_quadratic_term.resize(mat_size, mat_size);
+	_quadratic_term.setFromTriplets(triplets.begin(), triplets.end());
 }
 
 void get_optimization_formulation(
 	const std::vector<MeshCuboid *>& _cuboids,
 	const MeshCuboidPredictor &_predictor,
 	Eigen::VectorXd &_init_values,
-	Eigen::MatrixXd &_single_quadratic_term, Eigen::MatrixXd &_pair_quadratic_term,
+	Eigen::SparseMatrix<double> &_single_quadratic_term, Eigen::SparseMatrix<double> &_pair_quadratic_term,
 	Eigen::VectorXd &_single_linear_term, Eigen::VectorXd &_pair_linear_term,
 	double &_single_constant_term, double &_pair_constant_term,
-	double &_single_total_energy, double &_pair_total_energy)
+	double &_single_total_energy, double &_pair_total_energy,
+	MeshCuboidPairQuadraticFormCache *_pair_quadratic_form_cache)
 {
 	const unsigned int num_attributes = MeshCuboidAttributes::k_num_attributes;
 	unsigned int num_cuboids = _cuboids.size();
 	unsigned int mat_size = num_cuboids * num_attributes;
 
-	_single_quadratic_term = Eigen::MatrixXd(mat_size, mat_size);
-	_pair_quadratic_term = Eigen::MatrixXd(mat_size, mat_size);
-
-	_single_linear_term = Eigen::VectorXd(mat_size);
-	_pair_linear_term = Eigen::VectorXd(mat_size);
-
-	_single_quadratic_term.setZero(); _pair_quadratic_term.setZero();
-	_single_linear_term.setZero(); _pair_linear_term.setZero();
-	_single_constant_term = 0; _pair_constant_term = 0;
-
 	_init_values = Eigen::VectorXd(mat_size);
 
 	for (unsigned int cuboid_index = 0; cuboid_index < num_cuboids; ++cuboid_index)
@@ -1233,30 +1810,62 @@ void get_optimization_formulation(
 
 
 	// Single energy (ICP prior energy).
+	// NOTE:
+	// The single quadratic form of each cuboid is computed in the space of its own attributes,
+	// and is placed in the diagonal block of the cuboid.
+	std::vector< Eigen::Triplet<double> > single_triplets;
+	single_triplets.reserve(num_cuboids * num_attributes * num_attributes);
+
+	_single_linear_term = Eigen::VectorXd::Zero(mat_size);
+	_single_constant_term = 0;
+
+	Eigen::MatrixXd each_single_quadratic_term(num_attributes, num_attributes);
+	Eigen::VectorXd each_single_linear_term(num_attributes);
+
 	for (unsigned int cuboid_index = 0; cuboid_index < num_cuboids; ++cuboid_index)
 	{
 		MeshCuboid *cuboid = _cuboids[cuboid_index];
 		//LabelIndex label_index = cuboid->get_label_index();
 
-		Eigen::MatrixXd each_single_quadratic_term(mat_size, mat_size);
-		Eigen::VectorXd each_single_linear_term(mat_size);
 		double each_single_constant_term;
 
-		_predictor.get_single_quadratic_form(cuboid, cuboid_index,
+		_predictor.get_single_quadratic_form(cuboid, 0,
 			each_single_quadratic_term, each_single_linear_term, each_single_constant_term);
 
-		_single_quadratic_term = _single_quadratic_term + each_single_quadratic_term;
-		_single_linear_term = _single_linear_term + each_single_linear_term;
+		const unsigned int start_index = num_attributes * cuboid_index;
+		for (unsigned int col = 0; col < num_attributes; ++col)
+			for (unsigned int row = 0; row < num_attributes; ++row)
+				if (each_single_quadratic_term(row, col) != 0)
+					single_triplets.push_back(Eigen::Triplet<double>(
+					start_index + row, start_index + col, each_single_quadratic_term(row, col)));
+
+		_single_linear_term.segment<num_attributes>(start_index) += each_single_linear_term;
 		_single_constant_term = _single_constant_term + each_single_constant_term;
 	}
 
+	_single_quadratic_term.resize(mat_size, mat_size);
+	_single_quadratic_term.setFromTriplets(single_triplets.begin(), single_triplets.end());
+
 	_single_total_energy = 0;
-	_single_total_energy += _init_values.transpose() * _single_quadratic_term * _init_values;
-	_single_total_energy += 2 * _single_linear_term.transpose() * _init_values;
+	_single_total_energy += _init_values.dot(_single_quadratic_term * _init_values);
+	_single_total_energy += 2 * _single_linear_term.dot(_init_values);
 	_single_total_energy += _single_constant_term;
 
 
 	// Pairwise energy.
+	MeshCuboidPairQuadraticFormCache local_pair_quadratic_form_cache;
+	MeshCuboidPairQuadraticFormCache &pair_quadratic_form_cache = (_pair_quadratic_form_cache ?
+		(*_pair_quadratic_form_cache) : local_pair_quadratic_form_cache);
+
+	pair_quadratic_form_cache.get_pair_quadratic_form(_cuboids, _predictor,
+		_pair_quadratic_term, _pair_linear_term, _pair_constant_term);
+
+	_pair_total_energy = 0;
+	_pair_total_energy += _init_values.dot(_pair_quadratic_term * _init_values);
+	_pair_total_energy += 2 * _pair_linear_term.dot(_init_values);
+	_pair_total_energy += _pair_constant_term;
+
+#ifdef DEBUG_TEST
 	double same_pair_total_energy = 0;
 
 	for (unsigned int cuboid_index_1 = 0; cuboid_index_1 < num_cuboids; ++cuboid_index_1)
@@ -1264,14 +1873,6 @@ void get_optimization_formulation(
 		MeshCuboid *cuboid_1 = _cuboids[cuboid_index_1];
 		LabelIndex label_index_1 = cuboid_1->get_label_index();
 
-		//for (unsigned int cuboid_index_2 = 0; cuboid_index_2 < num_cuboids; ++cuboid_index_2)
-		//{
-		//	if (cuboid_index_1 == cuboid_index_2)
-		//		continue;
-
-		// Using bilateral relations.
-		// (A, B) and (B, A) pairs are the same.
-		//for (unsigned int cuboid_index_2 = cuboid_index_1 + 1; cuboid_index_2 < num_cuboids; ++cuboid_index_2)
 		for (unsigned int cuboid_index_2 = cuboid_index_1; cuboid_index_2 < num_cuboids; ++cuboid_index_2)
 		{
 			MeshCuboid *cuboid_2 = _cuboids[cuboid_index_2];
@@ -1281,25 +1882,13 @@ void get_optimization_formulation(
 			Eigen::VectorXd each_pair_linear_term(mat_size);
 			double each_pair_constant_term;
 
-			Real energy = _predictor.get_pair_quadratic_form(cuboid_1, cuboid_2,
+			same_pair_total_energy += _predictor.get_pair_quadratic_form(cuboid_1, cuboid_2,
 				cuboid_index_1, cuboid_index_2,
 				label_index_1, label_index_2,
 				each_pair_quadratic_term, each_pair_linear_term, each_pair_constant_term);
-
-			_pair_quadratic_term = _pair_quadratic_term + each_pair_quadratic_term;
-			_pair_linear_term = _pair_linear_term + each_pair_linear_term;
-			_pair_constant_term = _pair_constant_term + each_pair_constant_term;
-
-			same_pair_total_energy += energy;
 		}
 	}
 
-	_pair_total_energy = 0;
-	_pair_total_energy += _init_values.transpose() * _pair_quadratic_term * _init_values;
-	_pair_total_energy += 2 * _pair_linear_term.transpose() * _init_values;
-	_pair_total_energy += _pair_constant_term;
-
-#ifdef DEBUG_TEST
 	CHECK_NUMERICAL_ERROR(__FUNCTION__, _pair_total_energy, same_pair_total_energy);
 #endif
 }
@@ -1307,10 +1896,11 @@ void get_optimization_formulation(
 void get_optimization_error(
 	const std::vector<MeshCuboid *>& _cuboids,
 	const MeshCuboidPredictor &_predictor,
-	double &_single_total_energy, double &_pair_total_energy)
+	double &_single_total_energy, double &_pair_total_energy,
+	MeshCuboidPairQuadraticFormCache *_pair_quadratic_form_cache)
 {
 	Eigen::VectorXd init_values;
-	Eigen::MatrixXd single_quadratic_term, pair_quadratic_term;
+	Eigen::SparseMatrix<double> single_quadratic_term, pair_quadratic_term;
 	Eigen::VectorXd single_linear_term, pair_linear_term;
 	double single_constant_term, pair_constant_term;
 
@@ -1318,20 +1908,22 @@ void get_optimization_error(
 		single_quadratic_term, pair_quadratic_term,
 		single_linear_term, pair_linear_term,
 		single_constant_term, pair_constant_term,
-		_single_total_energy, _pair_total_energy);
+		_single_total_energy, _pair_total_energy,
+		_pair_quadratic_form_cache);
 }
 
 void optimize_attributes_quadratic_once(
 	const std::vector<MeshCuboid *>& _cuboids,
 	const MeshCuboidPredictor& _predictor,
-	const double _single_energy_term_weight)
+	const double _single_energy_term_weight,
+	MeshCuboidPairQuadraticFormCache *_pair_quadratic_form_cache)
 {
 	const unsigned int num_attributes = MeshCuboidAttributes::k_num_attributes;
 	unsigned int num_cuboids = _cuboids.size();
 	unsigned int mat_size = num_cuboids * num_attributes;
 
 	Eigen::VectorXd init_values;
-	Eigen::MatrixXd single_quadratic_term, pair_quadratic_term;
+	Eigen::SparseMatrix<double> single_quadratic_term, pair_quadratic_term;
 	Eigen::VectorXd single_linear_term, pair_linear_term;
 	double single_constant_term, pair_constant_term;
 	double single_total_energy, pair_total_energy;
@@ -1340,10 +1932,14 @@ void optimize_attributes_quadratic_once(
 		single_quadratic_term, pair_quadratic_term,
 		single_linear_term, pair_linear_term,
 		single_constant_term, pair_constant_term,
-		single_total_energy, pair_total_energy);
+		single_total_energy, pair_total_energy,
+		_pair_quadratic_form_cache);
 
 
-	Eigen::MatrixXd quadratic_term = pair_quadratic_term + _single_energy_term_weight * single_quadratic_term;
+	// NOTE:
+	// The solver takes a dense quadratic term.
+	Eigen::MatrixXd quadratic_term = Eigen::MatrixXd(
+		pair_quadratic_term + _single_energy_term_weight * single_quadratic_term);
 	Eigen::VectorXd linear_term = pair_linear_term + _single_energy_term_weight * single_linear_term;
 	double constant_term = pair_constant_term + _single_energy_term_weight * single_constant_term;
 
@@ -1382,19 +1978,236 @@ void optimize_attributes_quadratic_once(
 		cuboid->set_bbox_center(new_bbox_center);
 		cuboid->set_bbox_corners(new_bbox_corners);
 
-		// Update cuboid surface points.
-		for (unsigned int point_index = 0; point_index < cuboid->num_cuboid_surface_points();
-			++point_index)
+		// NOTE:
+		// Cuboid surface points are updated from the new corners when they are requested.
+	}
+}
+
+void get_linearized_cuboid_constraints(
+	const std::vector<MeshCuboid *>& _cuboids,
+	Eigen::SparseMatrix<double> &_constraint_matrix,
+	Eigen::VectorXd &_constraint_values)
+{
+	const unsigned int dimension = 3;
+	const unsigned int num_attributes = MeshCuboidAttributes::k_num_attributes;
+	const unsigned int num_axis_variables = dimension * dimension;
+	// Unit axes, orthogonal axes, and 3 edges on each of 6 faces.
+	const unsigned int num_cuboid_constraints = dimension + dimension + 2 * dimension * 3;
+
+	unsigned int num_cuboids = _cuboids.size();
+	unsigned int mat_size = num_cuboids * num_attributes;
+	unsigned int num_variables = mat_size + num_cuboids * num_axis_variables;
+	unsigned int num_constraints = num_cuboids * num_cuboid_constraints;
+
+	std::vector< Eigen::Triplet<double> > triplets;
+	_constraint_values = Eigen::VectorXd::Zero(num_constraints);
+
+	unsigned int constraint_index = 0;
+	for (unsigned int cuboid_index = 0; cuboid_index < num_cuboids; ++cuboid_index)
+	{
+		const MeshCuboid *cuboid = _cuboids[cuboid_index];
+		assert(cuboid);
+
+		const unsigned int corner_start_index = num_attributes * cuboid_index
+			+ MeshCuboidAttributes::k_corner_index;
+		const unsigned int axis_start_index = mat_size + num_axis_variables * cuboid_index;
+
+		std::array<MyMesh::Normal, dimension> axes = cuboid->get_bbox_axes();
+		std::array<MyMesh::Point, MeshCuboid::k_num_corners> corners = cuboid->get_bbox_corners();
+
+		for (unsigned int axis_index = 0; axis_index < dimension; ++axis_index)
 		{
-			MeshCuboidSurfacePoint *cuboid_surface_point = cuboid->get_cuboid_surface_point(point_index);
+			const unsigned int next_axis_index = (axis_index + 1) % dimension;
+
+			// Unit vector constraint.
+			// n^T n = 1 => 2 n0^T n = 1 + n0^T n0.
+			for (unsigned int i = 0; i < dimension; ++i)
+				triplets.push_back(Eigen::Triplet<double>(constraint_index,
+				axis_start_index + dimension * axis_index + i, 2 * axes[axis_index][i]));
+			_constraint_values[constraint_index] = 1 + dot(axes[axis_index], axes[axis_index]);
+			++constraint_index;
+
+			// Orthogonality constraint.
+			// n1^T n2 = 0 => n2_0^T n1 + n1_0^T n2 = n1_0^T n2_0.
+			for (unsigned int i = 0; i < dimension; ++i)
+			{
+				triplets.push_back(Eigen::Triplet<double>(constraint_index,
+					axis_start_index + dimension * axis_index + i, axes[next_axis_index][i]));
+				triplets.push_back(Eigen::Triplet<double>(constraint_index,
+					axis_start_index + dimension * next_axis_index + i, axes[axis_index][i]));
+			}
+			_constraint_values[constraint_index] = dot(axes[axis_index], axes[next_axis_index]);
+			++constraint_index;
+		}
+
+		for (unsigned int axis_index = 0; axis_index < dimension; ++axis_index)
+		{
+			for (unsigned int axis_side = 0; axis_side < 2; ++axis_side)
+			{
+				// The corners on a face have the same coordinate along the face normal axis.
+				std::bitset<3> bits;
+				bits[axis_index] = (axis_side == 1);
+				const unsigned int base_corner_index = bits.to_ulong();
+
+				for (unsigned int face_corner_index = 1; face_corner_index < MeshCuboid::k_num_face_corners;
+					++face_corner_index)
+				{
+					bits[(axis_index + 1) % 3] = ((face_corner_index / 2) == 1);
+					bits[(axis_index + 2) % 3] = ((face_corner_index % 2) == 1);
+					const unsigned int corner_index = bits.to_ulong();
+
+					// n^T(x - y) = 0 => n0^T x - n0^T y + (x0 - y0)^T n = n0^T (x0 - y0).
+					MyMesh::Normal edge = corners[corner_index] - corners[base_corner_index];
+					for (unsigned int i = 0; i < dimension; ++i)
+					{
+						triplets.push_back(Eigen::Triplet<double>(constraint_index,
+							corner_start_index + dimension * corner_index + i, axes[axis_index][i]));
+						triplets.push_back(Eigen::Triplet<double>(constraint_index,
+							corner_start_index + dimension * base_corner_index + i, -axes[axis_index][i]));
+						triplets.push_back(Eigen::Triplet<double>(constraint_index,
+							axis_start_index + dimension * axis_index + i, edge[i]));
+					}
+					_constraint_values[constraint_index] = dot(axes[axis_index], edge);
+					++constraint_index;
+				}
+			}
+		}
+	}
+	assert(constraint_index == num_constraints);
+
+	_constraint_matrix.resize(num_constraints, num_variables);
+	_constraint_matrix.setFromTriplets(triplets.begin(), triplets.end());
+}
+
+bool optimize_attributes_sparse_quadratic_once(
+	const std::vector<MeshCuboid *>& _cuboids,
+	const MeshCuboidPredictor& _predictor,
+	const double _single_energy_term_weight,
+	MeshCuboidSparseKKTSolver &_kkt_solver,
+	MeshCuboidPairQuadraticFormCache *_pair_quadratic_form_cache)
+{
+	const unsigned int dimension = 3;
+	const unsigned int num_attributes = MeshCuboidAttributes::k_num_attributes;
+	const unsigned int num_axis_variables = dimension * dimension;
+	unsigned int num_cuboids = _cuboids.size();
+	unsigned int mat_size = num_cuboids * num_attributes;
+	unsigned int num_variables = mat_size + num_cuboids * num_axis_variables;
+
+	Eigen::VectorXd init_values;
+	Eigen::SparseMatrix<double> single_quadratic_term, pair_quadratic_term;
+	Eigen::VectorXd single_linear_term, pair_linear_term;
+	double single_constant_term, pair_constant_term;
+	double single_total_energy, pair_total_energy;
+
+	get_optimization_formulation(_cuboids, _predictor, init_values,
+		single_quadratic_term, pair_quadratic_term,
+		single_linear_term, pair_linear_term,
+		single_constant_term, pair_constant_term,
+		single_total_energy, pair_total_energy,
+		_pair_quadratic_form_cache);
+
+	Eigen::SparseMatrix<double> attribute_quadratic_term = pair_quadratic_term + _single_energy_term_weight * single_quadratic_term;
+	Eigen::VectorXd attribute_linear_term = pair_linear_term + _single_energy_term_weight * single_linear_term;
+	double constant_term = pair_constant_term + _single_energy_term_weight * single_constant_term;
+	assert(attribute_quadratic_term.rows() == mat_size);
+
+	double max_diagonal = 0.0;
+	for (unsigned int i = 0; i < mat_size; ++i)
+		max_diagonal = std::max(max_diagonal, std::abs(attribute_quadratic_term.coeff(i, i)));
+
+	// NOTE:
+	// The energy does not depend on the axes. A small proximal term, w |n - n0|^2,
+	// makes the quadratic term positive definite for the axis variables.
+	const double axis_proximal_weight = 1.0E-6 * std::max(max_diagonal, 1.0E-12);
+
+	std::vector< Eigen::Triplet<double> > triplets;
+	triplets.reserve(attribute_quadratic_term.nonZeros() + num_variables - mat_size);
+	for (int k = 0; k < attribute_quadratic_term.outerSize(); ++k)
+		for (Eigen::SparseMatrix<double>::InnerIterator it(attribute_quadratic_term, k); it; ++it)
+			triplets.push_back(Eigen::Triplet<double>(it.row(), it.col(), it.value()));
+
+	Eigen::VectorXd linear_term = Eigen::VectorXd::Zero(num_variables);
+	linear_term.head(mat_size) = attribute_linear_term;
+
+	for (unsigned int cuboid_index = 0; cuboid_index < num_cuboids; ++cuboid_index)
+	{
+		for (unsigned int axis_index = 0; axis_index < dimension; ++axis_index)
+		{
+			MyMesh::Normal axis = _cuboids[cuboid_index]->get_bbox_axis(axis_index);
+			for (unsigned int i = 0; i < dimension; ++i)
+			{
+				unsigned int index = mat_size + num_axis_variables * cuboid_index + dimension * axis_index + i;
+				triplets.push_back(Eigen::Triplet<double>(index, index, axis_proximal_weight));
+				linear_term[index] = -axis_proximal_weight * axis[i];
+			}
+		}
+	}
+
+	Eigen::SparseMatrix<double> quadratic_term(num_variables, num_variables);
+	quadratic_term.setFromTriplets(triplets.begin(), triplets.end());
+
+	Eigen::SparseMatrix<double> constraint_matrix;
+	Eigen::VectorXd constraint_values;
+	get_linearized_cuboid_constraints(_cuboids, constraint_matrix, constraint_values);
 
-			MyMesh::Point new_point(0.0);
-			for (unsigned int corner_index = 0; corner_index < MeshCuboid::k_num_corners; ++corner_index)
-				new_point += cuboid_surface_point->corner_weights_[corner_index] * new_bbox_corners[corner_index];
 
-			cuboid_surface_point->point_ = new_point;
+	// Solve quadratic programming.
+	Eigen::VectorXd new_values;
+	if (!_kkt_solver.solve(quadratic_term, linear_term, constraint_matrix, constraint_values, new_values))
+	{
+		std::cerr << "Warning: Sparse KKT solver failed." << std::endl;
+		return false;
+	}
+
+	assert(new_values.rows() == num_variables);
+
+	Eigen::VectorXd new_attribute_values = new_values.head(mat_size);
+	double init_error = init_values.dot(attribute_quadratic_term * init_values)
+		+ 2 * attribute_linear_term.dot(init_values) + constant_term;
+	double final_error = new_attribute_values.dot(attribute_quadratic_term * new_attribute_values)
+		+ 2 * attribute_linear_term.dot(new_attribute_values) + constant_term;
+	std::cout << "Energy: (initial = " << init_error << ", final = " << final_error << ")" << std::endl;
+
+
+	// Update cuboid.
+	for (unsigned int cuboid_index = 0; cuboid_index < num_cuboids; ++cuboid_index)
+	{
+		MeshCuboid *cuboid = _cuboids[cuboid_index];
+		Eigen::VectorXd new_attributes_vec = new_values.segment(
+			num_attributes * cuboid_index, num_attributes);
+
+		MyMesh::Point new_bbox_center(0.0);
+		std::array<MyMesh::Point, MeshCuboid::k_num_corners> new_bbox_corners;
+		std::array<MyMesh::Normal, dimension> new_bbox_axes;
+
+		for (unsigned int corner_index = 0; corner_index < MeshCuboid::k_num_corners; ++corner_index)
+		{
+			for (unsigned int i = 0; i < 3; ++i)
+			{
+				new_bbox_corners[corner_index][i] = new_attributes_vec[
+					MeshCuboidAttributes::k_corner_index + 3 * corner_index + i];
+			}
+			new_bbox_center += new_bbox_corners[corner_index];
+		}
+		new_bbox_center = new_bbox_center / MeshCuboid::k_num_corners;
+
+		for (unsigned int axis_index = 0; axis_index < dimension; ++axis_index)
+		{
+			for (unsigned int i = 0; i < dimension; ++i)
+				new_bbox_axes[axis_index][i] = new_values[
+					mat_size + num_axis_variables * cuboid_index + dimension * axis_index + i];
+			new_bbox_axes[axis_index].normalize();
 		}
+
+		cuboid->set_bbox_center(new_bbox_center);
+		cuboid->set_bbox_corners(new_bbox_corners);
+		cuboid->set_bbox_axes(new_bbox_axes, false);
+
+		// NOTE:
+		// Cuboid surface points are updated from the new corners when they are requested.
 	}
+
+	return true;
 }
 
 void optimize_attributes_once(
@@ -1402,7 +2215,9 @@ void optimize_attributes_once(
 	const MeshCuboidPredictor& _predictor,
 	const double _single_energy_term_weight,
 	const double _symmetry_energy_term_weight,
-	bool _use_symmetry)
+	bool _use_symmetry,
+	MeshCuboidPairQuadraticFormCache *_pair_quadratic_form_cache,
+	MeshCuboidNonLinearSolverSession *_non_linear_solver_session)
 {
 	const Real squared_neighbor_distance = FLAGS_param_sparse_neighbor_distance *
 		_cuboid_structure.mesh_->get_object_diameter();
@@ -1418,7 +2233,7 @@ void optimize_attributes_once(
 	unsigned int mat_size = num_cuboids * num_attributes;
 
 	Eigen::VectorXd init_values;
-	Eigen::MatrixXd single_quadratic_term, pair_quadratic_term;
+	Eigen::SparseMatrix<double> single_quadratic_term, pair_quadratic_term;
 	Eigen::VectorXd single_linear_term, pair_linear_term;
 	double single_constant_term, pair_constant_term;
 	double single_total_energy, pair_total_energy;
@@ -1427,9 +2242,10 @@ void optimize_attributes_once(
 		single_quadratic_term, pair_quadratic_term,
 		single_linear_term, pair_linear_term,
 		single_constant_term, pair_constant_term,
-		single_total_energy, pair_total_energy);
+		single_total_energy, pair_total_energy,
+		_pair_quadratic_form_cache);
 
-	Eigen::MatrixXd quadratic_term = pair_quadratic_term + _single_energy_term_weight * single_quadratic_term;
+	Eigen::SparseMatrix<double> quadratic_term = pair_quadratic_term + _single_energy_term_weight * single_quadratic_term;
 	Eigen::VectorXd linear_term = pair_linear_term + _single_energy_term_weight * single_linear_term;
 	double constant_term = pair_constant_term + _single_energy_term_weight * single_constant_term;
 
@@ -1447,7 +2263,99 @@ void optimize_attributes_once(
 		FLAGS_param_min_num_symmetric_point_pairs,
 		_symmetry_energy_term_weight);
 
-	non_linear_solver.optimize(quadratic_term, linear_term, constant_term, &init_values);
+	non_linear_solver.optimize(quadratic_term, linear_term, constant_term, &init_values,
+		NULL, _non_linear_solver_session);
+}
+
+void MeshCuboidPoseSnapshot::save(const MeshCuboidStructure &_cuboid_structure)
+{
+	const std::vector<MeshCuboid *> all_cuboids = _cuboid_structure.get_all_cuboids();
+	cuboid_poses_.resize(all_cuboids.size());
+
+	for (unsigned int cuboid_index = 0; cuboid_index < all_cuboids.size(); ++cuboid_index)
+	{
+		const MeshCuboid *cuboid = all_cuboids[cuboid_index];
+		CuboidPose &pose = cuboid_poses_[cuboid_index];
+		pose.axes_ = cuboid->get_bbox_axes();
+		pose.center_ = cuboid->get_bbox_center();
+		pose.size_ = cuboid->get_bbox_size();
+		pose.corners_ = cuboid->get_bbox_corners();
+	}
+
+	const std::vector<MeshCuboidReflectionSymmetryGroup *> &reflection_symmetry_groups
+		= _cuboid_structure.reflection_symmetry_groups_;
+	reflection_planes_.resize(reflection_symmetry_groups.size());
+	for (unsigned int group_index = 0; group_index < reflection_symmetry_groups.size(); ++group_index)
+	{
+		reflection_symmetry_groups[group_index]->get_reflection_plane(
+			reflection_planes_[group_index].first, reflection_planes_[group_index].second);
+	}
+
+	const std::vector<MeshCuboidRotationSymmetryGroup *> &rotation_symmetry_groups
+		= _cuboid_structure.rotation_symmetry_groups_;
+	rotation_axes_.resize(rotation_symmetry_groups.size());
+	for (unsigned int group_index = 0; group_index < rotation_symmetry_groups.size(); ++group_index)
+	{
+		rotation_symmetry_groups[group_index]->get_rotation_axis(
+			rotation_axes_[group_index].first, rotation_axes_[group_index].second);
+	}
+}
+
+void MeshCuboidPoseSnapshot::restore(MeshCuboidStructure &_cuboid_structure) const
+{
+	const std::vector<MeshCuboid *> all_cuboids = _cuboid_structure.get_all_cuboids();
+	assert(all_cuboids.size() == cuboid_poses_.size());
+
+	for (unsigned int cuboid_index = 0; cuboid_index < all_cuboids.size(); ++cuboid_index)
+	{
+		MeshCuboid *cuboid = all_cuboids[cuboid_index];
+		const CuboidPose &pose = cuboid_poses_[cuboid_index];
+		cuboid->set_bbox_axes(pose.axes_, false);
+		cuboid->set_bbox_center(pose.center_);
+		cuboid->set_bbox_size(pose.size_, false);
+		cuboid->set_bbox_corners(pose.corners_);
+	}
+
+	const std::vector<MeshCuboidReflectionSymmetryGroup *> &reflection_symmetry_groups
+		= _cuboid_structure.reflection_symmetry_groups_;
+	assert(reflection_symmetry_groups.size() == reflection_planes_.size());
+	for (unsigned int group_index = 0; group_index < reflection_symmetry_groups.size(); ++group_index)
+	{
+		reflection_symmetry_groups[group_index]->set_reflection_plane(
+			reflection_planes_[group_index].first, reflection_planes_[group_index].second);
+	}
+
+	const std::vector<MeshCuboidRotationSymmetryGroup *> &rotation_symmetry_groups
+		= _cuboid_structure.rotation_symmetry_groups_;
+	assert(rotation_symmetry_groups.size() == rotation_axes_.size());
+	for (unsigned int group_index = 0; group_index < rotation_symmetry_groups.size(); ++group_index)
+	{
+		rotation_symmetry_groups[group_index]->set_rotation_axis(
+			rotation_axes_[group_index].first, rotation_axes_[group_index].second);
+	}
+}
+
+Real MeshCuboidPoseSnapshot::get_max_corner_distance(
+	const MeshCuboidStructure &_cuboid_structure) const
+{
+	const std::vector<MeshCuboid *> all_cuboids = _cuboid_structure.get_all_cuboids();
+	assert(all_cuboids.size() == cuboid_poses_.size());
+
+	Real max_distance = 0;
+	for (unsigned int cuboid_index = 0; cuboid_index < all_cuboids.size(); ++cuboid_index)
+	{
+		const MeshCuboid *cuboid = all_cuboids[cuboid_index];
+		const CuboidPose &pose = cuboid_poses_[cuboid_index];
+
+		for (unsigned int corner_index = 0; corner_index < MeshCuboid::k_num_corners; ++corner_index)
+		{
+			const Real distance = (cuboid->get_bbox_corner(corner_index)
+				- pose.corners_[corner_index]).length();
+			max_distance = std::max(max_distance, distance);
+		}
+	}
+
+	return max_distance;
 }
 
 void optimize_attributes(
@@ -1464,49 +2372,95 @@ void optimize_attributes(
 	std::ofstream log_file(_log_filename, std::ofstream::out | std::ofstream::app);
 	assert(log_file);
 
-	unsigned int num_labels = _cuboid_structure.num_labels();
+	// NOTE:
+	// Per-iteration energies and timings are written to a CSV trace file.
+	// Each run starts with the row of iteration 0 (initial cuboids).
+	const std::string trace_filename = _log_filename + ".trace.csv";
+	std::ofstream trace_file(trace_filename, std::ofstream::out | std::ofstream::app);
+	assert(trace_file);
+	trace_file.seekp(0, std::ios_base::end);
+	if (trace_file.tellp() == std::streampos(0))
+	{
+		trace_file << "iteration,optimization_time,cuboidization_time,"
+			<< "pair_energy,single_energy,total_energy,"
+			<< "relative_energy_change,max_corner_distance,is_minimum" << std::endl;
+	}
 
 	std::vector<MeshCuboid *> all_cuboids = _cuboid_structure.get_all_cuboids();
-	unsigned int num_cuboids = all_cuboids.size();
 
 	std::stringstream sstr;
 	double single_total_energy, pair_total_energy, total_energy;
 
+	const Real object_diameter = _cuboid_structure.mesh_->get_object_diameter();
+	const double start_time = omp_get_wtime();
+
 
 	// NOTE: Keep the lowest energy cuboids.
 	double final_total_energy = std::numeric_limits<double>::max();
 	unsigned int final_cuboid_iteration = 0;
-	MeshCuboidStructure final_cuboid_structure = _cuboid_structure;
+	MeshCuboidPoseSnapshot final_cuboid_poses;
+	final_cuboid_poses.save(_cuboid_structure);
+
+	// Cuboid poses of the previous iteration for the corner distance criterion.
+	MeshCuboidPoseSnapshot prev_cuboid_poses;
+
+	// NOTE:
+	// Pairwise quadratic forms are reused across iterations for cuboid pairs
+	// whose labels and axes are not changed.
+	MeshCuboidPairQuadraticFormCache pair_quadratic_form_cache;
+
+	// NOTE:
+	// IPOPT problems are reused across iterations when enabled
+	// (see 'MeshCuboidNonLinearSolverSession').
+	MeshCuboidNonLinearSolverSession non_linear_solver_session;
+	MeshCuboidNonLinearSolverSession *non_linear_solver_session_ptr =
+		(FLAGS_use_warm_start_non_linear_solver ? &non_linear_solver_session : NULL);
+
+	// NOTE:
+	// Without symmetry terms, the energy is quadratic in the cuboid attributes,
+	// and only the cuboid constraints are nonlinear.
+	const bool use_sparse_quadratic_solver = (!_use_symmetry && FLAGS_use_sparse_quadratic_solver);
+	MeshCuboidSparseKKTSolver kkt_solver;
 
 	update_cuboid_surface_points(_cuboid_structure, _modelview_matrix);
 	if (_viewer) _viewer->updateGL();
 
 	//
 	get_optimization_error(all_cuboids, _predictor,
-		single_total_energy, pair_total_energy);
+		single_total_energy, pair_total_energy, &pair_quadratic_form_cache);
 	total_energy = pair_total_energy + _single_energy_term_weight * single_total_energy;
 	sstr.str(std::string());
 	sstr << "Energy: (pair = " << pair_total_energy
 		<< ", single = " << _single_energy_term_weight * single_total_energy
 		<< ", total = " << total_energy << ")" << std::endl;
 	std::cout << sstr.str(); log_file << sstr.str();
-	//
 
-	std::cout << std::endl; log_file << std::endl;
+	trace_file << 0 << "," << 0 << "," << 0 << ","
+		<< pair_total_energy << "," << _single_energy_term_weight * single_total_energy << ","
+		<< total_energy << ",," << "," << 0 << std::endl;
+	//
 
+	double prev_total_energy = total_energy;
+	std::string stop_reason;
 
 	unsigned int iteration = 1;
 	for (; iteration <= _max_num_iterations; ++iteration)
 	{
-		sstr.str(std::string());
-		sstr << "iteration [" << iteration << "]" << std::endl;
-		std::cout << sstr.str(); log_file << sstr.str();
+		prev_cuboid_poses.save(_cuboid_structure);
+		const double optimization_start_time = omp_get_wtime();
 
+		if (use_sparse_quadratic_solver
+			&& optimize_attributes_sparse_quadratic_once(all_cuboids, _predictor, _single_energy_term_weight,
+			kkt_solver, &pair_quadratic_form_cache))
+		{
+			// NOTE:
+			// Otherwise (if the KKT system is not quasi-definite), IPOPT is used below.
+		}
 		// NOTE: When jointly optimizing all reflection symmetry groups which have
 		// orthogonal relations each other, the result might go wrong due to the
 		// numerical issue in the solver. We therefore optimize for each reflection
 		// symmetry group separately.
-		if (FLAGS_optimize_individual_reflection_symmetry_group)
+		else if (FLAGS_optimize_individual_reflection_symmetry_group)
 		{
 			const std::vector<MeshCuboidReflectionSymmetryGroup *> all_reflection_symmetry_groups
 				= _cuboid_structure.reflection_symmetry_groups_;
@@ -1524,7 +2478,8 @@ void optimize_attributes(
 				optimize_attributes_once(
 					_cuboid_structure, _predictor,
 					_single_energy_term_weight, _symmetry_energy_term_weight,
-					_use_symmetry);
+					_use_symmetry, &pair_quadratic_form_cache,
+					non_linear_solver_session_ptr);
 			}
 
 			_cuboid_structure.reflection_symmetry_groups_ = all_reflection_symmetry_groups;
@@ -1535,23 +2490,17 @@ void optimize_attributes(
 			optimize_attributes_once(
 				_cuboid_structure, _predictor,
 				_single_energy_term_weight, _symmetry_energy_term_weight,
-				_use_symmetry);
+				_use_symmetry, &pair_quadratic_form_cache,
+				non_linear_solver_session_ptr);
 		}
 		
-		
+		const double optimization_time = omp_get_wtime() - optimization_start_time;
 		if (_viewer) _viewer->updateGL();
 
-		//
-		get_optimization_error(all_cuboids, _predictor,
-			single_total_energy, pair_total_energy);
-		total_energy = pair_total_energy + _single_energy_term_weight * single_total_energy;
-		sstr.str(std::string());
-		sstr << " - After optimization" << std::endl;
-		sstr << "Energy: (pair = " << pair_total_energy
-			<< ", single = " << _single_energy_term_weight * single_total_energy
-			<< ", total = " << total_energy << ")" << std::endl;
-		std::cout << sstr.str(); log_file << sstr.str();
-		//
+		// NOTE:
+		// The energy is evaluated only after cuboidization, which is the state
+		// kept as the result.
+		const double cuboidization_start_time = omp_get_wtime();
 
 		// Cuboidize.
 		if (_use_symmetry)
@@ -1569,67 +2518,78 @@ void optimize_attributes(
 		}
 
 		update_cuboid_surface_points(_cuboid_structure, _modelview_matrix);
+		const double cuboidization_time = omp_get_wtime() - cuboidization_start_time;
 		if (_viewer) _viewer->updateGL();
 
 		//
 		get_optimization_error(all_cuboids, _predictor,
-			single_total_energy, pair_total_energy);
+			single_total_energy, pair_total_energy, &pair_quadratic_form_cache);
 		total_energy = pair_total_energy + _single_energy_term_weight * single_total_energy;
-		sstr.str(std::string());
-		sstr << " - After cuboidization" << std::endl;
-		sstr << "Energy: (pair = " << pair_total_energy
-			<< ", single = " << _single_energy_term_weight * single_total_energy
-			<< ", total = " << total_energy << ")";
-		if (total_energy < final_total_energy)
-			sstr << " - Minimum.";
-		sstr << std::endl;
-
-		std::cout << sstr.str(); log_file << sstr.str();
+
+		const double relative_energy_change = std::abs(total_energy - prev_total_energy)
+			/ std::max(std::abs(prev_total_energy), std::numeric_limits<double>::min());
+		const Real max_corner_distance = prev_cuboid_poses.get_max_corner_distance(_cuboid_structure);
+		const bool is_minimum = (total_energy < final_total_energy);
+		prev_total_energy = total_energy;
+
+		trace_file << iteration << "," << optimization_time << "," << cuboidization_time << ","
+			<< pair_total_energy << "," << _single_energy_term_weight * single_total_energy << ","
+			<< total_energy << "," << relative_energy_change << ","
+			<< max_corner_distance / object_diameter << "," << is_minimum << std::endl;
 		//
 
-		std::cout << std::endl; log_file << std::endl;
-				
-		if (total_energy < final_total_energy)
+		if (is_minimum)
 		{
 			final_total_energy = total_energy;
 			final_cuboid_iteration = iteration;
-			final_cuboid_structure = _cuboid_structure;
+			final_cuboid_poses.save(_cuboid_structure);
 		}
 		else if (total_energy > 1.5 * final_total_energy)
 		{
-			sstr.str(std::string());
-			sstr << "Last iteration is worse than the previous one..." << std::endl;
-			sstr << "Recover to the previous iteration... Stop." << std::endl;
-			std::cout << sstr.str(); log_file << sstr.str();
+			stop_reason = "Last iteration is worse than the previous one. Recover to the previous iteration";
+			break;
+		}
 
+		if (relative_energy_change < FLAGS_param_opt_energy_tolerance)
+		{
+			stop_reason = "Energy is converged";
+			break;
+		}
+		else if (max_corner_distance < FLAGS_param_opt_corner_tolerance * object_diameter)
+		{
+			stop_reason = "Cuboids are converged";
 			break;
 		}
 	}
 
-	if (iteration >= _max_num_iterations)
+	if (stop_reason.empty())
 	{
 		sstr.str(std::string());
 		sstr << "# of iteration exceeds maximum number of iterations ("
-			<< _max_num_iterations << ") ... Stop." << std::endl;
-		std::cout << sstr.str(); log_file << sstr.str();
+			<< _max_num_iterations << ")";
+		stop_reason = sstr.str();
+		iteration = _max_num_iterations;
 	}
 
-	// Copy final result.
-	_cuboid_structure = final_cuboid_structure;
-	all_cuboids = _cuboid_structure.get_all_cuboids();
-	num_cuboids = all_cuboids.size();
+	// Restore the lowest energy cuboids.
+	if (final_cuboid_iteration != iteration)
+	{
+		final_cuboid_poses.restore(_cuboid_structure);
+		update_cuboid_surface_points(_cuboid_structure, _modelview_matrix);
+		if (_viewer) _viewer->updateGL();
 
-	update_cuboid_surface_points(_cuboid_structure, _modelview_matrix);
-	if (_viewer) _viewer->updateGL();
+		get_optimization_error(all_cuboids, _predictor,
+			single_total_energy, pair_total_energy, &pair_quadratic_form_cache);
+		total_energy = pair_total_energy + _single_energy_term_weight * single_total_energy;
+	}
 
 	//
 	sstr.str(std::string());
-	sstr << "Final cuboid iteration: " << final_cuboid_iteration << std::endl;
+	sstr << stop_reason << " (iteration " << iteration << ")... Stop." << std::endl;
+	sstr << "Final cuboid iteration: " << final_cuboid_iteration
+		<< " (" << (omp_get_wtime() - start_time) << " s)" << std::endl;
 	std::cout << sstr.str(); log_file << sstr.str();
 
-	get_optimization_error(all_cuboids, _predictor,
-		single_total_energy, pair_total_energy);
-	total_energy = pair_total_energy + _single_energy_term_weight * single_total_energy;
 	sstr.str(std::string());
 	sstr << "Energy: (pair = " << pair_total_energy
 		<< ", single = " << _single_energy_term_weight * single_total_energy
@@ -1637,7 +2597,11 @@ void optimize_attributes(
 	std::cout << sstr.str(); log_file << sstr.str();
 	//
 
+	ICP::KdTreeCache::print_statistics();
+	pair_quadratic_form_cache.print_statistics();
+
 	log_file.close();
+	trace_file.close();
 }
 
 void add_missing_cuboids_once(
@@ -1894,6 +2858,9 @@ bool add_missing_cuboids(
 	}
 	//
 
+	MeshCuboidVisibilityEngine visibility_engine(
+		_modelview_matrix, radius, _cuboid_structure.get_sample_point_store().get_points());
+
 	std::set<LabelIndex> added_label_indices;
 	for (unsigned int cuboid_index = 0; cuboid_index < num_all_cuboids; ++cuboid_index)
 	{
@@ -1918,8 +2885,7 @@ bool add_missing_cuboids(
 
 			// NOTE:
 			// Do not use normal directions when computing the overall visibility.
-			cuboid->compute_cuboid_surface_point_visibility(
-				_modelview_matrix, radius, _cuboid_structure.sample_points_, false);
+			cuboid->compute_cuboid_surface_point_visibility(visibility_engine, false);
 			Real overall_visibility = cuboid->get_cuboid_overvall_visibility();
 
 			bool is_occluded = (symmetric_label_index >= num_labels || !is_given_label_indices[symmetric_label_index])
@@ -1932,8 +2898,7 @@ bool add_missing_cuboids(
 			}
 			else
 			{
-				cuboid->compute_cuboid_surface_point_visibility(
-					_modelview_matrix, radius, _cuboid_structure.sample_points_);
+				cuboid->compute_cuboid_surface_point_visibility(visibility_engine);
 
 				LabelIndex label_index = cuboid->get_label_index();
 				_cuboid_structure.label_cuboids_[label_index].push_back(cuboid);
@@ -1994,6 +2959,10 @@ bool add_missing_cuboids(
 /*
 void symmetrize_cuboids(MeshCuboidStructure &_cuboid_structure)
 {
+	// NOTE:
+	// New sample points are directly added to the structure sample points.
+	std::vector<MeshSamplePoint *> &sample_points = _cuboid_structure.get_mutable_sample_points();
+
 	unsigned int num_given_labels = _cuboid_structure.num_labels();
 
 	for (LabelIndex label_index_1 = 0; label_index_1 < num_given_labels; ++label_index_1)
@@ -2052,7 +3021,7 @@ void symmetrize_cuboids(MeshCuboidStructure &_cuboid_structure)
 					new_sample_point->point_[i] = transformed_p[i];
 
 				cuboid_1->add_sample_point(new_sample_point);
-				_cuboid_structure.sample_points_.push_back(new_sample_point);
+				sample_points.push_back(new_sample_point);
 			}
 		}
 
@@ -2249,7 +3218,7 @@ void symmetrize_cuboids(MeshCuboidStructure &_cuboid_structure)
 					new_sample_point->point_[i] = transformed_p[i];
 
 				cuboid_2->add_sample_point(new_sample_point);
-				_cuboid_structure.sample_points_.push_back(new_sample_point);
+				sample_points.push_back(new_sample_point);
 			}
 
 			// 2 -> 1.
@@ -2266,7 +3235,7 @@ void symmetrize_cuboids(MeshCuboidStructure &_cuboid_structure)
 					new_sample_point->point_[i] = transformed_p[i];
 
 				cuboid_1->add_sample_point(new_sample_point);
-				_cuboid_structure.sample_points_.push_back(new_sample_point);
+				sample_points.push_back(new_sample_point);
 			}
 
 
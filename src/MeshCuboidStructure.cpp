@@ -6,6 +6,16 @@
 #include <deque>
 #include <fstream>
 #include <iostream>
+#include <map>
+
+
+// Reference counted by copies of a structure sharing the same sample points.
+// NOTE:
+// Sample points are not changed while they are shared, so the last structure holding it
+// deletes its own sample points.
+struct MeshCuboidStructure::SharedSamplePoints
+{
+};
 
 
 MeshCuboidStructure::MeshCuboidStructure(const MyMesh* _mesh)
@@ -13,6 +23,8 @@ MeshCuboidStructure::MeshCuboidStructure(const MyMesh* _mesh)
 	, query_label_index_(0)
 	, translation_(0.0)
 	, scale_(1.0)
+	, shared_sample_points_(std::make_shared<SharedSamplePoints>())
+	, is_sample_point_store_valid_(false)
 {
 	assert(_mesh);
 }
@@ -23,6 +35,8 @@ MeshCuboidStructure::~MeshCuboidStructure()
 }
 
 MeshCuboidStructure::MeshCuboidStructure(const MeshCuboidStructure& _other)
+	: shared_sample_points_(std::make_shared<SharedSamplePoints>())
+	, is_sample_point_store_valid_(false)
 {
 	deep_copy(_other);
 }
@@ -51,17 +65,14 @@ void MeshCuboidStructure::deep_copy(const MeshCuboidStructure& _other)
 	this->symmetry_group_info_ = _other.symmetry_group_info_;
 
 
-	// Deep copy sample points.
-	assert(_other.sample_points_.size() == _other.num_sample_points());
-	this->sample_points_.clear();
-	this->sample_points_.reserve(_other.num_sample_points());
-
-	for (std::vector<MeshSamplePoint *>::const_iterator it = _other.sample_points_.begin();
-		it != _other.sample_points_.end(); ++it)
-	{
-		MeshSamplePoint *sample_point = new MeshSamplePoint(**it);
-		this->sample_points_.push_back(sample_point);
-	}
+	// Share sample points.
+	// NOTE:
+	// Sample points are copied when either structure changes them.
+	// See 'make_sample_points_unique()'.
+	assert(_other.shared_sample_points_);
+	this->shared_sample_points_ = _other.shared_sample_points_;
+	this->sample_points_ = _other.sample_points_;
+	invalidate_sample_point_store();
 
 	// Deep copy label cuboids.
 	assert(_other.label_cuboids_.size() == _other.num_labels());
@@ -75,24 +86,9 @@ void MeshCuboidStructure::deep_copy(const MeshCuboidStructure& _other)
 		for (std::vector<MeshCuboid *>::const_iterator it = _other.label_cuboids_[label_index].begin();
 			it != _other.label_cuboids_[label_index].end(); ++it)
 		{
-			MeshCuboid *cuboid = new MeshCuboid(**it);
-
-			const std::vector<MeshSamplePoint *> &cuboid_sample_points = cuboid->get_sample_points();
-			std::vector<MeshSamplePoint *> new_cuboid_sample_points;
-
-			for (std::vector<MeshSamplePoint *>::const_iterator it = cuboid_sample_points.begin();
-				it != cuboid_sample_points.end(); ++it)
-			{
-				SamplePointIndex sample_point_index = (*it)->sample_point_index_;
-				assert(sample_point_index < num_sample_points());
-				assert(sample_points_[sample_point_index]->sample_point_index_ == sample_point_index);
-				new_cuboid_sample_points.push_back(sample_points_[sample_point_index]);
-			}
-
 			// NOTE:
-			// 'MeshCuboidStructure' class is a friend of 'MeshCuboid'.
-			cuboid->sample_points_.swap(new_cuboid_sample_points);
-
+			// The copied cuboid points to the same shared sample points.
+			MeshCuboid *cuboid = new MeshCuboid(**it);
 			this->label_cuboids_[label_index].push_back(cuboid);
 		}
 	}
@@ -132,10 +128,20 @@ void MeshCuboidStructure::clear()
 
 void MeshCuboidStructure::clear_sample_points()
 {
-	for (std::vector<MeshSamplePoint *>::iterator it = sample_points_.begin();
-		it != sample_points_.end(); ++it)
-		delete (*it);
+	if (is_sample_point_shared())
+	{
+		// NOTE:
+		// Shared sample points are deleted with the last structure sharing them.
+		shared_sample_points_ = std::make_shared<SharedSamplePoints>();
+	}
+	else
+	{
+		for (std::vector<MeshSamplePoint *>::iterator it = sample_points_.begin();
+			it != sample_points_.end(); ++it)
+			delete (*it);
+	}
 	sample_points_.clear();
+	invalidate_sample_point_store();
 
 	//
 	for (std::vector< std::vector<MeshCuboid *> >::iterator it = label_cuboids_.begin();
@@ -153,8 +159,62 @@ void MeshCuboidStructure::clear_sample_points()
 	scale_ = 1.0;
 }
 
+void MeshCuboidStructure::make_sample_points_unique()
+{
+	// NOTE:
+	// Sample points are changed after this function is called.
+	invalidate_sample_point_store();
+
+	if (!is_sample_point_shared())
+		return;
+
+	std::map<const MeshSamplePoint *, MeshSamplePoint *> new_sample_point_map;
+
+	for (std::vector<MeshSamplePoint *>::iterator it = sample_points_.begin();
+		it != sample_points_.end(); ++it)
+	{
+		assert(*it);
+		MeshSamplePoint *sample_point = new MeshSamplePoint(**it);
+		new_sample_point_map[*it] = sample_point;
+		(*it) = sample_point;
+	}
+
+	for (std::vector< std::vector<MeshCuboid *> >::iterator it = label_cuboids_.begin();
+		it != label_cuboids_.end(); ++it)
+	{
+		for (std::vector<MeshCuboid *>::iterator jt = (*it).begin(); jt != (*it).end(); ++jt)
+		{
+			// NOTE:
+			// 'MeshCuboidStructure' class is a friend of 'MeshCuboid'.
+			std::vector<MeshSamplePoint *> &cuboid_sample_points = (*jt)->sample_points_;
+			for (std::vector<MeshSamplePoint *>::iterator kt = cuboid_sample_points.begin();
+				kt != cuboid_sample_points.end(); ++kt)
+			{
+				assert(new_sample_point_map.find(*kt) != new_sample_point_map.end());
+				(*kt) = new_sample_point_map[*kt];
+			}
+		}
+	}
+
+	shared_sample_points_ = std::make_shared<SharedSamplePoints>();
+}
+
+std::vector<MeshSamplePoint *> &MeshCuboidStructure::get_mutable_sample_points()
+{
+	make_sample_points_unique();
+	return sample_points_;
+}
+
+bool MeshCuboidStructure::is_sample_point_shared() const
+{
+	assert(shared_sample_points_);
+	return (shared_sample_points_.use_count() > 1);
+}
+
 void MeshCuboidStructure::clear_label_sample_points(const std::vector<LabelIndex> &_label_indices)
 {
+	make_sample_points_unique();
+
 	std::list<SamplePointIndex> deleted_sample_point_indices;
 
 	// Collect sample points to be deleted.
@@ -246,6 +306,10 @@ void MeshCuboidStructure::clear_labels()
 	symmetry_group_info_.size();
 
 	query_label_index_ = 0;
+
+	// NOTE:
+	// The number of label confidence values in the store is changed.
+	invalidate_sample_point_store();
 }
 
 bool MeshCuboidStructure::load_cuboids(const std::string _filename, bool _verbose)
@@ -494,6 +558,8 @@ void MeshCuboidStructure::apply_mesh_transformation()
 
 void MeshCuboidStructure::translate(const MyMesh::Normal _translate)
 {
+	make_sample_points_unique();
+
 	for (std::vector<MeshSamplePoint *>::iterator it = sample_points_.begin();
 		it != sample_points_.end(); ++it)
 	{
@@ -506,6 +572,8 @@ void MeshCuboidStructure::translate(const MyMesh::Normal _translate)
 
 void MeshCuboidStructure::scale(const Real _scale)
 {
+	make_sample_points_unique();
+
 	assert(_scale > 0);
 	for (std::vector<MeshSamplePoint *>::iterator it = sample_points_.begin();
 		it != sample_points_.end(); ++it)
@@ -533,6 +601,34 @@ void MeshCuboidStructure::reset_transformation()
 	assert(scale_ == 1.0);
 }
 
+void MeshCuboidStructure::get_sample_points(Eigen::MatrixXd &_sample_points) const
+{
+	_sample_points = get_sample_point_store().get_points();
+}
+
+const MeshSamplePointStore &MeshCuboidStructure::get_sample_point_store() const
+{
+	std::lock_guard<std::mutex> lock(sample_point_store_mutex_);
+	if (!is_sample_point_store_valid_)
+	{
+		sample_point_store_.update(sample_points_, num_labels());
+		is_sample_point_store_valid_ = true;
+	}
+	return sample_point_store_;
+}
+
+void MeshCuboidStructure::invalidate_sample_point_store()
+{
+	std::lock_guard<std::mutex> lock(sample_point_store_mutex_);
+	is_sample_point_store_valid_ = false;
+}
+
+ANNkd_tree *MeshCuboidStructure::get_sample_point_kd_tree(ANNpointArray *_ann_points) const
+{
+	return sample_point_kd_tree_cache_.get_kd_tree(
+		get_sample_point_store().get_points(), _ann_points);
+}
+
 bool MeshCuboidStructure::load_labels(const char *_filename, bool _verbose)
 {
 	std::ifstream file(_filename);
@@ -909,7 +1005,7 @@ bool MeshCuboidStructure::load_dense_sample_points(const char *_filename, bool _
 		}
 	}
 
-	Eigen::MatrixXd sparse_sample_points(3, num_sample_points());
+	const Eigen::MatrixXd &sparse_sample_points = get_sample_point_store().get_points();
 
 	// FIXME:
 	// The type of indices should integer.
@@ -919,11 +1015,6 @@ bool MeshCuboidStructure::load_dense_sample_points(const char *_filename, bool _
 	for (SamplePointIndex sample_point_index = 0; sample_point_index < num_sample_points();
 		++sample_point_index)
 	{
-		assert(sample_points_[sample_point_index]);
-		for (unsigned int i = 0; i < 3; ++i)
-			sparse_sample_points.col(sample_point_index)(i) =
-			sample_points_[sample_point_index]->point_[i];
-
 		sparse_sample_point_indices.col(sample_point_index)(0) = 
 			static_cast<double>(sample_point_index);
 	}
@@ -1000,18 +1091,9 @@ bool MeshCuboidStructure::load_dense_sample_points(const char *_filename, bool _
 
 
 	//
-	Eigen::MatrixXd dense_sample_points(3, num_sample_points());
+	const Eigen::MatrixXd &dense_sample_points = get_sample_point_store().get_points();
 	Eigen::MatrixXd dense_sample_point_indices(1, num_sample_points());
 
-	for (SamplePointIndex sample_point_index = 0; sample_point_index < num_sample_points();
-		++sample_point_index)
-	{
-		assert(sample_points_[sample_point_index]);
-		for (unsigned int i = 0; i < 3; ++i)
-			dense_sample_points.col(sample_point_index)(i) =
-			sample_points_[sample_point_index]->point_[i];
-	}
-
 	ICP::get_closest_points(sparse_sample_ann_kd_tree, dense_sample_points,
 		sparse_sample_point_indices, dense_sample_point_indices);
 	assert(dense_sample_point_indices.rows() == 1);
@@ -1037,6 +1119,10 @@ bool MeshCuboidStructure::load_dense_sample_points(const char *_filename, bool _
 			= sparse_sample_point->label_index_confidence_;
 	}
 
+	// NOTE:
+	// The store was read above before the label confidence values are copied.
+	invalidate_sample_point_store();
+
 
 	annDeallocPts(sparse_sample_ann_points);
 	delete sparse_sample_ann_kd_tree;
@@ -1155,6 +1241,8 @@ bool MeshCuboidStructure::save_sample_points_to_ply(const char *_filename, bool
 
 bool MeshCuboidStructure::load_sample_point_labels(const char *_filename, bool _verbose)
 {
+	make_sample_points_unique();
+
 	if (labels_.empty())
 	{
 		std::cerr << "Error: Load label information first." << std::endl;
@@ -1292,6 +1380,8 @@ bool MeshCuboidStructure::save_sample_point_labels(const char *_filename, bool _
 
 bool MeshCuboidStructure::test_load_cuboids(const char *_filename, bool _verbose)
 {
+	make_sample_points_unique();
+
 	std::ifstream file(_filename);
 	if (!file)
 	{
@@ -1454,7 +1544,7 @@ std::vector<MeshCuboid *> MeshCuboidStructure::get_all_cuboids() const
 }
 
 void MeshCuboidStructure::get_all_cuboid_surface_points(
-	std::vector<MeshCuboidSurfacePoint *> &all_cuboid_surface_points) const
+	std::vector<const MeshCuboidSurfacePoint *> &all_cuboid_surface_points) const
 {
 	all_cuboid_surface_points.clear();
 	const std::vector<MeshCuboid *> all_cuboids = get_all_cuboids();
@@ -1469,6 +1559,8 @@ void MeshCuboidStructure::get_all_cuboid_surface_points(
 MeshSamplePoint *MeshCuboidStructure::add_sample_point(
 	const MyMesh::Point& _point, const MyMesh::Normal& _normal)
 {
+	make_sample_points_unique();
+
 	// NOTE:
 	// Assume that the sample point index is the same with the index in the 'sample_points_' vector.
 	SamplePointIndex new_sample_point_index = sample_points_.size();
@@ -1480,6 +1572,8 @@ MeshSamplePoint *MeshCuboidStructure::add_sample_point(
 
 void MeshCuboidStructure::add_sample_points_from_mesh_vertices()
 {
+	make_sample_points_unique();
+
 	assert(mesh_);
 	assert(mesh_->has_vertex_normals());
 
@@ -1530,6 +1624,8 @@ void MeshCuboidStructure::add_sample_points_from_mesh_vertices()
 
 void MeshCuboidStructure::remove_sample_points(const bool *is_sample_point_removed)
 {
+	make_sample_points_unique();
+
 	assert(is_sample_point_removed);
 
 	//
@@ -1565,6 +1661,8 @@ void MeshCuboidStructure::remove_sample_points(const bool *is_sample_point_remov
 
 void MeshCuboidStructure::apply_mesh_face_labels_to_sample_points()
 {
+	make_sample_points_unique();
+
 	assert(mesh_);
 	
 	for (SamplePointIndex sample_point_index = 0; sample_point_index < num_sample_points(); ++sample_point_index)
@@ -1771,6 +1869,8 @@ void MeshCuboidStructure::get_sample_point_label_indices_from_mesh(
 
 void MeshCuboidStructure::set_sample_point_label_confidence_using_cuboids()
 {
+	make_sample_points_unique();
+
 	for (SamplePointIndex sample_point_index = 0; sample_point_index < num_sample_points(); ++sample_point_index)
 	{
 		MeshSamplePoint* sample_point = sample_points_[sample_point_index];
@@ -2047,6 +2147,8 @@ void MeshCuboidStructure::copy_sample_points_to_symmetric_position(
 	const MeshCuboidSymmetryGroup* _symmetry_group,
 	const MeshCuboid *_cuboid_1, MeshCuboid *_cuboid_2)
 {
+	make_sample_points_unique();
+
 	assert(_symmetry_group);
 	if (!_cuboid_1 || !_cuboid_2)
 		return;
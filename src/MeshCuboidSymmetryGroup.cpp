@@ -781,21 +781,13 @@ bool MeshCuboidRotationSymmetryGroup::compute_rotation_angle(
 		cuboid_ann_points[cuboid_index] = NULL;
 
 		MeshCuboid *cuboid = _cuboids[cuboid_index];
-		unsigned int num_cuboid_sample_points = cuboid->num_sample_points();
-		if (num_cuboid_sample_points == 0)
+		if (cuboid->num_sample_points() == 0)
 			continue;
 
-		Eigen::MatrixXd cuboid_sample_points(3, num_cuboid_sample_points);
-
-		for (unsigned int point_index = 0; point_index < num_cuboid_sample_points; ++point_index)
-		{
-			for (unsigned int i = 0; i < 3; ++i)
-				cuboid_sample_points.col(point_index)(i) =
-				cuboid->get_sample_point(point_index)->point_[i];
-		}
-
-		cuboid_ann_kd_tree[cuboid_index] = ICP::create_kd_tree(cuboid_sample_points,
-			cuboid_ann_points[cuboid_index]);
+		// NOTE:
+		// The trees are owned by the cuboids.
+		cuboid_ann_kd_tree[cuboid_index] = cuboid->get_sample_point_kd_tree(
+			&cuboid_ann_points[cuboid_index]);
 		assert(cuboid_ann_points[cuboid_index]);
 		assert(cuboid_ann_kd_tree[cuboid_index]);
 
@@ -843,11 +835,6 @@ bool MeshCuboidRotationSymmetryGroup::compute_rotation_angle(
 	}
 
 	//
-	for (unsigned int cuboid_index = 0; cuboid_index < num_cuboids; ++cuboid_index)
-	{
-		if (cuboid_ann_points[cuboid_index]) annDeallocPts(cuboid_ann_points[cuboid_index]);
-		if (cuboid_ann_kd_tree[cuboid_index]) delete cuboid_ann_kd_tree[cuboid_index];
-	}
 	cuboid_ann_points.clear();
 	cuboid_ann_kd_tree.clear();
 	//
@@ -1,5 +1,6 @@
 #include "MeshCuboidTrainer.h"
 
+#include "MeshCuboidParameters.h"
 #include "Utilities.h"
 
 #include <deque>
@@ -135,12 +136,145 @@ bool MeshCuboidTrainer::load_transformations(const std::string &_filename_prefix
 	return true;
 }
 
+void MeshCuboidTrainer::get_joint_normal_features(
+	const LabelIndex _label_index_1, const LabelIndex _label_index_2,
+	Eigen::MatrixXd &_features,
+	std::vector<unsigned int> &_object_indices,
+	const std::list<std::string> *_ignored_object_list) const
+{
+	assert(_label_index_1 < feature_list_.size());
+	assert(_label_index_2 < feature_list_.size());
+
+	// NOTE:
+	// 'object_list_' should contain all object names.
+	assert(object_list_.size() == feature_list_[_label_index_1].size());
+	assert(object_list_.size() == feature_list_[_label_index_2].size());
+	assert(object_list_.size() == transformation_list_[_label_index_1].size());
+	assert(object_list_.size() == transformation_list_[_label_index_2].size());
+
+	std::vector<MeshCuboidFeatures *> feature_1;
+	std::vector<MeshCuboidFeatures *> feature_2;
+	std::vector<MeshCuboidTransformation *> transformation_1;
+	std::vector<MeshCuboidTransformation *> transformation_2;
+	_object_indices.clear();
+
+	feature_1.reserve(feature_list_[_label_index_1].size());
+	feature_2.reserve(feature_list_[_label_index_2].size());
+	transformation_1.reserve(transformation_list_[_label_index_1].size());
+	transformation_2.reserve(transformation_list_[_label_index_2].size());
+	_object_indices.reserve(object_list_.size());
+
+	std::list<std::string>::const_iterator o_it = object_list_.begin();
+	std::list<MeshCuboidFeatures *>::const_iterator f_it_1 = feature_list_[_label_index_1].begin();
+	std::list<MeshCuboidFeatures *>::const_iterator f_it_2 = feature_list_[_label_index_2].begin();
+	std::list<MeshCuboidTransformation *>::const_iterator t_it_1 = transformation_list_[_label_index_1].begin();
+	std::list<MeshCuboidTransformation *>::const_iterator t_it_2 = transformation_list_[_label_index_2].begin();
+
+	int num_objects = 0;
+	for (unsigned int object_index = 0; true; ++object_index)
+	{
+		if (f_it_1 == feature_list_[_label_index_1].end()
+			|| f_it_2 == feature_list_[_label_index_2].end()
+			|| t_it_1 == transformation_list_[_label_index_1].end()
+			|| t_it_2 == transformation_list_[_label_index_2].end())
+			break;
+
+		bool has_values = (!(*f_it_1)->has_nan() && !(*f_it_2)->has_nan());
+
+		if (has_values && _ignored_object_list)
+		{
+			// Check whether the current object should be ignored.
+			for (std::list<std::string>::const_iterator io_it = _ignored_object_list->begin();
+				io_it != _ignored_object_list->end(); ++io_it)
+			{
+				if ((*o_it) == (*io_it))
+				{
+					std::cout << "Mesh [" << (*o_it) << "] is ignored." << std::endl;
+					has_values = false;
+					break;
+				}
+			}
+		}
+
+		if (has_values)
+		{
+			feature_1.push_back(*f_it_1);
+			feature_2.push_back(*f_it_2);
+			transformation_1.push_back(*t_it_1);
+			transformation_2.push_back(*t_it_2);
+			_object_indices.push_back(object_index);
+			++num_objects;
+		}
+
+		++o_it;
+		++f_it_1;
+		++f_it_2;
+		++t_it_1;
+		++t_it_2;
+	}
+
+	assert(feature_1.size() == num_objects);
+	assert(feature_2.size() == num_objects);
+	assert(transformation_1.size() == num_objects);
+	assert(transformation_2.size() == num_objects);
+
+	// NOTE:
+	// Since the center point is always the origin in the local coordinates,
+	// it is not used as the feature values.
+	const unsigned int num_cols = MeshCuboidJointNormalRelations::k_mat_size;
+	_features.resize(num_objects, num_cols);
+
+	for (int object_index = 0; object_index < num_objects; ++object_index)
+	{
+		assert(feature_1[object_index]);
+		assert(feature_2[object_index]);
+		assert(transformation_1[object_index]);
+		assert(transformation_2[object_index]);
+
+		Eigen::VectorXd pairwise_feature_vec;
+		MeshCuboidJointNormalRelations::get_pairwise_cuboid_features(
+			(*feature_1[object_index]), (*feature_2[object_index]),
+			transformation_1[object_index], transformation_2[object_index],
+			pairwise_feature_vec);
+
+		_features.row(object_index) = pairwise_feature_vec;
+	}
+}
+
+void MeshCuboidTrainer::fit_joint_normal_relation(
+	const Eigen::MatrixXd &_features,
+	const Real _energy_threshold,
+	MeshCuboidJointNormalRelations *_relation)
+{
+	assert(_relation);
+	assert(_features.rows() > 0);
+	assert(_features.cols() == MeshCuboidJointNormalRelations::k_mat_size);
+
+	const int num_objects = _features.rows();
+
+	Eigen::RowVectorXd mean = _features.colwise().mean();
+	Eigen::MatrixXd centered_X = _features.rowwise() - mean;
+
+	Eigen::MatrixXd cov = (centered_X.transpose() * centered_X) / static_cast<double>(num_objects);
+	Eigen::MatrixXd inv_cov = regularized_inverse(cov);
+
+	_relation->set_mean(mean.transpose());
+	_relation->set_inv_cov(inv_cov);
+
+	if (_energy_threshold < 1.0)
+		_relation->compress(_energy_threshold);
+
+#ifdef DEBUG_TEST
+	Eigen::MatrixXd diff = centered_X.transpose();
+	Eigen::VectorXd error = (diff.transpose() * inv_cov * diff).diagonal();
+	std::cout << "max_error = " << error.maxCoeff() << std::endl;
+#endif
+}
+
 void MeshCuboidTrainer::get_joint_normal_relations(
 	std::vector< std::vector<MeshCuboidJointNormalRelations *> > &_relations,
 	const std::list<std::string> *_ignored_object_list) const
 {
-	const unsigned int num_features = MeshCuboidFeatures::k_num_features;
-
 	unsigned int num_labels = feature_list_.size();
 	assert(transformation_list_.size() == num_labels);
 
@@ -160,120 +294,25 @@ void MeshCuboidTrainer::get_joint_normal_relations(
 		{
 			//if (label_index_1 == label_index_2) continue;
 
-			// NOTE:
-			// 'object_list_' should contain all object names.
-			assert(object_list_.size() == feature_list_[label_index_1].size());
-			assert(object_list_.size() == feature_list_[label_index_2].size());
-			assert(object_list_.size() == transformation_list_[label_index_1].size());
-			assert(object_list_.size() == transformation_list_[label_index_2].size());
-
-			std::vector<MeshCuboidFeatures *> feature_1;
-			std::vector<MeshCuboidFeatures *> feature_2;
-			std::vector<MeshCuboidTransformation *> transformation_1;
-			std::vector<MeshCuboidTransformation *> transformation_2;
-
-			feature_1.reserve(feature_list_[label_index_1].size());
-			feature_2.reserve(feature_list_[label_index_2].size());
-			transformation_1.reserve(transformation_list_[label_index_1].size());
-			transformation_2.reserve(transformation_list_[label_index_2].size());
+			Eigen::MatrixXd X;
+			std::vector<unsigned int> object_indices;
+			get_joint_normal_features(label_index_1, label_index_2, X, object_indices,
+				_ignored_object_list);
 
-			std::list<std::string>::const_iterator o_it = object_list_.begin();
-			std::list<MeshCuboidFeatures *>::const_iterator f_it_1 = feature_list_[label_index_1].begin();
-			std::list<MeshCuboidFeatures *>::const_iterator f_it_2 = feature_list_[label_index_2].begin();
-			std::list<MeshCuboidTransformation *>::const_iterator t_it_1 = transformation_list_[label_index_1].begin();
-			std::list<MeshCuboidTransformation *>::const_iterator t_it_2 = transformation_list_[label_index_2].begin();
-
-			int num_objects = 0;
-			while (true)
-			{
-				if (f_it_1 == feature_list_[label_index_1].end()
-					|| f_it_2 == feature_list_[label_index_2].end()
-					|| t_it_1 == transformation_list_[label_index_1].end()
-					|| t_it_2 == transformation_list_[label_index_2].end())
-					break;
-
-				bool has_values = (!(*f_it_1)->has_nan() && !(*f_it_2)->has_nan());
-
-				if (has_values && _ignored_object_list)
-				{
-					// Check whether the current object should be ignored.
-					for (std::list<std::string>::const_iterator io_it = _ignored_object_list->begin();
-						io_it != _ignored_object_list->end(); ++io_it)
-					{
-						if ((*o_it) == (*io_it))
-						{
-							std::cout << "Mesh [" << (*o_it) << "] is ignored." << std::endl;
-							has_values = false;
-							break;
-						}
-					}
-				}
-
-				if (has_values)
-				{
-					feature_1.push_back(*f_it_1);
-					feature_2.push_back(*f_it_2);
-					transformation_1.push_back(*t_it_1);
-					transformation_2.push_back(*t_it_2);
-					++num_objects;
-				}
-
-				++o_it;
-				++f_it_1;
-				++f_it_2;
-				++t_it_1;
-				++t_it_2;
-			}
-
-			if (num_objects == 0) continue;
+			if (X.rows() == 0) continue;
 
 
 			_relations[label_index_1][label_index_2] = new MeshCuboidJointNormalRelations();
 			MeshCuboidJointNormalRelations *relation_12 = _relations[label_index_1][label_index_2];
 			assert(relation_12);
 
-			assert(feature_1.size() == num_objects);
-			assert(feature_2.size() == num_objects);
-			assert(transformation_1.size() == num_objects);
-			assert(transformation_2.size() == num_objects);
+			fit_joint_normal_relation(X, FLAGS_param_relation_energy_threshold, relation_12);
 
-			// NOTE:
-			// Since the center point is always the origin in the local coordinates,
-			// it is not used as the feature values.
-			const unsigned int num_cols = MeshCuboidJointNormalRelations::k_mat_size;
-			Eigen::MatrixXd X(num_objects, num_cols);
-
-			for (int object_index = 0; object_index < num_objects; ++object_index)
+			if (FLAGS_param_relation_energy_threshold < 1.0)
 			{
-				assert(feature_1[object_index]);
-				assert(feature_2[object_index]);
-				assert(transformation_1[object_index]);
-				assert(transformation_2[object_index]);
-
-				Eigen::VectorXd pairwise_feature_vec;
-				MeshCuboidJointNormalRelations::get_pairwise_cuboid_features(
-					(*feature_1[object_index]), (*feature_2[object_index]),
-					transformation_1[object_index], transformation_2[object_index],
-					pairwise_feature_vec);
-
-				X.row(object_index) = pairwise_feature_vec;
+				std::cout << "(" << label_index_1 << ", " << label_index_2 << "): rank = "
+					<< relation_12->get_rank() << std::endl;
 			}
-
-			Eigen::RowVectorXd mean = X.colwise().mean();
-			Eigen::MatrixXd centered_X = X.rowwise() - mean;
-
-			Eigen::MatrixXd cov = (centered_X.transpose() * centered_X) / static_cast<double>(num_objects);
-			Eigen::MatrixXd inv_cov = regularized_inverse(cov);
-
-			relation_12->set_mean(mean.transpose());
-			relation_12->set_inv_cov(inv_cov);
-
-
-#ifdef DEBUG_TEST
-			Eigen::MatrixXd diff = (X.rowwise() - mean).transpose();
-			Eigen::VectorXd error = (diff.transpose() * inv_cov * diff).diagonal();
-			std::cout << "(" << label_index_1 << ", " << label_index_2 << "): max_error = " << error.maxCoeff() << std::endl;
-#endif
 		}
 	}
 }
@@ -649,17 +688,36 @@ void MeshCuboidTrainer::load_joint_normal_relations(
 			if (label_index_1 == label_index_2)
 				continue;
 
+			// NOTE:
+			// Low-rank relation files are used only when relations are compressed
+			// (see 'param_relation_energy_threshold'), and when they are not older
+			// than the full relation files.
+			std::stringstream low_rank_relation_filename_sstr;
+			low_rank_relation_filename_sstr << _filename_prefix
+				<< label_index_1 << std::string("_")
+				<< label_index_2 << std::string("_low_rank.dat");
+
 			std::stringstream relation_filename_sstr;
 			relation_filename_sstr << _filename_prefix
 				<< label_index_1 << std::string("_")
 				<< label_index_2 << std::string(".csv");
 
+			QFileInfo low_rank_relation_file(low_rank_relation_filename_sstr.str().c_str());
 			QFileInfo relation_file(relation_filename_sstr.str().c_str());
-			if (!relation_file.exists()) continue;
+
+			const bool use_low_rank_relation_file = (FLAGS_param_relation_energy_threshold < 1.0)
+				&& low_rank_relation_file.exists()
+				&& (!relation_file.exists() || low_rank_relation_file.lastModified() >= relation_file.lastModified());
+			if (!use_low_rank_relation_file && !relation_file.exists()) continue;
 
 			_relations[label_index_1][label_index_2] = new MeshCuboidJointNormalRelations();
-			bool ret = _relations[label_index_1][label_index_2]->load_joint_normal_csv(
-				relation_filename_sstr.str().c_str());
+			bool ret = false;
+			if (use_low_rank_relation_file)
+				ret = _relations[label_index_1][label_index_2]->load_joint_normal_low_rank(
+					low_rank_relation_filename_sstr.str().c_str());
+			else
+				ret = _relations[label_index_1][label_index_2]->load_joint_normal_csv(
+					relation_filename_sstr.str().c_str());
 
 			if (!ret)
 			{
@@ -0,0 +1,380 @@
+#include "MeshCuboidVisibility.h"
+
+#include "MeshCuboidParameters.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <list>
+
+
+// NOTE:
+// Margin added to the occlusion cone angles in the grid.
+// It covers the numerical error of the occlusion test.
+const Real k_grid_cone_angle_margin = 1.0e-6;
+const int k_max_grid_size = 1024;
+
+// Number of sample points tested at once before checking early termination.
+const unsigned int k_occlusion_test_chunk_size = 64;
+
+
+MeshCuboidVisibilityEngine::MeshCuboidVisibilityEngine(
+	const Real _modelview_matrix[16],
+	const Real _radius,
+	const std::vector<MeshSamplePoint *> &_given_sample_points)
+	: radius_(_radius)
+	, view_direction_(-_modelview_matrix[2], -_modelview_matrix[6], -_modelview_matrix[10])
+	, use_float_precision_(FLAGS_use_float_visibility_test)
+	, grid_cell_size_(1.0)
+{
+	Eigen::MatrixXd given_points(3, _given_sample_points.size());
+	for (unsigned int point_index = 0; point_index < _given_sample_points.size(); ++point_index)
+	{
+		assert(_given_sample_points[point_index]);
+		for (unsigned int i = 0; i < 3; ++i)
+			given_points(i, point_index) = _given_sample_points[point_index]->point_[i];
+	}
+
+	initialize(_modelview_matrix, given_points);
+}
+
+MeshCuboidVisibilityEngine::MeshCuboidVisibilityEngine(
+	const Real _modelview_matrix[16],
+	const Real _radius,
+	const Eigen::MatrixXd &_given_points)
+	: radius_(_radius)
+	, view_direction_(-_modelview_matrix[2], -_modelview_matrix[6], -_modelview_matrix[10])
+	, use_float_precision_(FLAGS_use_float_visibility_test)
+	, grid_cell_size_(1.0)
+{
+	initialize(_modelview_matrix, _given_points);
+}
+
+MeshCuboidVisibilityEngine::~MeshCuboidVisibilityEngine()
+{
+
+}
+
+void MeshCuboidVisibilityEngine::initialize(const Real _modelview_matrix[16],
+	const Eigen::MatrixXd &_given_points)
+{
+	assert(_given_points.rows() == 3);
+	assert(_modelview_matrix);
+	assert(radius_ > 0);
+
+	for (unsigned int i = 0; i < 16; ++i)
+		modelview_matrix_[i] = _modelview_matrix[i];
+
+	for (unsigned int col = 0; col < 4; ++col)
+		for (unsigned int row = 0; row < 4; ++row)
+			modelview_transformation_(row, col) = _modelview_matrix[4 * col + row];
+
+	lc_occluder_points_.reserve(_given_points.cols());
+	lc_occluder_point_lens_.reserve(_given_points.cols());
+	occluder_cone_angles_.reserve(_given_points.cols());
+
+	for (unsigned int point_index = 0; point_index < _given_points.cols(); ++point_index)
+	{
+		Eigen::Vector4d observed_point_4;
+		observed_point_4 << _given_points.col(point_index), 1.0;
+
+		// Positions in the model view coordinates.
+		Eigen::Vector4d lc_observed_point_4 = modelview_transformation_ * observed_point_4;
+		Eigen::Vector3d lc_observed_point = lc_observed_point_4.topRows(3) / lc_observed_point_4[3];
+		lc_observed_point[2] -= radius_;
+
+		Real lc_observed_point_len = lc_observed_point.norm();
+
+		// Ignore a sample point if it is not visible from this model view.
+		// NOTE:
+		// Sample points with invalid coordinates never pass the occlusion test either.
+		if (!(lc_observed_point[2] < 0) || !(lc_observed_point_len > 0)
+			|| !std::isfinite(lc_observed_point_len))
+			continue;
+
+		lc_occluder_points_.push_back(lc_observed_point);
+		lc_occluder_point_lens_.push_back(lc_observed_point_len);
+		occluder_cone_angles_.push_back(std::atan(radius_ / lc_observed_point_len));
+	}
+
+	build_grid();
+}
+
+unsigned int MeshCuboidVisibilityEngine::num_occluders() const
+{
+	return static_cast<unsigned int>(lc_occluder_points_.size());
+}
+
+void MeshCuboidVisibilityEngine::build_grid()
+{
+	const unsigned int num_occluders = lc_occluder_points_.size();
+
+	grid_min_[0] = grid_min_[1] = 0.0;
+	grid_size_[0] = grid_size_[1] = 0;
+	grid_cell_offsets_.assign(1, 0);
+	cell_x_.clear(); cell_y_.clear(); cell_z_.clear(); cell_inv_cos_squared_.clear();
+	cell_x_f_.clear(); cell_y_f_.clear(); cell_z_f_.clear(); cell_inv_cos_squared_f_.clear();
+
+	if (num_occluders == 0)
+		return;
+
+	// Bounding box of the occlusion cones on the grid plane.
+	Real range_min[2], range_max[2];
+	for (unsigned int axis = 0; axis < 2; ++axis)
+	{
+		range_min[axis] = std::numeric_limits<Real>::max();
+		range_max[axis] = -std::numeric_limits<Real>::max();
+	}
+
+	Real sum_cone_angles = 0.0;
+	for (unsigned int occluder_index = 0; occluder_index < num_occluders; ++occluder_index)
+	{
+		const Eigen::Vector3d &lc_observed_point = lc_occluder_points_[occluder_index];
+		const Real lc_observed_point_len = lc_occluder_point_lens_[occluder_index];
+		const Real half_width = occluder_cone_angles_[occluder_index] + k_grid_cone_angle_margin;
+		sum_cone_angles += half_width;
+
+		for (unsigned int axis = 0; axis < 2; ++axis)
+		{
+			Real value = lc_observed_point[axis] / lc_observed_point_len;
+			range_min[axis] = std::min(range_min[axis], value - half_width);
+			range_max[axis] = std::max(range_max[axis], value + half_width);
+		}
+	}
+
+	// NOTE:
+	// Cells are not smaller than the average occlusion cone size, so that each sample point
+	// is inserted to a few cells.
+	Real max_extent = std::max(range_max[0] - range_min[0], range_max[1] - range_min[1]);
+	int resolution = static_cast<int>(std::sqrt(static_cast<Real>(num_occluders)));
+	resolution = std::max(std::min(resolution, k_max_grid_size - 1), 1);
+
+	grid_cell_size_ = std::max(max_extent / resolution, sum_cone_angles / num_occluders);
+	grid_cell_size_ = std::max(grid_cell_size_, max_extent / (k_max_grid_size - 1));
+	if (!(grid_cell_size_ > 0)) grid_cell_size_ = 1.0;
+
+	for (unsigned int axis = 0; axis < 2; ++axis)
+	{
+		grid_min_[axis] = range_min[axis];
+		grid_size_[axis] = static_cast<int>(std::floor(
+			(range_max[axis] - grid_min_[axis]) / grid_cell_size_)) + 1;
+		assert(grid_size_[axis] > 0);
+	}
+
+	const unsigned int num_cells = grid_size_[0] * grid_size_[1];
+	grid_cell_offsets_.assign(num_cells + 1, 0);
+
+	// Count the number of sample points in each cell.
+	int cell_range_min[2], cell_range_max[2];
+	for (unsigned int occluder_index = 0; occluder_index < num_occluders; ++occluder_index)
+	{
+		get_occluder_grid_range(occluder_index, cell_range_min, cell_range_max);
+		for (int x = cell_range_min[0]; x <= cell_range_max[0]; ++x)
+			for (int y = cell_range_min[1]; y <= cell_range_max[1]; ++y)
+				++grid_cell_offsets_[x * grid_size_[1] + y + 1];
+	}
+
+	for (unsigned int cell_index = 0; cell_index < num_cells; ++cell_index)
+		grid_cell_offsets_[cell_index + 1] += grid_cell_offsets_[cell_index];
+
+	// Fill sample point values.
+	const unsigned int num_entries = grid_cell_offsets_[num_cells];
+	cell_x_.resize(num_entries);
+	cell_y_.resize(num_entries);
+	cell_z_.resize(num_entries);
+	cell_inv_cos_squared_.resize(num_entries);
+	std::vector<unsigned int> cell_cursors(grid_cell_offsets_.begin(), grid_cell_offsets_.end() - 1);
+
+	for (unsigned int occluder_index = 0; occluder_index < num_occluders; ++occluder_index)
+	{
+		const Eigen::Vector3d &lc_observed_point = lc_occluder_points_[occluder_index];
+		const Real squared_len = lc_occluder_point_lens_[occluder_index] * lc_occluder_point_lens_[occluder_index];
+		const Real inv_cos_squared = (squared_len + radius_ * radius_) / (squared_len * squared_len);
+
+		get_occluder_grid_range(occluder_index, cell_range_min, cell_range_max);
+		for (int x = cell_range_min[0]; x <= cell_range_max[0]; ++x)
+		{
+			for (int y = cell_range_min[1]; y <= cell_range_max[1]; ++y)
+			{
+				unsigned int entry_index = cell_cursors[x * grid_size_[1] + y]++;
+				cell_x_[entry_index] = lc_observed_point[0];
+				cell_y_[entry_index] = lc_observed_point[1];
+				cell_z_[entry_index] = lc_observed_point[2];
+				cell_inv_cos_squared_[entry_index] = inv_cos_squared;
+			}
+		}
+	}
+
+	if (use_float_precision_)
+	{
+		cell_x_f_.assign(cell_x_.begin(), cell_x_.end());
+		cell_y_f_.assign(cell_y_.begin(), cell_y_.end());
+		cell_z_f_.assign(cell_z_.begin(), cell_z_.end());
+		cell_inv_cos_squared_f_.assign(cell_inv_cos_squared_.begin(), cell_inv_cos_squared_.end());
+
+		cell_x_.clear(); cell_y_.clear(); cell_z_.clear(); cell_inv_cos_squared_.clear();
+	}
+}
+
+void MeshCuboidVisibilityEngine::get_occluder_grid_range(const unsigned int _occluder_index,
+	int _range_min[2], int _range_max[2]) const
+{
+	assert(_occluder_index < lc_occluder_points_.size());
+	const Eigen::Vector3d &lc_observed_point = lc_occluder_points_[_occluder_index];
+	const Real lc_observed_point_len = lc_occluder_point_lens_[_occluder_index];
+	const Real half_width = occluder_cone_angles_[_occluder_index] + k_grid_cone_angle_margin;
+
+	// NOTE:
+	// If the angle between two view directions is theta, the distance between their
+	// (x, y) components is not greater than the chord length (2 * sin(theta / 2) <= theta).
+	for (unsigned int axis = 0; axis < 2; ++axis)
+	{
+		Real value = lc_observed_point[axis] / lc_observed_point_len;
+		_range_min[axis] = std::max(get_grid_coord(value - half_width, axis), 0);
+		_range_max[axis] = std::min(get_grid_coord(value + half_width, axis), grid_size_[axis] - 1);
+	}
+}
+
+int MeshCuboidVisibilityEngine::get_grid_coord(const Real _value, const unsigned int _axis) const
+{
+	assert(_axis < 2);
+	Real coord = std::floor((_value - grid_min_[_axis]) / grid_cell_size_);
+
+	// Values out of the grid are mapped to -1 or the grid size.
+	if (coord < 0) return -1;
+	else if (coord >= grid_size_[_axis]) return grid_size_[_axis];
+	return static_cast<int>(coord);
+}
+
+Real MeshCuboidVisibilityEngine::compute_occlusion_visibility(
+	const MyMesh::Point &_test_point) const
+{
+	Eigen::Vector3d surface_point;
+	for (unsigned int i = 0; i < 3; ++i)
+		surface_point[i] = _test_point[i];
+
+	Eigen::Vector4d surface_point_4;
+	surface_point_4 << surface_point, 1.0;
+
+	Eigen::Vector4d lc_surface_point_4 = modelview_transformation_ * surface_point_4;
+	Eigen::Vector3d lc_surface_point = lc_surface_point_4.topRows(3) / lc_surface_point_4[3];
+
+	Real lc_surface_point_len = lc_surface_point.norm();
+
+	// Ignore a test point if it is not visible from this model view.
+	if (!(lc_surface_point[2] < 0) || !(lc_surface_point_len > 0)
+		|| !std::isfinite(lc_surface_point_len))
+		return 1.0;
+
+	int x = get_grid_coord(lc_surface_point[0] / lc_surface_point_len, 0);
+	int y = get_grid_coord(lc_surface_point[1] / lc_surface_point_len, 1);
+	if (x < 0 || x >= grid_size_[0] || y < 0 || y >= grid_size_[1])
+		return 1.0;
+
+	const unsigned int cell_index = x * grid_size_[1] + y;
+	const Real lc_surface_point_squared_len = lc_surface_point_len * lc_surface_point_len;
+
+	bool occluded;
+	if (use_float_precision_)
+		occluded = is_occluded(cell_x_f_, cell_y_f_, cell_z_f_, cell_inv_cos_squared_f_,
+		grid_cell_offsets_[cell_index], grid_cell_offsets_[cell_index + 1],
+		lc_surface_point, lc_surface_point_squared_len);
+	else
+		occluded = is_occluded(cell_x_, cell_y_, cell_z_, cell_inv_cos_squared_,
+		grid_cell_offsets_[cell_index], grid_cell_offsets_[cell_index + 1],
+		lc_surface_point, lc_surface_point_squared_len);
+
+	return (occluded ? 0.0 : 1.0);
+}
+
+template<typename T>
+bool MeshCuboidVisibilityEngine::is_occluded(
+	const std::vector<T> &_x, const std::vector<T> &_y,
+	const std::vector<T> &_z, const std::vector<T> &_inv_cos_squared,
+	const unsigned int _begin, const unsigned int _end,
+	const Eigen::Vector3d &_lc_surface_point, const Real _lc_surface_point_squared_len)
+{
+	// NOTE:
+	// Let 'cos_angle = dot / (surface_len * len)'. Since 'atan(radius / len)' is in (0, pi/2)
+	// and 'cos(atan(radius / len)) = len / sqrt(len^2 + radius^2)',
+	// 'acos(cos_angle) <= atan(radius / len)' is equivalent to
+	// 'dot > 0' and 'dot^2 * (len^2 + radius^2) / len^4 >= surface_len^2'.
+	// The sample point should also be closer to the camera than the test point.
+	if (_begin >= _end)
+		return false;
+
+	const T *x = &_x[0];
+	const T *y = &_y[0];
+	const T *z = &_z[0];
+	const T *inv_cos_squared = &_inv_cos_squared[0];
+
+	const T sx = static_cast<T>(_lc_surface_point[0]);
+	const T sy = static_cast<T>(_lc_surface_point[1]);
+	const T sz = static_cast<T>(_lc_surface_point[2]);
+	const T squared_len = static_cast<T>(_lc_surface_point_squared_len);
+
+	for (unsigned int chunk_begin = _begin; chunk_begin < _end; chunk_begin += k_occlusion_test_chunk_size)
+	{
+		const unsigned int chunk_end = std::min(chunk_begin + k_occlusion_test_chunk_size, _end);
+		int occluded = 0;
+
+#pragma omp simd reduction(|:occluded)
+		for (unsigned int i = chunk_begin; i < chunk_end; ++i)
+		{
+			const T dot_prod = sx * x[i] + sy * y[i] + sz * z[i];
+			occluded |= static_cast<int>((z[i] > sz) & (dot_prod > 0)
+				& (dot_prod * dot_prod * inv_cos_squared[i] >= squared_len));
+		}
+
+		if (occluded)
+			return true;
+	}
+
+	return false;
+}
+
+void MeshCuboidVisibilityEngine::compute_visibility(
+	const std::vector<MyMesh::Point> &_test_points,
+	const std::vector<MyMesh::Normal> *_test_normals,
+	std::vector<Real> &_visibility_values) const
+{
+	const int num_test_points = static_cast<int>(_test_points.size());
+	assert(!_test_normals || (*_test_normals).size() == num_test_points);
+	_visibility_values.resize(num_test_points);
+
+#pragma omp parallel for schedule(dynamic, 64)
+	for (int test_point_index = 0; test_point_index < num_test_points; ++test_point_index)
+	{
+		Real &visibility = _visibility_values[test_point_index];
+
+		// Ignore a surface point if its normal is not heading to the viewing direction.
+		if (_test_normals && dot((*_test_normals)[test_point_index], view_direction_) >= 0)
+		{
+			visibility = 0.0;
+			continue;
+		}
+
+		visibility = compute_occlusion_visibility(_test_points[test_point_index]);
+		assert(visibility >= 0.0);
+		assert(visibility <= 1.0);
+	}
+
+
+	// Test 2D view plane mask for occlusion.
+	//
+	if (FLAGS_use_view_plane_mask)
+	{
+		std::list<SamplePointIndex> occluded_test_point_indices;
+		MeshCuboid::compute_view_plane_mask_visibility(modelview_matrix_,
+			_test_points, occluded_test_point_indices);
+
+		for (std::list<SamplePointIndex>::iterator it = occluded_test_point_indices.begin();
+			it != occluded_test_point_indices.end(); ++it)
+		{
+			SamplePointIndex test_point_index = *it;
+			assert(test_point_index < _visibility_values.size());
+			_visibility_values[test_point_index] = 0.0;
+		}
+	}
+	//
+}
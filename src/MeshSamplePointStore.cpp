@@ -0,0 +1,101 @@
+#include "MeshSamplePointStore.h"
+
+#include <algorithm>
+#include <cassert>
+
+
+template<typename T>
+inline void update_value(const T _value, T &_stored_value, bool &_is_changed)
+{
+	if (_stored_value != _value)
+	{
+		_stored_value = _value;
+		_is_changed = true;
+	}
+}
+
+MeshSamplePointStore::MeshSamplePointStore()
+	: version_(0)
+{
+	clear();
+}
+
+MeshSamplePointStore::~MeshSamplePointStore()
+{
+
+}
+
+void MeshSamplePointStore::clear()
+{
+	points_.resize(3, 0);
+	normals_.resize(3, 0);
+	bary_coords_.resize(3, 0);
+	face_indices_.resize(0);
+	label_index_confidences_.resize(0, 0);
+	errors_.resize(0);
+	++version_;
+}
+
+bool MeshSamplePointStore::update(const std::vector<MeshSamplePoint *> &_sample_points,
+	const unsigned int _num_labels)
+{
+	const unsigned int num_sample_points = static_cast<unsigned int>(_sample_points.size());
+	bool is_changed = false;
+
+	if (num_points() != num_sample_points || num_labels() != _num_labels)
+	{
+		points_.resize(3, num_sample_points);
+		normals_.resize(3, num_sample_points);
+		bary_coords_.resize(3, num_sample_points);
+		face_indices_.resize(num_sample_points);
+		label_index_confidences_.resize(num_sample_points, _num_labels);
+		errors_.resize(num_sample_points);
+		is_changed = true;
+	}
+
+	// NOTE:
+	// Values are compared while being copied, so unchanged sample points cost only
+	// a single pass over the data.
+	for (SamplePointIndex point_index = 0; point_index < num_sample_points; ++point_index)
+	{
+		const MeshSamplePoint *sample_point = _sample_points[point_index];
+		assert(sample_point);
+
+		for (unsigned int i = 0; i < 3; ++i)
+		{
+			update_value(sample_point->point_[i], points_(i, point_index), is_changed);
+			update_value(sample_point->normal_[i], normals_(i, point_index), is_changed);
+			update_value(sample_point->bary_coord_[i], bary_coords_(i, point_index), is_changed);
+		}
+
+		update_value(static_cast<int>(sample_point->corr_fid_), face_indices_[point_index], is_changed);
+		update_value(sample_point->error_, errors_[point_index], is_changed);
+
+		const std::vector<Real> &label_index_confidence = sample_point->label_index_confidence_;
+		const unsigned int num_confidences = std::min(_num_labels,
+			static_cast<unsigned int>(label_index_confidence.size()));
+
+		for (LabelIndex label_index = 0; label_index < num_confidences; ++label_index)
+			update_value(label_index_confidence[label_index],
+			label_index_confidences_(point_index, label_index), is_changed);
+		for (LabelIndex label_index = num_confidences; label_index < _num_labels; ++label_index)
+			update_value(0.0, label_index_confidences_(point_index, label_index), is_changed);
+	}
+
+	if (is_changed)
+		++version_;
+
+	return is_changed;
+}
+
+void MeshSamplePointStore::get_points(const std::vector<SamplePointIndex> &_indices,
+	Eigen::MatrixXd &_points) const
+{
+	_points.resize(3, _indices.size());
+
+	for (unsigned int i = 0; i < _indices.size(); ++i)
+	{
+		assert(_indices[i] < num_points());
+		_points.col(i) = points_.col(_indices[i]);
+	}
+}
@@ -1,6 +1,7 @@
 #include "MeshViewerCore.h"
 
 #include "MeshCuboidParameters.h"
+#include "OcclusionDepthBuffer.h"
 
 #include <QColor>
 #include "glut_geometry.h"
@@ -734,8 +735,8 @@ void MeshViewerCore::draw_openmesh(const std::string& _drawmode)
 		// Draw sample points (Gray).
 		if (draw_all_labels)
 		{
-			for (std::vector<MeshSamplePoint *>::iterator it = cuboid_structure_.sample_points_.begin();
-				it != cuboid_structure_.sample_points_.end(); it++)
+			for (std::vector<MeshSamplePoint *>::const_iterator it = cuboid_structure_.get_sample_points().begin();
+				it != cuboid_structure_.get_sample_points().end(); it++)
 			{
 				assert(*it);
 				GLdouble *point = &(*it)->point_[0];
@@ -832,7 +833,7 @@ void MeshViewerCore::draw_openmesh(const std::string& _drawmode)
 							cuboid->get_cuboid_surface_point(point_index);
 						MyMesh::Point point = cuboid_surface_point->point_;
 						MyMesh::Normal normal = cuboid_surface_point->normal_;
-						Real visibility = cuboid_surface_point->visibility_;
+						Real visibility = cuboid->get_cuboid_surface_point_visibility(point_index);
 						Real radius = (visibility) * (mesh_.get_object_diameter() * 0.002) * point_size_;
 
 						glPushMatrix();
@@ -878,8 +879,8 @@ void MeshViewerCore::draw_openmesh(const std::string& _drawmode)
 						cuboid_surface_point_index < cuboid->num_cuboid_surface_points();
 						++cuboid_surface_point_index)
 					{
-						Real visibility = cuboid->get_cuboid_surface_point(
-							cuboid_surface_point_index)->visibility_;
+						Real visibility = cuboid->get_cuboid_surface_point_visibility(
+							cuboid_surface_point_index);
 						if (visibility < 1.0)
 							continue;
 
@@ -1002,7 +1003,7 @@ void MeshViewerCore::draw_openmesh(const std::string& _drawmode)
 		for (SamplePointIndex sample_point_index = 0; sample_point_index < cuboid_structure_.num_sample_points();
 			++sample_point_index)
 		{
-			const MeshSamplePoint *sample_point = cuboid_structure_.sample_points_[sample_point_index];
+			const MeshSamplePoint *sample_point = cuboid_structure_.get_sample_point(sample_point_index);
 			assert(sample_point);
 
 			LabelIndex label_index = sample_point_label_indices[sample_point_index];
@@ -1217,8 +1218,8 @@ void MeshViewerCore::draw_openmesh(const std::string& _drawmode)
 	}
 	else if (_drawmode == POINT_SAMPLES)
 	{
-		for (std::vector<MeshSamplePoint *>::iterator it = cuboid_structure_.sample_points_.begin();
-			it != cuboid_structure_.sample_points_.end(); it++)
+		for (std::vector<MeshSamplePoint *>::const_iterator it = cuboid_structure_.get_sample_points().begin();
+			it != cuboid_structure_.get_sample_points().end(); it++)
 		{
 			assert(*it);
 			GLdouble *point = &(*it)->point_[0];
@@ -1232,8 +1233,8 @@ void MeshViewerCore::draw_openmesh(const std::string& _drawmode)
 	}
 	else if (_drawmode == COLORED_POINT_SAMPLES)
 	{
-		for (std::vector<MeshSamplePoint *>::iterator it = cuboid_structure_.sample_points_.begin();
-			it != cuboid_structure_.sample_points_.end(); it++)
+		for (std::vector<MeshSamplePoint *>::const_iterator it = cuboid_structure_.get_sample_points().begin();
+			it != cuboid_structure_.get_sample_points().end(); it++)
 		{
 			assert(*it);
 			GLdouble *point = &(*it)->point_[0];
@@ -1291,7 +1292,7 @@ void MeshViewerCore::draw_openmesh(const std::string& _drawmode)
 			GLubyte b = static_cast<GLubyte>((sample_point_index >> 16) % 256);
 			glColor3ub(r, g, b);
 
-			MeshSamplePoint *sample_point = cuboid_structure_.sample_points_[sample_point_index];
+			MeshSamplePoint *sample_point = cuboid_structure_.get_sample_point(sample_point_index);
 			assert(sample_point);
 			GLdouble *point = &(sample_point->point_[0]);
 
@@ -1307,47 +1308,86 @@ void MeshViewerCore::draw_openmesh(const std::string& _drawmode)
 
 void MeshViewerCore::remove_occluded_points()
 {
-	std::string curr_draw_mode = getDrawMode();
-	setDrawMode(FACE_INDEX_RENDERING);
-
-	size_t w(width()), h(height());
-	GLenum buffer(GL_BACK);
-
-	std::vector<GLubyte> fbuffer(3 * w*h);
 	unsigned int num_sample_points = cuboid_structure_.num_sample_points();
 	bool *is_sample_point_removed = new bool[num_sample_points];
 	memset(is_sample_point_removed, true, num_sample_points * sizeof(bool));
 
-	//qApp->processEvents();
-	makeCurrent();
-	updateGL();
-	glFinish();
+	if (FLAGS_use_software_occlusion_rendering)
+	{
+		// NOTE:
+		// Render the same scene with 'FACE_INDEX_RENDERING' mode using the CPU depth buffer.
+		// Sample point indices are not limited by RGB encoding.
+		unsigned int w = std::max(static_cast<int>(std::round(
+			width() * FLAGS_param_occlusion_rendering_scale)), 1);
+		unsigned int h = std::max(static_cast<int>(std::round(
+			height() * FLAGS_param_occlusion_rendering_scale)), 1);
+
+		std::vector<MyMesh::Point> sample_points(num_sample_points);
+		for (SamplePointIndex sample_point_index = 0; sample_point_index < num_sample_points;
+			++sample_point_index)
+		{
+			const MeshSamplePoint *sample_point = cuboid_structure_.get_sample_point(sample_point_index);
+			assert(sample_point);
+			sample_points[sample_point_index] = sample_point->point_;
+		}
 
-	glReadBuffer(buffer);
-	glPixelStorei(GL_PACK_ALIGNMENT, 1);
-	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+		Real radius = (mesh_.get_object_diameter() * 0.01) * point_size_;
 
-	updateGL();
-	glReadPixels(0, 0, w, h, GL_RGB, GL_UNSIGNED_BYTE, &fbuffer[0]);
+		OcclusionDepthBuffer depth_buffer(w, h, modelview_matrix(), projection_matrix());
+		depth_buffer.add_mesh(mesh_, num_sample_points);
+		if (num_sample_points > 0)
+			depth_buffer.add_spheres(sample_points, radius, 0);
+		depth_buffer.render();
+
+		std::vector<bool> is_sample_point_visible;
+		depth_buffer.get_visible_indices(0, num_sample_points, is_sample_point_visible);
+		for (SamplePointIndex sample_point_index = 0; sample_point_index < num_sample_points;
+			++sample_point_index)
+			is_sample_point_removed[sample_point_index] = !is_sample_point_visible[sample_point_index];
+	}
+	else
+	{
+		std::string curr_draw_mode = getDrawMode();
+		setDrawMode(FACE_INDEX_RENDERING);
 
-	unsigned int x, y, offset;
+		size_t w(width()), h(height());
+		GLenum buffer(GL_BACK);
 
-	for (y = 0; y < h; ++y) {
-		for (x = 0; x < w; ++x) {
-			offset = 3 * (y*w + x);
-			unsigned int r = static_cast<unsigned int>(fbuffer[offset]);
-			unsigned int g = static_cast<unsigned int>(fbuffer[offset + 1]);
-			unsigned int b = static_cast<unsigned int>(fbuffer[offset + 2]);
+		std::vector<GLubyte> fbuffer(3 * w*h);
 
-			// NOTE:
-			// (255, 255, 255) is background color.
-			if (r >= 255 && g >= 255 && b >= 255)
-				continue;
+		//qApp->processEvents();
+		makeCurrent();
+		updateGL();
+		glFinish();
+
+		glReadBuffer(buffer);
+		glPixelStorei(GL_PACK_ALIGNMENT, 1);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+		updateGL();
+		glReadPixels(0, 0, w, h, GL_RGB, GL_UNSIGNED_BYTE, &fbuffer[0]);
+
+		unsigned int x, y, offset;
+
+		for (y = 0; y < h; ++y) {
+			for (x = 0; x < w; ++x) {
+				offset = 3 * (y*w + x);
+				unsigned int r = static_cast<unsigned int>(fbuffer[offset]);
+				unsigned int g = static_cast<unsigned int>(fbuffer[offset + 1]);
+				unsigned int b = static_cast<unsigned int>(fbuffer[offset + 2]);
+
+				// NOTE:
+				// (255, 255, 255) is background color.
+				if (r >= 255 && g >= 255 && b >= 255)
+					continue;
 
-			int index = r + 256 * g + 65536 * b;
-			if(index < num_sample_points)
-				is_sample_point_removed[index] = false;
+				int index = r + 256 * g + 65536 * b;
+				if(index < num_sample_points)
+					is_sample_point_removed[index] = false;
+			}
 		}
+
+		setDrawMode(curr_draw_mode);
 	}
 
 	// Test 2D view plane mask for occlusion.
@@ -1358,7 +1398,7 @@ void MeshViewerCore::remove_occluded_points()
 		for (SamplePointIndex sample_point_index = 0; sample_point_index < num_sample_points;
 			++sample_point_index)
 		{
-			const MeshSamplePoint *sample_point = cuboid_structure_.sample_points_[sample_point_index];
+			const MeshSamplePoint *sample_point = cuboid_structure_.get_sample_point(sample_point_index);
 			assert(sample_point);
 			sample_points[sample_point_index] = sample_point->point_;
 		}
@@ -1379,8 +1419,6 @@ void MeshViewerCore::remove_occluded_points()
 	cuboid_structure_.remove_sample_points(is_sample_point_removed);
 	delete[] is_sample_point_removed;
 
-	setDrawMode(curr_draw_mode);
-
 	updateGL();
 }
 
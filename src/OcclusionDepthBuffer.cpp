@@ -0,0 +1,398 @@
+#include "OcclusionDepthBuffer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <Eigen/LU>
+
+
+const unsigned int k_tile_size = 32;
+
+// NOTE:
+// Depth buffer is cleared to 1.0 as in OpenGL.
+const Real k_clear_depth = 1.0;
+
+
+OcclusionDepthBuffer::OcclusionDepthBuffer(const unsigned int _width, const unsigned int _height,
+	const Real _modelview_matrix[16], const Real _projection_matrix[16])
+	: width_(_width)
+	, height_(_height)
+{
+	assert(_width > 0 && _height > 0);
+	assert(_modelview_matrix);
+	assert(_projection_matrix);
+
+	// NOTE:
+	// OpenGL matrices are column-major.
+	for (unsigned int col = 0; col < 4; ++col)
+	{
+		for (unsigned int row = 0; row < 4; ++row)
+		{
+			modelview_matrix_(row, col) = _modelview_matrix[4 * col + row];
+			projection_matrix_(row, col) = _projection_matrix[4 * col + row];
+		}
+	}
+	inverse_projection_matrix_ = projection_matrix_.inverse();
+
+	num_tiles_x_ = (width_ + k_tile_size - 1) / k_tile_size;
+	num_tiles_y_ = (height_ + k_tile_size - 1) / k_tile_size;
+
+	clear();
+}
+
+OcclusionDepthBuffer::~OcclusionDepthBuffer()
+{
+
+}
+
+void OcclusionDepthBuffer::clear()
+{
+	triangles_.clear();
+	spheres_.clear();
+	primitives_.clear();
+	tile_primitive_indices_.clear();
+	tile_primitive_indices_.resize(num_tiles_x_ * num_tiles_y_);
+	depth_buffer_.assign(width_ * height_, k_clear_depth);
+	index_buffer_.assign(width_ * height_, -1);
+}
+
+Eigen::Vector3d OcclusionDepthBuffer::clip_to_window(const Eigen::Vector4d &_clip_vertex) const
+{
+	assert(_clip_vertex[3] > 0);
+	Eigen::Vector3d ndc_vertex = _clip_vertex.topRows(3) / _clip_vertex[3];
+
+	Eigen::Vector3d window_vertex;
+	window_vertex[0] = 0.5 * (ndc_vertex[0] + 1.0) * width_;
+	window_vertex[1] = 0.5 * (ndc_vertex[1] + 1.0) * height_;
+	window_vertex[2] = ndc_vertex[2];
+	return window_vertex;
+}
+
+void OcclusionDepthBuffer::add_mesh(const MyMesh &_mesh, const int _index_offset)
+{
+	Eigen::Matrix4d modelview_projection_matrix = projection_matrix_ * modelview_matrix_;
+
+	for (MyMesh::ConstFaceIter f_it = _mesh.faces_begin(); f_it != _mesh.faces_end(); ++f_it)
+	{
+		Eigen::Vector4d clip_vertices[3];
+		unsigned int vertex_index = 0;
+
+		for (MyMesh::ConstFaceVertexIter fv_it = _mesh.cfv_iter(f_it.handle());
+			fv_it && vertex_index < 3; ++fv_it, ++vertex_index)
+		{
+			const MyMesh::Point &point = _mesh.point(fv_it);
+			Eigen::Vector4d point_4(point[0], point[1], point[2], 1.0);
+			clip_vertices[vertex_index] = modelview_projection_matrix * point_4;
+		}
+
+		if (vertex_index < 3)
+			continue;
+
+		add_triangle(clip_vertices, _index_offset + f_it->idx());
+	}
+}
+
+void OcclusionDepthBuffer::add_triangle(const Eigen::Vector4d _clip_vertices[3], const int _index)
+{
+	// Clip the triangle with the near plane (z >= -w).
+	Eigen::Vector4d polygon[4];
+	unsigned int num_polygon_vertices = 0;
+
+	for (unsigned int i = 0; i < 3; ++i)
+	{
+		const Eigen::Vector4d &v1 = _clip_vertices[i];
+		const Eigen::Vector4d &v2 = _clip_vertices[(i + 1) % 3];
+		const Real d1 = v1[2] + v1[3];
+		const Real d2 = v2[2] + v2[3];
+
+		if (d1 >= 0)
+			polygon[num_polygon_vertices++] = v1;
+
+		if ((d1 >= 0) != (d2 >= 0))
+		{
+			const Real t = d1 / (d1 - d2);
+			polygon[num_polygon_vertices++] = v1 + t * (v2 - v1);
+		}
+	}
+
+	if (num_polygon_vertices < 3)
+		return;
+
+	Eigen::Vector3d window_vertices[4];
+	for (unsigned int i = 0; i < num_polygon_vertices; ++i)
+	{
+		// NOTE:
+		// A vertex exactly on the near plane of an orthographic projection can have w = 0.
+		if (!(polygon[i][3] > 0))
+			return;
+		window_vertices[i] = clip_to_window(polygon[i]);
+	}
+
+	// Triangle fan.
+	for (unsigned int i = 1; i + 1 < num_polygon_vertices; ++i)
+	{
+		Triangle triangle;
+		triangle.vertices_[0] = window_vertices[0];
+		triangle.vertices_[1] = window_vertices[i];
+		triangle.vertices_[2] = window_vertices[i + 1];
+		triangle.index_ = _index;
+
+		Eigen::Vector2d bbox_min = triangle.vertices_[0].topRows(2);
+		Eigen::Vector2d bbox_max = triangle.vertices_[0].topRows(2);
+		for (unsigned int j = 1; j < 3; ++j)
+		{
+			bbox_min = bbox_min.cwiseMin(triangle.vertices_[j].topRows(2));
+			bbox_max = bbox_max.cwiseMax(triangle.vertices_[j].topRows(2));
+		}
+
+		triangles_.push_back(triangle);
+		add_primitive(false, triangles_.size() - 1, bbox_min, bbox_max);
+	}
+}
+
+void OcclusionDepthBuffer::add_spheres(const std::vector<MyMesh::Point> &_centers,
+	const Real _radius, const int _index_offset)
+{
+	assert(_radius > 0);
+
+	for (unsigned int point_index = 0; point_index < _centers.size(); ++point_index)
+	{
+		const MyMesh::Point &point = _centers[point_index];
+		Eigen::Vector4d point_4(point[0], point[1], point[2], 1.0);
+		Eigen::Vector4d center_4 = modelview_matrix_ * point_4;
+
+		Sphere sphere;
+		sphere.center_ = center_4.topRows(3) / center_4[3];
+		sphere.radius_ = _radius;
+		sphere.index_ = _index_offset + static_cast<int>(point_index);
+
+		// Screen bounding box from the corners of the bounding box in the model view coordinates.
+		Eigen::Vector2d bbox_min(width_, height_);
+		Eigen::Vector2d bbox_max(0, 0);
+		unsigned int num_front_corners = 0;
+
+		for (unsigned int corner_index = 0; corner_index < 8; ++corner_index)
+		{
+			Eigen::Vector4d corner;
+			for (unsigned int i = 0; i < 3; ++i)
+				corner[i] = sphere.center_[i] + ((corner_index >> i) & 1 ? _radius : -_radius);
+			corner[3] = 1.0;
+
+			Eigen::Vector4d clip_corner = projection_matrix_ * corner;
+			if (clip_corner[2] + clip_corner[3] >= 0 && clip_corner[3] > 0)
+			{
+				Eigen::Vector3d window_corner = clip_to_window(clip_corner);
+				bbox_min = bbox_min.cwiseMin(window_corner.topRows(2));
+				bbox_max = bbox_max.cwiseMax(window_corner.topRows(2));
+				++num_front_corners;
+			}
+		}
+
+		if (num_front_corners == 0)
+			continue;
+		else if (num_front_corners < 8)
+		{
+			// The sphere intersects the near plane.
+			bbox_min = Eigen::Vector2d(0, 0);
+			bbox_max = Eigen::Vector2d(width_, height_);
+		}
+
+		spheres_.push_back(sphere);
+		add_primitive(true, spheres_.size() - 1, bbox_min, bbox_max);
+	}
+}
+
+void OcclusionDepthBuffer::add_primitive(const bool _is_sphere, const unsigned int _primitive_index,
+	const Eigen::Vector2d &_bbox_min, const Eigen::Vector2d &_bbox_max)
+{
+	Primitive primitive;
+	primitive.is_sphere_ = _is_sphere;
+	primitive.primitive_index_ = _primitive_index;
+
+	// Pixels whose centers are in the bounding box.
+	const Real max_coord[2] = { static_cast<Real>(width_), static_cast<Real>(height_) };
+	for (unsigned int i = 0; i < 2; ++i)
+	{
+		Real range_min = std::ceil(std::max(_bbox_min[i], -1.0) - 0.5);
+		Real range_max = std::floor(std::min(_bbox_max[i], max_coord[i] + 1.0) - 0.5);
+		primitive.bbox_[i] = std::max(static_cast<int>(range_min), 0);
+		primitive.bbox_[i + 2] = std::min(static_cast<int>(range_max), static_cast<int>(max_coord[i]) - 1);
+	}
+
+	if (primitive.bbox_[0] > primitive.bbox_[2] || primitive.bbox_[1] > primitive.bbox_[3])
+		return;
+
+	const unsigned int primitive_index = static_cast<unsigned int>(primitives_.size());
+	primitives_.push_back(primitive);
+
+	// Bin the primitive into the tiles overlapping its bounding box.
+	const unsigned int tile_range[4] = {
+		primitive.bbox_[0] / k_tile_size, primitive.bbox_[1] / k_tile_size,
+		primitive.bbox_[2] / k_tile_size, primitive.bbox_[3] / k_tile_size };
+
+	for (unsigned int tile_y = tile_range[1]; tile_y <= tile_range[3]; ++tile_y)
+		for (unsigned int tile_x = tile_range[0]; tile_x <= tile_range[2]; ++tile_x)
+			tile_primitive_indices_[tile_y * num_tiles_x_ + tile_x].push_back(primitive_index);
+}
+
+void OcclusionDepthBuffer::render()
+{
+	const int num_tiles = static_cast<int>(num_tiles_x_ * num_tiles_y_);
+
+#pragma omp parallel for schedule(dynamic)
+	for (int tile_index = 0; tile_index < num_tiles; ++tile_index)
+	{
+		render_tile(static_cast<unsigned int>(tile_index));
+	}
+}
+
+void OcclusionDepthBuffer::render_tile(const unsigned int _tile_index)
+{
+	const int tile_x = static_cast<int>(_tile_index % num_tiles_x_);
+	const int tile_y = static_cast<int>(_tile_index / num_tiles_x_);
+
+	const int tile_range[4] = {
+		tile_x * static_cast<int>(k_tile_size),
+		tile_y * static_cast<int>(k_tile_size),
+		std::min((tile_x + 1) * static_cast<int>(k_tile_size), static_cast<int>(width_)) - 1,
+		std::min((tile_y + 1) * static_cast<int>(k_tile_size), static_cast<int>(height_)) - 1 };
+
+	// NOTE:
+	// Each tile is written by only one thread, and primitives are processed in
+	// the order they are added.
+	const std::vector<unsigned int> &primitive_indices = tile_primitive_indices_[_tile_index];
+	for (std::vector<unsigned int>::const_iterator it = primitive_indices.begin();
+		it != primitive_indices.end(); ++it)
+	{
+		const Primitive &primitive = primitives_[*it];
+		int range[4] = {
+			std::max(primitive.bbox_[0], tile_range[0]),
+			std::max(primitive.bbox_[1], tile_range[1]),
+			std::min(primitive.bbox_[2], tile_range[2]),
+			std::min(primitive.bbox_[3], tile_range[3]) };
+
+		if (range[0] > range[2] || range[1] > range[3])
+			continue;
+
+		if (primitive.is_sphere_)
+			rasterize_sphere(spheres_[primitive.primitive_index_], range);
+		else
+			rasterize_triangle(triangles_[primitive.primitive_index_], range);
+	}
+}
+
+void OcclusionDepthBuffer::rasterize_triangle(const Triangle &_triangle, const int _range[4])
+{
+	const Eigen::Vector3d &v0 = _triangle.vertices_[0];
+	const Eigen::Vector3d &v1 = _triangle.vertices_[1];
+	const Eigen::Vector3d &v2 = _triangle.vertices_[2];
+
+	Real area = (v1[0] - v0[0]) * (v2[1] - v0[1]) - (v1[1] - v0[1]) * (v2[0] - v0[0]);
+	if (area == 0)
+		return;
+
+	// Both front and back faces are rendered.
+	const Real sign = (area > 0) ? 1.0 : -1.0;
+	area *= sign;
+
+	for (int y = _range[1]; y <= _range[3]; ++y)
+	{
+		const Real py = y + 0.5;
+		for (int x = _range[0]; x <= _range[2]; ++x)
+		{
+			const Real px = x + 0.5;
+
+			// Edge functions.
+			Real w0 = sign * ((v2[0] - v1[0]) * (py - v1[1]) - (v2[1] - v1[1]) * (px - v1[0]));
+			Real w1 = sign * ((v0[0] - v2[0]) * (py - v2[1]) - (v0[1] - v2[1]) * (px - v2[0]));
+			Real w2 = sign * ((v1[0] - v0[0]) * (py - v0[1]) - (v1[1] - v0[1]) * (px - v0[0]));
+			if (w0 < 0 || w1 < 0 || w2 < 0)
+				continue;
+
+			// NOTE:
+			// Normalized device depth is linear in the window coordinates.
+			Real depth = (w0 * v0[2] + w1 * v1[2] + w2 * v2[2]) / area;
+			if (depth < -1.0)
+				continue;
+
+			const unsigned int pixel_index = y * width_ + x;
+			if (depth < depth_buffer_[pixel_index])
+			{
+				depth_buffer_[pixel_index] = depth;
+				index_buffer_[pixel_index] = _triangle.index_;
+			}
+		}
+	}
+}
+
+void OcclusionDepthBuffer::rasterize_sphere(const Sphere &_sphere, const int _range[4])
+{
+	const Real squared_radius = _sphere.radius_ * _sphere.radius_;
+
+	for (int y = _range[1]; y <= _range[3]; ++y)
+	{
+		const Real ndc_y = 2.0 * (y + 0.5) / height_ - 1.0;
+		for (int x = _range[0]; x <= _range[2]; ++x)
+		{
+			const Real ndc_x = 2.0 * (x + 0.5) / width_ - 1.0;
+
+			// Ray from the near plane to the far plane in the model view coordinates.
+			Eigen::Vector4d near_point_4 = inverse_projection_matrix_ * Eigen::Vector4d(ndc_x, ndc_y, -1.0, 1.0);
+			Eigen::Vector4d far_point_4 = inverse_projection_matrix_ * Eigen::Vector4d(ndc_x, ndc_y, 1.0, 1.0);
+			Eigen::Vector3d ray_origin = near_point_4.topRows(3) / near_point_4[3];
+			Eigen::Vector3d ray_direction = far_point_4.topRows(3) / far_point_4[3] - ray_origin;
+
+			Eigen::Vector3d center_to_origin = ray_origin - _sphere.center_;
+			Real a = ray_direction.squaredNorm();
+			Real b = ray_direction.dot(center_to_origin);
+			Real c = center_to_origin.squaredNorm() - squared_radius;
+			Real discriminant = b * b - a * c;
+			if (discriminant < 0)
+				continue;
+
+			// If the near plane cuts the sphere, the inner side is visible.
+			Real t = (-b - std::sqrt(discriminant)) / a;
+			if (t < 0) t = (-b + std::sqrt(discriminant)) / a;
+			if (t < 0 || t > 1)
+				continue;
+
+			Eigen::Vector4d hit_point_4;
+			hit_point_4 << (ray_origin + t * ray_direction), 1.0;
+			Eigen::Vector4d clip_hit_point = projection_matrix_ * hit_point_4;
+			Real depth = clip_hit_point[2] / clip_hit_point[3];
+
+			const unsigned int pixel_index = y * width_ + x;
+			if (depth < depth_buffer_[pixel_index])
+			{
+				depth_buffer_[pixel_index] = depth;
+				index_buffer_[pixel_index] = _sphere.index_;
+			}
+		}
+	}
+}
+
+int OcclusionDepthBuffer::get_index(const unsigned int _x, const unsigned int _y) const
+{
+	assert(_x < width_ && _y < height_);
+	return index_buffer_[_y * width_ + _x];
+}
+
+Real OcclusionDepthBuffer::get_depth(const unsigned int _x, const unsigned int _y) const
+{
+	assert(_x < width_ && _y < height_);
+	return depth_buffer_[_y * width_ + _x];
+}
+
+void OcclusionDepthBuffer::get_visible_indices(const int _begin, const int _end,
+	std::vector<bool> &_is_visible) const
+{
+	assert(_begin <= _end);
+	_is_visible.clear();
+	_is_visible.resize(_end - _begin, false);
+
+	for (std::vector<int>::const_iterator it = index_buffer_.begin(); it != index_buffer_.end(); ++it)
+	{
+		const int index = (*it);
+		if (index >= _begin && index < _end)
+			_is_visible[index - _begin] = true;
+	}
+}
@@ -4,6 +4,7 @@
 #include "MeshCuboidParameters.h"
 #include "MeshCuboidPredictor.h"
 #include "MeshCuboidRelation.h"
+#include "MeshCuboidRelationBundle.h"
 #include "MeshCuboidTrainer.h"
 #include "MeshCuboidSolver.h"
 #include "simplerandom.h"
@@ -18,6 +19,11 @@
 #include "MRFEnergy.h"
 
 
+std::string get_relation_bundle_filepath()
+{
+	return FLAGS_training_dir + std::string("/") + FLAGS_relation_bundle_filename;
+}
+
 void MeshViewerCore::parse_arguments()
 {
 	std::cout << "data_root_path = " << FLAGS_data_root_path << std::endl;
@@ -87,6 +93,12 @@ void MeshViewerCore::parse_arguments()
 		run_extract_symmetry_info();
 		exit(EXIT_FAILURE);
 	}
+	else if (FLAGS_run_quadratic_solver_benchmark)
+	{
+		test_initialize();
+		test_quadratic_solver_benchmark();
+		exit(EXIT_FAILURE);
+	}
 }
 
 bool MeshViewerCore::load_object_info(
@@ -251,7 +263,7 @@ bool MeshViewerCore::load_object_info(
 		for (SamplePointIndex sample_point_index = 0; sample_point_index < _cuboid_structure.num_sample_points();
 			++sample_point_index)
 		{
-			MeshSamplePoint* sample_point = _cuboid_structure.sample_points_[sample_point_index];
+			MeshSamplePoint* sample_point = _cuboid_structure.get_sample_point(sample_point_index);
 			assert(sample_point);
 
 			FaceIndex fid = sample_point->corr_fid_;
@@ -759,6 +771,46 @@ void MeshViewerCore::train()
 
 	mesh_name_list_file.close();
 
+	if (FLAGS_relation_bundle_filename != "")
+	{
+		// NOTE:
+		// Relations are validated only once here, and are loaded from the bundle
+		// without validation when predicting.
+		MeshCuboidTrainer trainer;
+		ret = true;
+		ret = ret & trainer.load_object_list(FLAGS_training_dir + std::string("/") + FLAGS_object_list_filename);
+		ret = ret & trainer.load_features(FLAGS_training_dir + std::string("/") + FLAGS_feature_filename_prefix);
+		ret = ret & trainer.load_transformations(FLAGS_training_dir + std::string("/") + FLAGS_transformation_filename_prefix);
+
+		// NOTE:
+		// Predictions are evaluated by leave-one-out (see 'predict()'), so the training
+		// features are also saved, and the relations excluding each object are trained
+		// when the bundle is loaded.
+		if (ret)
+		{
+			std::vector< std::vector<MeshCuboidJointNormalRelations *> > joint_normal_relations;
+			std::vector< std::vector<MeshCuboidCondNormalRelations *> > cond_normal_relations;
+			trainer.get_joint_normal_relations(joint_normal_relations);
+
+			std::string relation_bundle_filepath = get_relation_bundle_filepath();
+			std::cout << "Saving '" << relation_bundle_filepath << "'..." << std::endl;
+			ret = MeshCuboidRelationBundle::save(relation_bundle_filepath.c_str(),
+				joint_normal_relations, cond_normal_relations, &trainer);
+
+			for (LabelIndex label_index_1 = 0; label_index_1 < joint_normal_relations.size(); ++label_index_1)
+				for (LabelIndex label_index_2 = 0; label_index_2 < joint_normal_relations[label_index_1].size(); ++label_index_2)
+					delete joint_normal_relations[label_index_1][label_index_2];
+		}
+
+		if (!ret)
+		{
+			do {
+				std::cout << "Error: Cannot save the relation bundle file.";
+				std::cout << '\n' << "Press the Enter key to continue.";
+			} while (std::cin.get() != '\n');
+		}
+	}
+
 	std::cout << std::endl;
 	std::cout << " -- Batch Completed. -- " << std::endl;
 }
@@ -794,6 +846,23 @@ void MeshViewerCore::train_file_files()
 
 			std::cout << "Saving '" << relation_filename_sstr.str() << "'..." << std::endl;
 			relation_12->save_joint_normal_csv(relation_filename_sstr.str().c_str());
+
+			std::stringstream low_rank_relation_filename_sstr;
+			low_rank_relation_filename_sstr << FLAGS_joint_normal_relation_filename_prefix << cuboid_index_1
+				<< "_" << cuboid_index_2 << "_low_rank.dat";
+
+			if (relation_12->is_low_rank())
+			{
+				std::cout << "Saving '" << low_rank_relation_filename_sstr.str() << "'..." << std::endl;
+				relation_12->save_joint_normal_low_rank(low_rank_relation_filename_sstr.str().c_str());
+			}
+			else
+			{
+				// NOTE:
+				// Remove the low-rank file of previous training so that it does not
+				// override the new relation.
+				QDir().remove(low_rank_relation_filename_sstr.str().c_str());
+			}
 		}
 	}
 	//
@@ -933,7 +1002,29 @@ void MeshViewerCore::predict()
 
 	std::vector< std::vector<MeshCuboidJointNormalRelations *> > joint_normal_relations;
 	//MeshCuboidTrainer::load_joint_normal_relations(num_labels, "joint_normal_", joint_normal_relations);
-	trainer.get_joint_normal_relations(joint_normal_relations, &ignored_object_list);
+	bool is_relation_bundle_loaded = false;
+	if (FLAGS_relation_bundle_filename != "")
+	{
+		// NOTE:
+		// The relations are trained without the input object when the bundle is loaded.
+		std::vector< std::vector<MeshCuboidCondNormalRelations *> > bundle_cond_normal_relations;
+		is_relation_bundle_loaded = MeshCuboidRelationBundle::load(
+			get_relation_bundle_filepath().c_str(),
+			joint_normal_relations, bundle_cond_normal_relations, mesh_name);
+
+		for (LabelIndex label_index_1 = 0; label_index_1 < bundle_cond_normal_relations.size(); ++label_index_1)
+			for (LabelIndex label_index_2 = 0; label_index_2 < bundle_cond_normal_relations[label_index_1].size(); ++label_index_2)
+				delete bundle_cond_normal_relations[label_index_1][label_index_2];
+
+		if (!is_relation_bundle_loaded)
+		{
+			std::cerr << "Warning: Cannot load the relation bundle without '" << mesh_name
+				<< "'. Relations are trained from the training files." << std::endl;
+		}
+	}
+
+	if (!is_relation_bundle_loaded)
+		trainer.get_joint_normal_relations(joint_normal_relations, &ignored_object_list);
 	MeshCuboidJointNormalRelationPredictor joint_normal_predictor(joint_normal_relations);
 
 	//std::vector< std::vector<MeshCuboidCondNormalRelations *> > cond_normal_relations;
@@ -1056,11 +1147,17 @@ void MeshViewerCore::predict()
 	cuboid_structure_candidates.push_back(std::make_pair(std::string("0"), cuboid_structure_));
 	std::set<LabelIndex> ignored_label_indices;
 
+	// NOTE:
+	// Candidates are processed one at a time. Each candidate is set to the viewer's
+	// 'cuboid_structure_' for snapshots, the stages search ANN kd-trees (which keep
+	// their search states in global variables), and IPOPT runs with MUMPS, which
+	// is not thread-safe. Running candidates concurrently requires per-candidate
+	// structures without the viewer, 'ICP::KdTree' in all stages, and serialized
+	// (or process-level) non-linear optimization.
 	while (!cuboid_structure_candidates.empty())
 	{
-		// FIXME:
-		// The cuboid structure should not deep copy all sample points.
-		// Use smart pointers for sample points.
+		// NOTE:
+		// Candidate structures share sample points until they are changed.
 		std::string cuboid_structure_name = cuboid_structure_candidates.front().first;
 		cuboid_structure_ = cuboid_structure_candidates.front().second;
 		cuboid_structure_candidates.pop_front();
@@ -1273,14 +1370,14 @@ void MeshViewerCore::run_symmetry_detection()
 	open_modelview_matrix_file(FLAGS_pose_filename.c_str());
 	updateGL();
 
-	const unsigned int num_input_points = cuboid_structure_.sample_points_.size();
+	const unsigned int num_input_points = cuboid_structure_.num_sample_points();
 	assert(num_input_points > 0);
 	Eigen::MatrixXd sample_points = Eigen::MatrixXd(3, num_input_points);
 
 	for (SamplePointIndex sample_point_index = 0; sample_point_index < num_input_points;
 		++sample_point_index)
 	{
-		const MeshSamplePoint *sample_point = cuboid_structure_.sample_points_[sample_point_index];
+		const MeshSamplePoint *sample_point = cuboid_structure_.get_sample_point(sample_point_index);
 		assert(sample_point);
 		for (int i = 0; i < 3; ++i)
 			sample_points.col(sample_point_index)[i] = sample_point->point_[i];
@@ -1413,7 +1510,7 @@ void MeshViewerCore::run_symmetry_detection_msh2pln()
 
 	for (SamplePointIndex sample_point_index = 0; sample_point_index < num_sample_points; ++sample_point_index)
 	{
-		MeshSamplePoint *sample_point = cuboid_structure_.sample_points_[sample_point_index];
+		MeshSamplePoint *sample_point = cuboid_structure_.get_sample_point(sample_point_index);
 		assert(sample_point);
 		sample_points[sample_point_index] = sample_point->point_;
 		for (unsigned int i = 0; i < 3; ++i)
@@ -1524,7 +1621,7 @@ void MeshViewerCore::run_symmetry_detection_msh2pln()
 
 		for (SamplePointIndex sample_point_index = 0; sample_point_index < num_sample_points; ++sample_point_index)
 		{
-			MeshSamplePoint *sample_point = cuboid_structure_.sample_points_[sample_point_index];
+			MeshSamplePoint *sample_point = cuboid_structure_.get_sample_point(sample_point_index);
 			assert(sample_point);
 
 			MyMesh::Point symmetric_point = symmetry_group->get_symmetric_point(sample_point->point_);
@@ -2157,7 +2254,7 @@ void MeshViewerCore::compute_view_plane_mask_range(const Real _modelview_matrix[
 	for (SamplePointIndex sample_point_index = 0; sample_point_index < num_sample_points;
 		++sample_point_index)
 	{
-		const MeshSamplePoint *sample_point = cuboid_structure_.sample_points_[sample_point_index];
+		const MeshSamplePoint *sample_point = cuboid_structure_.get_sample_point(sample_point_index);
 		assert(sample_point);
 		sample_points[sample_point_index] = sample_point->point_;
 	}
@@ -2324,7 +2421,7 @@ void MeshViewerCore::run_occlusion_test()
 	for (unsigned point_index = 0; point_index < cuboid_structure_.num_sample_points();
 		++point_index)
 	{
-		MyMesh::Point point = cuboid_structure_.sample_points_[point_index]->point_;
+		MyMesh::Point point = cuboid_structure_.get_sample_point(point_index)->point_;
 		Eigen::Vector3f point_vec;
 		point_vec << point[0], point[1], point[2];
 		sample_points.push_back(point_vec);
@@ -1,10 +1,12 @@
 #include "MeshViewerCore.h"
 #include "MeshCuboidFusion.h"
 #include "MeshCuboidParameters.h"
+#include "MeshCuboidRelationBundle.h"
 #include "MeshCuboidSolver.h"
 //#include "MeshCuboidNonLinearSolver.h"
 
 #include <sstream>
+#include <omp.h>
 #include <Eigen/Geometry>
 #include <QFileInfo>
 
@@ -24,31 +26,52 @@ void MeshViewerCore::test_initialize()
 			delete test_joint_normal_relations_[label_index_1][label_index_2];
 
 	test_joint_normal_relations_.clear();
-	test_joint_normal_relations_.resize(num_all_cuboid_labels);
-	for (LabelIndex label_index_1 = 0; label_index_1 < num_all_cuboid_labels; ++label_index_1)
-	{
-		test_joint_normal_relations_[label_index_1].resize(num_all_cuboid_labels, NULL);
-		for (LabelIndex label_index_2 = 0; label_index_2 < num_all_cuboid_labels; ++label_index_2)
-		{
-			if (label_index_1 == label_index_2)
-				continue;
 
-			std::stringstream relation_filename_sstr;
-			relation_filename_sstr << std::string("joint_normal_")
-				<< label_index_1 << std::string("_")
-				<< label_index_2 << std::string(".dat");
+	if (FLAGS_relation_bundle_filename != "")
+	{
+		std::vector< std::vector<MeshCuboidCondNormalRelations *> > cond_normal_relations;
+		bool ret = MeshCuboidRelationBundle::load(FLAGS_relation_bundle_filename.c_str(),
+			test_joint_normal_relations_, cond_normal_relations);
 
-			QFileInfo relation_file(relation_filename_sstr.str().c_str());
-			if (!relation_file.exists()) continue;
+		for (LabelIndex label_index_1 = 0; label_index_1 < cond_normal_relations.size(); ++label_index_1)
+			for (LabelIndex label_index_2 = 0; label_index_2 < cond_normal_relations[label_index_1].size(); ++label_index_2)
+				delete cond_normal_relations[label_index_1][label_index_2];
 
-			test_joint_normal_relations_[label_index_1][label_index_2] = new MeshCuboidJointNormalRelations();
-			bool ret = test_joint_normal_relations_[label_index_1][label_index_2]->load_joint_normal_dat(
-				relation_filename_sstr.str().c_str());
-			if (!ret)
+		if (!ret)
+		{
+			do {
+				std::cout << '\n' << "Press the Enter key to continue.";
+			} while (std::cin.get() != '\n');
+		}
+	}
+	else
+	{
+		test_joint_normal_relations_.resize(num_all_cuboid_labels);
+		for (LabelIndex label_index_1 = 0; label_index_1 < num_all_cuboid_labels; ++label_index_1)
+		{
+			test_joint_normal_relations_[label_index_1].resize(num_all_cuboid_labels, NULL);
+			for (LabelIndex label_index_2 = 0; label_index_2 < num_all_cuboid_labels; ++label_index_2)
 			{
-				do {
-					std::cout << '\n' << "Press the Enter key to continue.";
-				} while (std::cin.get() != '\n');
+				if (label_index_1 == label_index_2)
+					continue;
+
+				std::stringstream relation_filename_sstr;
+				relation_filename_sstr << std::string("joint_normal_")
+					<< label_index_1 << std::string("_")
+					<< label_index_2 << std::string(".dat");
+
+				QFileInfo relation_file(relation_filename_sstr.str().c_str());
+				if (!relation_file.exists()) continue;
+
+				test_joint_normal_relations_[label_index_1][label_index_2] = new MeshCuboidJointNormalRelations();
+				bool ret = test_joint_normal_relations_[label_index_1][label_index_2]->load_joint_normal_dat(
+					relation_filename_sstr.str().c_str());
+				if (!ret)
+				{
+					do {
+						std::cout << '\n' << "Press the Enter key to continue.";
+					} while (std::cin.get() != '\n');
+				}
 			}
 		}
 	}
@@ -148,6 +171,64 @@ void MeshViewerCore::test_optimize()
 		FLAGS_param_opt_max_iterations, "log.txt", this, false);
 }
 
+void MeshViewerCore::test_quadratic_solver_benchmark()
+{
+	assert(test_joint_normal_predictor_);
+	const unsigned int num_runs = 10;
+	const double single_energy_term_weight = FLAGS_param_opt_single_energy_term_weight;
+
+	// NOTE:
+	// Both solvers start from the same cuboids in every run.
+	MeshCuboidPoseSnapshot init_cuboid_poses;
+	init_cuboid_poses.save(cuboid_structure_);
+
+	// IPOPT (the current path without symmetry terms).
+	MeshCuboidPoseSnapshot non_linear_cuboid_poses;
+	double start_time = omp_get_wtime();
+	for (unsigned int run = 0; run < num_runs; ++run)
+	{
+		init_cuboid_poses.restore(cuboid_structure_);
+		optimize_attributes_once(cuboid_structure_, *test_joint_normal_predictor_,
+			single_energy_term_weight, 0.0, false);
+	}
+	const double non_linear_time = (omp_get_wtime() - start_time) / num_runs;
+	non_linear_cuboid_poses.save(cuboid_structure_);
+
+	double single_total_energy = 0, pair_total_energy = 0;
+	get_optimization_error(all_cuboids_, *test_joint_normal_predictor_, single_total_energy, pair_total_energy);
+	const double non_linear_energy = pair_total_energy + single_energy_term_weight * single_total_energy;
+
+	// Sparse KKT solver.
+	MeshCuboidSparseKKTSolver kkt_solver;
+	bool ret = true;
+	start_time = omp_get_wtime();
+	for (unsigned int run = 0; run < num_runs; ++run)
+	{
+		init_cuboid_poses.restore(cuboid_structure_);
+		ret = ret & optimize_attributes_sparse_quadratic_once(all_cuboids_, *test_joint_normal_predictor_,
+			single_energy_term_weight, kkt_solver);
+	}
+	const double sparse_time = (omp_get_wtime() - start_time) / num_runs;
+
+	get_optimization_error(all_cuboids_, *test_joint_normal_predictor_, single_total_energy, pair_total_energy);
+	const double sparse_energy = pair_total_energy + single_energy_term_weight * single_total_energy;
+	const Real max_corner_distance = non_linear_cuboid_poses.get_max_corner_distance(cuboid_structure_);
+
+	std::cout << "Quadratic solver benchmark (" << all_cuboids_.size() << " cuboids, "
+		<< num_runs << " runs)" << std::endl;
+	std::cout << " - IPOPT: " << non_linear_time << " s (energy = " << non_linear_energy << ")" << std::endl;
+	std::cout << " - Sparse KKT: " << sparse_time << " s (energy = " << sparse_energy << ", "
+		<< kkt_solver.num_symbolic_analyses() << " symbolic analyses, "
+		<< kkt_solver.num_numeric_factorizations() << " numeric factorizations)" << std::endl;
+	if (!ret)
+		std::cout << " - Sparse KKT solver failed." << std::endl;
+	std::cout << " - Max corner distance: " << max_corner_distance << std::endl;
+
+	init_cuboid_poses.restore(cuboid_structure_);
+	update_cuboid_surface_points(cuboid_structure_, test_occlusion_modelview_matrix_);
+	updateGL();
+}
+
 
 
 bool MeshViewerCore::load_result_info(
@@ -254,7 +335,7 @@ bool MeshViewerCore::load_result_info(
 		for (SamplePointIndex sample_point_index = 0; sample_point_index < _cuboid_structure.num_sample_points();
 			++sample_point_index)
 		{
-			MeshSamplePoint* sample_point = _cuboid_structure.sample_points_[sample_point_index];
+			MeshSamplePoint* sample_point = _cuboid_structure.get_sample_point(sample_point_index);
 			assert(sample_point);
 			LabelIndex label_index = sample_point_label_indices[sample_point_index];
 			if (label_index >= _cuboid_structure.num_labels())